@@ -71,6 +71,8 @@ static const pa_daemon_conf default_conf = {
     .flat_volumes = true,
     .exit_idle_time = 20,
     .scache_idle_time = 20,
+    .scache_persistent = false,
+    .subscription_coalesce_msec = 0,
     .script_commands = NULL,
     .dl_search_path = NULL,
     .load_default_script_file = true,
@@ -541,6 +543,8 @@ int pa_daemon_conf_load(pa_daemon_conf *c, const char *filename) {
         { "enable-deferred-volume",     pa_config_parse_bool,     &c->deferred_volume, NULL },
         { "exit-idle-time",             pa_config_parse_int,      &c->exit_idle_time, NULL },
         { "scache-idle-time",           pa_config_parse_int,      &c->scache_idle_time, NULL },
+        { "scache-persistent",          pa_config_parse_bool,     &c->scache_persistent, NULL },
+        { "subscription-coalesce-msec", pa_config_parse_unsigned, &c->subscription_coalesce_msec, NULL },
         { "realtime-priority",          parse_rtprio,             c, NULL },
         { "dl-search-path",             pa_config_parse_string,   &c->dl_search_path, NULL },
         { "default-script-file",        pa_config_parse_string,   &c->default_script_file, NULL },
@@ -752,6 +756,8 @@ char *pa_daemon_conf_dump(pa_daemon_conf *c) {
     pa_strbuf_printf(s, "lock-memory = %s\n", pa_yes_no(c->lock_memory));
     pa_strbuf_printf(s, "exit-idle-time = %i\n", c->exit_idle_time);
     pa_strbuf_printf(s, "scache-idle-time = %i\n", c->scache_idle_time);
+    pa_strbuf_printf(s, "scache-persistent = %s\n", pa_yes_no(c->scache_persistent));
+    pa_strbuf_printf(s, "subscription-coalesce-msec = %u\n", c->subscription_coalesce_msec);
     pa_strbuf_printf(s, "dl-search-path = %s\n", pa_strempty(c->dl_search_path));
     pa_strbuf_printf(s, "default-script-file = %s\n", pa_strempty(pa_daemon_conf_get_default_script_file(c)));
     pa_strbuf_printf(s, "load-default-script-file = %s\n", pa_yes_no(c->load_default_script_file));
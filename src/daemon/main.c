@@ -1050,6 +1050,8 @@ int main(int argc, char *argv[]) {
     c->lfe_crossover_freq = conf->lfe_crossover_freq;
     c->exit_idle_time = conf->exit_idle_time;
     c->scache_idle_time = conf->scache_idle_time;
+    c->scache_persistent = conf->scache_persistent;
+    c->subscription_coalesce_msec = conf->subscription_coalesce_msec;
     c->resample_method = conf->resample_method;
     c->realtime_priority = conf->realtime_priority;
     c->realtime_scheduling = conf->realtime_scheduling;
@@ -0,0 +1,187 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/socket.h>
+
+#include "a2dp-bitrate-controller.h"
+
+/* The controller looks for a standing queue in the socket, much like CoDel
+ * does: a link that keeps up with the bitrate drains the socket between two
+ * packets at least once in a while, so the minimum of the samples taken
+ * before each write over an interval stays close to zero. A link that is too
+ * slow never drains it. The bitrate is lowered after a single interval with
+ * a standing queue, but only raised after many clear intervals, and after
+ * even more if the last raise had to be taken back. The interval after a
+ * lowering is not judged, because the queue built up before takes a while to
+ * drain. */
+
+#define INTERVAL_USEC (500 * PA_USEC_PER_MSEC)
+
+/* Queue that counts as standing, as a fraction of the send buffer. The
+ * kernel accounts for the per-packet overhead as well, so an empty socket
+ * does not always read as zero. */
+#define STANDING_QUEUE_DIVISOR 8
+
+/* Clear intervals before a higher bitrate is tried */
+#define PROBE_INTERVALS_MIN 10
+#define PROBE_INTERVALS_MAX 120
+
+struct pa_a2dp_bitrate_controller {
+    pa_usec_t interval_start;
+    size_t min_queued;
+    size_t buffer_size;
+    unsigned clear_intervals;
+    unsigned probe_intervals;
+    bool probing;
+    bool draining;
+};
+
+pa_a2dp_bitrate_controller *pa_a2dp_bitrate_controller_new(void) {
+    pa_a2dp_bitrate_controller *c;
+
+    c = pa_xnew0(pa_a2dp_bitrate_controller, 1);
+    pa_a2dp_bitrate_controller_reset(c, 0);
+
+    return c;
+}
+
+void pa_a2dp_bitrate_controller_free(pa_a2dp_bitrate_controller *c) {
+    pa_assert(c);
+
+    pa_xfree(c);
+}
+
+static void start_interval(pa_a2dp_bitrate_controller *c, pa_usec_t now) {
+    c->interval_start = now;
+    c->min_queued = SIZE_MAX;
+}
+
+void pa_a2dp_bitrate_controller_reset(pa_a2dp_bitrate_controller *c, pa_usec_t now) {
+    pa_assert(c);
+
+    start_interval(c, now);
+    c->buffer_size = 0;
+    c->clear_intervals = 0;
+    c->probe_intervals = PROBE_INTERVALS_MIN;
+    c->probing = false;
+    c->draining = false;
+}
+
+/* The last raise of the bitrate had to be taken back, wait longer before the
+ * next one */
+static void probe_failed(pa_a2dp_bitrate_controller *c) {
+    if (!c->probing)
+        return;
+
+    c->probing = false;
+    c->probe_intervals = PA_MIN(c->probe_intervals * 2, PROBE_INTERVALS_MAX);
+}
+
+pa_a2dp_bitrate_action_t pa_a2dp_bitrate_controller_update(pa_a2dp_bitrate_controller *c, pa_usec_t now, size_t queued, size_t buffer_size) {
+    bool standing;
+
+    pa_assert(c);
+
+    c->min_queued = PA_MIN(c->min_queued, queued);
+    c->buffer_size = buffer_size;
+
+    if (now < c->interval_start + INTERVAL_USEC)
+        return PA_A2DP_BITRATE_KEEP;
+
+    standing = c->min_queued > c->buffer_size / STANDING_QUEUE_DIVISOR;
+    start_interval(c, now);
+
+    if (c->draining) {
+        c->draining = false;
+        return PA_A2DP_BITRATE_KEEP;
+    }
+
+    if (standing) {
+        c->clear_intervals = 0;
+        c->draining = true;
+        probe_failed(c);
+        return PA_A2DP_BITRATE_DECREASE;
+    }
+
+    c->clear_intervals++;
+
+    if (c->probing && c->clear_intervals >= PROBE_INTERVALS_MIN) {
+        /* The last raise held up, so the link probably has more to give */
+        c->probing = false;
+        c->probe_intervals = PA_MAX(c->probe_intervals / 2, PROBE_INTERVALS_MIN);
+    }
+
+    if (c->clear_intervals >= c->probe_intervals) {
+        c->clear_intervals = 0;
+        c->probing = true;
+        return PA_A2DP_BITRATE_INCREASE;
+    }
+
+    return PA_A2DP_BITRATE_KEEP;
+}
+
+void pa_a2dp_bitrate_controller_congested(pa_a2dp_bitrate_controller *c, pa_usec_t now) {
+    pa_assert(c);
+
+    start_interval(c, now);
+    c->clear_intervals = 0;
+    c->draining = true;
+    probe_failed(c);
+}
+
+int pa_a2dp_socket_get_queued(int fd, size_t *queued, size_t *buffer_size) {
+    struct sockaddr_storage sa;
+    socklen_t sa_len = sizeof(sa), len = sizeof(int);
+    int outq, sndbuf;
+
+    pa_assert(fd >= 0);
+    pa_assert(queued);
+    pa_assert(buffer_size);
+
+    if (ioctl(fd, SIOCOUTQ, &outq) < 0)
+        return -1;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) < 0)
+        return -1;
+
+    if (getsockname(fd, (struct sockaddr *) &sa, &sa_len) < 0)
+        return -1;
+
+#ifdef AF_BLUETOOTH
+    /* Bluetooth sockets report the free space in the send buffer instead of
+     * the bytes queued in it */
+    if (sa.ss_family == AF_BLUETOOTH)
+        outq = sndbuf - outq;
+#endif
+
+    *queued = (size_t) PA_MAX(outq, 0);
+    *buffer_size = (size_t) PA_MAX(sndbuf, 0);
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef fooa2dpbitratecontrollerhfoo
+#define fooa2dpbitratecontrollerhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulse/sample.h>
+
+typedef enum pa_a2dp_bitrate_action {
+    PA_A2DP_BITRATE_KEEP,
+    PA_A2DP_BITRATE_DECREASE,
+    PA_A2DP_BITRATE_INCREASE,
+} pa_a2dp_bitrate_action_t;
+
+typedef struct pa_a2dp_bitrate_controller pa_a2dp_bitrate_controller;
+
+pa_a2dp_bitrate_controller *pa_a2dp_bitrate_controller_new(void);
+void pa_a2dp_bitrate_controller_free(pa_a2dp_bitrate_controller *c);
+
+/* Forgets everything learned about the link, for a new stream */
+void pa_a2dp_bitrate_controller_reset(pa_a2dp_bitrate_controller *c, pa_usec_t now);
+
+/* Feeds the number of bytes queued in the socket right before a packet is
+ * written, and the size of the socket buffer in the same units, and returns
+ * what to do with the encoder bitrate. */
+pa_a2dp_bitrate_action_t pa_a2dp_bitrate_controller_update(pa_a2dp_bitrate_controller *c, pa_usec_t now, size_t queued, size_t buffer_size);
+
+/* Tells the controller that the bitrate was lowered because audio had to be
+ * dropped, so that it backs off before probing a higher bitrate again */
+void pa_a2dp_bitrate_controller_congested(pa_a2dp_bitrate_controller *c, pa_usec_t now);
+
+/* Gets the number of bytes queued in the send buffer of a socket, and the size
+ * of that buffer, both as accounted by the kernel. Returns a negative value if
+ * the socket does not support it. */
+int pa_a2dp_socket_get_queued(int fd, size_t *queued, size_t *buffer_size);
+
+#endif
@@ -38,6 +38,7 @@
 
 #define SBC_BITPOOL_DEC_LIMIT 32
 #define SBC_BITPOOL_DEC_STEP 5
+#define SBC_BITPOOL_INC_STEP 5
 
 struct sbc_info {
     sbc_t sbc;                           /* Codec data */
@@ -515,59 +516,62 @@ static size_t reduce_encoder_bitrate(void *codec_info, size_t write_link_mtu) {
     return get_block_size(codec_info, write_link_mtu);
 }
 
+static size_t increase_encoder_bitrate(void *codec_info, size_t write_link_mtu) {
+    struct sbc_info *sbc_info = (struct sbc_info *) codec_info;
+    uint8_t bitpool;
+
+    /* Check if bitpool is already at its limit */
+    if (sbc_info->sbc.bitpool >= sbc_info->max_bitpool)
+        return 0;
+
+    bitpool = (uint8_t) PA_MIN(sbc_info->sbc.bitpool + SBC_BITPOOL_INC_STEP, sbc_info->max_bitpool);
+
+    set_bitpool(sbc_info, bitpool);
+    return get_block_size(codec_info, write_link_mtu);
+}
+
 static size_t encode_buffer(void *codec_info, uint32_t timestamp, const uint8_t *input_buffer, size_t input_size, uint8_t *output_buffer, size_t output_size, size_t *processed) {
     struct sbc_info *sbc_info = (struct sbc_info *) codec_info;
     struct rtp_header *header;
     struct rtp_sbc_payload *payload;
     uint8_t *d;
     const uint8_t *p;
-    size_t to_write, to_encode;
+    size_t codesize, frame_length, n_frames;
     uint8_t frame_count;
 
     header = (struct rtp_header*) output_buffer;
     payload = (struct rtp_sbc_payload*) (output_buffer + sizeof(*header));
 
-    frame_count = 0;
+    if (PA_UNLIKELY(output_size <= sizeof(*header) + sizeof(*payload))) {
+        *processed = 0;
+        return 0;
+    }
 
-    p = input_buffer;
-    to_encode = input_size;
+    codesize = sbc_info->codesize;
+    frame_length = sbc_info->frame_length;
 
+    /* Work out up front how many frames fit, so that every sbc_encode() call
+     * gets exactly one frame of input and output and the loop needs no
+     * bookkeeping. frame_count is only 4 bit number. */
+    n_frames = PA_MIN(input_size / codesize, (output_size - sizeof(*header) - sizeof(*payload)) / frame_length);
+    n_frames = PA_MIN(n_frames, 15U);
+
+    p = input_buffer;
     d = output_buffer + sizeof(*header) + sizeof(*payload);
-    to_write = output_size - sizeof(*header) - sizeof(*payload);
 
-    /* frame_count is only 4 bit number */
-    while (PA_LIKELY(to_encode > 0 && to_write > 0 && frame_count < 15)) {
+    for (frame_count = 0; frame_count < n_frames; frame_count++) {
         ssize_t written;
         ssize_t encoded;
 
-        encoded = sbc_encode(&sbc_info->sbc,
-                             p, to_encode,
-                             d, to_write,
-                             &written);
-
-        if (PA_UNLIKELY(encoded <= 0)) {
-            pa_log_error("SBC encoding error (%li)", (long) encoded);
-            break;
-        }
+        encoded = sbc_encode(&sbc_info->sbc, p, codesize, d, frame_length, &written);
 
-        if (PA_UNLIKELY(written < 0)) {
-            pa_log_error("SBC encoding error (%li)", (long) written);
+        if (PA_UNLIKELY(encoded != (ssize_t) codesize || written != (ssize_t) frame_length)) {
+            pa_log_error("SBC encoding error (%li, %li)", (long) encoded, (long) written);
             break;
         }
 
-        pa_assert_fp((size_t) encoded <= to_encode);
-        pa_assert_fp((size_t) encoded == sbc_info->codesize);
-
-        pa_assert_fp((size_t) written <= to_write);
-        pa_assert_fp((size_t) written == sbc_info->frame_length);
-
-        p += encoded;
-        to_encode -= encoded;
-
-        d += written;
-        to_write -= written;
-
-        frame_count++;
+        p += codesize;
+        d += frame_length;
     }
 
     PA_ONCE_BEGIN {
@@ -677,6 +681,7 @@ const pa_a2dp_codec pa_a2dp_codec_sbc = {
     .get_read_block_size = get_block_size,
     .get_write_block_size = get_block_size,
     .reduce_encoder_bitrate = reduce_encoder_bitrate,
+    .increase_encoder_bitrate = increase_encoder_bitrate,
     .encode_buffer = encode_buffer,
     .decode_buffer = decode_buffer,
 };
@@ -46,6 +46,7 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/time-smoother.h>
 
+#include "a2dp-bitrate-controller.h"
 #include "a2dp-codecs.h"
 #include "a2dp-codec-util.h"
 #include "bluez5-util.h"
@@ -74,6 +75,7 @@ enum {
     BLUETOOTH_MESSAGE_IO_THREAD_FAILED,
     BLUETOOTH_MESSAGE_STREAM_FD_HUP,
     BLUETOOTH_MESSAGE_SET_TRANSPORT_PLAYING,
+    BLUETOOTH_MESSAGE_SET_BITRATE,
     BLUETOOTH_MESSAGE_MAX
 };
 
@@ -138,6 +140,8 @@ struct userdata {
     pa_sample_spec encoder_sample_spec;
     void *encoder_buffer;                        /* Codec transfer buffer */
     size_t encoder_buffer_size;                  /* Size of the buffer */
+    pa_a2dp_bitrate_controller *bitrate_controller;
+    uint32_t encoder_bitrate;                    /* Last bitrate published, in bit/s */
 
     void *decoder_info;
     pa_sample_spec decoder_sample_spec;
@@ -497,6 +501,49 @@ static int a2dp_write_buffer(struct userdata *u, size_t nbytes) {
     return ret;
 }
 
+static void handle_sink_block_size_change(struct userdata *u);
+
+/* Run from IO thread */
+static void a2dp_adjust_bitrate(struct userdata *u) {
+    size_t queued, buffer_size, new_write_block_size = 0;
+
+    if (pa_a2dp_socket_get_queued(u->stream_fd, &queued, &buffer_size) < 0)
+        return;
+
+    switch (pa_a2dp_bitrate_controller_update(u->bitrate_controller, pa_rtclock_now(), queued, buffer_size)) {
+        case PA_A2DP_BITRATE_DECREASE:
+            pa_log_debug("Socket backlog is not draining, reducing the bitrate");
+            new_write_block_size = u->a2dp_codec->reduce_encoder_bitrate(u->encoder_info, u->write_link_mtu);
+            break;
+
+        case PA_A2DP_BITRATE_INCREASE:
+            if (u->a2dp_codec->increase_encoder_bitrate)
+                new_write_block_size = u->a2dp_codec->increase_encoder_bitrate(u->encoder_info, u->write_link_mtu);
+            break;
+
+        case PA_A2DP_BITRATE_KEEP:
+            break;
+    }
+
+    if (new_write_block_size) {
+        u->write_block_size = new_write_block_size;
+        handle_sink_block_size_change(u);
+    }
+}
+
+/* Run from IO thread */
+static void a2dp_publish_bitrate(struct userdata *u, size_t length, size_t processed) {
+    uint32_t bitrate;
+
+    bitrate = (uint32_t) ((uint64_t) length * 8 * PA_USEC_PER_SEC / pa_bytes_to_usec(processed, &u->encoder_sample_spec));
+
+    if (bitrate == u->encoder_bitrate)
+        return;
+
+    u->encoder_bitrate = bitrate;
+    pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(u->msg), BLUETOOTH_MESSAGE_SET_BITRATE, NULL, bitrate, NULL, NULL);
+}
+
 /* Run from IO thread */
 static int a2dp_process_render(struct userdata *u) {
     const uint8_t *ptr;
@@ -508,9 +555,12 @@ static int a2dp_process_render(struct userdata *u) {
     pa_assert(u->sink);
     pa_assert(u->a2dp_codec);
 
-    /* First, render some data */
-    if (!u->write_memchunk.memblock)
+    /* First, render some data. The bitrate may only change while no block is
+     * pending, because the block size changes with it. */
+    if (!u->write_memchunk.memblock) {
+        a2dp_adjust_bitrate(u);
         pa_sink_render_full(u->sink, u->write_block_size, &u->write_memchunk);
+    }
 
     pa_assert(u->write_memchunk.length == u->write_block_size);
 
@@ -528,6 +578,9 @@ static int a2dp_process_render(struct userdata *u) {
         return -1;
     }
 
+    if (length > 0)
+        a2dp_publish_bitrate(u, length, processed);
+
     return a2dp_write_buffer(u, length);
 }
 
@@ -785,6 +838,12 @@ static int setup_stream(struct userdata *u) {
         pa_assert(u->a2dp_codec);
         if (u->a2dp_codec->reset(u->encoder_info) < 0)
             return -1;
+
+        /* The codec starts over at its highest bitrate */
+        if (!u->bitrate_controller)
+            u->bitrate_controller = pa_a2dp_bitrate_controller_new();
+        pa_a2dp_bitrate_controller_reset(u->bitrate_controller, pa_rtclock_now());
+        u->encoder_bitrate = 0;
     } else if (u->profile == PA_BLUETOOTH_PROFILE_A2DP_SOURCE) {
         pa_assert(u->a2dp_codec);
         if (u->a2dp_codec->reset(u->decoder_info) < 0)
@@ -1491,6 +1550,8 @@ static void thread_func(void *userdata) {
                                     u->write_block_size = new_write_block_size;
                                     handle_sink_block_size_change(u);
                                 }
+
+                                pa_a2dp_bitrate_controller_congested(u->bitrate_controller, pa_rtclock_now());
                             }
                         }
 
@@ -2221,6 +2282,16 @@ static int device_process_msg(pa_msgobject *obj, int code, void *data, int64_t o
             if (u->transport_acquired)
                 pa_bluetooth_transport_set_state(u->transport, PA_BLUETOOTH_TRANSPORT_STATE_PLAYING);
             break;
+        case BLUETOOTH_MESSAGE_SET_BITRATE:
+            /* The sink may have gone away while the message was pending */
+            if (u->sink && PA_SINK_IS_LINKED(u->sink->state)) {
+                pa_proplist *proplist = pa_proplist_new();
+
+                pa_proplist_setf(proplist, "bluetooth.bitrate", "%u", (unsigned) offset);
+                pa_sink_update_proplist(u->sink, PA_UPDATE_REPLACE, proplist);
+                pa_proplist_free(proplist);
+            }
+            break;
     }
 
     return 0;
@@ -2348,6 +2419,9 @@ void pa__done(pa_module *m) {
     if (u->encoder_buffer)
         pa_xfree(u->encoder_buffer);
 
+    if (u->bitrate_controller)
+        pa_a2dp_bitrate_controller_free(u->bitrate_controller);
+
     if (u->decoder_buffer)
         pa_xfree(u->decoder_buffer);
 
@@ -34,13 +34,24 @@
 #include <xmmintrin.h>
 #endif
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__amd64__))
+#define HAVE_AVX2_FUNCS
+#include <immintrin.h>
+#define AVX2_FUNC __attribute__((target("avx2")))
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define HAVE_NEON_FUNCS
+#include <arm_neon.h>
+#endif
+
 /* Vector Dot Product */
-static REAL dotp(REAL a[], REAL b[])
+static REAL dotp(const REAL a[], const REAL b[], int n)
 {
   REAL sum0 = 0.0f, sum1 = 0.0f;
   int j;
 
-  for (j = 0; j < NLMS_LEN; j += 2) {
+  for (j = 0; j < n; j += 2) {
     // optimize: partial loop unrolling
     sum0 += a[j] * b[j];
     sum1 += a[j + 1] * b[j + 1];
@@ -48,37 +59,152 @@ static REAL dotp(REAL a[], REAL b[])
   return sum0 + sum1;
 }
 
-static REAL dotp_sse(REAL a[], REAL b[])
+// update tap weights (filter learning)
+static void update(REAL w[], const REAL xf[], REAL mikro_ef)
+{
+#ifdef DISABLE_ORC
+  int i;
+  for (i = 0; i < NLMS_LEN; i += 2) {
+    // optimize: partial loop unrolling
+    w[i] += mikro_ef * xf[i];
+    w[i + 1] += mikro_ef * xf[i + 1];
+  }
+#else
+  update_tap_weights(w, (REAL *) xf, mikro_ef, NLMS_LEN);
+#endif
+}
+
+// exponential smoothing of |d| and |x|, fast and slow
+static void average(REAL avg[4], REAL d, REAL x)
 {
+  avg[DFAST] += ALPHAFAST * (fabsf(d) - avg[DFAST]);
+  avg[XFAST] += ALPHAFAST * (fabsf(x) - avg[XFAST]);
+  avg[DSLOW] += ALPHASLOW * (fabsf(d) - avg[DSLOW]);
+  avg[XSLOW] += ALPHASLOW * (fabsf(x) - avg[XSLOW]);
+}
+
 #ifdef __SSE__
+static REAL dotp_sse(const REAL a[], const REAL b[], int n)
+{
   /* This is taken from speex's inner product implementation */
   int j;
   REAL sum;
   __m128 acc = _mm_setzero_ps();
 
-  for (j=0;j<NLMS_LEN;j+=8)
+  for (j=0;j<n;j+=8)
   {
-    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(a+j), _mm_loadu_ps(b+j)));
-    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(a+j+4), _mm_loadu_ps(b+j+4)));
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a+j), _mm_loadu_ps(b+j)));
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a+j+4), _mm_loadu_ps(b+j+4)));
   }
   acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
   acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
   _mm_store_ss(&sum, acc);
 
   return sum;
-#else
-  return dotp(a, b);
+}
+
+static void update_sse(REAL w[], const REAL xf[], REAL mikro_ef)
+{
+  __m128 m = _mm_set1_ps(mikro_ef);
+  int i;
+
+  // w is aligned, xf moves by one tap at a time
+  for (i = 0; i < NLMS_LEN; i += 8) {
+    _mm_store_ps(w + i, _mm_add_ps(_mm_load_ps(w + i), _mm_mul_ps(m, _mm_loadu_ps(xf + i))));
+    _mm_store_ps(w + i + 4, _mm_add_ps(_mm_load_ps(w + i + 4), _mm_mul_ps(m, _mm_loadu_ps(xf + i + 4))));
+  }
+}
+
+static void average_sse(REAL avg[4], REAL d, REAL x)
+{
+  const __m128 alpha = _mm_setr_ps(ALPHAFAST, ALPHAFAST, ALPHASLOW, ALPHASLOW);
+  __m128 in = _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_setr_ps(d, x, d, x));
+  __m128 v = _mm_loadu_ps(avg);
+
+  _mm_storeu_ps(avg, _mm_add_ps(v, _mm_mul_ps(alpha, _mm_sub_ps(in, v))));
+}
+#endif
+
+#ifdef HAVE_AVX2_FUNCS
+static AVX2_FUNC REAL dotp_avx2(const REAL a[], const REAL b[], int n)
+{
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+  __m128 acc;
+  REAL sum;
+  int j = 0;
+
+  // two accumulators to hide the latency of the additions
+  for (; j + 16 <= n; j += 16) {
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + j), _mm256_loadu_ps(b + j)));
+    acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + j + 8), _mm256_loadu_ps(b + j + 8)));
+  }
+  if (j < n)
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + j), _mm256_loadu_ps(b + j)));
+
+  acc0 = _mm256_add_ps(acc0, acc1);
+  acc = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
+  _mm_store_ss(&sum, acc);
+
+  return sum;
+}
+
+static AVX2_FUNC void update_avx2(REAL w[], const REAL xf[], REAL mikro_ef)
+{
+  __m256 m = _mm256_set1_ps(mikro_ef);
+  int i;
+
+  for (i = 0; i < NLMS_LEN; i += 8)
+    _mm256_store_ps(w + i, _mm256_add_ps(_mm256_load_ps(w + i), _mm256_mul_ps(m, _mm256_loadu_ps(xf + i))));
+}
 #endif
+
+#ifdef HAVE_NEON_FUNCS
+static REAL dotp_neon(const REAL a[], const REAL b[], int n)
+{
+  float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+  float32x2_t acc;
+  int j;
+
+  for (j = 0; j < n; j += 8) {
+    acc0 = vmlaq_f32(acc0, vld1q_f32(a + j), vld1q_f32(b + j));
+    acc1 = vmlaq_f32(acc1, vld1q_f32(a + j + 4), vld1q_f32(b + j + 4));
+  }
+  acc0 = vaddq_f32(acc0, acc1);
+  acc = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+  acc = vpadd_f32(acc, acc);
+
+  return vget_lane_f32(acc, 0);
 }
 
+static void update_neon(REAL w[], const REAL xf[], REAL mikro_ef)
+{
+  int i;
+
+  for (i = 0; i < NLMS_LEN; i += 8) {
+    vst1q_f32(w + i, vmlaq_n_f32(vld1q_f32(w + i), vld1q_f32(xf + i), mikro_ef));
+    vst1q_f32(w + i + 4, vmlaq_n_f32(vld1q_f32(w + i + 4), vld1q_f32(xf + i + 4), mikro_ef));
+  }
+}
 
-AEC* AEC_init(int RATE, int have_vector)
+static void average_neon(REAL avg[4], REAL d, REAL x)
+{
+  static const float alpha_arr[4] = { ALPHAFAST, ALPHAFAST, ALPHASLOW, ALPHASLOW };
+  float in_arr[4] = { d, x, d, x };
+  float32x4_t v = vld1q_f32(avg);
+
+  vst1q_f32(avg, vmlaq_f32(v, vld1q_f32(alpha_arr), vsubq_f32(vabsq_f32(vld1q_f32(in_arr)), v)));
+}
+#endif
+
+AEC* AEC_init(int RATE, AEC_VECTOR vector)
 {
   AEC *a = pa_xnew0(AEC, 1);
   a->j = NLMS_EXT;
   AEC_setambient(a, NoiseFloor);
-  a->dfast = a->dslow = M75dB_PCM;
-  a->xfast = a->xslow = M80dB_PCM;
+  a->avg[DFAST] = a->avg[DSLOW] = M75dB_PCM;
+  a->avg[XFAST] = a->avg[XSLOW] = M80dB_PCM;
   a->gain = 1.0f;
   a->Fx = IIR1_init(2000.0f/RATE);
   a->Fe = IIR1_init(2000.0f/RATE);
@@ -90,14 +216,39 @@ AEC* AEC_init(int RATE, int have_vector)
 
   a->fdwdisplay = -1;
 
-  if (have_vector) {
-      /* Get a 16-byte aligned location */
-      a->w = (REAL *) (((uintptr_t) a->w_arr) - (((uintptr_t) a->w_arr) % 16) + 16);
-      a->dotp = dotp_sse;
-  } else {
-      /* We don't care about alignment, just use the array as-is */
-      a->w = a->w_arr;
-      a->dotp = dotp;
+  /* Get a 32-byte aligned location, for the aligned loads and stores of w */
+  a->w = (REAL *) (((uintptr_t) a->w_arr) - (((uintptr_t) a->w_arr) % 32) + 32);
+  a->dotp = dotp;
+  a->update = update;
+  a->average = average;
+
+  switch (vector) {
+    case AEC_VECTOR_AVX2:
+#ifdef HAVE_AVX2_FUNCS
+      a->dotp = dotp_avx2;
+      a->update = update_avx2;
+#endif
+      /* fall through, the DTD averages only fill an SSE register */
+    case AEC_VECTOR_SSE:
+#ifdef __SSE__
+      if (a->dotp == dotp)
+        a->dotp = dotp_sse;
+      if (a->update == update)
+        a->update = update_sse;
+      a->average = average_sse;
+#endif
+      break;
+
+    case AEC_VECTOR_NEON:
+#ifdef HAVE_NEON_FUNCS
+      a->dotp = dotp_neon;
+      a->update = update_neon;
+      a->average = average_neon;
+#endif
+      break;
+
+    case AEC_VECTOR_NONE:
+      break;
   }
 
   return a;
@@ -126,24 +277,19 @@ static float AEC_dtd(AEC *a, REAL d, REAL x)
 {
   float ratio, stepsize;
 
-  // fast near-end and far-end average
-  a->dfast += ALPHAFAST * (fabsf(d) - a->dfast);
-  a->xfast += ALPHAFAST * (fabsf(x) - a->xfast);
-
-  // slow near-end and far-end average
-  a->dslow += ALPHASLOW * (fabsf(d) - a->dslow);
-  a->xslow += ALPHASLOW * (fabsf(x) - a->xslow);
+  // fast and slow near-end and far-end averages
+  a->average(a->avg, d, x);
 
-  if (a->xfast < M70dB_PCM) {
+  if (a->avg[XFAST] < M70dB_PCM) {
     return 0.0f;   // no Spk signal
   }
 
-  if (a->dfast < M70dB_PCM) {
+  if (a->avg[DFAST] < M70dB_PCM) {
     return 0.0f;   // no Mic signal
   }
 
   // ratio of NFRs
-  ratio = (a->dfast * a->xslow) / (a->dslow * a->xfast);
+  ratio = (a->avg[DFAST] * a->avg[XSLOW]) / (a->avg[DSLOW] * a->avg[XFAST]);
 
   // Linear interpolation with clamping at the limits
   if (ratio < STEPX1)
@@ -162,7 +308,7 @@ static void AEC_leaky(AEC *a)
 // When hangover expires (no Spk signal for some time) the vector w
 // is erased. This is my implementation of Leaky NLMS.
 {
-  if (a->xfast >= M70dB_PCM) {
+  if (a->avg[XFAST] >= M70dB_PCM) {
     // vector w is valid for hangover Thold time
     a->hangover = Thold;
   } else {
@@ -196,7 +342,7 @@ static REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize)
   // (mic signal - estimated mic signal from spk signal)
   e = d;
   if (a->hangover > 0) {
-    e -= a->dotp(a->w, a->x + a->j);
+    e -= a->dotp(a->w, a->x + a->j, NLMS_LEN);
   }
   ef = IIR1_highpass(a->Fe, e);     // pre-whitening of e
 
@@ -207,17 +353,8 @@ static REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize)
     // calculate variable step size
     REAL mikro_ef = stepsize * ef / a->dotp_xf_xf;
 
-#ifdef DISABLE_ORC
     // update tap weights (filter learning)
-    int i;
-    for (i = 0; i < NLMS_LEN; i += 2) {
-      // optimize: partial loop unrolling
-      a->w[i] += mikro_ef * a->xf[i + a->j];
-      a->w[i + 1] += mikro_ef * a->xf[i + a->j + 1];
-    }
-#else
-    update_tap_weights(a->w, &a->xf[a->j], mikro_ef, NLMS_LEN);
-#endif
+    a->update(a->w, &a->xf[a->j], mikro_ef);
   }
 
   if (--(a->j) < 0) {
@@ -247,7 +384,7 @@ int AEC_doAEC(AEC *a, int d_, int x_)
   d = IIR_HP_highpass(a->acMic, d);
 
   // Mic Highpass Filter - cut-off below 300Hz
-  d = FIR_HP_300Hz_highpass(a->cutoff, d);
+  d = FIR_HP_300Hz_highpass(a->cutoff, d, a->dotp);
 
   // Amplify, for e.g. Soundcards with -6dB max. volume
   d *= a->gain;
@@ -22,6 +22,8 @@
 
 #include <pulsecore/macro.h>
 
+#include "adrian.h"
+
 #define WIDEB 2
 
 // use double if your CPU does software-emulation of float
@@ -105,6 +107,10 @@
 
 /* Below this line there are no more design constants */
 
+/* Vector dot product of n values, n being a multiple of 8. The
+ * implementation is picked based on processor features available. */
+typedef REAL (*AEC_dotp_t)(const REAL a[], const REAL b[], int n);
+
 typedef struct IIR_HP IIR_HP;
 
 /* Exponential Smoothing or IIR Infinite Impulse Response Filter */
@@ -173,20 +179,26 @@ public:
  * Coefficients calculated with
  * www.dsptutor.freeuk.com/KaiserFilterDesign/KaiserFilterDesign.html
  */
+// 35 taps padded to a multiple of 8 for the vector dot product
+#define FIR_HP_LEN 40
+// Extension in taps to reduce mem copies
+#define FIR_HP_EXT (4*8)
+
 struct FIR_HP_300Hz {
-  REAL z[36];
+  REAL z[FIR_HP_LEN + FIR_HP_EXT];
+  int j;                        // optimize: less memory copies
 };
 
 static  FIR_HP_300Hz* FIR_HP_300Hz_init(void) {
     FIR_HP_300Hz *ret = pa_xnew(FIR_HP_300Hz, 1);
     memset(ret, 0, sizeof(FIR_HP_300Hz));
+    ret->j = FIR_HP_EXT;
     return ret;
   }
 
-static  REAL FIR_HP_300Hz_highpass(FIR_HP_300Hz *f, REAL in) {
-    REAL sum0 = 0.0, sum1 = 0.0;
-    int j;
-    const REAL a[36] = {
+static  REAL FIR_HP_300Hz_highpass(FIR_HP_300Hz *f, REAL in, AEC_dotp_t dotp) {
+    REAL out;
+    static const REAL a[FIR_HP_LEN] = {
       // Kaiser Window FIR Filter, Filter type: High pass
       // Passband: 150.0 - 4000.0 Hz, Order: 34
       // Transition band: 34.0 Hz, Stopband attenuation: 10.0 dB
@@ -198,17 +210,18 @@ static  REAL FIR_HP_300Hz_highpass(FIR_HP_300Hz *f, REAL in) {
       -0.028842418, -0.028474221, -0.028004972, -0.027437767,
       -0.026776174, -0.02602462, -0.025187887, -0.024271343,
       -0.02328091, -0.022222936, -0.021104068, -0.019931411,
-      -0.01871232, -0.017454365, -0.016165324, 0.0
+      -0.01871232, -0.017454365, -0.016165324, 0.0,
+      0.0, 0.0, 0.0, 0.0
     };
-    memmove(f->z + 1, f->z, 35 * sizeof(REAL));
-    f->z[0] = in;
+    f->z[f->j] = in;
+    out = dotp(a, f->z + f->j, FIR_HP_LEN);
 
-    for (j = 0; j < 36; j += 2) {
-      // optimize: partial loop unrolling
-      sum0 += a[j] * f->z[j];
-      sum1 += a[j + 1] * f->z[j + 1];
+    if (--(f->j) < 0) {
+      // optimize: decrease number of memory copies
+      f->j = FIR_HP_EXT;
+      memmove(f->z + f->j + 1, f->z, (FIR_HP_LEN - 1) * sizeof(REAL));
     }
-    return sum0 + sum1;
+    return out;
   }
 #endif
 
@@ -292,7 +305,8 @@ public:
 // block size in taps to optimize DTD calculation
 #define DTD_LEN   16
 
-typedef struct AEC AEC;
+// Signal averages of the DTD, in AEC.avg
+enum { DFAST, XFAST, DSLOW, XSLOW };
 
 struct AEC {
   // Time domain Filters
@@ -302,14 +316,14 @@ struct AEC {
   IIR1 *Fx, *Fe;                // pre-whitening Highpass for x, e
 
   // Adrian soft decision DTD (Double Talk Detector)
-  REAL dfast, xfast;
-  REAL dslow, xslow;
+  // fast and slow near-end and far-end averages, updated together
+  REAL avg[4];
 
   // NLMS-pw
   REAL x[NLMS_LEN + NLMS_EXT];  // tap delayed loudspeaker signal
   REAL xf[NLMS_LEN + NLMS_EXT]; // pre-whitening tap delayed signal
-  REAL w_arr[NLMS_LEN + (16 / sizeof(REAL))]; // tap weights
-  REAL *w;                      // this will be a 16-byte aligned pointer into w_arr
+  REAL w_arr[NLMS_LEN + (32 / sizeof(REAL))]; // tap weights
+  REAL *w;                      // this will be a 32-byte aligned pointer into w_arr
   int j;                        // optimize: less memory copies
   double dotp_xf_xf;            // double to avoid loss of precision
   float delta;                  // noise floor to stabilize NLMS
@@ -327,7 +341,9 @@ struct AEC {
   float stepsize;
 
   // vfuncs that are picked based on processor features available
-  REAL (*dotp) (REAL[], REAL[]);
+  AEC_dotp_t dotp;
+  void (*update) (REAL w[], const REAL xf[], REAL mikro_ef);
+  void (*average) (REAL avg[4], REAL d, REAL x);
 };
 
 /* Double-Talk Detector
@@ -351,7 +367,7 @@ static  void AEC_leaky(AEC *a);
  */
 static  REAL AEC_nlms_pw(AEC *a, REAL d, REAL x_, float stepsize);
 
-AEC* AEC_init(int RATE, int have_vector);
+AEC* AEC_init(int RATE, AEC_VECTOR vector);
 void AEC_done(AEC *a);
 
 /* Acoustic Echo Cancellation and Suppression of one sample
@@ -362,7 +378,7 @@ void AEC_done(AEC *a);
   int AEC_doAEC(AEC *a, int d_, int x_);
 
 PA_GCC_UNUSED static  float AEC_getambient(AEC *a) {
-    return a->dfast;
+    return a->avg[DFAST];
   }
 static  void AEC_setambient(AEC *a, float Min_xf) {
     a->dotp_xf_xf -= a->delta;  // subtract old delta
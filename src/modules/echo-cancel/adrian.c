@@ -27,6 +27,8 @@
 #include <config.h>
 #endif
 
+#include <stdlib.h>
+
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/modargs.h>
@@ -59,7 +61,8 @@ bool pa_adrian_ec_init(pa_core *c, pa_echo_canceller *ec,
                        pa_sample_spec *play_ss, pa_channel_map *play_map,
                        pa_sample_spec *out_ss, pa_channel_map *out_map,
                        uint32_t *nframes, const char *args) {
-    int rate, have_vector = 0;
+    int rate;
+    AEC_VECTOR vector = AEC_VECTOR_NONE;
     uint32_t frame_size_ms;
     pa_modargs *ma;
 
@@ -82,11 +85,20 @@ bool pa_adrian_ec_init(pa_core *c, pa_echo_canceller *ec,
 
     pa_log_debug ("Using nframes %d, blocksize %u, channels %d, rate %d", *nframes, ec->params.adrian.blocksize, out_ss->channels, out_ss->rate);
 
-    /* For now we only support SSE */
-    if (c->cpu_info.cpu_type == PA_CPU_X86 && (c->cpu_info.flags.x86 & PA_CPU_X86_SSE))
-        have_vector = 1;
+    if (c->cpu_info.cpu_type == PA_CPU_X86 && (c->cpu_info.flags.x86 & PA_CPU_X86_AVX2))
+        vector = AEC_VECTOR_AVX2;
+    else if (c->cpu_info.cpu_type == PA_CPU_X86 && (c->cpu_info.flags.x86 & PA_CPU_X86_SSE))
+        vector = AEC_VECTOR_SSE;
+    else if (c->cpu_info.cpu_type == PA_CPU_ARM && (c->cpu_info.flags.arm & PA_CPU_ARM_NEON))
+        vector = AEC_VECTOR_NEON;
+#ifdef __aarch64__
+    /* NEON is always there, but the CPU features are only probed on 32 bit
+     * ARM. PULSE_NO_SIMD is what leaves the CPU type undefined otherwise. */
+    else if (c->cpu_info.cpu_type == PA_CPU_UNDEFINED && !getenv("PULSE_NO_SIMD"))
+        vector = AEC_VECTOR_NEON;
+#endif
 
-    ec->params.adrian.aec = AEC_init(rate, have_vector);
+    ec->params.adrian.aec = AEC_init(rate, vector);
     if (!ec->params.adrian.aec)
         goto fail;
 
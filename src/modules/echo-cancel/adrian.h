@@ -25,6 +25,14 @@
 
 typedef struct AEC AEC;
 
-AEC* AEC_init(int RATE, int have_vector);
+/* Vector instructions the filter can use */
+typedef enum AEC_VECTOR {
+    AEC_VECTOR_NONE,
+    AEC_VECTOR_SSE,
+    AEC_VECTOR_AVX2,
+    AEC_VECTOR_NEON
+} AEC_VECTOR;
+
+AEC* AEC_init(int RATE, AEC_VECTOR vector);
 void AEC_done(AEC *a);
 int AEC_doAEC(AEC *a, int d_, int x_);
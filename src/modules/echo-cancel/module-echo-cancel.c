@@ -36,6 +36,7 @@
 #include <pulse/xmalloc.h>
 #include <pulse/timeval.h>
 #include <pulse/rtclock.h>
+#include <pulse/util.h>
 
 #include <pulsecore/i18n.h>
 #include <pulsecore/atomic.h>
@@ -50,6 +51,18 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/ltdl-helper.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/fdsem.h>
+#include <pulsecore/poll.h>
+
+#ifdef ECHO_CANCEL_TEST
+#include <getopt.h>
+#include <time.h>
+
+#include <sndfile.h>
+
+#include <pulsecore/sconv.h>
+#endif
 
 PA_MODULE_AUTHOR("Wim Taymans");
 PA_MODULE_DESCRIPTION("Echo Cancellation");
@@ -74,6 +87,7 @@ PA_MODULE_USAGE(
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
           "use_master_format=<yes or no> "
+          "aec_thread=<run the canceller in its own thread> "
         ));
 
 /* NOTE: Make sure the enum and ec_table are maintained in the correct order */
@@ -140,11 +154,15 @@ static const pa_echo_canceller ec_table[] = {
 #define DEFAULT_SAVE_AEC false
 #define DEFAULT_AUTOLOADED false
 #define DEFAULT_USE_MASTER_FORMAT false
+#define DEFAULT_AEC_THREAD false
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
 #define MAX_LATENCY_BLOCKS 10
 
+/* Must be a power of two, see aec_thread_push() */
+#define AEC_THREAD_BLOCKS 32
+
 /* Can only be used in main context */
 #define IS_ACTIVE(u) (((u)->source->state == PA_SOURCE_RUNNING) && \
                       ((u)->sink->state == PA_SINK_RUNNING))
@@ -176,6 +194,13 @@ static const pa_echo_canceller ec_table[] = {
  *    be before capture and the difference should not be bigger than one frame
  *    size. We would ideally like to resample the sink_input but most driver
  *    don't give enough accuracy to be able to do that right now.
+ *
+ * With aec_thread=yes, the canceller runs in a thread of its own, so that a
+ * slow canceller doesn't hold up the source IO thread. The source IO thread
+ * still aligns the capture and playback samples as described above, but
+ * instead of running the canceller it hands each pair of blocks to the
+ * canceller thread through a ring, and posts the results to the source when
+ * the canceller thread signals that they are ready.
  */
 
 struct userdata;
@@ -203,6 +228,38 @@ struct snapshot {
     size_t plen;
 };
 
+/* Blocks of capture and playback samples on their way through the canceller
+ * thread. The source IO thread fills a slot and advances write_seq, the
+ * canceller thread cancels the echo into the out chunk and advances
+ * done_seq, and then the source IO thread posts the out chunk and advances
+ * read_seq. As each counter is advanced by a single thread, the ring needs
+ * no locking, and as the slots hold references to the memblocks, nothing is
+ * copied on the way. */
+struct aec_thread {
+    pa_thread *thread;
+    pa_atomic_t quit;
+
+    struct {
+        pa_memchunk rec, play, out;
+    } ring[AEC_THREAD_BLOCKS];
+    pa_atomic_t write_seq;
+    pa_atomic_t done_seq;
+    unsigned read_seq; /* source IO thread only */
+
+    pa_fdsem *todo; /* posted by the source IO thread */
+    pa_fdsem *done; /* posted by the canceller thread */
+    pa_rtpoll_item *rtpoll_item;
+
+    /* The capture volume as seen by the canceller, and the one it asked for
+     * (or PA_VOLUME_INVALID). The source IO thread passes the latter on. */
+    pa_atomic_t capture_volume;
+    pa_atomic_t set_capture_volume;
+
+    /* Processing time of the blocks, canceller thread only */
+    unsigned n_blocks;
+    pa_usec_t block_usec, total_usec, max_usec;
+};
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -211,6 +268,7 @@ struct userdata {
     bool save_aec;
 
     pa_echo_canceller *ec;
+    struct aec_thread *aec_thread;
     uint32_t source_output_blocksize;
     uint32_t source_blocksize;
     uint32_t sink_blocksize;
@@ -278,6 +336,7 @@ static const char* const valid_modargs[] = {
     "autoloaded",
     "use_volume_sharing",
     "use_master_format",
+    "aec_thread",
     NULL
 };
 
@@ -422,10 +481,17 @@ static int source_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t
                 /* and the buffering we do on the source */
                 pa_bytes_to_usec(u->source_output_blocksize, &u->source_output->source->sample_spec);
 
+            /* and the blocks in the canceller thread */
+            if (u->aec_thread)
+                *((int64_t*) data) += pa_bytes_to_usec(((unsigned) pa_atomic_load(&u->aec_thread->write_seq) - u->aec_thread->read_seq) *
+                                                       u->source_blocksize, &u->source->sample_spec);
+
             return 0;
 
         case PA_SOURCE_MESSAGE_SET_VOLUME_SYNCED:
             u->thread_info.current_volume = u->source->reference_volume;
+            if (u->aec_thread)
+                pa_atomic_store(&u->aec_thread->capture_volume, (int) pa_cvolume_avg(&u->thread_info.current_volume));
             break;
     }
 
@@ -889,6 +955,279 @@ static void do_push(struct userdata *u) {
     }
 }
 
+static void log_processing_time(unsigned n_blocks, pa_usec_t total_usec, pa_usec_t max_usec, pa_usec_t block_usec) {
+    if (n_blocks == 0)
+        return;
+
+    pa_log_info("Processed %u blocks of %llu usec in %llu usec on average, %llu usec at most (%0.1f%% of real time)",
+                n_blocks, (unsigned long long) block_usec, (unsigned long long) (total_usec / n_blocks),
+                (unsigned long long) max_usec, 100.0 * total_usec / ((double) n_blocks * block_usec));
+}
+
+/* Called from the canceller thread. */
+static void aec_thread_func(void *userdata) {
+    struct userdata *u = userdata;
+    struct aec_thread *t = u->aec_thread;
+
+    pa_log_debug("Canceller thread starting up");
+
+    if (u->core->realtime_scheduling)
+        pa_thread_make_realtime(u->core->realtime_priority);
+
+    for (;;) {
+        unsigned seq = (unsigned) pa_atomic_load(&t->done_seq);
+        unsigned i = seq % AEC_THREAD_BLOCKS;
+        uint8_t *rdata, *pdata, *cdata;
+        pa_usec_t start, usec;
+
+        if (pa_atomic_load(&t->quit))
+            break;
+
+        if (seq == (unsigned) pa_atomic_load(&t->write_seq)) {
+            pa_fdsem_wait(t->todo);
+            continue;
+        }
+
+        rdata = pa_memblock_acquire_chunk(&t->ring[i].rec);
+        pdata = pa_memblock_acquire_chunk(&t->ring[i].play);
+        cdata = pa_memblock_acquire_chunk(&t->ring[i].out);
+
+        start = pa_rtclock_now();
+        u->ec->run(u->ec, rdata, pdata, cdata);
+        usec = pa_rtclock_now() - start;
+
+        pa_memblock_release(t->ring[i].out.memblock);
+        pa_memblock_release(t->ring[i].play.memblock);
+        pa_memblock_release(t->ring[i].rec.memblock);
+
+        t->n_blocks++;
+        t->total_usec += usec;
+        t->max_usec = PA_MAX(t->max_usec, usec);
+
+        pa_atomic_store(&t->done_seq, (int) (seq + 1));
+        pa_fdsem_post(t->done);
+    }
+
+    pa_log_debug("Canceller thread shutting down");
+}
+
+/* Called from main context. */
+static int aec_thread_start(struct userdata *u, pa_usec_t block_usec) {
+    struct aec_thread *t;
+
+    pa_assert(!u->aec_thread);
+
+    u->aec_thread = t = pa_xnew0(struct aec_thread, 1);
+    t->block_usec = block_usec;
+    pa_atomic_store(&t->capture_volume, (int) PA_VOLUME_NORM);
+    pa_atomic_store(&t->set_capture_volume, (int) PA_VOLUME_INVALID);
+
+    if (!(t->todo = pa_fdsem_new()) || !(t->done = pa_fdsem_new())) {
+        pa_log("Failed to create fdsem.");
+        return -1;
+    }
+
+    if (!(t->thread = pa_thread_new("echo-cancel", aec_thread_func, u))) {
+        pa_log("Failed to create canceller thread.");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Called from main context, once the source output is detached. */
+static void aec_thread_stop(struct userdata *u) {
+    struct aec_thread *t = u->aec_thread;
+    unsigned seq, write_seq;
+
+    if (t->thread) {
+        pa_atomic_store(&t->quit, 1);
+        pa_fdsem_post(t->todo);
+        pa_thread_free(t->thread);
+
+        log_processing_time(t->n_blocks, t->total_usec, t->max_usec, t->block_usec);
+    }
+
+    write_seq = (unsigned) pa_atomic_load(&t->write_seq);
+    for (seq = t->read_seq; seq != write_seq; seq++) {
+        unsigned i = seq % AEC_THREAD_BLOCKS;
+
+        pa_memblock_unref(t->ring[i].rec.memblock);
+        pa_memblock_unref(t->ring[i].play.memblock);
+        pa_memblock_unref(t->ring[i].out.memblock);
+    }
+
+    if (t->done)
+        pa_fdsem_free(t->done);
+    if (t->todo)
+        pa_fdsem_free(t->todo);
+
+    pa_xfree(t);
+    u->aec_thread = NULL;
+}
+
+/* Hands a block of capture and playback samples and the chunk for the
+ * result to the canceller thread, which takes references to them. Returns
+ * false if the ring is full.
+ *
+ * Called from source I/O thread context. */
+static bool aec_thread_push(struct aec_thread *t, const pa_memchunk *rchunk, const pa_memchunk *pchunk, const pa_memchunk *cchunk) {
+    unsigned seq = (unsigned) pa_atomic_load(&t->write_seq);
+    unsigned i = seq % AEC_THREAD_BLOCKS;
+
+    /* This keeps working when seq wraps around, as AEC_THREAD_BLOCKS
+     * divides UINT_MAX + 1 */
+    if (seq - t->read_seq >= AEC_THREAD_BLOCKS)
+        return false;
+
+    t->ring[i].rec = *rchunk;
+    pa_memblock_ref(rchunk->memblock);
+    t->ring[i].play = *pchunk;
+    pa_memblock_ref(pchunk->memblock);
+    t->ring[i].out = *cchunk;
+    pa_memblock_ref(cchunk->memblock);
+
+    pa_atomic_store(&t->write_seq, (int) (seq + 1));
+    pa_fdsem_post(t->todo);
+
+    return true;
+}
+
+/* Takes the next block the canceller thread is done with out of the ring.
+ * The caller gets the reference to the chunk.
+ *
+ * Called from source I/O thread context. */
+static bool aec_thread_pop(struct aec_thread *t, pa_memchunk *cchunk) {
+    unsigned i = t->read_seq % AEC_THREAD_BLOCKS;
+
+    if (t->read_seq == (unsigned) pa_atomic_load(&t->done_seq))
+        return false;
+
+    *cchunk = t->ring[i].out;
+
+    pa_memblock_unref(t->ring[i].rec.memblock);
+    pa_memblock_unref(t->ring[i].play.memblock);
+    pa_memchunk_reset(&t->ring[i].rec);
+    pa_memchunk_reset(&t->ring[i].play);
+    pa_memchunk_reset(&t->ring[i].out);
+
+    t->read_seq++;
+
+    return true;
+}
+
+/* Posts the blocks the canceller thread is done with to the source, and
+ * passes on the capture volume the canceller asked for.
+ *
+ * Called from source I/O thread context. */
+static void aec_thread_post(struct userdata *u) {
+    pa_memchunk cchunk;
+    int v;
+    int unused PA_GCC_UNUSED;
+
+    while (aec_thread_pop(u->aec_thread, &cchunk)) {
+        if (u->save_aec && u->canceled_file) {
+            unused = fwrite(pa_memblock_acquire_chunk(&cchunk), 1, cchunk.length, u->canceled_file);
+            pa_memblock_release(cchunk.memblock);
+        }
+
+        if (PA_SOURCE_IS_LINKED(u->source->thread_info.state))
+            pa_source_post(u->source, &cchunk);
+
+        pa_memblock_unref(cchunk.memblock);
+    }
+
+    v = pa_atomic_load(&u->aec_thread->set_capture_volume);
+    if (v != (int) PA_VOLUME_INVALID && pa_atomic_cmpxchg(&u->aec_thread->set_capture_volume, v, (int) PA_VOLUME_INVALID))
+        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(u->ec->msg), ECHO_CANCELLER_MESSAGE_SET_VOLUME, PA_UINT_TO_PTR(v),
+                          0, NULL, NULL);
+}
+
+/* Called from source I/O thread context. */
+static int aec_thread_work_cb(pa_rtpoll_item *i) {
+    struct userdata *u = pa_rtpoll_item_get_userdata(i);
+
+    aec_thread_post(u);
+
+    return 0;
+}
+
+/* Called from source I/O thread context. */
+static int aec_thread_before_cb(pa_rtpoll_item *i) {
+    struct userdata *u = pa_rtpoll_item_get_userdata(i);
+
+    if (pa_fdsem_before_poll(u->aec_thread->done) < 0)
+        return 1; /* 1 means immediate restart of the loop */
+
+    return 0;
+}
+
+/* Called from source I/O thread context. */
+static void aec_thread_after_cb(pa_rtpoll_item *i) {
+    struct userdata *u = pa_rtpoll_item_get_userdata(i);
+
+    pa_fdsem_after_poll(u->aec_thread->done);
+}
+
+/* Like do_push(), but the echo is cancelled in the canceller thread, which
+ * gets behind if it is too slow. In that case, capture samples are dropped
+ * like in an overrun.
+ *
+ * Called from source I/O thread context. */
+static void do_push_thread(struct userdata *u) {
+    size_t rlen, plen;
+    pa_memchunk rchunk, pchunk, cchunk;
+    int unused PA_GCC_UNUSED;
+
+    rlen = pa_memblockq_get_length(u->source_memblockq);
+    plen = pa_memblockq_get_length(u->sink_memblockq);
+
+    while (rlen >= u->source_output_blocksize) {
+
+        /* take fixed blocks from recorded and played samples */
+        pa_memblockq_peek_fixed_size(u->source_memblockq, u->source_output_blocksize, &rchunk);
+        pa_memblockq_peek_fixed_size(u->sink_memblockq, u->sink_blocksize, &pchunk);
+
+        /* we ran out of played data and pchunk has been filled with silence bytes */
+        if (plen < u->sink_blocksize)
+            pa_memblockq_seek(u->sink_memblockq, u->sink_blocksize - plen, PA_SEEK_RELATIVE, true);
+
+        if (u->save_aec) {
+            if (u->captured_file) {
+                unused = fwrite(pa_memblock_acquire_chunk(&rchunk), 1, u->source_output_blocksize, u->captured_file);
+                pa_memblock_release(rchunk.memblock);
+            }
+            if (u->played_file) {
+                unused = fwrite(pa_memblock_acquire_chunk(&pchunk), 1, u->sink_blocksize, u->played_file);
+                pa_memblock_release(pchunk.memblock);
+            }
+        }
+
+        cchunk.index = 0;
+        cchunk.length = u->source_blocksize;
+        cchunk.memblock = pa_memblock_new(u->source->core->mempool, cchunk.length);
+
+        if (!aec_thread_push(u->aec_thread, &rchunk, &pchunk, &cchunk) && pa_log_ratelimit(PA_LOG_WARN))
+            pa_log_warn("Canceller thread is falling behind, dropping capture samples.");
+
+        pa_memblock_unref(cchunk.memblock);
+
+        /* drop consumed source samples */
+        pa_memblockq_drop(u->source_memblockq, u->source_output_blocksize);
+        pa_memblock_unref(rchunk.memblock);
+        rlen -= u->source_output_blocksize;
+
+        /* drop consumed sink samples */
+        pa_memblockq_drop(u->sink_memblockq, u->sink_blocksize);
+        pa_memblock_unref(pchunk.memblock);
+
+        if (plen >= u->sink_blocksize)
+            plen -= u->sink_blocksize;
+        else
+            plen = 0;
+    }
+}
+
 /* Called from source I/O thread context. */
 static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
     struct userdata *u;
@@ -936,10 +1275,14 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
         to_skip -= to_skip % u->source_output_blocksize;
 
         if (to_skip) {
-            pa_memblockq_peek_fixed_size(u->source_memblockq, to_skip, &rchunk);
-            pa_source_post(u->source, &rchunk);
+            /* With the canceller thread, these would overtake the blocks
+             * that are still being processed, so they are dropped */
+            if (!u->aec_thread) {
+                pa_memblockq_peek_fixed_size(u->source_memblockq, to_skip, &rchunk);
+                pa_source_post(u->source, &rchunk);
+                pa_memblock_unref(rchunk.memblock);
+            }
 
-            pa_memblock_unref(rchunk.memblock);
             pa_memblockq_drop(u->source_memblockq, to_skip);
 
             rlen -= to_skip;
@@ -966,6 +1309,8 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
     /* process and push out samples */
     if (u->ec->params.drift_compensation)
         do_push_drift_comp(u);
+    else if (u->aec_thread)
+        do_push_thread(u);
     else
         do_push(u);
 }
@@ -1285,6 +1630,20 @@ static void source_output_attach_cb(pa_source_output *o) {
             o->source->thread_info.rtpoll,
             PA_RTPOLL_LATE,
             u->asyncmsgq);
+
+    if (u->aec_thread) {
+        struct pollfd *pollfd;
+
+        u->aec_thread->rtpoll_item = pa_rtpoll_item_new(o->source->thread_info.rtpoll, PA_RTPOLL_NORMAL, 1);
+        pollfd = pa_rtpoll_item_get_pollfd(u->aec_thread->rtpoll_item, NULL);
+        pollfd->fd = pa_fdsem_get(u->aec_thread->done);
+        pollfd->events = POLLIN;
+
+        pa_rtpoll_item_set_work_callback(u->aec_thread->rtpoll_item, aec_thread_work_cb);
+        pa_rtpoll_item_set_before_callback(u->aec_thread->rtpoll_item, aec_thread_before_cb);
+        pa_rtpoll_item_set_after_callback(u->aec_thread->rtpoll_item, aec_thread_after_cb);
+        pa_rtpoll_item_set_userdata(u->aec_thread->rtpoll_item, u);
+    }
 }
 
 /* Called from sink I/O thread context. */
@@ -1339,6 +1698,11 @@ static void source_output_detach_cb(pa_source_output *o) {
         pa_rtpoll_item_free(u->rtpoll_item_read);
         u->rtpoll_item_read = NULL;
     }
+
+    if (u->aec_thread && u->aec_thread->rtpoll_item) {
+        pa_rtpoll_item_free(u->aec_thread->rtpoll_item);
+        u->aec_thread->rtpoll_item = NULL;
+    }
 }
 
 /* Called from sink I/O thread context. */
@@ -1596,18 +1960,31 @@ static int canceller_process_msg_cb(pa_msgobject *o, int code, void *userdata, i
     return 0;
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called by the canceller, so source I/O thread or canceller thread context. */
 pa_volume_t pa_echo_canceller_get_capture_volume(pa_echo_canceller *ec) {
 #ifndef ECHO_CANCEL_TEST
+    if (ec->msg->userdata->aec_thread)
+        return (pa_volume_t) pa_atomic_load(&ec->msg->userdata->aec_thread->capture_volume);
+
     return pa_cvolume_avg(&ec->msg->userdata->thread_info.current_volume);
 #else
     return PA_VOLUME_NORM;
 #endif
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called by the canceller, so source I/O thread or canceller thread context. */
 void pa_echo_canceller_set_capture_volume(pa_echo_canceller *ec, pa_volume_t v) {
 #ifndef ECHO_CANCEL_TEST
+    struct aec_thread *t = ec->msg->userdata->aec_thread;
+
+    /* The canceller thread can't post messages, the source I/O thread does it
+     * in aec_thread_post() */
+    if (t) {
+        if ((pa_volume_t) pa_atomic_load(&t->capture_volume) != v)
+            pa_atomic_store(&t->set_capture_volume, (int) v);
+        return;
+    }
+
     if (pa_cvolume_avg(&ec->msg->userdata->thread_info.current_volume) != v) {
         pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(ec->msg), ECHO_CANCELLER_MESSAGE_SET_VOLUME, PA_UINT_TO_PTR(v),
                 0, NULL, NULL);
@@ -1706,6 +2083,7 @@ int pa__init(pa_module*m) {
     uint32_t nframes = 0;
     bool use_master_format;
     pa_usec_t blocksize_usec;
+    bool aec_thread;
 
     pa_assert(m);
 
@@ -1806,6 +2184,12 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    aec_thread = DEFAULT_AEC_THREAD;
+    if (pa_modargs_get_value_boolean(ma, "aec_thread", &aec_thread) < 0) {
+        pa_log("aec_thread= expects a boolean argument");
+        goto fail;
+    }
+
     if (init_common(ma, u, &source_ss, &source_map) < 0)
         goto fail;
 
@@ -2070,6 +2454,18 @@ int pa__init(pa_module*m) {
 
     u->thread_info.current_volume = u->source->reference_volume;
 
+    if (aec_thread && u->ec->params.drift_compensation) {
+        pa_log_warn("The canceller does its own drift compensation, which is not supported in a separate thread");
+        aec_thread = false;
+    }
+
+    if (aec_thread) {
+        if (aec_thread_start(u, pa_bytes_to_usec(u->source_blocksize, &u->source->sample_spec)) < 0)
+            goto fail;
+
+        pa_atomic_store(&u->aec_thread->capture_volume, (int) pa_cvolume_avg(&u->thread_info.current_volume));
+    }
+
     /* We don't want to deal with too many chunks at a time */
     blocksize_usec = pa_bytes_to_usec(u->source_blocksize, &u->source->sample_spec);
     if (u->source->flags & PA_SOURCE_DYNAMIC_LATENCY)
@@ -2163,6 +2559,9 @@ void pa__done(pa_module*m) {
     if (u->sink_memblockq)
         pa_memblockq_free(u->sink_memblockq);
 
+    if (u->aec_thread)
+        aec_thread_stop(u);
+
     if (u->ec) {
         if (u->ec->done)
             u->ec->done(u->ec);
@@ -2196,43 +2595,354 @@ void pa__done(pa_module*m) {
 /*
  * Stand-alone test program for running in the canceller on pre-recorded files.
  */
+
+/* The playback file as float samples, delayed and resampled to simulate
+ * drift between the playback and capture clocks. Past its end, the
+ * reference is silent. */
+struct reference {
+    float *data;
+    size_t n_frames;
+    size_t pos;
+    unsigned channels;
+};
+
+/* Energy of the capture and canceled samples, for the ERLE. The first
+ * skip_blocks blocks, while the canceller converges, are left out. */
+struct erle {
+    unsigned skip_blocks;
+    unsigned n_rec, n_out;
+    double rec_energy, out_energy;
+};
+
+/* Files libsndfile can't make sense of are read as raw float samples of the
+ * default spec, like the files saved with save_aec */
+static SNDFILE *open_input(const char *path, SF_INFO *info) {
+    SNDFILE *f;
+
+    pa_zero(*info);
+    if ((f = sf_open(path, SFM_READ, info)))
+        return f;
+
+    pa_zero(*info);
+    info->format = SF_FORMAT_RAW | SF_FORMAT_FLOAT;
+    info->samplerate = DEFAULT_RATE;
+    info->channels = DEFAULT_CHANNELS;
+
+    if (!(f = sf_open(path, SFM_READ, info)))
+        pa_log("Could not open %s: %s", path, sf_strerror(NULL));
+
+    return f;
+}
+
+/* A positive delay makes the playback samples reach the canceller later,
+ * closer to their echo, a negative one earlier. A positive drift makes the
+ * playback clock faster than the capture clock. */
+static int load_reference(SNDFILE *f, const SF_INFO *info, double delay_msec, double drift_ppm, struct reference *r) {
+    float *data;
+    size_t n_frames, i, c;
+    long delay;
+    double step = 1.0 + drift_ppm / 1000000.0;
+
+    if (step <= 0) {
+        pa_log("Invalid drift");
+        return -1;
+    }
+
+    n_frames = info->frames;
+    data = pa_xnew(float, (n_frames + 1) * info->channels);
+    n_frames = sf_readf_float(f, data, n_frames);
+    memset(data + n_frames * info->channels, 0, info->channels * sizeof(float));
+
+    r->channels = info->channels;
+    r->pos = 0;
+    r->n_frames = n_frames > 0 ? (size_t) ((n_frames - 1) / step) + 1 : 0;
+    r->data = pa_xnew(float, r->n_frames * r->channels);
+
+    /* Linear interpolation is enough to move the echo around */
+    for (i = 0; i < r->n_frames; i++) {
+        double t = i * step;
+        size_t j = (size_t) t;
+        float a = (float) (t - j);
+
+        for (c = 0; c < r->channels; c++)
+            r->data[i * r->channels + c] = (1 - a) * data[j * r->channels + c] + a * data[(j + 1) * r->channels + c];
+    }
+
+    pa_xfree(data);
+
+    delay = lround(delay_msec * info->samplerate / 1000);
+    if (delay < 0)
+        r->pos = PA_MIN((size_t) -delay, r->n_frames);
+    else if (delay > 0) {
+        data = pa_xnew0(float, (r->n_frames + delay) * r->channels);
+        memcpy(data + delay * r->channels, r->data, r->n_frames * r->channels * sizeof(float));
+        pa_xfree(r->data);
+        r->data = data;
+        r->n_frames += delay;
+    }
+
+    return 0;
+}
+
+/* Converts the next n_frames reference frames to the format of the canceller */
+static void read_reference(struct reference *r, pa_convert_func_t convert, float *buf, void *dst, size_t n_frames) {
+    size_t n = PA_MIN(n_frames, r->n_frames - r->pos);
+
+    memcpy(buf, r->data + r->pos * r->channels, n * r->channels * sizeof(float));
+    memset(buf + n * r->channels, 0, (n_frames - n) * r->channels * sizeof(float));
+    r->pos += n;
+
+    convert(n_frames * r->channels, buf, dst);
+}
+
+static void add_energy(double *energy, unsigned *n_blocks, unsigned skip_blocks, const float *data, size_t n_samples) {
+    size_t i;
+
+    if ((*n_blocks)++ < skip_blocks)
+        return;
+
+    for (i = 0; i < n_samples; i++)
+        *energy += (double) data[i] * data[i];
+}
+
+static double erle_db(const struct erle *e) {
+    return 10 * log10((e->rec_energy + 1e-20) / (e->out_energy + 1e-20));
+}
+
+/* Reads a block of capture samples in the format of the canceller. Returns
+ * false at the end of the file, a partial block is dropped. */
+static bool read_capture(SNDFILE *f, pa_convert_func_t convert, float *buf, unsigned channels, void *dst, size_t n_frames,
+                         struct erle *e) {
+    if (sf_readf_float(f, buf, n_frames) < (sf_count_t) n_frames)
+        return false;
+
+    add_energy(&e->rec_energy, &e->n_rec, e->skip_blocks, buf, n_frames * channels);
+    convert(n_frames * channels, buf, dst);
+
+    return true;
+}
+
+static void write_output(SNDFILE *f, pa_convert_func_t convert, float *buf, unsigned channels, const void *src, size_t n_frames,
+                         struct erle *e) {
+    convert(n_frames * channels, src, buf);
+    add_energy(&e->out_energy, &e->n_out, e->skip_blocks, buf, n_frames * channels);
+    sf_writef_float(f, buf, n_frames);
+}
+
+struct test_files {
+    SNDFILE *rec, *out;
+    struct reference ref;
+    pa_convert_func_t rec_convert, play_convert, out_convert;
+    unsigned rec_channels, out_channels;
+    float *buf;
+    struct erle erle;
+};
+
+/* Writes out the blocks the canceller thread is done with */
+static void write_thread_output(struct userdata *u, struct test_files *t, uint32_t nframes) {
+    pa_memchunk cchunk;
+
+    while (aec_thread_pop(u->aec_thread, &cchunk)) {
+        write_output(t->out, t->out_convert, t->buf, t->out_channels, pa_memblock_acquire_chunk(&cchunk), nframes, &t->erle);
+        pa_memblock_release(cchunk.memblock);
+        pa_memblock_unref(cchunk.memblock);
+    }
+}
+
+/* Hands the files to the canceller thread block by block */
+static void run_thread(struct userdata *u, pa_mempool *pool, struct test_files *t, uint32_t nframes) {
+    pa_memchunk rchunk, pchunk, cchunk;
+    bool ok;
+
+    rchunk.index = pchunk.index = cchunk.index = 0;
+    rchunk.length = u->source_output_blocksize;
+    pchunk.length = u->sink_blocksize;
+    cchunk.length = u->source_blocksize;
+
+    for (;;) {
+        rchunk.memblock = pa_memblock_new(pool, rchunk.length);
+        ok = read_capture(t->rec, t->rec_convert, t->buf, t->rec_channels, pa_memblock_acquire(rchunk.memblock), nframes, &t->erle);
+        pa_memblock_release(rchunk.memblock);
+
+        if (!ok) {
+            pa_memblock_unref(rchunk.memblock);
+            break;
+        }
+
+        pchunk.memblock = pa_memblock_new(pool, pchunk.length);
+        read_reference(&t->ref, t->play_convert, t->buf, pa_memblock_acquire(pchunk.memblock), nframes);
+        pa_memblock_release(pchunk.memblock);
+
+        cchunk.memblock = pa_memblock_new(pool, cchunk.length);
+
+        write_thread_output(u, t, nframes);
+        while (!aec_thread_push(u->aec_thread, &rchunk, &pchunk, &cchunk)) {
+            pa_fdsem_wait(u->aec_thread->done);
+            write_thread_output(u, t, nframes);
+        }
+
+        pa_memblock_unref(rchunk.memblock);
+        pa_memblock_unref(pchunk.memblock);
+        pa_memblock_unref(cchunk.memblock);
+    }
+
+    for (;;) {
+        write_thread_output(u, t, nframes);
+        if (u->aec_thread->read_seq == (unsigned) pa_atomic_load(&u->aec_thread->write_seq))
+            break;
+        pa_fdsem_wait(u->aec_thread->done);
+    }
+}
+
+static void help(const char *argv0) {
+    printf("%s [options] play_file rec_file out_file [module args] [drift_file]\n\n"
+           "-h, --help                            Show this help\n"
+           "-v, --verbose                         Print debug messages\n"
+           "      --delay=MSEC                    Delay the playback file by MSEC milliseconds\n"
+           "      --drift=PPM                     Make the playback clock PPM parts per million faster\n"
+           "      --skip=MSEC                     Leave the first MSEC milliseconds out of the ERLE\n"
+           "                                      (defaults to 1000)\n"
+           "      --max-load=PERCENT              Fail if processing a block takes longer on average\n"
+           "                                      than PERCENT of its duration\n"
+           "      --min-erle=DB                   Fail if the ERLE is lower than DB decibels\n"
+           "\n"
+           "The files can have any format libsndfile knows, files without a header are\n"
+           "read as raw float32le. The module arguments select and configure the\n"
+           "canceller, aec_thread=yes runs it in its own thread. The ERLE (echo return\n"
+           "loss enhancement) is only meaningful if there is nothing but echo in rec_file.\n"
+           "\n"
+           "With a canceller that does drift compensation, drift_file drives the\n"
+           "processing, with lines of 'c BYTES' (capture), 'p BYTES' (playback) and\n"
+           "'d DRIFT' (set drift).\n",
+           argv0);
+}
+
+enum {
+    ARG_DELAY = 256,
+    ARG_DRIFT,
+    ARG_SKIP,
+    ARG_MAX_LOAD,
+    ARG_MIN_ERLE
+};
+
+/* Reads the size of a 'c' or 'p' record of a drift file. The canceller
+ * works on whole blocks, and that is all the module writes. */
+static int read_drift_block(FILE *f, size_t blocksize) {
+    int i;
+
+    if (fscanf(f, "%d", &i) != 1) {
+        perror("Drift file incomplete");
+        return -1;
+    }
+
+    if (i < 0 || (size_t) i != blocksize) {
+        pa_log("Drift file has a record of %d bytes, the blocks are %zu bytes", i, blocksize);
+        return -1;
+    }
+
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     struct userdata u;
+    struct test_files t;
     pa_sample_spec source_output_ss, source_ss, sink_ss;
     pa_channel_map source_output_map, source_map, sink_map;
     pa_modargs *ma = NULL;
+    pa_mempool *pool = NULL;
+    SNDFILE *play = NULL;
+    SF_INFO rec_info, play_info, out_info;
     uint8_t *rdata = NULL, *pdata = NULL, *cdata = NULL;
-    int unused PA_GCC_UNUSED;
     int ret = 0, i;
     char c;
     float drift;
     uint32_t nframes;
+    bool aec_thread = DEFAULT_AEC_THREAD, min_erle_set = false;
+    double delay_msec = 0, drift_ppm = 0, skip_msec = 1000, max_load = 0, min_erle = 0, load;
+    unsigned n_blocks = 0;
+    pa_usec_t start, usec, total_usec = 0, max_usec = 0, block_usec;
+    clock_t cpu_start;
+    double cpu_usec;
+    const char *argv0 = argv[0];
+
+    static const struct option long_options[] = {
+        {"help",     0, NULL, 'h'},
+        {"verbose",  0, NULL, 'v'},
+        {"delay",    1, NULL, ARG_DELAY},
+        {"drift",    1, NULL, ARG_DRIFT},
+        {"skip",     1, NULL, ARG_SKIP},
+        {"max-load", 1, NULL, ARG_MAX_LOAD},
+        {"min-erle", 1, NULL, ARG_MIN_ERLE},
+        {NULL,       0, NULL, 0}
+    };
 
     if (!getenv("MAKE_CHECK"))
         pa_log_set_level(PA_LOG_DEBUG);
 
     pa_memzero(&u, sizeof(u));
+    pa_zero(t);
 
-    if (argc < 4 || argc > 7) {
+    while ((i = getopt_long(argc, argv, "hv", long_options, NULL)) != -1) {
+        switch (i) {
+            case 'h':
+                help(argv0);
+                return 0;
+
+            case 'v':
+                pa_log_set_level(PA_LOG_DEBUG);
+                break;
+
+            case ARG_DELAY:
+                if (pa_atod(optarg, &delay_msec) < 0)
+                    goto usage;
+                break;
+
+            case ARG_DRIFT:
+                if (pa_atod(optarg, &drift_ppm) < 0)
+                    goto usage;
+                break;
+
+            case ARG_SKIP:
+                if (pa_atod(optarg, &skip_msec) < 0 || skip_msec < 0)
+                    goto usage;
+                break;
+
+            case ARG_MAX_LOAD:
+                if (pa_atod(optarg, &max_load) < 0)
+                    goto usage;
+                break;
+
+            case ARG_MIN_ERLE:
+                if (pa_atod(optarg, &min_erle) < 0)
+                    goto usage;
+                min_erle_set = true;
+                break;
+
+            default:
+                goto usage;
+        }
+    }
+
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc < 4 || argc > 6) {
         goto usage;
     }
 
-    u.captured_file = fopen(argv[2], "rb");
-    if (u.captured_file == NULL) {
-        perror ("Could not open capture file");
+    if (!(t.rec = open_input(argv[2], &rec_info)))
         goto fail;
-    }
-    u.played_file = fopen(argv[1], "rb");
-    if (u.played_file == NULL) {
-        perror ("Could not open play file");
+    if (!(play = open_input(argv[1], &play_info)))
         goto fail;
-    }
-    u.canceled_file = fopen(argv[3], "wb");
-    if (u.canceled_file == NULL) {
-        perror ("Could not open canceled file");
+
+    if (play_info.samplerate != rec_info.samplerate) {
+        pa_log("The play and capture files must have the same sample rate");
         goto fail;
     }
 
+    if (load_reference(play, &play_info, delay_msec, drift_ppm, &t.ref) < 0)
+        goto fail;
+
     u.core = pa_xnew0(pa_core, 1);
     u.core->cpu_info.cpu_type = PA_CPU_X86;
     u.core->cpu_info.flags.x86 |= PA_CPU_X86_SSE;
@@ -2242,14 +2952,19 @@ int main(int argc, char* argv[]) {
         goto fail;
     }
 
-    source_ss.format = PA_SAMPLE_FLOAT32LE;
-    source_ss.rate = DEFAULT_RATE;
-    source_ss.channels = DEFAULT_CHANNELS;
+    if (pa_modargs_get_value_boolean(ma, "aec_thread", &aec_thread) < 0) {
+        pa_log("aec_thread= expects a boolean argument");
+        goto fail;
+    }
+
+    source_ss.format = PA_SAMPLE_FLOAT32NE;
+    source_ss.rate = rec_info.samplerate;
+    source_ss.channels = rec_info.channels;
     pa_channel_map_init_auto(&source_map, source_ss.channels, PA_CHANNEL_MAP_DEFAULT);
 
-    sink_ss.format = PA_SAMPLE_FLOAT32LE;
-    sink_ss.rate = DEFAULT_RATE;
-    sink_ss.channels = DEFAULT_CHANNELS;
+    sink_ss.format = PA_SAMPLE_FLOAT32NE;
+    sink_ss.rate = play_info.samplerate;
+    sink_ss.channels = play_info.channels;
     pa_channel_map_init_auto(&sink_map, sink_ss.channels, PA_CHANNEL_MAP_DEFAULT);
 
     if (init_common(ma, &u, &source_ss, &source_map) < 0)
@@ -2266,6 +2981,41 @@ int main(int argc, char* argv[]) {
     u.source_output_blocksize = nframes * pa_frame_size(&source_output_ss);
     u.source_blocksize = nframes * pa_frame_size(&source_ss);
     u.sink_blocksize = nframes * pa_frame_size(&sink_ss);
+    block_usec = pa_bytes_to_usec(u.source_blocksize, &source_ss);
+
+    u.ec->msg = pa_msgobject_new(pa_echo_canceller_msg);
+    u.ec->msg->userdata = &u;
+
+    /* The files are converted to what the canceller asked for */
+    if ((int) source_output_ss.rate != rec_info.samplerate || (int) source_output_ss.channels != rec_info.channels ||
+        (int) sink_ss.rate != play_info.samplerate || (int) sink_ss.channels != play_info.channels) {
+        pa_log("The canceller needs %u Hz with %u capture and %u play channels",
+               source_output_ss.rate, source_output_ss.channels, sink_ss.channels);
+        goto fail;
+    }
+
+    t.rec_convert = pa_get_convert_from_float32ne_function(source_output_ss.format);
+    t.play_convert = pa_get_convert_from_float32ne_function(sink_ss.format);
+    t.out_convert = pa_get_convert_to_float32ne_function(source_ss.format);
+    t.rec_channels = source_output_ss.channels;
+    t.out_channels = source_ss.channels;
+    t.buf = pa_xnew(float, nframes * PA_MAX(PA_MAX(source_output_ss.channels, source_ss.channels), sink_ss.channels));
+    t.erle.skip_blocks = (unsigned) (skip_msec * PA_USEC_PER_MSEC / block_usec);
+
+    if (!t.rec_convert || !t.play_convert || !t.out_convert) {
+        pa_log("Unsupported sample format for the canceller");
+        goto fail;
+    }
+
+    pa_zero(out_info);
+    out_info.format = rec_info.format;
+    out_info.samplerate = source_ss.rate;
+    out_info.channels = source_ss.channels;
+
+    if (!(t.out = sf_open(argv[3], SFM_WRITE, &out_info))) {
+        pa_log("Could not open canceled file: %s", sf_strerror(NULL));
+        goto fail;
+    }
 
     if (u.ec->params.drift_compensation) {
         if (argc < 6) {
@@ -2279,6 +3029,30 @@ int main(int argc, char* argv[]) {
             perror ("Could not open drift file");
             goto fail;
         }
+
+        if (aec_thread) {
+            pa_log_warn("The canceller does its own drift compensation, which is not supported in a separate thread");
+            aec_thread = false;
+        }
+    }
+
+    cpu_start = clock();
+
+    if (aec_thread) {
+        if (!(pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, false))) {
+            pa_log("Failed to create memory pool.");
+            goto fail;
+        }
+
+        if (aec_thread_start(&u, block_usec) < 0)
+            goto fail;
+
+        run_thread(&u, pool, &t, nframes);
+
+        n_blocks = u.aec_thread->n_blocks;
+        total_usec = u.aec_thread->total_usec;
+        aec_thread_stop(&u);
+        goto done;
     }
 
     rdata = pa_xmalloc(u.source_output_blocksize);
@@ -2286,16 +3060,21 @@ int main(int argc, char* argv[]) {
     cdata = pa_xmalloc(u.source_blocksize);
 
     if (!u.ec->params.drift_compensation) {
-        while (fread(rdata, u.source_output_blocksize, 1, u.captured_file) > 0) {
-            if (fread(pdata, u.sink_blocksize, 1, u.played_file) == 0) {
-                perror("Played file ended before captured file");
-                goto fail;
-            }
+        while (read_capture(t.rec, t.rec_convert, t.buf, t.rec_channels, rdata, nframes, &t.erle)) {
+            read_reference(&t.ref, t.play_convert, t.buf, pdata, nframes);
 
+            start = pa_rtclock_now();
             u.ec->run(u.ec, rdata, pdata, cdata);
+            usec = pa_rtclock_now() - start;
 
-            unused = fwrite(cdata, u.source_blocksize, 1, u.canceled_file);
+            n_blocks++;
+            total_usec += usec;
+            max_usec = PA_MAX(max_usec, usec);
+
+            write_output(t.out, t.out_convert, t.buf, t.out_channels, cdata, nframes, &t.erle);
         }
+
+        log_processing_time(n_blocks, total_usec, max_usec, block_usec);
     } else {
         while (fscanf(u.drift_file, "%c", &c) > 0) {
             switch (c) {
@@ -2310,63 +3089,98 @@ int main(int argc, char* argv[]) {
                     break;
 
                 case 'c':
-                    if (!fscanf(u.drift_file, "%d", &i)) {
-                        perror("Drift file incomplete");
+                    if (read_drift_block(u.drift_file, u.source_output_blocksize) < 0)
                         goto fail;
-                    }
 
-                    if (fread(rdata, i, 1, u.captured_file) <= 0) {
-                        perror("Captured file ended prematurely");
+                    if (!read_capture(t.rec, t.rec_convert, t.buf, t.rec_channels, rdata, nframes, &t.erle)) {
+                        pa_log("Captured file ended prematurely");
                         goto fail;
                     }
 
+                    start = pa_rtclock_now();
                     u.ec->record(u.ec, rdata, cdata);
+                    usec = pa_rtclock_now() - start;
+
+                    n_blocks++;
+                    total_usec += usec;
+                    max_usec = PA_MAX(max_usec, usec);
 
-                    unused = fwrite(cdata, i, 1, u.canceled_file);
+                    write_output(t.out, t.out_convert, t.buf, t.out_channels, cdata, nframes, &t.erle);
 
                     break;
 
                 case 'p':
-                    if (!fscanf(u.drift_file, "%d", &i)) {
-                        perror("Drift file incomplete");
+                    if (read_drift_block(u.drift_file, u.sink_blocksize) < 0)
                         goto fail;
-                    }
 
-                    if (fread(pdata, i, 1, u.played_file) <= 0) {
-                        perror("Played file ended prematurely");
-                        goto fail;
-                    }
+                    read_reference(&t.ref, t.play_convert, t.buf, pdata, nframes);
 
+                    /* Counted with the next recorded block */
+                    start = pa_rtclock_now();
                     u.ec->play(u.ec, pdata);
+                    total_usec += pa_rtclock_now() - start;
 
                     break;
             }
         }
 
-        if (fread(rdata, i, 1, u.captured_file) > 0)
+        log_processing_time(n_blocks, total_usec, max_usec, block_usec);
+
+        if (sf_readf_float(t.rec, t.buf, 1) > 0)
             pa_log("All capture data was not consumed");
-        if (fread(pdata, i, 1, u.played_file) > 0)
+        if (t.ref.pos < t.ref.n_frames)
             pa_log("All playback data was not consumed");
     }
 
+done:
+    cpu_usec = (double) (clock() - cpu_start) * PA_USEC_PER_SEC / CLOCKS_PER_SEC;
+
+    if (n_blocks > 0) {
+        load = 100.0 * total_usec / ((double) n_blocks * block_usec);
+
+        pa_log_info("CPU time: %0.1f usec per block of %llu usec", cpu_usec / n_blocks, (unsigned long long) block_usec);
+        pa_log_info("ERLE: %0.2f dB", erle_db(&t.erle));
+
+        if (max_load > 0 && load > max_load) {
+            pa_log("Processing takes %0.1f%% of real time, more than %0.1f%%", load, max_load);
+            ret = -1;
+        }
+
+        if (min_erle_set && erle_db(&t.erle) < min_erle) {
+            pa_log("ERLE is lower than %0.2f dB", min_erle);
+            ret = -1;
+        }
+    }
+
     u.ec->done(u.ec);
-    u.ec->msg->dead = true;
-    pa_echo_canceller_msg_unref(u.ec->msg);
 
 out:
-    if (u.captured_file)
-        fclose(u.captured_file);
-    if (u.played_file)
-        fclose(u.played_file);
-    if (u.canceled_file)
-        fclose(u.canceled_file);
+    if (u.aec_thread)
+        aec_thread_stop(&u);
+
+    if (u.ec && u.ec->msg) {
+        u.ec->msg->dead = true;
+        pa_echo_canceller_msg_unref(u.ec->msg);
+    }
+
+    if (t.rec)
+        sf_close(t.rec);
+    if (play)
+        sf_close(play);
+    if (t.out)
+        sf_close(t.out);
     if (u.drift_file)
         fclose(u.drift_file);
 
+    pa_xfree(t.ref.data);
+    pa_xfree(t.buf);
     pa_xfree(rdata);
     pa_xfree(pdata);
     pa_xfree(cdata);
 
+    if (pool)
+        pa_mempool_unref(pool);
+
     pa_xfree(u.ec);
     pa_xfree(u.core);
 
@@ -2376,7 +3190,7 @@ out:
     return ret;
 
 usage:
-    pa_log("Usage: %s play_file rec_file out_file [module args] [drift_file]", argv[0]);
+    help(argv0);
 
 fail:
     ret = -1;
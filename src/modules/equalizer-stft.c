@@ -0,0 +1,330 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include <fftw3.h>
+
+#include <pulse/util.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/sample-util.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/thread.h>
+
+#include "equalizer-stft.h"
+
+struct worker {
+    pa_eq_stft *stft;
+    unsigned index;
+    pa_thread *thread;
+    pa_semaphore *start;
+
+    /* The windowed input, zero padded to the FFT size once and for all */
+    float *fft_in;
+    fftwf_complex *spectrum;
+    float *fft_out;
+};
+
+struct pa_eq_stft {
+    unsigned channels;
+    size_t fft_size;
+    size_t window_size;
+    size_t R;
+    size_t overlap_size;
+
+    float *W;
+    fftwf_plan forward_plan, inverse_plan;
+
+    pa_aupdate **a_H;
+    float **X;
+    float ***H;
+
+    unsigned n_threads;
+    unsigned n_workers;
+    struct worker *workers;
+    pa_semaphore *done;
+    int rtprio;
+    bool quit;
+
+    /* The arguments of the running pa_eq_stft_process() call */
+    float **input;
+    float **overlap;
+    size_t n_gathered;
+    size_t n_hops;
+    bool first;
+    float *dst;
+};
+
+static void hanning_window(float *W, size_t window_size) {
+    /* h=.5*(1-cos(2*pi*j/(window_size+1)), COLA for R=(M+1)/2 */
+    for (size_t i = 0; i < window_size; ++i)
+        W[i] = (float).5 * (1 - cos(2*M_PI*i / (window_size+1)));
+}
+
+/* dst = X * W * src */
+static void window_input(float *dst, const float *src, const float *W, float X, size_t n) {
+    size_t j = 0;
+
+#ifdef __SSE__
+    __m128 x = _mm_set1_ps(X);
+
+    for (; j + 4 <= n; j += 4)
+        _mm_storeu_ps(dst + j, _mm_mul_ps(x, _mm_mul_ps(_mm_loadu_ps(W + j), _mm_loadu_ps(src + j))));
+#endif
+
+    for (; j < n; ++j)
+        dst[j] = X * (W[j] * src[j]);
+}
+
+/* Scales both parts of each bin of the spectrum by the magnitude response */
+static void filter_spectrum(fftwf_complex *spectrum, const float *H, size_t n) {
+    float *d = (float *) spectrum;
+    size_t j = 0;
+
+#ifdef __SSE__
+    for (; j + 4 <= n; j += 4) {
+        __m128 h = _mm_loadu_ps(H + j);
+
+        _mm_storeu_ps(d + 2 * j, _mm_mul_ps(_mm_loadu_ps(d + 2 * j), _mm_unpacklo_ps(h, h)));
+        _mm_storeu_ps(d + 2 * j + 4, _mm_mul_ps(_mm_loadu_ps(d + 2 * j + 4), _mm_unpackhi_ps(h, h)));
+    }
+#endif
+
+    for (; j < n; ++j) {
+        d[2 * j] *= H[j];
+        d[2 * j + 1] *= H[j];
+    }
+}
+
+/* Adds the tail of the previous window to dst and keeps the tail of this one */
+static void overlap_add(float *dst, float *overlap, const float *tail, size_t n) {
+    size_t j = 0;
+
+#ifdef __SSE__
+    for (; j + 4 <= n; j += 4) {
+        _mm_storeu_ps(dst + j, _mm_add_ps(_mm_loadu_ps(dst + j), _mm_loadu_ps(overlap + j)));
+        _mm_storeu_ps(overlap + j, _mm_loadu_ps(tail + j));
+    }
+#endif
+
+    for (; j < n; ++j) {
+        dst[j] += overlap[j];
+        overlap[j] = tail[j];
+    }
+}
+
+static void process_channel(pa_eq_stft *s, struct worker *w, unsigned c) {
+    const float *src = s->input[c];
+    size_t hop, j;
+    unsigned a_i;
+
+    for (hop = 0; hop < s->n_hops; ++hop, src += s->R) {
+        //use a linear-phase sliding STFT and overlap-add method
+        a_i = pa_aupdate_read_begin(s->a_H[c]);
+        window_input(w->fft_in, src, s->W, s->X[c][a_i], s->window_size);
+        fftwf_execute_dft_r2c(s->forward_plan, w->fft_in, w->spectrum);
+        filter_spectrum(w->spectrum, s->H[c][a_i], s->fft_size / 2 + 1);
+        pa_aupdate_read_end(s->a_H[c]);
+
+        fftwf_execute_dft_c2r(s->inverse_plan, w->spectrum, w->fft_out);
+        overlap_add(w->fft_out, s->overlap[c], w->fft_out + s->R, s->overlap_size);
+
+        if (s->first && hop == 0) {
+            /* The windowing function will make the audio ramped in, as a cheap fix we can
+             * undo the windowing (for non-zero window values)
+             */
+            for (j = 0; j < s->overlap_size; ++j)
+                if (s->W[j] > FLT_EPSILON)
+                    w->fft_out[j] /= s->W[j];
+        }
+
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, s->dst + hop * s->R * s->channels + c, s->channels * sizeof(float),
+                        w->fft_out, sizeof(float), s->R);
+    }
+
+    //preserve the needed input for the next window's overlap
+    memmove(s->input[c], s->input[c] + s->n_hops * s->R, (s->n_gathered - s->n_hops * s->R) * sizeof(float));
+}
+
+static void process_share(pa_eq_stft *s, struct worker *w) {
+    for (unsigned c = w->index; c < s->channels; c += s->n_threads)
+        process_channel(s, w, c);
+}
+
+static void thread_func(void *userdata) {
+    struct worker *w = userdata;
+    pa_eq_stft *s = w->stft;
+
+    if (s->rtprio > 0)
+        pa_thread_make_realtime(s->rtprio);
+
+    for (;;) {
+        pa_semaphore_wait(w->start);
+
+        if (s->quit)
+            break;
+
+        process_share(s, w);
+        pa_semaphore_post(s->done);
+    }
+}
+
+pa_eq_stft *pa_eq_stft_new(unsigned channels, size_t fft_size, size_t window_size, unsigned n_threads, int rtprio,
+                           pa_aupdate **a_H, float **X, float ***H) {
+    pa_eq_stft *s;
+    unsigned t;
+
+    pa_assert(channels > 0);
+    pa_assert(window_size % 2 == 1);
+    pa_assert(fft_size >= window_size);
+    pa_assert(a_H);
+    pa_assert(X);
+    pa_assert(H);
+
+    s = pa_xnew0(pa_eq_stft, 1);
+    s->channels = channels;
+    s->fft_size = fft_size;
+    s->window_size = window_size;
+    s->R = (window_size + 1) / 2;
+    s->overlap_size = window_size - s->R;
+    s->a_H = a_H;
+    s->X = X;
+    s->H = H;
+    s->rtprio = rtprio;
+
+    s->W = fftwf_malloc(window_size * sizeof(float));
+    hanning_window(s->W, window_size);
+
+    s->n_threads = s->n_workers = PA_CLAMP(n_threads, 1U, channels);
+    s->workers = pa_xnew0(struct worker, s->n_workers);
+    s->done = pa_semaphore_new(0);
+
+    for (t = 0; t < s->n_workers; ++t) {
+        struct worker *w = &s->workers[t];
+
+        w->stft = s;
+        w->index = t;
+        w->fft_in = fftwf_malloc(fft_size * sizeof(float));
+        w->spectrum = fftwf_malloc((fft_size / 2 + 1) * sizeof(fftwf_complex));
+        w->fft_out = fftwf_malloc(fft_size * sizeof(float));
+        memset(w->fft_in, 0, fft_size * sizeof(float));
+    }
+
+    /* The plans are made for the buffers of the first thread, but FFTW
+     * allows executing them on any buffers aligned the same way */
+    s->forward_plan = fftwf_plan_dft_r2c_1d(fft_size, s->workers[0].fft_in, s->workers[0].spectrum, FFTW_ESTIMATE);
+    s->inverse_plan = fftwf_plan_dft_c2r_1d(fft_size, s->workers[0].spectrum, s->workers[0].fft_out, FFTW_ESTIMATE);
+
+    /* The calling thread does the share of the first one */
+    for (t = 1; t < s->n_threads; ++t) {
+        struct worker *w = &s->workers[t];
+
+        w->start = pa_semaphore_new(0);
+        if (!(w->thread = pa_thread_new("equalizer", thread_func, w))) {
+            pa_log("Failed to create equalizer thread, using %u threads.", t);
+            pa_semaphore_free(w->start);
+            w->start = NULL;
+            s->n_threads = t;
+            break;
+        }
+    }
+
+    pa_log_debug("Filtering %u channels in %u threads.", channels, s->n_threads);
+
+    return s;
+}
+
+void pa_eq_stft_free(pa_eq_stft *s) {
+    unsigned t;
+
+    pa_assert(s);
+
+    s->quit = true;
+    for (t = 1; t < s->n_threads; ++t)
+        pa_semaphore_post(s->workers[t].start);
+
+    for (t = 0; t < s->n_workers; ++t) {
+        struct worker *w = &s->workers[t];
+
+        if (w->thread)
+            pa_thread_free(w->thread);
+        if (w->start)
+            pa_semaphore_free(w->start);
+
+        fftwf_free(w->fft_out);
+        fftwf_free(w->spectrum);
+        fftwf_free(w->fft_in);
+    }
+
+    fftwf_destroy_plan(s->inverse_plan);
+    fftwf_destroy_plan(s->forward_plan);
+
+    pa_semaphore_free(s->done);
+    fftwf_free(s->W);
+    pa_xfree(s->workers);
+    pa_xfree(s);
+}
+
+size_t pa_eq_stft_get_hop_size(pa_eq_stft *s) {
+    pa_assert(s);
+
+    return s->R;
+}
+
+size_t pa_eq_stft_get_overlap_size(pa_eq_stft *s) {
+    pa_assert(s);
+
+    return s->overlap_size;
+}
+
+void pa_eq_stft_process(pa_eq_stft *s, float **input, float **overlap, size_t n_gathered, size_t n_hops, bool first, float *dst) {
+    unsigned t;
+
+    pa_assert(s);
+    pa_assert(input);
+    pa_assert(overlap);
+    pa_assert(dst);
+    pa_assert(n_gathered >= n_hops * s->R + s->overlap_size);
+
+    s->input = input;
+    s->overlap = overlap;
+    s->n_gathered = n_gathered;
+    s->n_hops = n_hops;
+    s->first = first;
+    s->dst = dst;
+
+    for (t = 1; t < s->n_threads; ++t)
+        pa_semaphore_post(s->workers[t].start);
+
+    process_share(s, &s->workers[0]);
+
+    for (t = 1; t < s->n_threads; ++t)
+        pa_semaphore_wait(s->done);
+}
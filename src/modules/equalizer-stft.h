@@ -0,0 +1,56 @@
+#ifndef fooequalizerstfthfoo
+#define fooequalizerstfthfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulsecore/aupdate.h>
+
+/* The STFT overlap-add filter of module-equalizer-sink.
+ *
+ * Each hop of window_size - overlap samples is windowed with a Hann window,
+ * transformed, multiplied by the magnitude response of its channel and
+ * transformed back. The channels are independent, so they are spread over
+ * n_threads threads: the one calling pa_eq_stft_process() and
+ * n_threads - 1 workers, each with its own FFT buffers.
+ *
+ * The magnitude responses and gains are read under the aupdate of their
+ * channel, H[c][i] and X[c][i] being the copy i of channel c. H must be
+ * divided by fft_size. */
+
+typedef struct pa_eq_stft pa_eq_stft;
+
+/* rtprio is the realtime priority for the workers, or 0 */
+pa_eq_stft *pa_eq_stft_new(unsigned channels, size_t fft_size, size_t window_size, unsigned n_threads, int rtprio,
+                           pa_aupdate **a_H, float **X, float ***H);
+void pa_eq_stft_free(pa_eq_stft *s);
+
+/* The hop size, which is also the latency */
+size_t pa_eq_stft_get_hop_size(pa_eq_stft *s);
+
+/* The samples of each input buffer kept for the next call */
+size_t pa_eq_stft_get_overlap_size(pa_eq_stft *s);
+
+/* Filters n_hops hops of all channels. input[c] holds n_gathered samples
+ * of channel c, starting with the overlap kept from the previous call, and
+ * the samples used up are moved out of it. overlap[c] holds the tail of the
+ * last output of channel c. The output is written to dst, n_hops times the
+ * hop size interleaved frames, clamped to [-1, 1]. If first is set, the fade
+ * in of the window is undone for the first hop. */
+void pa_eq_stft_process(pa_eq_stft *s, float **input, float **overlap, size_t n_gathered, size_t n_hops, bool first, float *dst);
+
+#endif
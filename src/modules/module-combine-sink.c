@@ -38,11 +38,13 @@
 #include <pulsecore/log.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/drift-controller.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
+#include <pulsecore/fdsem.h>
 #include <pulsecore/time-smoother.h>
 #include <pulsecore/strlist.h>
 
@@ -54,7 +56,7 @@ PA_MODULE_USAGE(
         "sink_name=<name for the sink> "
         "sink_properties=<properties for the sink> "
         "slaves=<slave sinks> "
-        "adjust_time=<how often to readjust rates in s> "
+        "adjust_time=<how often to readjust rates in s, fractions allowed> "
         "resample_method=<method> "
         "format=<sample format> "
         "rate=<sample rate> "
@@ -65,10 +67,16 @@ PA_MODULE_USAGE(
 
 #define MEMBLOCKQ_MAXLENGTH (1024*1024*16)
 
-#define DEFAULT_ADJUST_TIME_USEC (10*PA_USEC_PER_SEC)
+#define DEFAULT_ADJUST_TIME_USEC (500*PA_USEC_PER_MSEC)
+#define MIN_ADJUST_TIME_USEC (100*PA_USEC_PER_MSEC)
+
+/* Maximum deviation of an output's rate from the rate of the combined sink */
+#define MAX_RATE_DEVIATION 0.02
 
 #define BLOCK_USEC (PA_USEC_PER_MSEC * 200)
 
+#define RING_SLOTS 64
+
 static const char* const valid_modargs[] = {
     "sink_name",
     "sink_properties",
@@ -89,31 +97,37 @@ struct output {
     pa_sink_input *sink_input;
     bool ignore_state_change;
 
-    /* This message queue is only for POST messages, i.e. the messages that
-     * carry audio data from the sink thread to the output thread. The POST
-     * messages need to be handled in a separate queue, because the queue is
-     * processed not only in the output thread mainloop, but also inside the
-     * sink input pop() callback. Processing other messages (such as
-     * SET_REQUESTED_LATENCY) is not safe inside the pop() callback; at least
-     * one reason why it's not safe is that messages that generate rewind
-     * requests (such as SET_REQUESTED_LATENCY) cause crashes when processed
-     * in the pop() callback. */
-    pa_asyncmsgq *audio_inq;
-
-    /* This message queue is for all other messages than POST from the sink
-     * thread to the output thread (currently "all other messages" means just
-     * the SET_REQUESTED_LATENCY message). */
+    /* Position of this output in the ring of rendered audio. It is
+     * advanced by the output thread, and the sink thread only looks
+     * at it to find out which ring slots may be reused. If the output
+     * falls behind by a whole ring, the sink thread sets ring_overrun
+     * and the output skips ahead to the newest data. ring_reading is
+     * set while the output thread takes data out of the ring, which it
+     * only does while ring_active is set. The sink thread sets it when
+     * the output is added, the output thread clears it before asking
+     * for the output to be removed. */
+    pa_atomic_t ring_active;
+    pa_atomic_t ring_read_seq;
+    pa_atomic_t ring_reading;
+    pa_atomic_t ring_overrun;
+
+    /* This message queue is for control messages from the sink thread
+     * to the output thread (currently just the SET_REQUESTED_LATENCY
+     * message). */
     pa_asyncmsgq *control_inq;
 
     /* Message queue from the output thread to the sink thread. */
     pa_asyncmsgq *outq;
 
-    pa_rtpoll_item *audio_inq_rtpoll_item_read, *audio_inq_rtpoll_item_write;
     pa_rtpoll_item *control_inq_rtpoll_item_read, *control_inq_rtpoll_item_write;
     pa_rtpoll_item *outq_rtpoll_item_read, *outq_rtpoll_item_write;
 
     pa_memblockq *memblockq;
 
+    /* Keeps the latency of this output at the target latency, managed
+     * in main context */
+    pa_drift_controller *drift_controller;
+
     /* For communication of the stream latencies to the main thread */
     pa_usec_t total_latency;
 
@@ -152,6 +166,21 @@ struct userdata {
 
     pa_idxset* outputs; /* managed in main context */
 
+    /* Rendered audio for the outputs. It is written only by the sink
+     * thread and read by every output thread at its own position, so
+     * that the outputs never have to wait for the sink thread. A slot
+     * holds a reference to its memblock until it is reused. */
+    struct {
+        pa_memchunk chunk;
+        size_t end; /* Bytes rendered up to and including this slot, only used by the sink thread */
+    } ring[RING_SLOTS];
+    pa_atomic_t ring_write_seq;
+
+    /* Set and posted by outputs that are running low on data */
+    pa_atomic_t ring_hungry;
+    pa_fdsem *ring_need;
+    pa_rtpoll_item *ring_need_rtpoll_item;
+
     struct {
         PA_LLIST_HEAD(struct output, active_outputs); /* managed in IO thread context */
         pa_atomic_t running;  /* we cache that value here, so that every thread can query it cheaply */
@@ -159,21 +188,21 @@ struct userdata {
         bool in_null_mode;
         pa_smoother *smoother;
         uint64_t counter;
+        unsigned ring_seq;
+        size_t ring_written;
     } thread_info;
 };
 
 enum {
     SINK_MESSAGE_ADD_OUTPUT = PA_SINK_MESSAGE_MAX,
     SINK_MESSAGE_REMOVE_OUTPUT,
-    SINK_MESSAGE_NEED,
     SINK_MESSAGE_UPDATE_LATENCY,
     SINK_MESSAGE_UPDATE_MAX_REQUEST,
     SINK_MESSAGE_UPDATE_LATENCY_RANGE
 };
 
 enum {
-    SINK_INPUT_MESSAGE_POST = PA_SINK_INPUT_MESSAGE_MAX,
-    SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY
+    SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY = PA_SINK_INPUT_MESSAGE_MAX
 };
 
 static void output_disable(struct output *o);
@@ -183,7 +212,7 @@ static int output_create_sink_input(struct output *o);
 
 static void adjust_rates(struct userdata *u) {
     struct output *o;
-    pa_usec_t max_sink_latency = 0, min_total_latency = (pa_usec_t) -1, target_latency, avg_total_latency = 0;
+    pa_usec_t max_sink_latency = 0, min_total_latency = (pa_usec_t) -1, target_latency, avg_total_latency = 0, now;
     uint32_t base_rate;
     uint32_t idx;
     unsigned n = 0;
@@ -228,36 +257,24 @@ static void adjust_rates(struct userdata *u) {
 
     target_latency = PA_MAX(max_sink_latency, min_total_latency);
 
-    pa_log_info("[%s] avg total latency is %0.2f msec.", u->sink->name, (double) avg_total_latency / PA_USEC_PER_MSEC);
-    pa_log_info("[%s] target latency is %0.2f msec.", u->sink->name, (double) target_latency / PA_USEC_PER_MSEC);
+    pa_log_debug("[%s] avg total latency is %0.2f msec.", u->sink->name, (double) avg_total_latency / PA_USEC_PER_MSEC);
+    pa_log_debug("[%s] target latency is %0.2f msec.", u->sink->name, (double) target_latency / PA_USEC_PER_MSEC);
 
     base_rate = u->sink->sample_spec.rate;
+    now = pa_rtclock_now();
 
     PA_IDXSET_FOREACH(o, u->outputs, idx) {
-        uint32_t new_rate = base_rate;
-        uint32_t current_rate;
+        uint32_t new_rate;
 
         if (!o->sink_input || !PA_SINK_IS_OPENED(o->sink->state))
             continue;
 
-        current_rate = o->sink_input->sample_spec.rate;
+        new_rate = pa_drift_controller_update(o->drift_controller, now, (int64_t) o->total_latency - (int64_t) target_latency, base_rate);
 
-        if (o->total_latency != target_latency)
-            new_rate += (uint32_t) (((double) o->total_latency - (double) target_latency) / (double) u->adjust_time * (double) new_rate);
+        pa_log_debug("[%s] new rate is %u Hz; ratio is %0.4f; latency is %0.2f msec; estimated drift is %0.1f ppm.",
+                     o->sink_input->sink->name, new_rate, (double) new_rate / base_rate, (double) o->total_latency / PA_USEC_PER_MSEC,
+                     pa_drift_controller_get_drift(o->drift_controller) * 1e6);
 
-        if (new_rate < (uint32_t) (base_rate*0.8) || new_rate > (uint32_t) (base_rate*1.25)) {
-            pa_log_warn("[%s] sample rates too different, not adjusting (%u vs. %u).", o->sink_input->sink->name, base_rate, new_rate);
-            new_rate = base_rate;
-        } else {
-            if (base_rate < new_rate + 20 && new_rate < base_rate + 20)
-              new_rate = base_rate;
-            /* Do the adjustment in small steps; 2‰ can be considered inaudible */
-            if (new_rate < (uint32_t) (current_rate*0.998) || new_rate > (uint32_t) (current_rate*1.002)) {
-                pa_log_info("[%s] new rate of %u Hz not within 2‰ of %u Hz, forcing smaller adjustment", o->sink_input->sink->name, new_rate, current_rate);
-                new_rate = PA_CLAMP(new_rate, (uint32_t) (current_rate*0.998), (uint32_t) (current_rate*1.002));
-            }
-            pa_log_info("[%s] new rate is %u Hz; ratio is %0.3f; latency is %0.2f msec.", o->sink_input->sink->name, new_rate, (double) new_rate / base_rate, (double) o->total_latency / PA_USEC_PER_MSEC);
-        }
         pa_sink_input_set_rate(o->sink_input, new_rate);
     }
 
@@ -312,6 +329,84 @@ static void process_render_null(struct userdata *u, pa_usec_t now) {
                     pa_bytes_to_usec(u->thread_info.counter, &u->sink->sample_spec) - (u->thread_info.timestamp - now));
 }
 
+/* Called from combine sink I/O thread context. Returns whether the ring
+ * slot that is written next may be overwritten. */
+static bool ring_slot_reusable(struct userdata *u) {
+    struct output *o;
+    bool reusable = true;
+
+    PA_LLIST_FOREACH(o, u->thread_info.active_outputs) {
+        unsigned read_seq = (unsigned) pa_atomic_load(&o->ring_read_seq);
+
+        /* The output has already read the old contents of the slot */
+        if (u->thread_info.ring_seq - read_seq < RING_SLOTS)
+            continue;
+
+        /* The output is a whole ring behind. Make it skip ahead, but
+         * only reuse the slot if the output is not reading right now.
+         * If it is not, it will notice the overrun before it reads
+         * anything. */
+        pa_atomic_store(&o->ring_overrun, 1);
+
+        if (pa_atomic_load(&o->ring_reading))
+            reusable = false;
+    }
+
+    return reusable;
+}
+
+/* Called from combine sink I/O thread context. Returns how many bytes
+ * the output that is furthest ahead has not taken out of the ring yet. */
+static size_t ring_lead(struct userdata *u) {
+    unsigned behind = RING_SLOTS;
+    struct output *o;
+
+    PA_LLIST_FOREACH(o, u->thread_info.active_outputs) {
+        unsigned b = u->thread_info.ring_seq - (unsigned) pa_atomic_load(&o->ring_read_seq);
+
+        if (b < behind)
+            behind = b;
+    }
+
+    if (behind == 0)
+        return 0;
+
+    if (behind >= RING_SLOTS)
+        return (size_t) -1;
+
+    return u->thread_info.ring_written - u->ring[(u->thread_info.ring_seq - behind - 1) % RING_SLOTS].end;
+}
+
+/* Called from combine sink I/O thread context. When an output asked for
+ * more data, renders until there is one max_request worth of audio in
+ * the ring ahead of the fastest output. */
+static void fill_ring(struct userdata *u) {
+    size_t length = u->sink->thread_info.max_request;
+
+    pa_assert(u);
+
+    if (!pa_atomic_cmpxchg(&u->ring_hungry, 1, 0))
+        return;
+
+    while (ring_lead(u) < length && ring_slot_reusable(u)) {
+        pa_memchunk chunk;
+        unsigned i = u->thread_info.ring_seq % RING_SLOTS;
+
+        pa_sink_render(u->sink, length, &chunk);
+        u->thread_info.counter += chunk.length;
+
+        if (u->ring[i].chunk.memblock)
+            pa_memblock_unref(u->ring[i].chunk.memblock);
+
+        u->ring[i].chunk = chunk;
+        u->thread_info.ring_written += chunk.length;
+        u->ring[i].end = u->thread_info.ring_written;
+
+        u->thread_info.ring_seq++;
+        pa_atomic_store(&u->ring_write_seq, (int) u->thread_info.ring_seq);
+    }
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
 
@@ -345,6 +440,9 @@ static void thread_func(void *userdata) {
             pa_rtpoll_set_timer_absolute(u->rtpoll, u->thread_info.timestamp);
             u->thread_info.in_null_mode = true;
         } else {
+            if (pa_atomic_load(&u->thread_info.running))
+                fill_ring(u);
+
             pa_rtpoll_set_timer_disabled(u->rtpoll);
             u->thread_info.in_null_mode = false;
         }
@@ -369,69 +467,50 @@ finish:
     pa_log_debug("Thread shutting down");
 }
 
-/* Called from combine sink I/O thread context */
-static void render_memblock(struct userdata *u, struct output *o, size_t length) {
-    pa_assert(u);
+/* Called from output I/O thread context. Moves the data this output
+ * has not seen yet from the ring into its memblockq, and asks the sink
+ * thread for more if less than min_length bytes are queued then. */
+static void output_read_ring(struct output *o, size_t min_length) {
+    struct userdata *u;
+    unsigned seq, write_seq;
+    bool opened;
+
     pa_assert(o);
+    pa_assert_se(u = o->userdata);
 
-    /* We are run by the sink thread, on behalf of an output (o). The
-     * output is waiting for us, hence it is safe to access its
-     * mainblockq and asyncmsgq directly. */
+    pa_atomic_store(&o->ring_reading, 1);
 
-    /* If we are not running, we cannot produce any data */
-    if (!pa_atomic_load(&u->thread_info.running))
+    if (!pa_atomic_load(&o->ring_active)) {
+        pa_atomic_store(&o->ring_reading, 0);
         return;
+    }
 
-    /* Maybe there's some data in the requesting output's queue
-     * now? */
-    while (pa_asyncmsgq_process_one(o->audio_inq) > 0)
-        ;
+    if (pa_atomic_load(&o->ring_overrun)) {
+        pa_log_debug("[%s] Output fell behind by more than %u blocks, skipping ahead.", o->sink->name, RING_SLOTS);
+        pa_atomic_store(&o->ring_read_seq, pa_atomic_load(&u->ring_write_seq));
+        pa_atomic_store(&o->ring_overrun, 0);
+    }
 
-    /* Ok, now let's prepare some data if we really have to */
-    while (!pa_memblockq_is_readable(o->memblockq)) {
-        struct output *j;
-        pa_memchunk chunk;
+    seq = (unsigned) pa_atomic_load(&o->ring_read_seq);
+    write_seq = (unsigned) pa_atomic_load(&u->ring_write_seq);
+    opened = PA_SINK_IS_OPENED(o->sink_input->sink->thread_info.state);
 
-        /* Render data! */
-        pa_sink_render(u->sink, length, &chunk);
+    for (; seq != write_seq; seq++)
+        if (opened)
+            pa_memblockq_push_align(o->memblockq, &u->ring[seq % RING_SLOTS].chunk);
 
-        u->thread_info.counter += chunk.length;
+    if (!opened)
+        pa_memblockq_flush_write(o->memblockq, true);
 
-        /* OK, let's send this data to the other threads */
-        PA_LLIST_FOREACH(j, u->thread_info.active_outputs) {
-            if (j == o)
-                continue;
-
-            pa_asyncmsgq_post(j->audio_inq, PA_MSGOBJECT(j->sink_input), SINK_INPUT_MESSAGE_POST, NULL, 0, &chunk, NULL);
-        }
+    pa_atomic_store(&o->ring_read_seq, (int) seq);
+    pa_atomic_store(&o->ring_reading, 0);
 
-        /* And place it directly into the requesting output's queue */
-        pa_memblockq_push_align(o->memblockq, &chunk);
-        pa_memblock_unref(chunk.memblock);
+    if (pa_memblockq_get_length(o->memblockq) < min_length && pa_atomic_load(&u->thread_info.running)) {
+        pa_atomic_store(&u->ring_hungry, 1);
+        pa_fdsem_post(u->ring_need);
     }
 }
 
-/* Called from I/O thread context */
-static void request_memblock(struct output *o, size_t length) {
-    pa_assert(o);
-    pa_sink_input_assert_ref(o->sink_input);
-    pa_sink_assert_ref(o->userdata->sink);
-
-    /* If another thread already prepared some data we received
-     * the data over the asyncmsgq, hence let's first process
-     * it. */
-    while (pa_asyncmsgq_process_one(o->audio_inq) > 0)
-        ;
-
-    /* Check whether we're now readable */
-    if (pa_memblockq_is_readable(o->memblockq))
-        return;
-
-    /* OK, we need to prepare new data, but only if the sink is actually running */
-    if (pa_atomic_load(&o->userdata->thread_info.running))
-        pa_asyncmsgq_send(o->outq, PA_MSGOBJECT(o->userdata->sink), SINK_MESSAGE_NEED, o, (int64_t) length, NULL);
-}
-
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct output *o;
@@ -439,8 +518,10 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     pa_sink_input_assert_ref(i);
     pa_assert_se(o = i->userdata);
 
-    /* If necessary, get some new data */
-    request_memblock(o, nbytes);
+    /* Take whatever the sink thread rendered in the meantime. We never
+     * wait for the sink thread here: if the ring runs dry we underrun,
+     * and the sink thread renders ahead for the next time. */
+    output_read_ring(o, nbytes + o->sink->thread_info.max_request);
 
     /* pa_log("%s q size is %u + %u (%u/%u)", */
     /*        i->sink->name, */
@@ -531,15 +612,9 @@ static void sink_input_attach_cb(pa_sink_input *i) {
     pa_assert_se(o = i->userdata);
 
     /* Set up the queue from the sink thread to us */
-    pa_assert(!o->audio_inq_rtpoll_item_read);
     pa_assert(!o->control_inq_rtpoll_item_read);
     pa_assert(!o->outq_rtpoll_item_write);
 
-    o->audio_inq_rtpoll_item_read = pa_rtpoll_item_new_asyncmsgq_read(
-            i->sink->thread_info.rtpoll,
-            PA_RTPOLL_LATE,  /* This one is not that important, since we check for data in _peek() anyway. */
-            o->audio_inq);
-
     o->control_inq_rtpoll_item_read = pa_rtpoll_item_new_asyncmsgq_read(
             i->sink->thread_info.rtpoll,
             PA_RTPOLL_NORMAL,
@@ -579,15 +654,14 @@ static void sink_input_detach_cb(pa_sink_input *i) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(o = i->userdata);
 
-    /* We unregister the output. That means that the sink doesn't
-     * pass any further data to this output */
+    /* Stop reading the ring before we unregister the output. Only this
+     * thread reads it, and it blocks until the sink thread has handled
+     * the message, so the sink thread never has to wait for a read to
+     * finish. After that the sink doesn't pass any further data to this
+     * output. */
+    pa_atomic_store(&o->ring_active, 0);
     pa_asyncmsgq_send(o->userdata->sink->asyncmsgq, PA_MSGOBJECT(o->userdata->sink), SINK_MESSAGE_REMOVE_OUTPUT, o, 0, NULL);
 
-    if (o->audio_inq_rtpoll_item_read) {
-        pa_rtpoll_item_free(o->audio_inq_rtpoll_item_read);
-        o->audio_inq_rtpoll_item_read = NULL;
-    }
-
     if (o->control_inq_rtpoll_item_read) {
         pa_rtpoll_item_free(o->control_inq_rtpoll_item_read);
         o->control_inq_rtpoll_item_read = NULL;
@@ -621,6 +695,7 @@ static int sink_input_process_msg(pa_msgobject *obj, int code, void *data, int64
         case PA_SINK_INPUT_MESSAGE_GET_LATENCY: {
             pa_usec_t *r = data;
 
+            output_read_ring(o, 0);
             *r = pa_bytes_to_usec(pa_memblockq_get_length(o->memblockq), &o->sink_input->sample_spec);
 
             /* Fall through, the default handler will add in the extra
@@ -628,15 +703,6 @@ static int sink_input_process_msg(pa_msgobject *obj, int code, void *data, int64
             break;
         }
 
-        case SINK_INPUT_MESSAGE_POST:
-
-            if (PA_SINK_IS_OPENED(o->sink_input->sink->thread_info.state))
-                pa_memblockq_push_align(o->memblockq, chunk);
-            else
-                pa_memblockq_flush_write(o->memblockq, true);
-
-            return 0;
-
         case SINK_INPUT_MESSAGE_SET_REQUESTED_LATENCY: {
             pa_usec_t latency = (pa_usec_t) offset;
 
@@ -814,18 +880,19 @@ static void output_add_within_thread(struct output *o) {
 
     PA_LLIST_PREPEND(struct output, o->userdata->thread_info.active_outputs, o);
 
+    /* The output starts reading at the newest data in the ring */
+    pa_atomic_store(&o->ring_read_seq, (int) o->userdata->thread_info.ring_seq);
+    pa_atomic_store(&o->ring_overrun, 0);
+    pa_atomic_store(&o->ring_active, 1);
+    pa_atomic_store(&o->userdata->ring_hungry, 1);
+
     pa_assert(!o->outq_rtpoll_item_read);
-    pa_assert(!o->audio_inq_rtpoll_item_write);
     pa_assert(!o->control_inq_rtpoll_item_write);
 
     o->outq_rtpoll_item_read = pa_rtpoll_item_new_asyncmsgq_read(
             o->userdata->rtpoll,
             PA_RTPOLL_EARLY-1,  /* This item is very important */
             o->outq);
-    o->audio_inq_rtpoll_item_write = pa_rtpoll_item_new_asyncmsgq_write(
-            o->userdata->rtpoll,
-            PA_RTPOLL_EARLY,
-            o->audio_inq);
     o->control_inq_rtpoll_item_write = pa_rtpoll_item_new_asyncmsgq_write(
             o->userdata->rtpoll,
             PA_RTPOLL_NORMAL,
@@ -837,6 +904,11 @@ static void output_remove_within_thread(struct output *o) {
     pa_assert(o);
     pa_sink_assert_io_context(o->sink);
 
+    /* The output thread stopped reading the ring before it sent this
+     * message, see sink_input_detach_cb() */
+    pa_assert(!pa_atomic_load(&o->ring_active));
+    pa_assert(!pa_atomic_load(&o->ring_reading));
+
     PA_LLIST_REMOVE(struct output, o->userdata->thread_info.active_outputs, o);
 
     if (o->outq_rtpoll_item_read) {
@@ -844,11 +916,6 @@ static void output_remove_within_thread(struct output *o) {
         o->outq_rtpoll_item_read = NULL;
     }
 
-    if (o->audio_inq_rtpoll_item_write) {
-        pa_rtpoll_item_free(o->audio_inq_rtpoll_item_write);
-        o->audio_inq_rtpoll_item_write = NULL;
-    }
-
     if (o->control_inq_rtpoll_item_write) {
         pa_rtpoll_item_free(o->control_inq_rtpoll_item_write);
         o->control_inq_rtpoll_item_write = NULL;
@@ -910,10 +977,6 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             update_latency_range(u);
             return 0;
 
-        case SINK_MESSAGE_NEED:
-            render_memblock(u, (struct output*) data, (size_t) offset);
-            return 0;
-
         case SINK_MESSAGE_UPDATE_LATENCY: {
             pa_usec_t x, y, latency = (pa_usec_t) offset;
 
@@ -1033,12 +1096,6 @@ static struct output *output_new(struct userdata *u, pa_sink *sink) {
     o = pa_xnew0(struct output, 1);
     o->userdata = u;
 
-    o->audio_inq = pa_asyncmsgq_new(0);
-    if (!o->audio_inq) {
-        pa_log("pa_asyncmsgq_new() failed.");
-        goto fail;
-    }
-
     o->control_inq = pa_asyncmsgq_new(0);
     if (!o->control_inq) {
         pa_log("pa_asyncmsgq_new() failed.");
@@ -1063,6 +1120,8 @@ static struct output *output_new(struct userdata *u, pa_sink *sink) {
             0,
             &u->sink->silence);
 
+    o->drift_controller = pa_drift_controller_new(u->adjust_time > 0 ? u->adjust_time : DEFAULT_ADJUST_TIME_USEC, MAX_RATE_DEVIATION);
+
     pa_assert_se(pa_idxset_put(u->outputs, o, NULL) == 0);
     update_description(u);
 
@@ -1081,11 +1140,6 @@ static void output_free(struct output *o) {
     output_disable(o);
     update_description(o->userdata);
 
-    if (o->audio_inq_rtpoll_item_read)
-        pa_rtpoll_item_free(o->audio_inq_rtpoll_item_read);
-    if (o->audio_inq_rtpoll_item_write)
-        pa_rtpoll_item_free(o->audio_inq_rtpoll_item_write);
-
     if (o->control_inq_rtpoll_item_read)
         pa_rtpoll_item_free(o->control_inq_rtpoll_item_read);
     if (o->control_inq_rtpoll_item_write)
@@ -1096,9 +1150,6 @@ static void output_free(struct output *o) {
     if (o->outq_rtpoll_item_write)
         pa_rtpoll_item_free(o->outq_rtpoll_item_write);
 
-    if (o->audio_inq)
-        pa_asyncmsgq_unref(o->audio_inq);
-
     if (o->control_inq)
         pa_asyncmsgq_unref(o->control_inq);
 
@@ -1108,6 +1159,9 @@ static void output_free(struct output *o) {
     if (o->memblockq)
         pa_memblockq_free(o->memblockq);
 
+    if (o->drift_controller)
+        pa_drift_controller_free(o->drift_controller);
+
     pa_xfree(o);
 }
 
@@ -1125,6 +1179,8 @@ static void output_enable(struct output *o) {
     o->ignore_state_change = true;
 
     if (output_create_sink_input(o) >= 0) {
+        /* The new stream starts at the base rate */
+        pa_drift_controller_reset(o->drift_controller, true);
 
         if (o->sink->state != PA_SINK_INIT) {
             /* Enable the sink input. That means that the sink
@@ -1153,7 +1209,6 @@ static void output_disable(struct output *o) {
 
     /* Finally, drop all queued data */
     pa_memblockq_flush_write(o->memblockq, true);
-    pa_asyncmsgq_flush(o->audio_inq, false);
     pa_asyncmsgq_flush(o->control_inq, false);
     pa_asyncmsgq_flush(o->outq, false);
 }
@@ -1293,7 +1348,7 @@ int pa__init(pa_module*m) {
     struct output *o;
     uint32_t idx;
     pa_sink_new_data data;
-    uint32_t adjust_time_sec;
+    double adjust_time_sec;
     size_t nbytes;
 
     pa_assert(m);
@@ -1320,6 +1375,9 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    u->ring_need = pa_fdsem_new();
+    u->ring_need_rtpoll_item = pa_rtpoll_item_new_fdsem(u->rtpoll, PA_RTPOLL_EARLY, u->ring_need);
+
     u->resample_method = resample_method;
     u->outputs = pa_idxset_new(NULL, NULL);
     u->thread_info.smoother = pa_smoother_new(
@@ -1331,16 +1389,14 @@ int pa__init(pa_module*m) {
             pa_rtclock_now(),
             true);
 
-    adjust_time_sec = DEFAULT_ADJUST_TIME_USEC / PA_USEC_PER_SEC;
-    if (pa_modargs_get_value_u32(ma, "adjust_time", &adjust_time_sec) < 0) {
+    adjust_time_sec = (double) DEFAULT_ADJUST_TIME_USEC / PA_USEC_PER_SEC;
+    if (pa_modargs_get_value_double(ma, "adjust_time", &adjust_time_sec) < 0 || adjust_time_sec < 0 ||
+        (adjust_time_sec > 0 && adjust_time_sec * PA_USEC_PER_SEC < MIN_ADJUST_TIME_USEC)) {
         pa_log("Failed to parse adjust_time value");
         goto fail;
     }
 
-    if (adjust_time_sec != DEFAULT_ADJUST_TIME_USEC / PA_USEC_PER_SEC)
-        u->adjust_time = adjust_time_sec * PA_USEC_PER_SEC;
-    else
-        u->adjust_time = DEFAULT_ADJUST_TIME_USEC;
+    u->adjust_time = (pa_usec_t) (adjust_time_sec * PA_USEC_PER_SEC);
 
     slaves = pa_modargs_get_value(ma, "slaves", NULL);
     u->automatic = !slaves;
@@ -1535,6 +1591,7 @@ fail:
 
 void pa__done(pa_module*m) {
     struct userdata *u;
+    unsigned i;
 
     pa_assert(m);
 
@@ -1568,6 +1625,16 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
+    if (u->ring_need_rtpoll_item)
+        pa_rtpoll_item_free(u->ring_need_rtpoll_item);
+
+    if (u->ring_need)
+        pa_fdsem_free(u->ring_need);
+
+    for (i = 0; i < RING_SLOTS; i++)
+        if (u->ring[i].chunk.memblock)
+            pa_memblock_unref(u->ring[i].chunk.memblock);
+
     if (u->rtpoll)
         pa_rtpoll_free(u->rtpoll);
 
@@ -30,17 +30,10 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <float.h>
 #include <math.h>
 #include <string.h>
 #include <stdint.h>
 
-//#undef __SSE2__
-#ifdef __SSE2__
-#include <xmmintrin.h>
-#include <emmintrin.h>
-#endif
-
 #include <fftw3.h>
 
 #include <pulse/xmalloc.h>
@@ -63,6 +56,10 @@
 #include <pulsecore/database.h>
 #include <pulsecore/protocol-dbus.h>
 #include <pulsecore/dbus-util.h>
+#include <pulsecore/filter/biquad-cascade.h>
+#include <pulsecore/filter/parametric-eq.h>
+
+#include "equalizer-stft.h"
 
 PA_MODULE_AUTHOR("Jason Newton");
 PA_MODULE_DESCRIPTION(_("General Purpose Equalizer"));
@@ -78,16 +75,31 @@ PA_MODULE_USAGE(
           "channel_map=<channel map> "
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
+          "mode=<fft or iir> "
+          "threads=<number of threads filtering in fft mode> "
          ));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 #define DEFAULT_AUTOLOADED false
 
+#define MAX_THREADS 4
+
+#define IIR_STAGES 10
+#define IIR_RAMP_MSEC 10
+
+enum equalizer_mode {
+    /* Linear phase, with the latency of half the window */
+    MODE_FFT,
+    /* Minimum phase biquads fitted to the same filter, without latency */
+    MODE_IIR,
+};
+
 struct userdata {
     pa_module *module;
     pa_sink *sink;
     pa_sink_input *sink_input;
     bool autoloaded;
+    enum equalizer_mode mode;
 
     size_t channels;
     size_t fft_size;//length (res) of fft
@@ -104,15 +116,16 @@ struct userdata {
     size_t samples_gathered;
     size_t input_buffer_max;
     //message
-    float *W;//windowing function (time domain)
-    float *work_buffer, **input, **overlap_accum;
-    fftwf_complex *output_window;
-    fftwf_plan forward_plan, inverse_plan;
+    float **input, **overlap_accum;
+    pa_eq_stft *stft;
     //size_t samplings;
 
     float **Xs;
     float ***Hs;//thread updatable copies of the freq response filters (magnitude based)
     pa_aupdate **a_H;
+    struct biquad ***Bs;//the IIR stages designed from Hs, updated along with them
+    struct biquad **Bs_applied;//the IIR stages last handed to the cascade
+    pa_biquad_cascade *cascade;
     pa_memblockq *input_q;
     char *output_buffer;
     size_t output_buffer_length;
@@ -139,6 +152,8 @@ static const char* const valid_modargs[] = {
     "channel_map",
     "autoloaded",
     "use_volume_sharing",
+    "mode",
+    "threads",
     NULL
 };
 
@@ -153,10 +168,14 @@ static const char* const valid_modargs[] = {
 static void dbus_init(struct userdata *u);
 static void dbus_done(struct userdata *u);
 
-static void hanning_window(float *W, size_t window_size) {
-    /* h=.5*(1-cos(2*pi*j/(window_size+1)), COLA for R=(M+1)/2 */
-    for (size_t i = 0; i < window_size; ++i)
-        W[i] = (float).5 * (1 - cos(2*M_PI*i / (window_size+1)));
+/* Called from main context, between pa_aupdate_write_begin() and
+ * pa_aupdate_write_end() */
+static void design_iir(struct userdata *u, size_t c, unsigned a_i) {
+    if (u->mode != MODE_IIR)
+        return;
+
+    pa_parametric_eq_design(u->Bs[c][a_i], IIR_STAGES, u->Hs[c][a_i], FILTER_SIZE(u),
+                            u->sink->sample_spec.rate, u->Xs[c][a_i] * u->fft_size);
 }
 
 static void fix_filter(float *H, size_t fft_size) {
@@ -364,159 +383,6 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
-#if 1
-//reference implementation
-static void dsp_logic(
-    float * restrict dst,//used as a temp array too, needs to be fft_length!
-    float * restrict src,/*input data w/ overlap at start,
-                               *automatically cycled in routine
-                               */
-    float * restrict overlap,
-    const float X,//multiplier
-    const float * restrict H,//The freq. magnitude scalers filter
-    const float * restrict W,//The windowing function
-    fftwf_complex * restrict output_window,//The transformed windowed src
-    struct userdata *u) {
-
-    //use a linear-phase sliding STFT and overlap-add method (for each channel)
-    //window the data
-    for(size_t j = 0; j < u->window_size; ++j) {
-        dst[j] = X * W[j] * src[j];
-    }
-    //zero pad the remaining fft window
-    memset(dst + u->window_size, 0, (u->fft_size - u->window_size) * sizeof(float));
-    //Processing is done here!
-    //do fft
-    fftwf_execute_dft_r2c(u->forward_plan, dst, output_window);
-    //perform filtering
-    for(size_t j = 0; j < FILTER_SIZE(u); ++j) {
-        u->output_window[j][0] *= H[j];
-        u->output_window[j][1] *= H[j];
-    }
-    //inverse fft
-    fftwf_execute_dft_c2r(u->inverse_plan, output_window, dst);
-    ////debug: tests overlapping add
-    ////and negates ALL PREVIOUS processing
-    ////yields a perfect reconstruction if COLA is held
-    //for(size_t j = 0; j < u->window_size; ++j) {
-    //    u->work_buffer[j] = u->W[j] * u->input[c][j];
-    //}
-
-    //overlap add and preserve overlap component from this window (linear phase)
-    for(size_t j = 0; j < u->overlap_size; ++j) {
-        u->work_buffer[j] += overlap[j];
-        overlap[j] = dst[u->R + j];
-    }
-    ////debug: tests if basic buffering works
-    ////shouldn't modify the signal AT ALL (beyond roundoff)
-    //for(size_t j = 0; j < u->window_size;++j) {
-    //    u->work_buffer[j] = u->input[c][j];
-    //}
-
-    //preserve the needed input for the next window's overlap
-    memmove(src, src + u->R,
-        (u->samples_gathered - u->R) * sizeof(float)
-    );
-}
-#else
-typedef float v4sf __attribute__ ((__aligned__(v_size * sizeof(float))));
-typedef union float_vector {
-    float f[v_size];
-    v4sf v;
-    __m128 m;
-} float_vector_t;
-
-//regardless of sse enabled, the loops in here assume
-//16 byte aligned addresses and memory allocations divisible by v_size
-static void dsp_logic(
-    float * restrict dst,//used as a temp array too, needs to be fft_length!
-    float * restrict src,/*input data w/ overlap at start,
-                               *automatically cycled in routine
-                               */
-    float * restrict overlap,//The size of the overlap
-    const float X,//multiplier
-    const float * restrict H,//The freq. magnitude scalers filter
-    const float * restrict W,//The windowing function
-    fftwf_complex * restrict output_window,//The transformed windowed src
-    struct userdata *u) {//Collection of constants
-    const size_t overlap_size = PA_ROUND_UP(u->overlap_size, v_size);
-    float_vector_t x;
-    x.f[0] = x.f[1] = x.f[2] = x.f[3] = X;
-
-    //assert(u->samples_gathered >= u->R);
-    //use a linear-phase sliding STFT and overlap-add method
-    for(size_t j = 0; j < u->window_size; j += v_size) {
-        //dst[j] = W[j] * src[j];
-        float_vector_t *d = (float_vector_t*) (dst + j);
-        float_vector_t *w = (float_vector_t*) (W + j);
-        float_vector_t *s = (float_vector_t*) (src + j);
-//#if __SSE2__
-        d->m = _mm_mul_ps(x.m, _mm_mul_ps(w->m, s->m));
-//        d->v = x->v * w->v * s->v;
-//#endif
-    }
-    //zero pad the remaining fft window
-    memset(dst + u->window_size, 0, (u->fft_size - u->window_size) * sizeof(float));
-
-    //Processing is done here!
-    //do fft
-    fftwf_execute_dft_r2c(u->forward_plan, dst, output_window);
-    //perform filtering - purely magnitude based
-    for(size_t j = 0; j < FILTER_SIZE; j += v_size / 2) {
-        //output_window[j][0]*=H[j];
-        //output_window[j][1]*=H[j];
-        float_vector_t *d = (float_vector_t*)( ((float *) output_window) + 2 * j);
-        float_vector_t h;
-        h.f[0] = h.f[1] = H[j];
-        h.f[2] = h.f[3] = H[j + 1];
-//#if __SSE2__
-        d->m = _mm_mul_ps(d->m, h.m);
-//#else
-//        d->v = d->v * h.v;
-//#endif
-    }
-
-    //inverse fft
-    fftwf_execute_dft_c2r(u->inverse_plan, output_window, dst);
-
-    ////debug: tests overlapping add
-    ////and negates ALL PREVIOUS processing
-    ////yields a perfect reconstruction if COLA is held
-    //for(size_t j = 0; j < u->window_size; ++j) {
-    //    dst[j] = W[j] * src[j];
-    //}
-
-    //overlap add and preserve overlap component from this window (linear phase)
-    for(size_t j = 0; j < overlap_size; j += v_size) {
-        //dst[j]+=overlap[j];
-        //overlap[j]+=dst[j+R];
-        float_vector_t *d = (float_vector_t*)(dst + j);
-        float_vector_t *o = (float_vector_t*)(overlap + j);
-//#if __SSE2__
-        d->m = _mm_add_ps(d->m, o->m);
-        o->m = ((float_vector_t*)(dst + u->R + j))->m;
-//#else
-//        d->v = d->v + o->v;
-//        o->v = ((float_vector_t*)(dst + u->R + j))->v;
-//#endif
-    }
-    //memcpy(overlap, dst+u->R, u->overlap_size * sizeof(float)); //overlap preserve (debug)
-    //zero out the bit beyond the real overlap so we don't add garbage next iteration
-    memset(overlap + u->overlap_size, 0, overlap_size - u->overlap_size);
-
-    ////debug: tests if basic buffering works
-    ////shouldn't modify the signal AT ALL (beyond roundoff)
-    //for(size_t j = 0; j < u->window_size; ++j) {
-    //    dst[j] = src[j];
-    //}
-
-    //preserve the needed input for the next window's overlap
-    memmove(src, src + u->R,
-        (u->samples_gathered - u->R) * sizeof(float)
-    );
-}
-#endif
-
 static void flatten_to_memblockq(struct userdata *u) {
     size_t mbs = pa_mempool_block_size_max(u->sink->core->mempool);
     pa_memchunk tchunk;
@@ -538,9 +404,7 @@ static void flatten_to_memblockq(struct userdata *u) {
 
 static void process_samples(struct userdata *u) {
     size_t fs = pa_frame_size(&(u->sink->sample_spec));
-    unsigned a_i;
-    float *H, X;
-    size_t iterations, offset;
+    size_t iterations;
     pa_assert(u->samples_gathered >= u->window_size);
     iterations = (u->samples_gathered - u->overlap_size) / u->R;
     //make sure there is enough buffer memory allocated
@@ -551,38 +415,10 @@ static void process_samples(struct userdata *u) {
     }
     u->output_buffer_length = iterations * u->R * fs;
 
-    for(size_t iter = 0; iter < iterations; ++iter) {
-        offset = iter * u->R * fs;
-        for(size_t c = 0;c < u->channels; c++) {
-            a_i = pa_aupdate_read_begin(u->a_H[c]);
-            X = u->Xs[c][a_i];
-            H = u->Hs[c][a_i];
-            dsp_logic(
-                u->work_buffer,
-                u->input[c],
-                u->overlap_accum[c],
-                X,
-                H,
-                u->W,
-                u->output_window,
-                u
-            );
-            pa_aupdate_read_end(u->a_H[c]);
-            if (u->first_iteration) {
-                /* The windowing function will make the audio ramped in, as a cheap fix we can
-                 * undo the windowing (for non-zero window values)
-                 */
-                for(size_t i = 0; i < u->overlap_size; ++i) {
-                    u->work_buffer[i] = u->W[i] <= FLT_EPSILON ? u->work_buffer[i] : u->work_buffer[i] / u->W[i];
-                }
-            }
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, (uint8_t *) (((float *)u->output_buffer) + c) + offset, fs, u->work_buffer, sizeof(float), u->R);
-        }
-        if (u->first_iteration) {
-            u->first_iteration = false;
-        }
-        u->samples_gathered -= u->R;
-    }
+    pa_eq_stft_process(u->stft, u->input, u->overlap_accum, u->samples_gathered, iterations, u->first_iteration,
+                       (float *) u->output_buffer);
+    u->first_iteration = false;
+    u->samples_gathered -= iterations * u->R;
     flatten_to_memblockq(u);
 }
 
@@ -603,6 +439,73 @@ static void input_buffer(struct userdata *u, pa_memchunk *in) {
     pa_memblock_release(in->memblock);
 }
 
+/* Called from I/O thread context */
+static void update_iir(struct userdata *u) {
+    bool changed = false;
+    unsigned a_i;
+
+    for (size_t c = 0; c < u->channels; ++c) {
+        a_i = pa_aupdate_read_begin(u->a_H[c]);
+        if (memcmp(u->Bs_applied[c], u->Bs[c][a_i], IIR_STAGES * sizeof(struct biquad)) != 0) {
+            memcpy(u->Bs_applied[c], u->Bs[c][a_i], IIR_STAGES * sizeof(struct biquad));
+            for (unsigned s = 0; s < IIR_STAGES; ++s)
+                pa_biquad_cascade_set(u->cascade, s, c, &u->Bs_applied[c][s]);
+            changed = true;
+        }
+        pa_aupdate_read_end(u->a_H[c]);
+    }
+
+    /* Move to the new filter smoothly, so that changing it doesn't click */
+    if (changed)
+        pa_biquad_cascade_commit(u->cascade, u->sink->sample_spec.rate * IIR_RAMP_MSEC / 1000);
+}
+
+/* Called from I/O thread context */
+static int sink_input_pop_iir(struct userdata *u, size_t nbytes, pa_memchunk *chunk) {
+    size_t fs = pa_frame_size(&u->sink->sample_spec);
+    pa_memchunk tchunk;
+    float *src, *dst;
+    unsigned n;
+
+    /* Hmm, process any rewind request that might be queued up */
+    pa_sink_process_rewind(u->sink, 0);
+
+    while (pa_memblockq_peek(u->input_q, &tchunk) < 0) {
+        pa_memchunk nchunk;
+
+        pa_sink_render(u->sink, nbytes, &nchunk);
+        pa_memblockq_push(u->input_q, &nchunk);
+        pa_memblock_unref(nchunk.memblock);
+    }
+
+    tchunk.length = PA_MIN(nbytes, tchunk.length);
+    pa_assert(tchunk.length > 0);
+
+    n = (unsigned) (tchunk.length / fs);
+    pa_assert(n > 0);
+
+    chunk->index = 0;
+    chunk->length = n * fs;
+    chunk->memblock = pa_memblock_new(u->sink->core->mempool, chunk->length);
+
+    pa_memblockq_drop(u->input_q, chunk->length);
+
+    update_iir(u);
+
+    src = pa_memblock_acquire_chunk(&tchunk);
+    dst = pa_memblock_acquire(chunk->memblock);
+
+    pa_biquad_cascade_process_float32(u->cascade, dst, src, n);
+    pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst, sizeof(float), dst, sizeof(float), n * u->channels);
+
+    pa_memblock_release(tchunk.memblock);
+    pa_memblock_release(chunk->memblock);
+
+    pa_memblock_unref(tchunk.memblock);
+
+    return 0;
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
@@ -619,6 +522,9 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     if (!PA_SINK_IS_LINKED(u->sink->thread_info.state))
         return -1;
 
+    if (u->mode == MODE_IIR)
+        return sink_input_pop_iir(u, nbytes, chunk);
+
     /* FIXME: Please clean this up. I see more commented code lines
      * than uncommented code lines. I am sorry, but I am too dumb to
      * understand this. */
@@ -761,6 +667,8 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
             //invalidate the output q
             pa_memblockq_seek(u->input_q, - (int64_t) amount, PA_SEEK_RELATIVE, true);
             pa_log("Resetting filter");
+            if (u->mode == MODE_IIR)
+                pa_biquad_cascade_reset(u->cascade);
             //reset_filter(u); //this is the "proper" thing to do...
         }
     }
@@ -790,6 +698,11 @@ static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
 
+    if (u->mode == MODE_IIR) {
+        pa_sink_set_max_request_within_thread(u->sink, nbytes);
+        return;
+    }
+
     fs = pa_frame_size(&u->sink_input->sample_spec);
     pa_sink_set_max_request_within_thread(u->sink, PA_ROUND_UP(nbytes / fs, u->R) * fs);
 }
@@ -839,12 +752,16 @@ static void sink_input_attach_cb(pa_sink_input *i) {
     pa_sink_set_latency_range_within_thread(u->sink, i->sink->thread_info.min_latency, i->sink->thread_info.max_latency);
     pa_sink_set_fixed_latency_within_thread(u->sink, i->sink->thread_info.fixed_latency);
 
-    fs = pa_frame_size(&u->sink_input->sample_spec);
-    /* set buffer size to max request, no overlap copy */
-    max_request = PA_ROUND_UP(pa_sink_input_get_max_request(u->sink_input) / fs, u->R);
-    max_request = PA_MAX(max_request, u->window_size);
+    if (u->mode == MODE_IIR)
+        pa_sink_set_max_request_within_thread(u->sink, pa_sink_input_get_max_request(u->sink_input));
+    else {
+        fs = pa_frame_size(&u->sink_input->sample_spec);
+        /* set buffer size to max request, no overlap copy */
+        max_request = PA_ROUND_UP(pa_sink_input_get_max_request(u->sink_input) / fs, u->R);
+        max_request = PA_MAX(max_request, u->window_size);
 
-    pa_sink_set_max_request_within_thread(u->sink, max_request * fs);
+        pa_sink_set_max_request_within_thread(u->sink, max_request * fs);
+    }
 
     /* FIXME: Too small max_rewind:
      * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
@@ -1002,6 +919,7 @@ static const char* load_profile(struct userdata *u, size_t channel, char *name)
             u->Xs[channel][a_i] = profile[0];
             memcpy(u->Hs[channel][a_i], profile + 1, FILTER_SIZE(u) * sizeof(float));
             fix_filter(u->Hs[channel][a_i], u->fft_size);
+            design_iir(u, channel, a_i);
             pa_aupdate_write_end(u->a_H[channel]);
             pa_xfree(u->base_profiles[channel]);
             u->base_profiles[channel] = pa_xstrdup(name);
@@ -1042,6 +960,7 @@ static void load_state(struct userdata *u) {
                 H = state + c * CHANNEL_PROFILE_SIZE(u) + 1;
                 u->Xs[c][a_i] = state[c * CHANNEL_PROFILE_SIZE(u)];
                 memcpy(u->Hs[c][a_i], H, FILTER_SIZE(u) * sizeof(float));
+                design_iir(u, c, a_i);
                 pa_aupdate_write_end(u->a_H[c]);
             }
             unpack(((char *)value.data) + FILTER_STATE_SIZE(u) * sizeof(float), value.size - FILTER_STATE_SIZE(u) * sizeof(float), &names, &n_profs);
@@ -1091,7 +1010,7 @@ static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest) {
             char *new_description;
 
             master_description = pa_proplist_gets(dest->proplist, PA_PROP_DEVICE_DESCRIPTION);
-            new_description = pa_sprintf_malloc(_("FFT based equalizer on %s"),
+            new_description = pa_sprintf_malloc(u->mode == MODE_IIR ? _("IIR based equalizer on %s") : _("FFT based equalizer on %s"),
                                                 master_description ? master_description : dest->name);
             pa_sink_set_description(u->sink, new_description);
             pa_xfree(new_description);
@@ -1113,6 +1032,9 @@ int pa__init(pa_module*m) {
     float *H;
     unsigned a_i;
     bool use_volume_sharing = true;
+    enum equalizer_mode mode;
+    const char *mode_str;
+    uint32_t n_threads;
 
     pa_assert(m);
 
@@ -1145,9 +1067,27 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    mode_str = pa_modargs_get_value(ma, "mode", "fft");
+    if (pa_streq(mode_str, "fft"))
+        mode = MODE_FFT;
+    else if (pa_streq(mode_str, "iir"))
+        mode = MODE_IIR;
+    else {
+        pa_log("mode= expects fft or iir");
+        goto fail;
+    }
+
+    /* Leave a core for the rest of the system */
+    n_threads = PA_CLAMP(pa_ncpus(), 2U, MAX_THREADS + 1) - 1;
+    if (pa_modargs_get_value_u32(ma, "threads", &n_threads) < 0 || n_threads < 1) {
+        pa_log("threads= expects a positive number");
+        goto fail;
+    }
+
     u = pa_xnew0(struct userdata, 1);
     u->module = m;
     m->userdata = u;
+    u->mode = mode;
 
     u->channels = ss.channels;
     u->fft_size = pow(2, ceil(log(ss.rate) / log(2)));//probably unstable near corner cases of powers of 2
@@ -1163,28 +1103,39 @@ int pa__init(pa_module*m) {
     u->a_H = pa_xnew0(pa_aupdate *, u->channels);
     u->Xs = pa_xnew0(float *, u->channels);
     u->Hs = pa_xnew0(float **, u->channels);
+    u->Bs = pa_xnew0(struct biquad **, u->channels);
 
     for (c = 0; c < u->channels; ++c) {
         u->Xs[c] = pa_xnew0(float, 2);
         u->Hs[c] = pa_xnew0(float *, 2);
-        for (i = 0; i < 2; ++i)
+        u->Bs[c] = pa_xnew0(struct biquad *, 2);
+        for (i = 0; i < 2; ++i) {
             u->Hs[c][i] = alloc(FILTER_SIZE(u), sizeof(float));
+            u->Bs[c][i] = pa_xnew0(struct biquad, IIR_STAGES);
+        }
     }
 
-    u->W = alloc(u->window_size, sizeof(float));
-    u->work_buffer = alloc(u->fft_size, sizeof(float));
     u->input = pa_xnew0(float *, u->channels);
     u->overlap_accum = pa_xnew0(float *, u->channels);
     for (c = 0; c < u->channels; ++c) {
         u->a_H[c] = pa_aupdate_new();
         u->input[c] = NULL;
-        u->overlap_accum[c] = alloc(u->overlap_size, sizeof(float));
     }
-    u->output_window = alloc(FILTER_SIZE(u), sizeof(fftwf_complex));
-    u->forward_plan = fftwf_plan_dft_r2c_1d(u->fft_size, u->work_buffer, u->output_window, FFTW_ESTIMATE);
-    u->inverse_plan = fftwf_plan_dft_c2r_1d(u->fft_size, u->output_window, u->work_buffer, FFTW_ESTIMATE);
 
-    hanning_window(u->W, u->window_size);
+    if (u->mode == MODE_IIR) {
+        /* The filter is still kept in the frequency domain, but the FFT
+         * buffers are not needed */
+        u->Bs_applied = pa_xnew0(struct biquad *, u->channels);
+        for (c = 0; c < u->channels; ++c)
+            u->Bs_applied[c] = pa_xnew0(struct biquad, IIR_STAGES);
+        u->cascade = pa_biquad_cascade_new(u->channels, IIR_STAGES);
+    } else {
+        for (c = 0; c < u->channels; ++c)
+            u->overlap_accum[c] = alloc(u->overlap_size, sizeof(float));
+        u->stft = pa_eq_stft_new(u->channels, u->fft_size, u->window_size, n_threads,
+                                 m->core->realtime_scheduling ? m->core->realtime_priority : 0,
+                                 u->a_H, u->Xs, u->Hs);
+    }
     u->first_iteration = true;
 
     u->base_profiles = pa_xnew0(char *, u->channels);
@@ -1214,7 +1165,8 @@ int pa__init(pa_module*m) {
 
         master_description = pa_proplist_gets(master->proplist, PA_PROP_DEVICE_DESCRIPTION);
         pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION,
-                         _("FFT based equalizer on %s"), master_description ? master_description : master->name);
+                         u->mode == MODE_IIR ? _("IIR based equalizer on %s") : _("FFT based equalizer on %s"),
+                         master_description ? master_description : master->name);
         u->automatic_description = true;
     }
 
@@ -1302,6 +1254,7 @@ int pa__init(pa_module*m) {
             H[i] = 1.0 / sqrtf(2.0f);
 
         fix_filter(H, u->fft_size);
+        design_iir(u, c, a_i);
         pa_aupdate_write_end(u->a_H[c]);
     }
 
@@ -1375,9 +1328,16 @@ void pa__done(pa_module*m) {
     pa_memblockq_free(u->output_q);
     pa_memblockq_free(u->input_q);
 
-    fftwf_destroy_plan(u->inverse_plan);
-    fftwf_destroy_plan(u->forward_plan);
-    fftwf_free(u->output_window);
+    if (u->cascade)
+        pa_biquad_cascade_free(u->cascade);
+    if (u->Bs_applied) {
+        for (c = 0; c < u->channels; ++c)
+            pa_xfree(u->Bs_applied[c]);
+        pa_xfree(u->Bs_applied);
+    }
+
+    if (u->stft)
+        pa_eq_stft_free(u->stft);
     for (c = 0; c < u->channels; ++c) {
         pa_aupdate_free(u->a_H[c]);
         fftwf_free(u->overlap_accum[c]);
@@ -1386,16 +1346,18 @@ void pa__done(pa_module*m) {
     pa_xfree(u->a_H);
     pa_xfree(u->overlap_accum);
     pa_xfree(u->input);
-    fftwf_free(u->work_buffer);
-    fftwf_free(u->W);
     for (c = 0; c < u->channels; ++c) {
         pa_xfree(u->Xs[c]);
-        for (size_t i = 0; i < 2; ++i)
+        for (size_t i = 0; i < 2; ++i) {
             fftwf_free(u->Hs[c][i]);
+            pa_xfree(u->Bs[c][i]);
+        }
         fftwf_free(u->Hs[c]);
+        pa_xfree(u->Bs[c]);
     }
     pa_xfree(u->Xs);
     pa_xfree(u->Hs);
+    pa_xfree(u->Bs);
 
     pa_xfree(u);
 }
@@ -1880,12 +1842,14 @@ void equalizer_handle_seed_filter(DBusConnection *conn, DBusMessage *msg, void *
     u->Xs[r_channel][a_i] = preamp;
     interpolate(H, FILTER_SIZE(u), xs, ys, x_npoints);
     fix_filter(H, u->fft_size);
+    design_iir(u, r_channel, a_i);
     if (channel == u->channels) {
         for(size_t c = 1; c < u->channels; ++c) {
             unsigned b_i = pa_aupdate_write_begin(u->a_H[c]);
             float *H_p = u->Hs[c][b_i];
             u->Xs[c][b_i] = preamp;
             memcpy(H_p, H, FILTER_SIZE(u) * sizeof(float));
+            memcpy(u->Bs[c][b_i], u->Bs[r_channel][a_i], IIR_STAGES * sizeof(struct biquad));
             pa_aupdate_write_end(u->a_H[c]);
         }
     }
@@ -2031,11 +1995,13 @@ static void set_filter(struct userdata *u, size_t channel, double *H_, double pr
         H[i] = (float) H_[i];
     }
     fix_filter(H, u->fft_size);
+    design_iir(u, r_channel, a_i);
     if (channel == u->channels) {
         for(size_t c = 1; c < u->channels; ++c) {
             unsigned b_i = pa_aupdate_write_begin(u->a_H[c]);
             u->Xs[c][b_i] = u->Xs[r_channel][a_i];
             memcpy(u->Hs[c][b_i], u->Hs[r_channel][a_i], FILTER_SIZE(u) * sizeof(float));
+            memcpy(u->Bs[c][b_i], u->Bs[r_channel][a_i], IIR_STAGES * sizeof(struct biquad));
             pa_aupdate_write_end(u->a_H[c]);
         }
     }
@@ -33,10 +33,12 @@
 #include <pulsecore/sink.h>
 #include <pulsecore/module.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/filter-sink.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/log.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
+#include <pulsecore/strbuf.h>
 #include <pulsecore/ltdl-helper.h>
 
 #ifdef HAVE_DBUS
@@ -60,30 +62,56 @@ PA_MODULE_USAGE(
       "rate=<sample rate> "
       "channels=<number of channels> "
       "channel_map=<input channel map> "
-      "plugin=<ladspa plugin name> "
-      "label=<ladspa plugin label> "
-      "control=<comma separated list of input control values> "
-      "input_ladspaport_map=<comma separated list of input LADSPA port names> "
-      "output_ladspaport_map=<comma separated list of output LADSPA port names> "
+      "plugin=<ladspa plugin name, or a | separated list of plugins to chain> "
+      "label=<ladspa plugin label, | separated per plugin> "
+      "control=<comma separated list of input control values, | separated per plugin> "
+      "input_ladspaport_map=<comma separated list of input LADSPA port names, | separated per plugin> "
+      "output_ladspaport_map=<comma separated list of output LADSPA port names, | separated per plugin> "
       "autoloaded=<set if this module is being loaded automatically> "));
 
-#define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 #define DEFAULT_AUTOLOADED false
 
+/* The plugins are run on blocks of at most this many frames, so that the
+ * channel buffers stay in the cache while they go through the chain */
+#define BLOCK_FRAMES 256
+
 /* PLEASE NOTICE: The PortAudio ports and the LADSPA ports are two different concepts.
 They are not related and where possible the names of the LADSPA port variables contains "ladspa" to avoid confusion */
 
+struct plugin {
+    const LADSPA_Descriptor *descriptor;
+    lt_dlhandle dl;
+    LADSPA_Handle handle[PA_CHANNELS_MAX];
+    unsigned long max_ladspaport_count, input_count, output_count, n_handles;
+    unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
+
+    /* The channel buffers the audio ports are connected to. Plugins that
+     * can't work in place read from one and write to the other. */
+    unsigned in, out;
+
+    /* This plugin's part of the control values in userdata */
+    LADSPA_Data *control;
+    long unsigned n_control;
+};
+
 struct userdata {
     pa_module *module;
 
-    pa_sink *sink;
-    pa_sink_input *sink_input;
+    pa_filter_sink *filter;
 
-    const LADSPA_Descriptor *descriptor;
-    LADSPA_Handle handle[PA_CHANNELS_MAX];
-    unsigned long max_ladspaport_count, input_count, output_count, channels;
-    LADSPA_Data **input, **output;
-    size_t block_size;
+    /* The plugins, in the order the audio goes through them */
+    struct plugin *plugins;
+    unsigned n_plugins;
+    unsigned long channels;
+
+    /* Two sets of planar channel buffers of BLOCK_FRAMES each, shared by
+     * all plugins. The audio is deinterleaved into buffer[0] once, and
+     * the output of the chain is in buffer[out]. */
+    void *buffer_data;
+    LADSPA_Data *buffer[2][PA_CHANNELS_MAX];
+    unsigned out;
+
+    /* The control values of all plugins, in chain order */
     LADSPA_Data *control;
     long unsigned n_control;
 
@@ -91,8 +119,6 @@ struct userdata {
     about control out ports. We connect them all to this single buffer. */
     LADSPA_Data control_out;
 
-    pa_memblockq *memblockq;
-
     bool *use_default;
     pa_sample_spec ss;
 
@@ -100,9 +126,6 @@ struct userdata {
     pa_dbus_protocol *dbus_protocol;
     char *dbus_path;
 #endif
-
-    bool auto_desc;
-    bool autoloaded;
 };
 
 static const char* const valid_modargs[] = {
@@ -230,7 +253,7 @@ static void set_algorithm_parameters(DBusConnection *conn, DBusMessage *msg, DBu
         goto error;
     }
 
-    pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), LADSPA_SINK_MESSAGE_UPDATE_PARAMETERS, NULL, 0, NULL);
+    pa_asyncmsgq_send(u->filter->sink->asyncmsgq, PA_MSGOBJECT(u->filter->sink), LADSPA_SINK_MESSAGE_UPDATE_PARAMETERS, NULL, 0, NULL);
 
     pa_dbus_send_empty_reply(conn, msg);
 
@@ -312,8 +335,8 @@ static pa_dbus_interface_info ladspa_info = {
 static void dbus_init(struct userdata *u) {
     pa_assert_se(u);
 
-    u->dbus_protocol = pa_dbus_protocol_get(u->sink->core);
-    u->dbus_path = pa_sprintf_malloc("/org/pulseaudio/core1/sink%d", u->sink->index);
+    u->dbus_protocol = pa_dbus_protocol_get(u->filter->sink->core);
+    u->dbus_path = pa_sprintf_malloc("/org/pulseaudio/core1/sink%d", u->filter->sink->index);
 
     pa_dbus_protocol_add_interface(u->dbus_protocol, u->dbus_path, &ladspa_info, u);
 }
@@ -338,37 +361,17 @@ static void dbus_done(struct userdata *u) {
 
 /* Called from I/O thread context */
 static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
-    struct userdata *u = PA_SINK(o)->userdata;
+    pa_filter_sink *f = PA_SINK(o)->userdata;
+    struct userdata *u = f->userdata;
 
     switch (code) {
 
-    case PA_SINK_MESSAGE_GET_LATENCY:
-
-        /* The sink is _put() before the sink input is, so let's
-         * make sure we don't access it in that time. Also, the
-         * sink input is first shut down, the sink second. */
-        if (!PA_SINK_IS_LINKED(u->sink->thread_info.state) ||
-            !PA_SINK_INPUT_IS_LINKED(u->sink_input->thread_info.state)) {
-            *((int64_t*) data) = 0;
-            return 0;
-        }
-
-        *((int64_t*) data) =
-
-            /* Get the latency of the master sink */
-            pa_sink_get_latency_within_thread(u->sink_input->sink, true) +
-
-            /* Add the latency internal to our sink input on top */
-            pa_bytes_to_usec(pa_memblockq_get_length(u->sink_input->thread_info.render_memblockq), &u->sink_input->sink->sample_spec);
-
-        return 0;
-
     case LADSPA_SINK_MESSAGE_UPDATE_PARAMETERS:
 
         /* rewind the stream to throw away the previously rendered data */
 
         pa_log_debug("Requesting rewind due to parameter update.");
-        pa_sink_request_rewind(u->sink, -1);
+        pa_sink_request_rewind(f->sink, -1);
 
         /* change the sink parameters */
         connect_control_ports(u);
@@ -376,367 +379,85 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
         return 0;
     }
 
-    return pa_sink_process_msg(o, code, data, offset, chunk);
-}
-
-/* Called from main context */
-static int sink_set_state_in_main_thread_cb(pa_sink *s, pa_sink_state_t state, pa_suspend_cause_t suspend_cause) {
-    struct userdata *u;
-
-    pa_sink_assert_ref(s);
-    pa_assert_se(u = s->userdata);
-
-    if (!PA_SINK_IS_LINKED(state) ||
-            !PA_SINK_INPUT_IS_LINKED(u->sink_input->state))
-        return 0;
-
-    pa_sink_input_cork(u->sink_input, state == PA_SINK_SUSPENDED);
-    return 0;
-}
-
-/* Called from the IO thread. */
-static int sink_set_state_in_io_thread_cb(pa_sink *s, pa_sink_state_t new_state, pa_suspend_cause_t new_suspend_cause) {
-    struct userdata *u;
-
-    pa_assert(s);
-    pa_assert_se(u = s->userdata);
-
-    /* When set to running or idle for the first time, request a rewind
-     * of the master sink to make sure we are heard immediately */
-    if (PA_SINK_IS_OPENED(new_state) && s->thread_info.state == PA_SINK_INIT) {
-        pa_log_debug("Requesting rewind due to state change.");
-        pa_sink_input_request_rewind(u->sink_input, 0, false, true, true);
-    }
-
-    return 0;
-}
-
-/* Called from I/O thread context */
-static void sink_request_rewind_cb(pa_sink *s) {
-    struct userdata *u;
-
-    pa_sink_assert_ref(s);
-    pa_assert_se(u = s->userdata);
-
-    if (!PA_SINK_IS_LINKED(u->sink->thread_info.state) ||
-            !PA_SINK_INPUT_IS_LINKED(u->sink_input->thread_info.state))
-        return;
-
-    /* Just hand this one over to the master sink */
-    pa_sink_input_request_rewind(u->sink_input,
-                                 s->thread_info.rewind_nbytes +
-                                 pa_memblockq_get_length(u->memblockq), true, false, false);
-}
-
-/* Called from I/O thread context */
-static void sink_update_requested_latency_cb(pa_sink *s) {
-    struct userdata *u;
-
-    pa_sink_assert_ref(s);
-    pa_assert_se(u = s->userdata);
-
-    if (!PA_SINK_IS_LINKED(u->sink->thread_info.state) ||
-            !PA_SINK_INPUT_IS_LINKED(u->sink_input->thread_info.state))
-        return;
-
-    /* Just hand this one over to the master sink */
-    pa_sink_input_set_requested_latency_within_thread(
-        u->sink_input,
-        pa_sink_get_requested_latency_within_thread(s));
-}
-
-/* Called from main context */
-static void sink_set_mute_cb(pa_sink *s) {
-    struct userdata *u;
-
-    pa_sink_assert_ref(s);
-    pa_assert_se(u = s->userdata);
-
-    if (!PA_SINK_IS_LINKED(s->state) ||
-            !PA_SINK_INPUT_IS_LINKED(u->sink_input->state))
-        return;
-
-    pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
+    return pa_filter_sink_process_msg(o, code, data, offset, chunk);
 }
 
 /* Called from I/O thread context */
-static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
-    struct userdata *u;
-    float *src, *dst;
-    size_t fs;
-    unsigned n, h, c;
-    pa_memchunk tchunk;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert(chunk);
-    pa_assert_se(u = i->userdata);
-
-    if (!PA_SINK_IS_LINKED(u->sink->thread_info.state))
-        return -1;
-
-    /* Hmm, process any rewind request that might be queued up */
-    pa_sink_process_rewind(u->sink, 0);
-
-    while (pa_memblockq_peek(u->memblockq, &tchunk) < 0) {
-        pa_memchunk nchunk;
-
-        pa_sink_render(u->sink, nbytes, &nchunk);
-        pa_memblockq_push(u->memblockq, &nchunk);
-        pa_memblock_unref(nchunk.memblock);
-    }
-
-    tchunk.length = PA_MIN(nbytes, tchunk.length);
-    pa_assert(tchunk.length > 0);
-
-    fs = pa_frame_size(&i->sample_spec);
-    n = (unsigned) (PA_MIN(tchunk.length, u->block_size) / fs);
-
-    pa_assert(n > 0);
+static void process_block(struct userdata *u, const float *src, float *dst, unsigned n) {
+    unsigned i, h, c;
 
-    chunk->index = 0;
-    chunk->length = n*fs;
-    chunk->memblock = pa_memblock_new(i->sink->core->mempool, chunk->length);
+    for (c = 0; c < u->channels; c++)
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->buffer[0][c], sizeof(float), src + c, u->channels*sizeof(float), n);
 
-    pa_memblockq_drop(u->memblockq, chunk->length);
+    for (i = 0; i < u->n_plugins; i++) {
+        struct plugin *p = &u->plugins[i];
 
-    src = pa_memblock_acquire_chunk(&tchunk);
-    dst = pa_memblock_acquire(chunk->memblock);
+        for (h = 0; h < p->n_handles; h++)
+            p->descriptor->run(p->handle[h], n);
 
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        for (c = 0; c < u->input_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[c], sizeof(float), src+ h*u->max_ladspaport_count + c, u->channels*sizeof(float), n);
-        u->descriptor->run(u->handle[h], n);
-        for (c = 0; c < u->output_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + h*u->max_ladspaport_count + c, u->channels*sizeof(float), u->output[c], sizeof(float), n);
+        /* Channels without an output port are passed through */
+        if (p->in != p->out && p->output_count < p->max_ladspaport_count)
+            for (c = 0; c < u->channels; c++)
+                if (c % p->max_ladspaport_count >= p->output_count)
+                    memcpy(u->buffer[p->out][c], u->buffer[p->in][c], n * sizeof(float));
     }
 
-    pa_memblock_release(tchunk.memblock);
-    pa_memblock_release(chunk->memblock);
-
-    pa_memblock_unref(tchunk.memblock);
-
-    return 0;
+    for (c = 0; c < u->channels; c++)
+        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + c, u->channels*sizeof(float), u->buffer[u->out][c], sizeof(float), n);
 }
 
 /* Called from I/O thread context */
-static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
+static void filter_process_cb(pa_filter_sink *f, const void *src, void *dst, unsigned n) {
     struct userdata *u;
-    size_t amount = 0;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(u = i->userdata);
-
-    /* If the sink is not yet linked, there is nothing to rewind */
-    if (!PA_SINK_IS_LINKED(u->sink->thread_info.state))
-        return;
+    unsigned k, l;
 
-    if (u->sink->thread_info.rewind_nbytes > 0) {
-        size_t max_rewrite;
+    pa_assert_se(u = f->userdata);
 
-        max_rewrite = nbytes + pa_memblockq_get_length(u->memblockq);
-        amount = PA_MIN(u->sink->thread_info.rewind_nbytes, max_rewrite);
-        u->sink->thread_info.rewind_nbytes = 0;
-
-        if (amount > 0) {
-            unsigned c;
-
-            pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, true);
-
-            pa_log_debug("Resetting plugin");
-
-            /* Reset the plugin */
-            if (u->descriptor->deactivate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->deactivate(u->handle[c]);
-            if (u->descriptor->activate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->activate(u->handle[c]);
-        }
+    for (k = 0; k < n; k += l) {
+        l = PA_MIN(n - k, BLOCK_FRAMES);
+        process_block(u, (const float*) src + k*u->channels, (float*) dst + k*u->channels, l);
     }
-
-    pa_sink_process_rewind(u->sink, amount);
-    pa_memblockq_rewind(u->memblockq, nbytes);
 }
 
 /* Called from I/O thread context */
-static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
+static void filter_reset_cb(pa_filter_sink *f) {
     struct userdata *u;
+    unsigned p, c;
 
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(u = i->userdata);
+    pa_assert_se(u = f->userdata);
 
-    /* FIXME: Too small max_rewind:
-     * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
-    pa_memblockq_set_maxrewind(u->memblockq, nbytes);
-    pa_sink_set_max_rewind_within_thread(u->sink, nbytes);
-}
-
-/* Called from I/O thread context */
-static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes) {
-    struct userdata *u;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(u = i->userdata);
-
-    pa_sink_set_max_request_within_thread(u->sink, nbytes);
-}
-
-/* Called from I/O thread context */
-static void sink_input_update_sink_latency_range_cb(pa_sink_input *i) {
-    struct userdata *u;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(u = i->userdata);
+    pa_log_debug("Resetting plugins");
 
-    pa_sink_set_latency_range_within_thread(u->sink, i->sink->thread_info.min_latency, i->sink->thread_info.max_latency);
-}
+    /* Reset the plugins */
+    for (p = 0; p < u->n_plugins; p++) {
+        const LADSPA_Descriptor *d = u->plugins[p].descriptor;
 
-/* Called from I/O thread context */
-static void sink_input_update_sink_fixed_latency_cb(pa_sink_input *i) {
-    struct userdata *u;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(u = i->userdata);
-
-    pa_sink_set_fixed_latency_within_thread(u->sink, i->sink->thread_info.fixed_latency);
-}
-
-/* Called from I/O thread context */
-static void sink_input_detach_cb(pa_sink_input *i) {
-    struct userdata *u;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(u = i->userdata);
-
-    if (PA_SINK_IS_LINKED(u->sink->thread_info.state))
-        pa_sink_detach_within_thread(u->sink);
-
-    pa_sink_set_rtpoll(u->sink, NULL);
-}
-
-/* Called from I/O thread context */
-static void sink_input_attach_cb(pa_sink_input *i) {
-    struct userdata *u;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(u = i->userdata);
-
-    pa_sink_set_rtpoll(u->sink, i->sink->thread_info.rtpoll);
-    pa_sink_set_latency_range_within_thread(u->sink, i->sink->thread_info.min_latency, i->sink->thread_info.max_latency);
-    pa_sink_set_fixed_latency_within_thread(u->sink, i->sink->thread_info.fixed_latency);
-    pa_sink_set_max_request_within_thread(u->sink, pa_sink_input_get_max_request(i));
-
-    /* FIXME: Too small max_rewind:
-     * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
-    pa_sink_set_max_rewind_within_thread(u->sink, pa_sink_input_get_max_rewind(i));
-
-    if (PA_SINK_IS_LINKED(u->sink->thread_info.state))
-        pa_sink_attach_within_thread(u->sink);
-}
-
-/* Called from main context */
-static void sink_input_kill_cb(pa_sink_input *i) {
-    struct userdata *u;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(u = i->userdata);
-
-    /* The order here matters! We first kill the sink so that streams
-     * can properly be moved away while the sink input is still connected
-     * to the master. */
-    pa_sink_input_cork(u->sink_input, true);
-    pa_sink_unlink(u->sink);
-    pa_sink_input_unlink(u->sink_input);
-
-    pa_sink_input_unref(u->sink_input);
-    u->sink_input = NULL;
-
-    pa_sink_unref(u->sink);
-    u->sink = NULL;
-
-    pa_module_unload_request(u->module, true);
-}
-
-/* Called from main context */
-static bool sink_input_may_move_to_cb(pa_sink_input *i, pa_sink *dest) {
-    struct userdata *u;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(u = i->userdata);
-
-    if (u->autoloaded)
-        return false;
-
-    return u->sink != dest;
-}
-
-/* Called from main context */
-static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest) {
-    struct userdata *u;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(u = i->userdata);
-
-    if (dest) {
-        pa_sink_set_asyncmsgq(u->sink, dest->asyncmsgq);
-        pa_sink_update_flags(u->sink, PA_SINK_LATENCY|PA_SINK_DYNAMIC_LATENCY, dest->flags);
-    } else
-        pa_sink_set_asyncmsgq(u->sink, NULL);
-
-    if (u->auto_desc && dest) {
-        const char *z;
-        pa_proplist *pl;
-
-        pl = pa_proplist_new();
-        z = pa_proplist_gets(dest->proplist, PA_PROP_DEVICE_DESCRIPTION);
-        pa_proplist_setf(pl, PA_PROP_DEVICE_DESCRIPTION, "LADSPA Plugin %s on %s",
-                         pa_proplist_gets(u->sink->proplist, "device.ladspa.name"), z ? z : dest->name);
-
-        pa_sink_update_proplist(u->sink, PA_UPDATE_REPLACE, pl);
-        pa_proplist_free(pl);
+        if (d->deactivate)
+            for (c = 0; c < u->plugins[p].n_handles; c++)
+                d->deactivate(u->plugins[p].handle[c]);
+        if (d->activate)
+            for (c = 0; c < u->plugins[p].n_handles; c++)
+                d->activate(u->plugins[p].handle[c]);
     }
 }
 
-/* Called from main context */
-static void sink_input_mute_changed_cb(pa_sink_input *i) {
-    struct userdata *u;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(u = i->userdata);
-
-    pa_sink_mute_changed(u->sink, i->muted);
-}
-
-/* Called from main context */
-static void sink_input_suspend_cb(pa_sink_input *i, pa_sink_state_t old_state, pa_suspend_cause_t old_suspend_cause) {
-    struct userdata *u;
-
-    pa_sink_input_assert_ref(i);
-    pa_assert_se(u = i->userdata);
-
-    if (i->sink->state != PA_SINK_SUSPENDED || i->sink->suspend_cause == PA_SUSPEND_IDLE)
-        pa_sink_suspend(u->sink, false, PA_SUSPEND_UNAVAILABLE);
-    else
-        pa_sink_suspend(u->sink, true, PA_SUSPEND_UNAVAILABLE);
-}
-
-static int parse_control_parameters(struct userdata *u, const char *cdata, double *read_values, bool *use_default) {
+static int parse_control_parameters(struct plugin *pl, const char *cdata, double *read_values, bool *use_default) {
     unsigned long p = 0;
     const char *state = NULL;
     char *k;
 
     pa_assert(read_values);
     pa_assert(use_default);
-    pa_assert(u);
+    pa_assert(pl);
 
-    pa_log_debug("Trying to read %lu control values", u->n_control);
+    pa_log_debug("Trying to read %lu control values", pl->n_control);
 
-    if (!cdata || u->n_control == 0)
+    if (!cdata || pl->n_control == 0)
         return -1;
 
     pa_log_debug("cdata: '%s'", cdata);
 
-    while ((k = pa_split(cdata, ",", &state)) && p < u->n_control) {
+    while ((k = pa_split(cdata, ",", &state)) && p < pl->n_control) {
         double f;
 
         if (*k == 0) {
@@ -763,19 +484,19 @@ static int parse_control_parameters(struct userdata *u, const char *cdata, doubl
     /* The previous loop doesn't take the last control value into account
        if it is left empty, so we do it here. */
     if (*cdata == 0 || cdata[strlen(cdata) - 1] == ',') {
-        if (p < u->n_control)
+        if (p < pl->n_control)
             use_default[p] = true;
         p++;
     }
 
-    if (p > u->n_control || k) {
-        pa_log("Too many control values passed, %lu expected.", u->n_control);
+    if (p > pl->n_control || k) {
+        pa_log("Too many control values passed, %lu expected.", pl->n_control);
         pa_xfree(k);
         goto fail;
     }
 
-    if (p < u->n_control) {
-        pa_log("Not enough control values passed, %lu expected, %lu passed.", u->n_control, p);
+    if (p < pl->n_control) {
+        pa_log("Not enough control values passed, %lu expected, %lu passed.", pl->n_control, p);
         goto fail;
     }
 
@@ -786,34 +507,40 @@ fail:
 }
 
 static void connect_control_ports(struct userdata *u) {
-    unsigned long p = 0, h = 0, c;
+    unsigned long p = 0, h, c;
+    unsigned i;
     const LADSPA_Descriptor *d;
 
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
 
-    for (p = 0; p < d->PortCount; p++) {
-        if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
-            continue;
+    for (i = 0; i < u->n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
 
-        if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-            for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
-            continue;
-        }
+        pa_assert_se(d = pl->descriptor);
 
-        /* input control port */
+        for (p = 0, h = 0; p < d->PortCount; p++) {
+            if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]))
+                continue;
 
-        pa_log_debug("Binding %f to port %s", u->control[h], d->PortNames[p]);
+            if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
+                for (c = 0; c < pl->n_handles; c++)
+                    d->connect_port(pl->handle[c], p, &u->control_out);
+                continue;
+            }
 
-        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-            d->connect_port(u->handle[c], p, &u->control[h]);
+            /* input control port */
 
-        h++;
+            pa_log_debug("Binding %f to port %s", pl->control[h], d->PortNames[p]);
+
+            for (c = 0; c < pl->n_handles; c++)
+                d->connect_port(pl->handle[c], p, &pl->control[h]);
+
+            h++;
+        }
     }
 }
 
-static int validate_control_parameters(struct userdata *u, double *control_values, bool *use_default) {
+static int validate_control_parameters(struct userdata *u, struct plugin *pl, double *control_values, bool *use_default) {
     unsigned long p = 0, h = 0;
     const LADSPA_Descriptor *d;
     pa_sample_spec ss;
@@ -821,7 +548,8 @@ static int validate_control_parameters(struct userdata *u, double *control_value
     pa_assert(control_values);
     pa_assert(use_default);
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
+    pa_assert(pl);
+    pa_assert_se(d = pl->descriptor);
 
     ss = u->ss;
 
@@ -876,7 +604,7 @@ static int validate_control_parameters(struct userdata *u, double *control_value
     return 0;
 }
 
-static int write_control_parameters(struct userdata *u, double *control_values, bool *use_default) {
+static void write_plugin_control_parameters(struct userdata *u, struct plugin *pl, double *control_values, bool *use_default) {
     unsigned long p = 0, h = 0, c;
     const LADSPA_Descriptor *d;
     pa_sample_spec ss;
@@ -884,13 +612,11 @@ static int write_control_parameters(struct userdata *u, double *control_values,
     pa_assert(control_values);
     pa_assert(use_default);
     pa_assert(u);
-    pa_assert_se(d = u->descriptor);
+    pa_assert(pl);
+    pa_assert_se(d = pl->descriptor);
 
     ss = u->ss;
 
-    if (validate_control_parameters(u, control_values, use_default) < 0)
-        return -1;
-
     /* p iterates over all ports, h is the control port iterator */
 
     for (p = 0; p < d->PortCount; p++) {
@@ -900,8 +626,8 @@ static int write_control_parameters(struct userdata *u, double *control_values,
             continue;
 
         if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-            for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
+            for (c = 0; c < pl->n_handles; c++)
+                d->connect_port(pl->handle[c], p, &u->control_out);
             continue;
         }
 
@@ -920,48 +646,48 @@ static int write_control_parameters(struct userdata *u, double *control_values,
             switch (hint & LADSPA_HINT_DEFAULT_MASK) {
 
             case LADSPA_HINT_DEFAULT_MINIMUM:
-                u->control[h] = lower;
+                pl->control[h] = lower;
                 break;
 
             case LADSPA_HINT_DEFAULT_MAXIMUM:
-                u->control[h] = upper;
+                pl->control[h] = upper;
                 break;
 
             case LADSPA_HINT_DEFAULT_LOW:
                 if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
+                    pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
                 else
-                    u->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
+                    pl->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
                 break;
 
             case LADSPA_HINT_DEFAULT_MIDDLE:
                 if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
+                    pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
                 else
-                    u->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
+                    pl->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
                 break;
 
             case LADSPA_HINT_DEFAULT_HIGH:
                 if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                    u->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
+                    pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
                 else
-                    u->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
+                    pl->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
                 break;
 
             case LADSPA_HINT_DEFAULT_0:
-                u->control[h] = 0;
+                pl->control[h] = 0;
                 break;
 
             case LADSPA_HINT_DEFAULT_1:
-                u->control[h] = 1;
+                pl->control[h] = 1;
                 break;
 
             case LADSPA_HINT_DEFAULT_100:
-                u->control[h] = 100;
+                pl->control[h] = 100;
                 break;
 
             case LADSPA_HINT_DEFAULT_440:
-                u->control[h] = 440;
+                pl->control[h] = 440;
                 break;
 
             default:
@@ -970,15 +696,32 @@ static int write_control_parameters(struct userdata *u, double *control_values,
         }
         else {
             if (LADSPA_IS_HINT_INTEGER(hint)) {
-                u->control[h] = roundf(control_values[h]);
+                pl->control[h] = roundf(control_values[h]);
             }
             else {
-                u->control[h] = control_values[h];
+                pl->control[h] = control_values[h];
             }
         }
 
         h++;
     }
+}
+
+static int write_control_parameters(struct userdata *u, double *control_values, bool *use_default) {
+    unsigned long offset;
+    unsigned i;
+
+    pa_assert(control_values);
+    pa_assert(use_default);
+    pa_assert(u);
+
+    /* Nothing is written unless the values of all plugins are valid */
+    for (i = 0, offset = 0; i < u->n_plugins; offset += u->plugins[i].n_control, i++)
+        if (validate_control_parameters(u, &u->plugins[i], control_values + offset, use_default + offset) < 0)
+            return -1;
+
+    for (i = 0, offset = 0; i < u->n_plugins; offset += u->plugins[i].n_control, i++)
+        write_plugin_control_parameters(u, &u->plugins[i], control_values + offset, use_default + offset);
 
     /* set the use_default array to the user data */
     memcpy(u->use_default, use_default, u->n_control * sizeof(u->use_default[0]));
@@ -986,86 +729,72 @@ static int write_control_parameters(struct userdata *u, double *control_values,
     return 0;
 }
 
-int pa__init(pa_module*m) {
-    struct userdata *u;
-    pa_sample_spec ss;
-    pa_channel_map map;
-    pa_modargs *ma;
-    char *t;
-    const char *master_name;
-    pa_sink *master;
-    pa_sink_input_new_data sink_input_data;
-    pa_sink_new_data sink_data;
-    const char *plugin, *label, *input_ladspaport_map, *output_ladspaport_map;
-    LADSPA_Descriptor_Function descriptor_func;
-    unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
-    const char *e, *cdata;
-    const LADSPA_Descriptor *d;
-    unsigned long p, h, j, n_control, c;
-    pa_memchunk silence;
+/* Splits a module argument that has one entry per plugin. Returns the number
+ * of entries, or -1 if there are more than n_entries. */
+static int split_chain_arg(const char *arg, char **entries, unsigned n_entries) {
+    const char *state = NULL;
+    char *k;
+    unsigned n = 0;
 
-    pa_assert(m);
+    if (!arg)
+        return 0;
 
-    pa_assert_cc(sizeof(LADSPA_Data) == sizeof(float));
+    while ((k = pa_split(arg, "|", &state))) {
+        if (n == n_entries) {
+            pa_xfree(k);
+            return -1;
+        }
 
-    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
-        pa_log("Failed to parse module arguments.");
-        goto fail;
+        entries[n++] = k;
     }
 
-    master_name = pa_modargs_get_value(ma, "sink_master", NULL);
-    if (!master_name) {
-        master_name = pa_modargs_get_value(ma, "master", NULL);
-        if (master_name)
-            pa_log_warn("The 'master' module argument is deprecated and may be removed in the future, "
-                        "please use the 'sink_master' argument instead.");
-    }
+    /* pa_split() doesn't return the last entry if it is empty */
+    if (*arg == 0 || arg[strlen(arg) - 1] == '|') {
+        if (n == n_entries)
+            return -1;
 
-    master = pa_namereg_get(m->core, master_name, PA_NAMEREG_SINK);
-    if (!master) {
-        pa_log("Master sink not found.");
-        goto fail;
+        entries[n++] = pa_xstrdup("");
     }
 
-    ss = master->sample_spec;
-    ss.format = PA_SAMPLE_FLOAT32;
-    map = master->channel_map;
-    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
-        pa_log("Invalid sample format specification or channel map");
-        goto fail;
-    }
+    return (int) n;
+}
 
-    if (ss.format != PA_SAMPLE_FLOAT32) {
-        pa_log("LADSPA accepts float format only");
-        goto fail;
-    }
+static void free_chain_arg(char **entries, unsigned n_entries) {
+    unsigned i;
 
-    if (!(plugin = pa_modargs_get_value(ma, "plugin", NULL))) {
-        pa_log("Missing LADSPA plugin name");
-        goto fail;
-    }
+    if (!entries)
+        return;
 
-    if (!(label = pa_modargs_get_value(ma, "label", NULL))) {
-        pa_log("Missing LADSPA plugin label");
-        goto fail;
-    }
+    for (i = 0; i < n_entries; i++)
+        pa_xfree(entries[i]);
+    pa_xfree(entries);
+}
 
-    if (!(input_ladspaport_map = pa_modargs_get_value(ma, "input_ladspaport_map", NULL)))
-        pa_log_debug("Using default input ladspa port mapping");
+static void set_chain_property(pa_proplist *p, const char *key, pa_strbuf *buf) {
+    char *value;
 
-    if (!(output_ladspaport_map = pa_modargs_get_value(ma, "output_ladspaport_map", NULL)))
-        pa_log_debug("Using default output ladspa port mapping");
+    value = pa_strbuf_to_string_free(buf);
+    pa_proplist_sets(p, key, value);
+    pa_xfree(value);
+}
 
-    cdata = pa_modargs_get_value(ma, "control", NULL);
+static int load_plugin(struct userdata *u, struct plugin *pl, const char *plugin, const char *label,
+                       const char *input_ladspaport_map, const char *output_ladspaport_map) {
+    LADSPA_Descriptor_Function descriptor_func;
+    const LADSPA_Descriptor *d;
+    const char *e;
+    char *t;
+    unsigned long p, j, c;
 
-    u = pa_xnew0(struct userdata, 1);
-    u->module = m;
-    m->userdata = u;
-    u->max_ladspaport_count = 1; /*to avoid division by zero etc. in pa__done when failing before this value has been set*/
-    u->channels = 0;
-    u->input = NULL;
-    u->output = NULL;
-    u->ss = ss;
+    if (!plugin || !*plugin) {
+        pa_log("Missing LADSPA plugin name");
+        return -1;
+    }
+
+    if (!label || !*label) {
+        pa_log("Missing LADSPA plugin label for plugin %s", plugin);
+        return -1;
+    }
 
     if (!(e = getenv("LADSPA_PATH")))
         /* The LADSPA_PATH preprocessor macro isn't a string literal (i.e. it
@@ -1078,32 +807,32 @@ int pa__init(pa_module*m) {
     /* FIXME: This is not exactly thread safe */
     t = pa_xstrdup(lt_dlgetsearchpath());
     lt_dlsetsearchpath(e);
-    m->dl = lt_dlopenext(plugin);
+    pl->dl = lt_dlopenext(plugin);
     lt_dlsetsearchpath(t);
     pa_xfree(t);
 
-    if (!m->dl) {
+    if (!pl->dl) {
         pa_log("Failed to load LADSPA plugin: %s", lt_dlerror());
-        goto fail;
+        return -1;
     }
 
-    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(m->dl, NULL, "ladspa_descriptor"))) {
+    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(pl->dl, NULL, "ladspa_descriptor"))) {
         pa_log("LADSPA module lacks ladspa_descriptor() symbol.");
-        goto fail;
+        return -1;
     }
 
     for (j = 0;; j++) {
 
         if (!(d = descriptor_func(j))) {
             pa_log("Failed to find plugin label '%s' in plugin '%s'.", label, plugin);
-            goto fail;
+            return -1;
         }
 
         if (pa_streq(d->Label, label))
             break;
     }
 
-    u->descriptor = d;
+    pl->descriptor = d;
 
     pa_log_debug("Module: %s", plugin);
     pa_log_debug("Label: %s", d->Label);
@@ -1112,9 +841,6 @@ int pa__init(pa_module*m) {
     pa_log_debug("Maker: %s", d->Maker);
     pa_log_debug("Copyright: %s", d->Copyright);
 
-    n_control = 0;
-    u->channels = ss.channels;
-
     /*
     * Enumerate ladspa ports
     * Default mapping is in order given by the plugin
@@ -1123,33 +849,40 @@ int pa__init(pa_module*m) {
         if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p])) {
             if (LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
                 pa_log_debug("Port %lu is input: %s", p, d->PortNames[p]);
-                input_ladspaport[u->input_count] = p;
-                u->input_count++;
+                if (pl->input_count == PA_CHANNELS_MAX) {
+                    pa_log("Too many input ports in plugin %s", d->Label);
+                    return -1;
+                }
+                pl->input_ladspaport[pl->input_count] = p;
+                pl->input_count++;
             } else if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
                 pa_log_debug("Port %lu is output: %s", p, d->PortNames[p]);
-                output_ladspaport[u->output_count] = p;
-                u->output_count++;
+                if (pl->output_count == PA_CHANNELS_MAX) {
+                    pa_log("Too many output ports in plugin %s", d->Label);
+                    return -1;
+                }
+                pl->output_ladspaport[pl->output_count] = p;
+                pl->output_count++;
             }
         } else if (LADSPA_IS_PORT_CONTROL(d->PortDescriptors[p]) && LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
             pa_log_debug("Port %lu is control: %s", p, d->PortNames[p]);
-            n_control++;
+            pl->n_control++;
         } else
             pa_log_debug("Ignored port %s", d->PortNames[p]);
-        /* XXX: Has anyone ever seen an in-place plugin with non-equal number of input and output ports? */
-        /* Could be if the plugin is for up-mixing stereo to 5.1 channels */
-        /* Or if the plugin is down-mixing 5.1 to two channel stereo or binaural encoded signal */
-        if (u->input_count > u->max_ladspaport_count)
-            u->max_ladspaport_count = u->input_count;
-        else
-            u->max_ladspaport_count = u->output_count;
     }
 
-    if (u->channels % u->max_ladspaport_count) {
+    /* XXX: Has anyone ever seen an in-place plugin with non-equal number of input and output ports? */
+    /* Could be if the plugin is for up-mixing stereo to 5.1 channels */
+    /* Or if the plugin is down-mixing 5.1 to two channel stereo or binaural encoded signal */
+    pl->max_ladspaport_count = PA_MAX(PA_MAX(pl->input_count, pl->output_count), 1UL);
+
+    if (u->channels % pl->max_ladspaport_count) {
         pa_log("Cannot handle non-integral number of plugins required for given number of channels");
-        goto fail;
+        return -1;
     }
 
-    pa_log_debug("Will run %lu plugin instances", u->channels / u->max_ladspaport_count);
+    pl->n_handles = u->channels / pl->max_ladspaport_count;
+    pa_log_debug("Will run %lu plugin instances", pl->n_handles);
 
     /* Parse data for input ladspa port map */
     if (input_ladspaport_map) {
@@ -1157,20 +890,20 @@ int pa__init(pa_module*m) {
         char *pname;
         c = 0;
         while ((pname = pa_split(input_ladspaport_map, ",", &state))) {
-            if (c == u->input_count) {
+            if (c == pl->input_count) {
                 pa_log("Too many ports in input ladspa port map");
                 pa_xfree(pname);
-                goto fail;
+                return -1;
             }
 
             for (p = 0; p < d->PortCount; p++) {
                 if (pa_streq(d->PortNames[p], pname)) {
                     if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p]) && LADSPA_IS_PORT_INPUT(d->PortDescriptors[p])) {
-                        input_ladspaport[c] = p;
+                        pl->input_ladspaport[c] = p;
                     } else {
                         pa_log("Port %s is not an audio input ladspa port", pname);
                         pa_xfree(pname);
-                        goto fail;
+                        return -1;
                     }
                 }
             }
@@ -1185,19 +918,19 @@ int pa__init(pa_module*m) {
         char *pname;
         c = 0;
         while ((pname = pa_split(output_ladspaport_map, ",", &state))) {
-            if (c == u->output_count) {
+            if (c == pl->output_count) {
                 pa_log("Too many ports in output ladspa port map");
                 pa_xfree(pname);
-                goto fail;
+                return -1;
             }
             for (p = 0; p < d->PortCount; p++) {
                 if (pa_streq(d->PortNames[p], pname)) {
                     if (LADSPA_IS_PORT_AUDIO(d->PortDescriptors[p]) && LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-                        output_ladspaport[c] = p;
+                        pl->output_ladspaport[c] = p;
                     } else {
                         pa_log("Port %s is not an output ladspa port", pname);
                         pa_xfree(pname);
-                        goto fail;
+                        return -1;
                     }
                 }
             }
@@ -1206,36 +939,162 @@ int pa__init(pa_module*m) {
         }
     }
 
-    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
-
-    /* Create buffers */
-    if (LADSPA_IS_INPLACE_BROKEN(d->Properties)) {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->input_count);
-        for (c = 0; c < u->input_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->output_count);
-        for (c = 0; c < u->output_count; c++)
-            u->output[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-    } else {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->max_ladspaport_count);
-        for (c = 0; c < u->max_ladspaport_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = u->input;
+    return 0;
+}
+
+int pa__init(pa_module*m) {
+    struct userdata *u;
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_modargs *ma;
+    const char *master_name;
+    pa_sink *master;
+    pa_filter_sink_new_data data;
+    const char *plugin, *label, *input_ladspaport_map, *output_ladspaport_map;
+    char **plugins = NULL, **labels = NULL, **controls = NULL, **input_maps = NULL, **output_maps = NULL;
+    const char *e, *cdata;
+    const LADSPA_Descriptor *d;
+    unsigned long h, c, offset;
+    unsigned i, n_plugins = 0, n_buffers;
+    LADSPA_Data *buffer;
+    pa_strbuf *names, *labels_buf, *makers, *copyrights, *unique_ids;
+
+    pa_assert(m);
+
+    pa_assert_cc(sizeof(LADSPA_Data) == sizeof(float));
+
+    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
+        pa_log("Failed to parse module arguments.");
+        goto fail;
     }
-    /* Initialize plugin instances */
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        if (!(u->handle[h] = d->instantiate(d, ss.rate))) {
-            pa_log("Failed to instantiate plugin %s with label %s", plugin, d->Label);
+
+    master_name = pa_modargs_get_value(ma, "sink_master", NULL);
+    if (!master_name) {
+        master_name = pa_modargs_get_value(ma, "master", NULL);
+        if (master_name)
+            pa_log_warn("The 'master' module argument is deprecated and may be removed in the future, "
+                        "please use the 'sink_master' argument instead.");
+    }
+
+    master = pa_namereg_get(m->core, master_name, PA_NAMEREG_SINK);
+    if (!master) {
+        pa_log("Master sink not found.");
+        goto fail;
+    }
+
+    ss = master->sample_spec;
+    ss.format = PA_SAMPLE_FLOAT32;
+    map = master->channel_map;
+    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
+        pa_log("Invalid sample format specification or channel map");
+        goto fail;
+    }
+
+    if (ss.format != PA_SAMPLE_FLOAT32) {
+        pa_log("LADSPA accepts float format only");
+        goto fail;
+    }
+
+    if (!(plugin = pa_modargs_get_value(ma, "plugin", NULL))) {
+        pa_log("Missing LADSPA plugin name");
+        goto fail;
+    }
+
+    if (!(label = pa_modargs_get_value(ma, "label", NULL))) {
+        pa_log("Missing LADSPA plugin label");
+        goto fail;
+    }
+
+    if (!(input_ladspaport_map = pa_modargs_get_value(ma, "input_ladspaport_map", NULL)))
+        pa_log_debug("Using default input ladspa port mapping");
+
+    if (!(output_ladspaport_map = pa_modargs_get_value(ma, "output_ladspaport_map", NULL)))
+        pa_log_debug("Using default output ladspa port mapping");
+
+    cdata = pa_modargs_get_value(ma, "control", NULL);
+
+    /* Several plugins separated by | are run as a chain in this sink. The
+     * other plugin arguments then have one entry per plugin, too. */
+    n_plugins = 1;
+    for (e = plugin; *e; e++)
+        if (*e == '|')
+            n_plugins++;
+
+    plugins = pa_xnew0(char*, n_plugins);
+    labels = pa_xnew0(char*, n_plugins);
+    controls = pa_xnew0(char*, n_plugins);
+    input_maps = pa_xnew0(char*, n_plugins);
+    output_maps = pa_xnew0(char*, n_plugins);
+
+    split_chain_arg(plugin, plugins, n_plugins);
+
+    if (split_chain_arg(label, labels, n_plugins) != (int) n_plugins) {
+        pa_log("Expected %u LADSPA plugin labels", n_plugins);
+        goto fail;
+    }
+
+    if (split_chain_arg(cdata, controls, n_plugins) < 0 ||
+        split_chain_arg(input_ladspaport_map, input_maps, n_plugins) < 0 ||
+        split_chain_arg(output_ladspaport_map, output_maps, n_plugins) < 0) {
+        pa_log("Control values or ladspa port maps given for more than %u plugins", n_plugins);
+        goto fail;
+    }
+
+    u = pa_xnew0(struct userdata, 1);
+    u->module = m;
+    m->userdata = u;
+    u->channels = ss.channels;
+    u->ss = ss;
+
+    u->plugins = pa_xnew0(struct plugin, n_plugins);
+    u->n_plugins = n_plugins;
+
+    for (i = 0; i < n_plugins; i++)
+        if (load_plugin(u, &u->plugins[i], plugins[i], labels[i], input_maps[i], output_maps[i]) < 0)
             goto fail;
-        }
 
-        for (c = 0; c < u->input_count; c++)
-            d->connect_port(u->handle[h], input_ladspaport[c], u->input[c]);
-        for (c = 0; c < u->output_count; c++)
-            d->connect_port(u->handle[h], output_ladspaport[c], u->output[c]);
+    /* Plugins that can work in place use the same buffers for their input
+     * and output, the others write to the second set of buffers */
+    u->out = 0;
+    n_buffers = 1;
+    for (i = 0; i < n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
+
+        pl->in = u->out;
+        if (LADSPA_IS_INPLACE_BROKEN(pl->descriptor->Properties)) {
+            u->out = !u->out;
+            n_buffers = 2;
+        }
+        pl->out = u->out;
     }
 
-    u->n_control = n_control;
+    /* Create buffers, aligned for plugins that use SIMD */
+    u->buffer_data = pa_xmalloc0(n_buffers * u->channels * BLOCK_FRAMES * sizeof(LADSPA_Data) + 32);
+    buffer = (LADSPA_Data *) (((uintptr_t) u->buffer_data + 31) & ~(uintptr_t) 31);
+    for (i = 0; i < n_buffers; i++)
+        for (c = 0; c < u->channels; c++)
+            u->buffer[i][c] = buffer + (i * u->channels + c) * BLOCK_FRAMES;
+
+    /* Initialize plugin instances */
+    for (i = 0; i < n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
+
+        d = pl->descriptor;
+
+        for (h = 0; h < pl->n_handles; h++) {
+            if (!(pl->handle[h] = d->instantiate(d, ss.rate))) {
+                pa_log("Failed to instantiate plugin %s with label %s", plugins[i], d->Label);
+                goto fail;
+            }
+
+            for (c = 0; c < pl->input_count; c++)
+                d->connect_port(pl->handle[h], pl->input_ladspaport[c], u->buffer[pl->in][h * pl->max_ladspaport_count + c]);
+            for (c = 0; c < pl->output_count; c++)
+                d->connect_port(pl->handle[h], pl->output_ladspaport[c], u->buffer[pl->out][h * pl->max_ladspaport_count + c]);
+        }
+
+        u->n_control += pl->n_control;
+    }
 
     if (u->n_control > 0) {
         double *control_values;
@@ -1249,8 +1108,17 @@ int pa__init(pa_module*m) {
         u->control = pa_xnew(LADSPA_Data, (unsigned) u->n_control);
         u->use_default = pa_xnew(bool, (unsigned) u->n_control);
 
-        if ((parse_control_parameters(u, cdata, control_values, use_default) < 0) ||
-            (write_control_parameters(u, control_values, use_default) < 0)) {
+        for (i = 0, offset = 0; i < n_plugins; offset += u->plugins[i].n_control, i++) {
+            struct plugin *pl = &u->plugins[i];
+
+            pl->control = u->control + offset;
+
+            if (pl->n_control > 0 &&
+                parse_control_parameters(pl, controls[i], control_values + offset, use_default + offset) < 0)
+                break;
+        }
+
+        if (i < n_plugins || write_control_parameters(u, control_values, use_default) < 0) {
             pa_xfree(control_values);
             pa_xfree(use_default);
 
@@ -1263,129 +1131,104 @@ int pa__init(pa_module*m) {
         pa_xfree(use_default);
     }
 
-    if (d->activate)
-        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-            d->activate(u->handle[c]);
-
-    /* Create sink */
-    pa_sink_new_data_init(&sink_data);
-    sink_data.driver = __FILE__;
-    sink_data.module = m;
-    if (!(sink_data.name = pa_xstrdup(pa_modargs_get_value(ma, "sink_name", NULL))))
-        sink_data.name = pa_sprintf_malloc("%s.ladspa", master->name);
-    pa_sink_new_data_set_sample_spec(&sink_data, &ss);
-    pa_sink_new_data_set_channel_map(&sink_data, &map);
-    pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, master->name);
-    pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_CLASS, "filter");
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.module", plugin);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.label", d->Label);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.name", d->Name);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.maker", d->Maker);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.copyright", d->Copyright);
-    pa_proplist_setf(sink_data.proplist, "device.ladspa.unique_id", "%lu", (unsigned long) d->UniqueID);
-
-    if (pa_modargs_get_proplist(ma, "sink_properties", sink_data.proplist, PA_UPDATE_REPLACE) < 0) {
-        pa_log("Invalid properties");
-        pa_sink_new_data_done(&sink_data);
-        goto fail;
-    }
+    for (i = 0; i < n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
 
-    u->autoloaded = DEFAULT_AUTOLOADED;
-    if (pa_modargs_get_value_boolean(ma, "autoloaded", &u->autoloaded) < 0) {
-        pa_log("Failed to parse autoloaded value");
-        goto fail;
+        if (pl->descriptor->activate)
+            for (c = 0; c < pl->n_handles; c++)
+                pl->descriptor->activate(pl->handle[c]);
     }
 
-    if ((u->auto_desc = !pa_proplist_contains(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION))) {
-        const char *z;
-
-        z = pa_proplist_gets(master->proplist, PA_PROP_DEVICE_DESCRIPTION);
-        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "LADSPA Plugin %s on %s", d->Name, z ? z : master->name);
+    /* The properties list the plugins the same way as the module arguments */
+    names = pa_strbuf_new();
+    labels_buf = pa_strbuf_new();
+    makers = pa_strbuf_new();
+    copyrights = pa_strbuf_new();
+    unique_ids = pa_strbuf_new();
+
+    for (i = 0; i < n_plugins; i++) {
+        const char *sep = i > 0 ? "|" : "";
+
+        d = u->plugins[i].descriptor;
+        pa_strbuf_printf(names, "%s%s", sep, d->Name);
+        pa_strbuf_printf(labels_buf, "%s%s", sep, d->Label);
+        pa_strbuf_printf(makers, "%s%s", sep, d->Maker);
+        pa_strbuf_printf(copyrights, "%s%s", sep, d->Copyright);
+        pa_strbuf_printf(unique_ids, "%s%lu", sep, (unsigned long) d->UniqueID);
     }
 
-    u->sink = pa_sink_new(m->core, &sink_data,
-                          (master->flags & (PA_SINK_LATENCY|PA_SINK_DYNAMIC_LATENCY)) | PA_SINK_SHARE_VOLUME_WITH_MASTER);
-    pa_sink_new_data_done(&sink_data);
+    /* Create sink and sink input */
+    pa_filter_sink_new_data_init(&data, m, __FILE__, master);
+    data.description = "LADSPA Plugin";
+    data.name_property = "device.ladspa.name";
+    data.in_place = true;
+
+    if (!(data.sink_data.name = pa_xstrdup(pa_modargs_get_value(ma, "sink_name", NULL))))
+        data.sink_data.name = pa_sprintf_malloc("%s.ladspa", master->name);
+    pa_sink_new_data_set_sample_spec(&data.sink_data, &ss);
+    pa_sink_new_data_set_channel_map(&data.sink_data, &map);
+    pa_proplist_sets(data.sink_data.proplist, "device.ladspa.module", plugin);
+    set_chain_property(data.sink_data.proplist, "device.ladspa.label", labels_buf);
+    set_chain_property(data.sink_data.proplist, "device.ladspa.name", names);
+    set_chain_property(data.sink_data.proplist, "device.ladspa.maker", makers);
+    set_chain_property(data.sink_data.proplist, "device.ladspa.copyright", copyrights);
+    set_chain_property(data.sink_data.proplist, "device.ladspa.unique_id", unique_ids);
+
+    if (pa_modargs_get_proplist(ma, "sink_properties", data.sink_data.proplist, PA_UPDATE_REPLACE) < 0) {
+        pa_log("Invalid properties");
+        pa_filter_sink_new_data_done(&data);
+        goto fail;
+    }
 
-    if (!u->sink) {
-        pa_log("Failed to create sink.");
+    data.autoloaded = DEFAULT_AUTOLOADED;
+    if (pa_modargs_get_value_boolean(ma, "autoloaded", &data.autoloaded) < 0) {
+        pa_log("Failed to parse autoloaded value");
+        pa_filter_sink_new_data_done(&data);
         goto fail;
     }
 
-    u->sink->parent.process_msg = sink_process_msg_cb;
-    u->sink->set_state_in_main_thread = sink_set_state_in_main_thread_cb;
-    u->sink->set_state_in_io_thread = sink_set_state_in_io_thread_cb;
-    u->sink->update_requested_latency = sink_update_requested_latency_cb;
-    u->sink->request_rewind = sink_request_rewind_cb;
-    pa_sink_set_set_mute_callback(u->sink, sink_set_mute_cb);
-    u->sink->userdata = u;
-
-    pa_sink_set_asyncmsgq(u->sink, master->asyncmsgq);
-
-    /* Create sink input */
-    pa_sink_input_new_data_init(&sink_input_data);
-    sink_input_data.driver = __FILE__;
-    sink_input_data.module = m;
-    pa_sink_input_new_data_set_sink(&sink_input_data, master, false, true);
-    sink_input_data.origin_sink = u->sink;
-    pa_proplist_sets(sink_input_data.proplist, PA_PROP_MEDIA_NAME, "LADSPA Stream");
-    pa_proplist_sets(sink_input_data.proplist, PA_PROP_MEDIA_ROLE, "filter");
-
-    if (pa_modargs_get_proplist(ma, "sink_input_properties", sink_input_data.proplist, PA_UPDATE_REPLACE) < 0) {
+    pa_proplist_sets(data.sink_input_data.proplist, PA_PROP_MEDIA_NAME, "LADSPA Stream");
+
+    if (pa_modargs_get_proplist(ma, "sink_input_properties", data.sink_input_data.proplist, PA_UPDATE_REPLACE) < 0) {
         pa_log("Invalid properties");
-        pa_sink_input_new_data_done(&sink_input_data);
+        pa_filter_sink_new_data_done(&data);
         goto fail;
     }
 
-    pa_sink_input_new_data_set_sample_spec(&sink_input_data, &ss);
-    pa_sink_input_new_data_set_channel_map(&sink_input_data, &map);
-    sink_input_data.flags |= PA_SINK_INPUT_START_CORKED;
-
-    pa_sink_input_new(&u->sink_input, m->core, &sink_input_data);
-    pa_sink_input_new_data_done(&sink_input_data);
+    u->filter = pa_filter_sink_new(&data);
+    pa_filter_sink_new_data_done(&data);
 
-    if (!u->sink_input)
+    if (!u->filter)
         goto fail;
 
-    u->sink_input->pop = sink_input_pop_cb;
-    u->sink_input->process_rewind = sink_input_process_rewind_cb;
-    u->sink_input->update_max_rewind = sink_input_update_max_rewind_cb;
-    u->sink_input->update_max_request = sink_input_update_max_request_cb;
-    u->sink_input->update_sink_latency_range = sink_input_update_sink_latency_range_cb;
-    u->sink_input->update_sink_fixed_latency = sink_input_update_sink_fixed_latency_cb;
-    u->sink_input->kill = sink_input_kill_cb;
-    u->sink_input->attach = sink_input_attach_cb;
-    u->sink_input->detach = sink_input_detach_cb;
-    u->sink_input->may_move_to = sink_input_may_move_to_cb;
-    u->sink_input->moving = sink_input_moving_cb;
-    u->sink_input->mute_changed = sink_input_mute_changed_cb;
-    u->sink_input->suspend = sink_input_suspend_cb;
-    u->sink_input->userdata = u;
-
-    u->sink->input_to_master = u->sink_input;
-
-    pa_sink_input_get_silence(u->sink_input, &silence);
-    u->memblockq = pa_memblockq_new("module-ladspa-sink memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0, &ss, 1, 1, 0, &silence);
-    pa_memblock_unref(silence.memblock);
-
-    /* The order here is important. The input must be put first,
-     * otherwise streams might attach to the sink before the sink
-     * input is attached to the master. */
-    pa_sink_input_put(u->sink_input);
-    pa_sink_put(u->sink);
-    pa_sink_input_cork(u->sink_input, false);
+    u->filter->sink->parent.process_msg = sink_process_msg_cb;
+    u->filter->process = filter_process_cb;
+    u->filter->reset = filter_reset_cb;
+    u->filter->userdata = u;
+
+    pa_filter_sink_put(u->filter);
 
 #ifdef HAVE_DBUS
     dbus_init(u);
 #endif
 
     pa_modargs_free(ma);
+    free_chain_arg(plugins, n_plugins);
+    free_chain_arg(labels, n_plugins);
+    free_chain_arg(controls, n_plugins);
+    free_chain_arg(input_maps, n_plugins);
+    free_chain_arg(output_maps, n_plugins);
 
     return 0;
 
 fail:
     if (ma)
         pa_modargs_free(ma);
+    free_chain_arg(plugins, n_plugins);
+    free_chain_arg(labels, n_plugins);
+    free_chain_arg(controls, n_plugins);
+    free_chain_arg(input_maps, n_plugins);
+    free_chain_arg(output_maps, n_plugins);
 
     pa__done(m);
 
@@ -1398,68 +1241,42 @@ int pa__get_n_used(pa_module *m) {
     pa_assert(m);
     pa_assert_se(u = m->userdata);
 
-    return pa_sink_linked_by(u->sink);
+    return pa_sink_linked_by(u->filter->sink);
 }
 
 void pa__done(pa_module*m) {
     struct userdata *u;
-    unsigned c;
+    unsigned i, c;
 
     pa_assert(m);
 
     if (!(u = m->userdata))
         return;
 
-    /* See comments in sink_input_kill_cb() above regarding
-    * destruction order! */
-
 #ifdef HAVE_DBUS
     dbus_done(u);
 #endif
 
-    if (u->sink_input)
-        pa_sink_input_cork(u->sink_input, true);
-
-    if (u->sink)
-        pa_sink_unlink(u->sink);
-
-    if (u->sink_input) {
-        pa_sink_input_unlink(u->sink_input);
-        pa_sink_input_unref(u->sink_input);
-    }
+    if (u->filter)
+        pa_filter_sink_free(u->filter);
 
-    if (u->sink)
-        pa_sink_unref(u->sink);
+    for (i = 0; i < u->n_plugins; i++) {
+        struct plugin *pl = &u->plugins[i];
 
-    for (c = 0; c < (u->channels / u->max_ladspaport_count); c++) {
-        if (u->handle[c]) {
-            if (u->descriptor->deactivate)
-                u->descriptor->deactivate(u->handle[c]);
-            u->descriptor->cleanup(u->handle[c]);
+        for (c = 0; c < pl->n_handles; c++) {
+            if (pl->handle[c]) {
+                if (pl->descriptor->deactivate)
+                    pl->descriptor->deactivate(pl->handle[c]);
+                pl->descriptor->cleanup(pl->handle[c]);
+            }
         }
-    }
 
-    if (u->output == u->input) {
-        if (u->input != NULL) {
-            for (c = 0; c < u->max_ladspaport_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
-        }
-    } else {
-        if (u->input != NULL) {
-            for (c = 0; c < u->input_count; c++)
-                pa_xfree(u->input[c]);
-            pa_xfree(u->input);
-        }
-        if (u->output != NULL) {
-            for (c = 0; c < u->output_count; c++)
-                pa_xfree(u->output[c]);
-            pa_xfree(u->output);
-        }
+        if (pl->dl)
+            lt_dlclose(pl->dl);
     }
 
-    if (u->memblockq)
-        pa_memblockq_free(u->memblockq);
+    pa_xfree(u->plugins);
+    pa_xfree(u->buffer_data);
 
     pa_xfree(u->control);
     pa_xfree(u->use_default);
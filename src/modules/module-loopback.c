@@ -32,6 +32,7 @@
 #include <pulsecore/namereg.h>
 #include <pulsecore/log.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/drift-controller.h>
 
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
@@ -43,7 +44,7 @@ PA_MODULE_LOAD_ONCE(false);
 PA_MODULE_USAGE(
         "source=<source to connect to> "
         "sink=<sink to connect to> "
-        "adjust_time=<how often to readjust rates in s> "
+        "adjust_time=<how often to readjust rates in s, fractions allowed> "
         "latency_msec=<latency in ms> "
         "max_latency_msec=<maximum latency in ms> "
         "fast_adjust_threshold_msec=<threshold for fast adjust in ms> "
@@ -63,7 +64,11 @@ PA_MODULE_USAGE(
 
 #define MIN_DEVICE_LATENCY (2.5*PA_USEC_PER_MSEC)
 
-#define DEFAULT_ADJUST_TIME_USEC (10*PA_USEC_PER_SEC)
+#define DEFAULT_ADJUST_TIME_USEC (500*PA_USEC_PER_MSEC)
+#define MIN_ADJUST_TIME_USEC (100*PA_USEC_PER_MSEC)
+
+/* Maximum deviation of the sink input rate from the source output rate */
+#define MAX_RATE_DEVIATION 0.01
 
 typedef struct loopback_msg loopback_msg;
 
@@ -82,6 +87,7 @@ struct userdata {
     pa_rtpoll_item *rtpoll_item_read, *rtpoll_item_write;
 
     pa_time_event *time_event;
+    pa_drift_controller *drift_controller;
 
     /* Variables used to calculate the average time between
      * subsequent calls of adjust_rates() */
@@ -234,27 +240,6 @@ static void teardown(struct userdata *u) {
     }
 }
 
-/* rate controller, called from main context
- * - maximum deviation from base rate is less than 1%
- * - can create audible artifacts by changing the rate too quickly
- * - exhibits hunting with USB or Bluetooth sources
- */
-static uint32_t rate_controller(
-                uint32_t base_rate,
-                pa_usec_t adjust_time,
-                int32_t latency_difference_usec) {
-
-    uint32_t new_rate;
-    double min_cycles;
-
-    /* Calculate best rate to correct the current latency offset, limit at
-     * slightly below 1% difference from base_rate */
-    min_cycles = (double)abs(latency_difference_usec) / adjust_time / 0.01 + 1;
-    new_rate = base_rate * (1.0 + (double)latency_difference_usec / min_cycles / adjust_time);
-
-    return new_rate;
-}
-
 /* Called from main thread.
  * It has been a matter of discussion how to correctly calculate the minimum
  * latency that module-loopback can deliver with a given source and sink.
@@ -316,10 +301,10 @@ static void update_minimum_latency(struct userdata *u, pa_sink *sink, bool print
 /* Called from main context */
 static void adjust_rates(struct userdata *u) {
     size_t buffer;
-    uint32_t old_rate, base_rate, new_rate, run_hours;
-    int32_t latency_difference;
+    uint32_t base_rate, new_rate, run_hours;
+    int64_t latency_difference;
     pa_usec_t current_buffer_latency, snapshot_delay;
-    int64_t current_source_sink_latency, current_latency, latency_at_optimum_rate;
+    int64_t current_source_sink_latency, current_latency;
     pa_usec_t final_latency, now, time_passed;
 
     pa_assert(u);
@@ -369,7 +354,6 @@ static void adjust_rates(struct userdata *u) {
     u->adjust_time_stamp = now;
 
     /* Rates and latencies */
-    old_rate = u->sink_input->sample_spec.rate;
     base_rate = u->source_output->sample_spec.rate;
 
     buffer = u->latency_snapshot.loopback_memblockq_length;
@@ -385,11 +369,8 @@ static void adjust_rates(struct userdata *u) {
     /* Current latency */
     current_latency = current_source_sink_latency + current_buffer_latency;
 
-    /* Latency at base rate */
-    latency_at_optimum_rate = current_source_sink_latency + current_buffer_latency * old_rate / base_rate;
-
     final_latency = PA_MAX(u->latency, u->minimum_latency);
-    latency_difference = (int32_t)(latency_at_optimum_rate - final_latency);
+    latency_difference = current_latency - (int64_t) final_latency;
 
     pa_log_debug("Loopback overall latency is %0.2f ms + %0.2f ms + %0.2f ms = %0.2f ms",
                 (double) u->latency_snapshot.sink_latency / PA_USEC_PER_MSEC,
@@ -397,27 +378,32 @@ static void adjust_rates(struct userdata *u) {
                 (double) u->latency_snapshot.source_latency / PA_USEC_PER_MSEC,
                 (double) current_latency / PA_USEC_PER_MSEC);
 
-    pa_log_debug("Loopback latency at base rate is %0.2f ms", (double)latency_at_optimum_rate / PA_USEC_PER_MSEC);
-
     /* Drop or insert samples if fast_adjust_threshold_msec was specified and the latency difference is too large. */
-    if (u->fast_adjust_threshold > 0 && abs(latency_difference) > u->fast_adjust_threshold) {
+    if (u->fast_adjust_threshold > 0 && (pa_usec_t) llabs(latency_difference) > u->fast_adjust_threshold) {
         pa_log_debug ("Latency difference larger than %lu msec, skipping or inserting samples.", u->fast_adjust_threshold / PA_USEC_PER_MSEC);
 
         pa_asyncmsgq_send(u->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_FAST_ADJUST, NULL, current_source_sink_latency, NULL);
 
+        /* The latency jumped, but the clocks still drift the same way */
+        pa_drift_controller_reset(u->drift_controller, false);
+
         /* Skip real adjust time calculation on next iteration. */
         u->source_sink_changed = true;
         return;
     }
 
-    /* Calculate new rate */
-    new_rate = rate_controller(base_rate, u->real_adjust_time, latency_difference);
+    /* Calculate new rate. The drift controller filters out the jitter of
+     * the latency snapshots and converges to the clock drift between the
+     * source and the sink, so that the latency settles at its target
+     * without the rate hunting around the base rate. */
+    new_rate = pa_drift_controller_update(u->drift_controller, now, latency_difference, base_rate);
 
     u->source_sink_changed = false;
 
     /* Set rate */
     pa_sink_input_set_rate(u->sink_input, new_rate);
-    pa_log_debug("[%s] Updated sampling rate to %lu Hz.", u->sink_input->sink->name, (unsigned long) new_rate);
+    pa_log_debug("[%s] Updated sampling rate to %lu Hz, estimated drift is %0.1f ppm.", u->sink_input->sink->name,
+                 (unsigned long) new_rate, pa_drift_controller_get_drift(u->drift_controller) * 1e6);
 }
 
 /* Called from main context */
@@ -745,6 +731,7 @@ static void source_output_moving_cb(pa_source_output *o, pa_source *dest) {
     u->underrun_counter = 0;
 
     u->source_sink_changed = true;
+    pa_drift_controller_reset(u->drift_controller, true);
 
     /* Send a mesage to the output thread that the source has changed.
      * If the sink is invalid here during a profile switching situation
@@ -1142,6 +1129,7 @@ static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest) {
     u->underrun_counter = 0;
 
     u->source_sink_changed = true;
+    pa_drift_controller_reset(u->drift_controller, true);
 
     u->output_thread_info.pop_called = false;
     u->output_thread_info.first_pop_done = false;
@@ -1312,7 +1300,7 @@ int pa__init(pa_module *m) {
     bool rate_set = false;
     bool channels_set = false;
     pa_memchunk silence;
-    uint32_t adjust_time_sec;
+    double adjust_time_sec;
     const char *n;
     bool remix = true;
 
@@ -1423,18 +1411,16 @@ int pa__init(pa_module *m) {
     u->adjust_counter = 0;
     u->fast_adjust_threshold = fast_adjust_threshold * PA_USEC_PER_MSEC;
 
-    adjust_time_sec = DEFAULT_ADJUST_TIME_USEC / PA_USEC_PER_SEC;
-    if (pa_modargs_get_value_u32(ma, "adjust_time", &adjust_time_sec) < 0) {
+    adjust_time_sec = (double) DEFAULT_ADJUST_TIME_USEC / PA_USEC_PER_SEC;
+    if (pa_modargs_get_value_double(ma, "adjust_time", &adjust_time_sec) < 0 || adjust_time_sec < 0 ||
+        (adjust_time_sec > 0 && adjust_time_sec * PA_USEC_PER_SEC < MIN_ADJUST_TIME_USEC)) {
         pa_log("Failed to parse adjust_time value");
         goto fail;
     }
 
-    if (adjust_time_sec != DEFAULT_ADJUST_TIME_USEC / PA_USEC_PER_SEC)
-        u->adjust_time = adjust_time_sec * PA_USEC_PER_SEC;
-    else
-        u->adjust_time = DEFAULT_ADJUST_TIME_USEC;
-
+    u->adjust_time = (pa_usec_t) (adjust_time_sec * PA_USEC_PER_SEC);
     u->real_adjust_time = u->adjust_time;
+    u->drift_controller = pa_drift_controller_new(u->adjust_time > 0 ? u->adjust_time : DEFAULT_ADJUST_TIME_USEC, MAX_RATE_DEVIATION);
 
     pa_source_output_new_data_init(&source_output_data);
     source_output_data.driver = __FILE__;
@@ -1648,5 +1634,8 @@ void pa__done(pa_module*m) {
     if (u->asyncmsgq)
         pa_asyncmsgq_unref(u->asyncmsgq);
 
+    if (u->drift_controller)
+        pa_drift_controller_free(u->drift_controller);
+
     pa_xfree(u);
 }
@@ -21,7 +21,12 @@
 #include <config.h>
 #endif
 
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
 #include <pulse/context.h>
+#include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
 #include <pulse/stream.h>
@@ -30,16 +35,21 @@
 #include <pulse/error.h>
 
 #include <pulsecore/core.h>
+#include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/i18n.h>
 #include <pulsecore/sink.h>
+#include <pulsecore/module.h>
 #include <pulsecore/modargs.h>
+#include <pulsecore/parseaddr.h>
+#include <pulsecore/arpa-inet.h>
 #include <pulsecore/log.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/poll.h>
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/proplist-util.h>
+#include <pulsecore/time-smoother.h>
 
 PA_MODULE_AUTHOR("Alexander Couzens");
 PA_MODULE_DESCRIPTION("Create a network sink which connects via a stream to a remote PulseAudio server");
@@ -54,17 +64,59 @@ PA_MODULE_USAGE(
         "channels=<number of channels> "
         "rate=<sample rate> "
         "channel_map=<channel map> "
-        "cookie=<cookie file path>"
+        "cookie=<cookie file path> "
+        "adaptive_latency=<tune the buffer to the network instead of the requested latency?> "
+        "encoding=<pcm or opus> "
+        "bitrate=<bit rate of Opus streams in bit/s>"
         );
 
 #define MAX_LATENCY_USEC (200 * PA_USEC_PER_MSEC)
 #define TUNNEL_THREAD_FAILED_MAINLOOP 1
 
+/* With encoding=opus the audio is not sent through the native protocol,
+ * which has no compressed sample formats. Instead module-rtp-send sends
+ * the sink's monitor as an Opus RTP stream to the server. The server has
+ * to run a receiver for it, which is set up there like any other
+ * module-rtp-recv, listening for the announcements on its own address:
+ *
+ *     load-module module-rtp-recv sap_address=<address of the server>
+ *
+ * The tunnel does not load modules on the server. It only looks for such
+ * a receiver, to warn if there is none and to report its latency. This is
+ * the latency of a receiver that does not set latency_msec. */
+#define RTP_RECEIVER_DEFAULT_LATENCY_MSEC 500
+
+/* In adaptive mode the stream's tlength is the sum of a fixed base, which
+ * covers the scheduling of both daemons, the round trip time plus four times
+ * its mean deviation (as TCP estimates its retransmission timeout), and a
+ * safety margin which grows on every underrun and decays slowly while the
+ * stream runs without one. */
+#define ADAPTIVE_BASE_LATENCY_USEC (25 * PA_USEC_PER_MSEC)
+#define ADAPTIVE_INITIAL_SAFETY_USEC (25 * PA_USEC_PER_MSEC)
+#define ADAPTIVE_UNDERRUN_SAFETY_USEC (10 * PA_USEC_PER_MSEC)
+#define ADAPTIVE_MAX_SAFETY_USEC (150 * PA_USEC_PER_MSEC)
+#define ADAPTIVE_SAFETY_DECAY_USEC (2 * PA_USEC_PER_MSEC)
+#define ADAPTIVE_DECAY_AFTER_USEC (10 * PA_USEC_PER_SEC)
+#define ADAPTIVE_TIMING_INTERVAL_USEC (250 * PA_USEC_PER_MSEC)
+#define ADAPTIVE_ADJUST_INTERVAL_USEC (PA_USEC_PER_SEC)
+
+enum {
+    SINK_MESSAGE_UPDATE_LATENCY_PROPERTIES = PA_SINK_MESSAGE_MAX,
+};
+
+struct latency_report {
+    pa_usec_t latency;
+    pa_usec_t target;
+    pa_usec_t rtt;
+    unsigned underruns;
+};
+
 static void stream_state_cb(pa_stream *stream, void *userdata);
 static void stream_changed_buffer_attr_cb(pa_stream *stream, void *userdata);
 static void stream_set_buffer_attr_cb(pa_stream *stream, int success, void *userdata);
 static void context_state_cb(pa_context *c, void *userdata);
 static void sink_update_requested_latency_cb(pa_sink *s);
+static void render_event_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata);
 
 struct userdata {
     pa_module *module;
@@ -85,6 +137,30 @@ struct userdata {
     char *cookie_file;
     char *remote_server;
     char *remote_sink_name;
+
+    /* Only used in adaptive mode, from the IO thread */
+    bool adaptive_latency;
+    pa_smoother *smoother;
+    uint64_t counter;
+    pa_time_event *timing_event;
+    bool have_timing;
+    pa_usec_t rtt;
+    pa_usec_t rtt_var;
+    pa_usec_t safety;
+    pa_usec_t last_underrun;
+    pa_usec_t last_adjust;
+    unsigned underruns;
+    struct latency_report last_report;
+
+    /* Only used with encoding=opus */
+    bool encoded;
+    char *rtp_destination;
+    uint32_t rtp_sender_index;          /* main thread */
+    bool have_rtp_receiver;             /* IO thread */
+    pa_usec_t rtp_receiver_latency;     /* IO thread */
+    pa_time_event *render_event;        /* IO thread */
+    pa_usec_t render_timestamp;         /* IO thread */
+    pa_usec_t block_usec;               /* IO thread */
 };
 
 static const char* const valid_modargs[] = {
@@ -97,6 +173,9 @@ static const char* const valid_modargs[] = {
     "rate",
     "channel_map",
     "cookie",
+    "adaptive_latency",
+    "encoding",
+    "bitrate",
    /* "reconnect", reconnect if server comes back again - unimplemented */
     NULL,
 };
@@ -118,6 +197,13 @@ static void cork_stream(struct userdata *u, bool cork) {
 
     if ((operation = pa_stream_cork(u->stream, cork, NULL, NULL)))
         pa_operation_unref(operation);
+
+    if (u->smoother) {
+        if (cork)
+            pa_smoother_pause(u->smoother, pa_rtclock_now());
+        else
+            pa_smoother_resume(u->smoother, pa_rtclock_now(), true);
+    }
 }
 
 static void reset_bufferattr(pa_buffer_attr *bufferattr) {
@@ -164,6 +250,9 @@ static void thread_func(void *userdata) {
         goto fail;
     }
 
+    if (u->encoded)
+        u->render_event = u->thread_mainloop_api->time_new(u->thread_mainloop_api, NULL, render_event_cb, u);
+
     pa_context_set_state_callback(u->context, context_state_cb, u);
     if (pa_context_connect(u->context,
                            u->remote_server,
@@ -215,7 +304,8 @@ static void thread_func(void *userdata) {
                 if (ret != 0) {
                     pa_log_error("Could not write data into the stream ... ret = %i", ret);
                     u->thread_mainloop_api->quit(u->thread_mainloop_api, TUNNEL_THREAD_FAILED_MAINLOOP);
-                }
+                } else
+                    u->counter += memchunk.length;
 
             }
         }
@@ -225,6 +315,16 @@ fail:
     pa_asyncmsgq_wait_for(u->thread_mq->inq, PA_MESSAGE_SHUTDOWN);
 
 finish:
+    if (u->render_event) {
+        u->thread_mainloop_api->time_free(u->render_event);
+        u->render_event = NULL;
+    }
+
+    if (u->timing_event) {
+        u->thread_mainloop_api->time_free(u->timing_event);
+        u->timing_event = NULL;
+    }
+
     if (u->stream) {
         pa_stream_disconnect(u->stream);
         pa_stream_unref(u->stream);
@@ -240,6 +340,172 @@ finish:
     pa_log_debug("Thread shutting down");
 }
 
+static pa_usec_t usec_diff(pa_usec_t a, pa_usec_t b) {
+    return a > b ? a - b : b - a;
+}
+
+static pa_usec_t adaptive_target_latency(struct userdata *u) {
+    pa_usec_t target;
+
+    target = ADAPTIVE_BASE_LATENCY_USEC + u->rtt + 4 * u->rtt_var + u->safety;
+
+    return PA_MIN(target, MAX_LATENCY_USEC);
+}
+
+static void adaptive_fill_bufferattr(struct userdata *u, pa_buffer_attr *bufferattr) {
+    pa_usec_t target;
+
+    target = adaptive_target_latency(u);
+
+    reset_bufferattr(bufferattr);
+    bufferattr->tlength = (uint32_t) pa_usec_to_bytes(target, &u->sink->sample_spec);
+    bufferattr->minreq = (uint32_t) pa_usec_to_bytes(target / 4, &u->sink->sample_spec);
+}
+
+/* Called from the IO thread. If grow is false, the buffer attributes are only
+ * changed if the target moved by more than 10%, because every change costs a
+ * round trip and resets the server's latency calculations. */
+static void adaptive_update_bufferattr(struct userdata *u, bool grow) {
+    pa_buffer_attr bufferattr;
+    uint32_t tlength;
+    pa_operation *operation;
+
+    pa_assert(u);
+
+    if (!u->stream || pa_stream_get_state(u->stream) != PA_STREAM_READY)
+        return;
+
+    adaptive_fill_bufferattr(u, &bufferattr);
+    tlength = pa_stream_get_buffer_attr(u->stream)->tlength;
+
+    if (bufferattr.tlength == tlength)
+        return;
+
+    if (!(grow && bufferattr.tlength > tlength) && usec_diff(bufferattr.tlength, tlength) < tlength / 10)
+        return;
+
+    pa_log_debug("Changing tlength to %0.2f ms (RTT %0.2f ms, deviation %0.2f ms, safety margin %0.2f ms)",
+                 (double) pa_bytes_to_usec(bufferattr.tlength, &u->sink->sample_spec) / PA_USEC_PER_MSEC,
+                 (double) u->rtt / PA_USEC_PER_MSEC,
+                 (double) u->rtt_var / PA_USEC_PER_MSEC,
+                 (double) u->safety / PA_USEC_PER_MSEC);
+
+    if ((operation = pa_stream_set_buffer_attr(u->stream, &bufferattr, stream_set_buffer_attr_cb, u)))
+        pa_operation_unref(operation);
+}
+
+/* Called from the IO thread. Hands the measured latency to the main thread,
+ * which publishes it in the sink properties. */
+static void adaptive_report_latency(struct userdata *u, pa_usec_t now) {
+    struct latency_report r;
+    pa_usec_t written, played;
+
+    written = pa_bytes_to_usec(u->counter, &u->sink->sample_spec);
+    played = pa_smoother_get(u->smoother, now);
+
+    r.latency = written > played ? written - played : 0;
+    r.target = pa_bytes_to_usec(pa_stream_get_buffer_attr(u->stream)->tlength, &u->sink->sample_spec);
+    r.rtt = u->rtt;
+    r.underruns = u->underruns;
+
+    /* Don't flood clients with property change events for measurement
+     * jitter */
+    if (r.target == u->last_report.target &&
+        r.underruns == u->last_report.underruns &&
+        usec_diff(r.latency, u->last_report.latency) < PA_USEC_PER_MSEC &&
+        usec_diff(r.rtt, u->last_report.rtt) < PA_USEC_PER_MSEC)
+        return;
+
+    u->last_report = r;
+    pa_asyncmsgq_post(u->thread_mq->outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_LATENCY_PROPERTIES,
+                      pa_xmemdup(&r, sizeof(r)), 0, NULL, pa_xfree);
+}
+
+/* Called whenever new timing info arrived from the server */
+static void stream_latency_update_cb(pa_stream *stream, void *userdata) {
+    struct userdata *u = userdata;
+    const pa_timing_info *ti;
+    pa_usec_t now, rtt, remote_latency, y;
+    int negative;
+
+    pa_assert(u);
+
+    if (!(ti = pa_stream_get_timing_info(stream)))
+        return;
+
+    now = pa_rtclock_now();
+
+    /* Unless the clocks of both hosts are synchronized, transport_usec is
+     * estimated as half the round trip of the timing request */
+    rtt = 2 * ti->transport_usec;
+
+    if (!u->have_timing) {
+        u->rtt = rtt;
+        u->rtt_var = rtt / 2;
+    } else {
+        u->rtt_var = (3 * u->rtt_var + usec_diff(rtt, u->rtt)) / 4;
+        u->rtt = (7 * u->rtt + rtt) / 8;
+    }
+
+    if (pa_stream_get_latency(stream, &remote_latency, &negative) >= 0) {
+        y = pa_bytes_to_usec(u->counter, &u->sink->sample_spec);
+
+        if (negative)
+            y += remote_latency;
+        else if (y > remote_latency)
+            y -= remote_latency;
+        else
+            y = 0;
+
+        pa_smoother_put(u->smoother, now, y);
+        u->have_timing = true;
+    }
+
+    if (now - u->last_adjust < ADAPTIVE_ADJUST_INTERVAL_USEC)
+        return;
+
+    u->last_adjust = now;
+
+    if (u->safety > 0 && now - u->last_underrun >= ADAPTIVE_DECAY_AFTER_USEC)
+        u->safety -= PA_MIN(u->safety, ADAPTIVE_SAFETY_DECAY_USEC);
+
+    adaptive_update_bufferattr(u, false);
+
+    if (u->have_timing)
+        adaptive_report_latency(u, now);
+}
+
+static void stream_underflow_cb(pa_stream *stream, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(u);
+
+    u->underruns++;
+    u->last_underrun = pa_rtclock_now();
+    u->safety = PA_MIN(u->safety + ADAPTIVE_UNDERRUN_SAFETY_USEC, ADAPTIVE_MAX_SAFETY_USEC);
+
+    pa_log_debug("Remote underrun, safety margin is now %0.2f ms", (double) u->safety / PA_USEC_PER_MSEC);
+
+    adaptive_update_bufferattr(u, true);
+}
+
+/* The automatic timing updates of libpulse become rare after the stream has
+ * been running for a while, so request them ourselves to keep the round trip
+ * estimate fresh. */
+static void timing_event_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    struct userdata *u = userdata;
+    pa_operation *operation;
+    struct timeval tv;
+
+    pa_assert(u);
+
+    if (u->stream && pa_stream_get_state(u->stream) == PA_STREAM_READY && pa_stream_is_corked(u->stream) == 0)
+        if ((operation = pa_stream_update_timing_info(u->stream, NULL, NULL)))
+            pa_operation_unref(operation);
+
+    a->time_restart(e, pa_timeval_rtstore(&tv, pa_rtclock_now() + ADAPTIVE_TIMING_INTERVAL_USEC, true));
+}
+
 static void stream_state_cb(pa_stream *stream, void *userdata) {
     struct userdata *u = userdata;
 
@@ -258,6 +524,18 @@ static void stream_state_cb(pa_stream *stream, void *userdata) {
             if (PA_SINK_IS_OPENED(u->sink->thread_info.state))
                 cork_stream(u, false);
 
+            if (u->adaptive_latency) {
+                struct timeval tv;
+
+                if (!u->timing_event)
+                    u->timing_event = u->thread_mainloop_api->time_new(u->thread_mainloop_api,
+                                                                       pa_timeval_rtstore(&tv, pa_rtclock_now() + ADAPTIVE_TIMING_INTERVAL_USEC, true),
+                                                                       timing_event_cb, u);
+
+                stream_changed_buffer_attr_cb(stream, userdata);
+                break;
+            }
+
             /* Only call our requested_latency_cb when requested_latency
              * changed between PA_STREAM_CREATING -> PA_STREAM_READY, because
              * we don't want to override the initial tlength set by the server
@@ -287,10 +565,91 @@ static void stream_set_buffer_attr_cb(pa_stream *stream, int success, void *user
     stream_changed_buffer_attr_cb(stream, userdata);
 }
 
+/* Called from the IO thread with encoding=opus. Nobody reads what the sink
+ * renders but module-rtp-send through the monitor source, so render in
+ * real time like module-null-sink does. */
+static void render_event_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    struct userdata *u = userdata;
+    struct timeval tv;
+    pa_usec_t now;
+
+    pa_assert(u);
+
+    now = pa_rtclock_now();
+
+    if (u->render_timestamp + u->block_usec < now)
+        u->render_timestamp = now;
+
+    while (u->render_timestamp < now + u->block_usec) {
+        pa_memchunk chunk;
+
+        pa_sink_render(u->sink, u->sink->thread_info.max_request, &chunk);
+        pa_memblock_unref(chunk.memblock);
+
+        u->render_timestamp += pa_bytes_to_usec(chunk.length, &u->sink->sample_spec);
+    }
+
+    a->time_restart(e, pa_timeval_rtstore(&tv, u->render_timestamp, true));
+}
+
+/* Looks for a module-rtp-recv on the server that listens for the
+ * announcements of our sender, and takes its latency */
+static void rtp_receiver_info_cb(pa_context *c, const pa_module_info *i, int eol, void *userdata) {
+    struct userdata *u = userdata;
+    pa_modargs *ma;
+
+    pa_assert(u);
+
+    if (eol < 0) {
+        pa_log_warn("Failed to list the modules of the server: %s", pa_strerror(pa_context_errno(c)));
+        return;
+    }
+
+    if (eol) {
+        if (!u->have_rtp_receiver)
+            pa_log_warn("No module-rtp-recv on the server listens on %s. Load it there with "
+                        "\"load-module module-rtp-recv sap_address=%s\", built with Opus support.",
+                        u->rtp_destination, u->rtp_destination);
+        return;
+    }
+
+    if (u->have_rtp_receiver || !pa_streq(i->name, "module-rtp-recv"))
+        return;
+
+    if (!(ma = pa_modargs_new(i->argument, NULL)))
+        return;
+
+    if (pa_safe_streq(pa_modargs_get_value(ma, "sap_address", NULL), u->rtp_destination)) {
+        uint32_t latency_msec = RTP_RECEIVER_DEFAULT_LATENCY_MSEC;
+
+        pa_modargs_get_value_u32(ma, "latency_msec", &latency_msec);
+
+        pa_log_info("Playing through module-rtp-recv #%u on the server, with %u ms latency.", i->index, latency_msec);
+        u->have_rtp_receiver = true;
+        u->rtp_receiver_latency = latency_msec * PA_USEC_PER_MSEC;
+    }
+
+    pa_modargs_free(ma);
+}
+
 static void context_state_cb(pa_context *c, void *userdata) {
     struct userdata *u = userdata;
     pa_assert(u);
 
+    /* With encoding=opus the audio goes through RTP, so there is no stream
+     * to create. Just check that the server runs a receiver. */
+    if (u->encoded && pa_context_get_state(c) == PA_CONTEXT_READY) {
+        pa_operation *operation;
+
+        pa_log_debug("Connection successful. Looking for the RTP receiver.");
+
+        u->have_rtp_receiver = false;
+        if ((operation = pa_context_get_module_info_list(c, rtp_receiver_info_cb, u)))
+            pa_operation_unref(operation);
+
+        return;
+    }
+
     switch (pa_context_get_state(c)) {
         case PA_CONTEXT_UNCONNECTED:
         case PA_CONTEXT_CONNECTING:
@@ -301,6 +660,7 @@ static void context_state_cb(pa_context *c, void *userdata) {
             pa_proplist *proplist;
             pa_buffer_attr bufferattr;
             pa_usec_t requested_latency;
+            pa_stream_flags_t flags;
             char *username = pa_get_user_name_malloc();
             char *hostname = pa_get_host_name_malloc();
             /* TODO: old tunnel put here the remote sink_name into stream name e.g. 'Null Output for lynxis@lazus' */
@@ -333,12 +693,24 @@ static void context_state_cb(pa_context *c, void *userdata) {
             reset_bufferattr(&bufferattr);
             bufferattr.tlength = pa_usec_to_bytes(requested_latency, &u->sink->sample_spec);
 
+            flags = PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_DONT_MOVE | PA_STREAM_START_CORKED | PA_STREAM_AUTO_TIMING_UPDATE;
+
+            if (u->adaptive_latency) {
+                /* tlength is the end-to-end latency we aim for, so let the
+                 * server configure the remote sink from it */
+                adaptive_fill_bufferattr(u, &bufferattr);
+                flags |= PA_STREAM_ADJUST_LATENCY;
+
+                pa_stream_set_latency_update_callback(u->stream, stream_latency_update_cb, userdata);
+                pa_stream_set_underflow_callback(u->stream, stream_underflow_cb, userdata);
+            }
+
             pa_stream_set_state_callback(u->stream, stream_state_cb, userdata);
             pa_stream_set_buffer_attr_callback(u->stream, stream_changed_buffer_attr_cb, userdata);
             if (pa_stream_connect_playback(u->stream,
                                            u->remote_sink_name,
                                            &bufferattr,
-                                           PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_DONT_MOVE | PA_STREAM_START_CORKED | PA_STREAM_AUTO_TIMING_UPDATE,
+                                           flags,
                                            NULL,
                                            NULL) < 0) {
                 pa_log_error("Could not connect stream.");
@@ -370,6 +742,10 @@ static void sink_update_requested_latency_cb(pa_sink *s) {
     pa_sink_assert_ref(s);
     pa_assert_se(u = s->userdata);
 
+    /* In adaptive mode tlength follows the network, not the clients */
+    if (u->adaptive_latency)
+        return;
+
     block_usec = pa_sink_get_requested_latency_within_thread(s);
     if (block_usec == (pa_usec_t) -1)
         block_usec = s->thread_info.max_latency;
@@ -377,6 +753,11 @@ static void sink_update_requested_latency_cb(pa_sink *s) {
     nbytes = pa_usec_to_bytes(block_usec, &s->sample_spec);
     pa_sink_set_max_request_within_thread(s, nbytes);
 
+    if (u->encoded) {
+        u->block_usec = block_usec;
+        return;
+    }
+
     if (u->stream) {
         switch (pa_stream_get_state(u->stream)) {
             case PA_STREAM_READY:
@@ -411,6 +792,16 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
                 return 0;
             }
 
+            /* What was rendered ahead, plus the jitter buffer of the
+             * receiver */
+            if (u->encoded) {
+                pa_usec_t now = pa_rtclock_now();
+
+                *((int64_t*) data) = (int64_t) (u->render_timestamp > now ? u->render_timestamp - now : 0) +
+                                     (int64_t) u->rtp_receiver_latency;
+                return 0;
+            }
+
             if (!u->stream) {
                 *((int64_t*) data) = 0;
                 return 0;
@@ -421,6 +812,16 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
                 return 0;
             }
 
+            if (u->have_timing) {
+                pa_usec_t yl, yr;
+
+                yl = pa_bytes_to_usec(u->counter, &u->sink->sample_spec);
+                yr = pa_smoother_get(u->smoother, pa_rtclock_now());
+
+                *((int64_t*) data) = (int64_t) yl - (int64_t) yr;
+                return 0;
+            }
+
             if (pa_stream_get_latency(u->stream, &remote_latency, &negative) < 0) {
                 *((int64_t*) data) = 0;
                 return 0;
@@ -429,6 +830,25 @@ static int sink_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t of
             *((int64_t*) data) = remote_latency;
             return 0;
         }
+
+        case SINK_MESSAGE_UPDATE_LATENCY_PROPERTIES: {
+            /* Called from the main thread */
+            struct latency_report *r = data;
+            pa_proplist *proplist;
+
+            if (!PA_SINK_IS_LINKED(u->sink->state))
+                return 0;
+
+            proplist = pa_proplist_new();
+            pa_proplist_setf(proplist, "tunnel.latency_usec", "%llu", (unsigned long long) r->latency);
+            pa_proplist_setf(proplist, "tunnel.target_latency_usec", "%llu", (unsigned long long) r->target);
+            pa_proplist_setf(proplist, "tunnel.rtt_usec", "%llu", (unsigned long long) r->rtt);
+            pa_proplist_setf(proplist, "tunnel.underruns", "%u", r->underruns);
+            pa_sink_update_proplist(u->sink, PA_UPDATE_REPLACE, proplist);
+            pa_proplist_free(proplist);
+
+            return 0;
+        }
     }
     return pa_sink_process_msg(o, code, data, offset, chunk);
 }
@@ -445,6 +865,18 @@ static int sink_set_state_in_io_thread_cb(pa_sink *s, pa_sink_state_t new_state,
     if (new_state == s->thread_info.state)
         return 0;
 
+    if (u->encoded) {
+        struct timeval tv;
+
+        if (PA_SINK_IS_OPENED(new_state) && !PA_SINK_IS_OPENED(s->thread_info.state)) {
+            u->render_timestamp = pa_rtclock_now();
+            u->thread_mainloop_api->time_restart(u->render_event, pa_timeval_rtstore(&tv, u->render_timestamp, true));
+        } else if (!PA_SINK_IS_OPENED(new_state))
+            u->thread_mainloop_api->time_restart(u->render_event, NULL);
+
+        return 0;
+    }
+
     if (!u->stream || pa_stream_get_state(u->stream) != PA_STREAM_READY)
         return 0;
 
@@ -467,6 +899,70 @@ static int sink_set_state_in_io_thread_cb(pa_sink *s, pa_sink_state_t new_state,
     return 0;
 }
 
+/* Resolves the host of the server address to the IP address that the RTP
+ * packets are sent to. Returns NULL if it is not a TCP address. */
+static char *resolve_rtp_destination(const char *server) {
+    pa_parsed_address a;
+    struct addrinfo hints, *res = NULL;
+    char ip[INET6_ADDRSTRLEN], *r = NULL;
+    int e;
+
+    if (pa_parse_address(server, &a) < 0)
+        return NULL;
+
+    if (a.type != PA_PARSED_ADDRESS_TCP4 && a.type != PA_PARSED_ADDRESS_TCP6 && a.type != PA_PARSED_ADDRESS_TCP_AUTO) {
+        pa_log("encoding=opus needs the server to be given as a TCP address.");
+        goto finish;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = a.type == PA_PARSED_ADDRESS_TCP4 ? AF_INET : (a.type == PA_PARSED_ADDRESS_TCP6 ? AF_INET6 : AF_UNSPEC);
+    hints.ai_socktype = SOCK_DGRAM;
+
+    if ((e = getaddrinfo(a.path_or_host, NULL, &hints, &res)) != 0) {
+        pa_log("Failed to resolve %s: %s", a.path_or_host, gai_strerror(e));
+        goto finish;
+    }
+
+    if (res->ai_family == AF_INET)
+        r = pa_xstrdup(inet_ntop(AF_INET, &((struct sockaddr_in*) res->ai_addr)->sin_addr, ip, sizeof(ip)));
+#ifdef HAVE_IPV6
+    else if (res->ai_family == AF_INET6)
+        r = pa_xstrdup(inet_ntop(AF_INET6, &((struct sockaddr_in6*) res->ai_addr)->sin6_addr, ip, sizeof(ip)));
+#endif
+
+    freeaddrinfo(res);
+
+finish:
+    pa_xfree(a.path_or_host);
+    return r;
+}
+
+/* Called from main context with encoding=opus. Loads module-rtp-send to
+ * send the monitor of the sink to the server. */
+static int load_rtp_sender(struct userdata *u, uint32_t bitrate) {
+    pa_module *sender;
+    char *source, *args;
+    int r;
+
+    source = pa_escape(u->sink->monitor_source->name, "\"");
+    args = pa_sprintf_malloc("source=\"%s\" destination_ip=%s source_ip=%s encoding=opus bitrate=%u",
+                             source, u->rtp_destination, strchr(u->rtp_destination, ':') ? "::" : "0.0.0.0", bitrate);
+    pa_xfree(source);
+
+    r = pa_module_load(&sender, u->module->core, "module-rtp-send", args);
+    pa_xfree(args);
+
+    if (r < 0) {
+        pa_log("Failed to load module-rtp-send.");
+        return -1;
+    }
+
+    u->rtp_sender_index = sender->index;
+
+    return 0;
+}
+
 int pa__init(pa_module *m) {
     struct userdata *u = NULL;
     pa_modargs *ma = NULL;
@@ -476,6 +972,9 @@ int pa__init(pa_module *m) {
     const char *remote_server = NULL;
     const char *sink_name = NULL;
     char *default_sink_name = NULL;
+    bool adaptive_latency = false;
+    const char *encoding;
+    uint32_t bitrate = 0;
 
     pa_assert(m);
 
@@ -497,9 +996,26 @@ int pa__init(pa_module *m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "adaptive_latency", &adaptive_latency) < 0) {
+        pa_log("Failed to parse adaptive_latency argument.");
+        goto fail;
+    }
+
+    encoding = pa_modargs_get_value(ma, "encoding", "pcm");
+    if (!pa_streq(encoding, "pcm") && !pa_streq(encoding, "opus")) {
+        pa_log("Unsupported encoding '%s'.", encoding);
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "bitrate", &bitrate) < 0) {
+        pa_log("Failed to parse bitrate argument.");
+        goto fail;
+    }
+
     u = pa_xnew0(struct userdata, 1);
     u->module = m;
     m->userdata = u;
+    u->rtp_sender_index = PA_INVALID_INDEX;
     u->remote_server = pa_xstrdup(remote_server);
     u->thread_mainloop = pa_mainloop_new();
     if (u->thread_mainloop == NULL) {
@@ -510,6 +1026,32 @@ int pa__init(pa_module *m) {
     u->cookie_file = pa_xstrdup(pa_modargs_get_value(ma, "cookie", NULL));
     u->remote_sink_name = pa_xstrdup(pa_modargs_get_value(ma, "sink", NULL));
 
+    if (pa_streq(encoding, "opus")) {
+        if (!(u->rtp_destination = resolve_rtp_destination(remote_server)))
+            goto fail;
+
+        if (u->remote_sink_name)
+            pa_log_warn("sink= is not used with encoding=opus. The receiver on the server picks the sink.");
+
+        u->encoded = true;
+        u->block_usec = MAX_LATENCY_USEC;
+        u->rtp_receiver_latency = RTP_RECEIVER_DEFAULT_LATENCY_MSEC * PA_USEC_PER_MSEC;
+
+        if (adaptive_latency)
+            pa_log_warn("adaptive_latency= is not used with encoding=opus. The receiver on the server sets the latency.");
+    } else if (adaptive_latency) {
+        u->adaptive_latency = true;
+        u->safety = ADAPTIVE_INITIAL_SAFETY_USEC;
+        u->smoother = pa_smoother_new(
+                PA_USEC_PER_SEC,
+                PA_USEC_PER_SEC*2,
+                true,
+                true,
+                10,
+                pa_rtclock_now(),
+                true);
+    }
+
     u->thread_mq = pa_xnew0(pa_thread_mq, 1);
 
     if (pa_thread_mq_init_thread_mainloop(u->thread_mq, m->core->mainloop, u->thread_mainloop_api) < 0) {
@@ -563,6 +1105,9 @@ int pa__init(pa_module *m) {
     u->sink->update_requested_latency = sink_update_requested_latency_cb;
     pa_sink_set_latency_range(u->sink, 0, MAX_LATENCY_USEC);
 
+    if (u->encoded)
+        pa_sink_set_max_request(u->sink, pa_usec_to_bytes(u->block_usec, &u->sink->sample_spec));
+
     /* set thread message queue */
     pa_sink_set_asyncmsgq(u->sink, u->thread_mq->inq);
     pa_sink_set_rtpoll(u->sink, u->rtpoll);
@@ -573,6 +1118,10 @@ int pa__init(pa_module *m) {
     }
 
     pa_sink_put(u->sink);
+
+    if (u->encoded && load_rtp_sender(u, bitrate) < 0)
+        goto fail;
+
     pa_modargs_free(ma);
     pa_xfree(default_sink_name);
 
@@ -598,6 +1147,9 @@ void pa__done(pa_module *m) {
     if (!(u = m->userdata))
         return;
 
+    if (u->rtp_sender_index != PA_INVALID_INDEX)
+        pa_module_unload_request_by_index(m->core, u->rtp_sender_index, true);
+
     if (u->sink)
         pa_sink_unlink(u->sink);
 
@@ -623,11 +1175,16 @@ void pa__done(pa_module *m) {
     if (u->remote_server)
         pa_xfree(u->remote_server);
 
+    pa_xfree(u->rtp_destination);
+
     if (u->sink)
         pa_sink_unref(u->sink);
 
     if (u->rtpoll)
         pa_rtpoll_free(u->rtpoll);
 
+    if (u->smoother)
+        pa_smoother_free(u->smoother);
+
     pa_xfree(u);
 }
@@ -40,6 +40,7 @@ PA_MODULE_USAGE(
         "protocol=<transport protocol> "
         "encryption=<encryption type> "
         "codec=<audio codec> "
+        "compress=<compress ALAC frames, default: false> "
         "format=<sample format> "
         "rate=<sample rate> "
         "channels=<number of channels> "
@@ -55,6 +56,7 @@ static const char* const valid_modargs[] = {
     "protocol",
     "encryption",
     "codec",
+    "compress",
     "format",
     "rate",
     "channels",
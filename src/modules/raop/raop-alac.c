@@ -0,0 +1,517 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/macro.h>
+
+#include "raop-alac.h"
+
+/* The frames we send are made of a single channel pair element. Its two
+ * channels are decorrelated, run through the adaptive linear predictor of
+ * ALAC and the residual is written with ALAC's adaptive Rice code. The
+ * receiver runs the same predictor and adapts it the same way, so the
+ * encoder has to mirror the decoder exactly. The parameters must match
+ * PA_RAOP_ALAC_FMTP_PARAMETERS. */
+
+#define ELEMENT_CPE 1
+#define ELEMENT_END 7
+
+/* 16 bit samples, one more bit for the side channel */
+#define CHANNEL_BITS 17
+
+#define PREDICTOR_ORDER 4
+#define PREDICTOR_SHIFT 9
+#define PREDICTOR_COEF_MAX 8192
+
+#define RICE_HISTORY_MULT 40
+#define RICE_INITIAL_HISTORY 10
+#define RICE_LIMIT 14
+/* The history mult of a channel is RICE_HISTORY_MULT * factor / 4 */
+#define RICE_HISTORY_MULT_FACTOR 4
+#define RICE_ESCAPE_CODE 0x1ff
+
+/* Size of a frame header with the sample count */
+#define FRAME_HEADER_BITS (3 + 4 + 12 + 1 + 2 + 1 + 32)
+
+typedef enum stereo_mode {
+    STEREO_INDEPENDENT,
+    STEREO_LEFT_SIDE,
+    STEREO_MID_SIDE,
+    STEREO_MAX
+} stereo_mode_t;
+
+/* The receiver computes right = u - ((v * mix_res) >> mix_bits) and
+ * left = right + v, or takes u and v as they are if mix_res is 0. */
+static const struct {
+    uint8_t mix_bits, mix_res;
+} stereo_modes[STEREO_MAX] = {
+    [STEREO_INDEPENDENT] = { 0, 0 },
+    [STEREO_LEFT_SIDE] = { 0, 1 },
+    [STEREO_MID_SIDE] = { 1, 1 },
+};
+
+struct pa_raop_alac_encoder {
+    bool compress;
+
+    unsigned n_alloc;
+    int32_t *left, *right;
+    int32_t *channel[2];
+    int32_t *residual[2];
+
+    /* The predictor state is carried over from one frame to the next, so
+     * that it doesn't have to adapt from scratch for every frame. Oldest
+     * sample first. */
+    int16_t coefs[2][PREDICTOR_ORDER];
+};
+
+struct bit_writer {
+    uint8_t *data;
+    size_t size, pos;
+    uint64_t acc;
+    unsigned n_bits;
+};
+
+static void bit_writer_init(struct bit_writer *w, uint8_t *data, size_t size) {
+    w->data = data;
+    w->size = size;
+    w->pos = 0;
+    w->acc = 0;
+    w->n_bits = 0;
+}
+
+/* Writes the n lowest bits of value, most significant bit first. Writes
+ * beyond the end of the buffer are counted, but dropped. */
+static inline void put_bits(struct bit_writer *w, unsigned n, uint32_t value) {
+    pa_assert(n <= 32);
+
+    w->acc = (w->acc << n) | (value & (((uint64_t) 1 << n) - 1));
+    w->n_bits += n;
+
+    while (w->n_bits >= 8) {
+        w->n_bits -= 8;
+
+        if (w->pos < w->size)
+            w->data[w->pos] = (uint8_t) (w->acc >> w->n_bits);
+        w->pos++;
+    }
+}
+
+/* Pads to a byte boundary and returns the number of bytes written, or 0
+ * if they didn't fit. */
+static size_t bit_writer_flush(struct bit_writer *w) {
+    if (w->n_bits > 0)
+        put_bits(w, 8 - w->n_bits, 0);
+
+    return w->pos <= w->size ? w->pos : 0;
+}
+
+static inline int32_t sign_extend(int32_t v) {
+    return (int32_t) ((uint32_t) v << (32 - CHANNEL_BITS)) >> (32 - CHANNEL_BITS);
+}
+
+static inline int sign_of(int32_t v) {
+    return (v > 0) - (v < 0);
+}
+
+static inline unsigned log2_of(uint32_t v) {
+    pa_assert(v > 0);
+
+    return 31 - (unsigned) __builtin_clz(v);
+}
+
+static void write_frame_header(struct bit_writer *w, unsigned n_frames, bool verbatim) {
+    put_bits(w, 3, ELEMENT_CPE);
+    put_bits(w, 4, 0);  /* Element instance tag */
+    put_bits(w, 12, 0); /* Unused */
+    put_bits(w, 1, 1);  /* The sample count follows */
+    put_bits(w, 2, 0);  /* No uncompressed low bytes, we have 16 bit */
+    put_bits(w, 1, verbatim);
+    put_bits(w, 32, n_frames);
+}
+
+static size_t write_verbatim(struct bit_writer *w, const uint8_t *raw, unsigned n_frames) {
+    unsigned i;
+
+    write_frame_header(w, n_frames, true);
+
+    for (i = 0; i < n_frames; i++, raw += 4) {
+        /* Byte swap stereo data */
+        put_bits(w, 16, (uint32_t) raw[1] << 8 | raw[0]);
+        put_bits(w, 16, (uint32_t) raw[3] << 8 | raw[2]);
+    }
+
+    return bit_writer_flush(w);
+}
+
+/* Sums up the magnitudes of the second order differences of left, right,
+ * their difference and their mean, which predict how well each of them
+ * compresses. */
+static void estimate_costs_c(const int32_t *left, const int32_t *right, unsigned n, uint64_t costs[4]) {
+    unsigned i;
+
+    for (i = 2; i < n; i++) {
+        int32_t l = left[i] - 2 * left[i - 1] + left[i - 2];
+        int32_t r = right[i] - 2 * right[i - 1] + right[i - 2];
+
+        costs[0] += (uint32_t) abs(l);
+        costs[1] += (uint32_t) abs(r);
+        costs[2] += (uint32_t) abs(l - r);
+        costs[3] += (uint32_t) abs((l + r) >> 1);
+    }
+}
+
+#if defined(__SSE2__)
+static inline __m128i abs_epi32(__m128i v) {
+    __m128i sign = _mm_srai_epi32(v, 31);
+
+    return _mm_sub_epi32(_mm_xor_si128(v, sign), sign);
+}
+
+static inline uint64_t sum_epi32(__m128i v) {
+    uint32_t lanes[4];
+
+    _mm_storeu_si128((__m128i *) lanes, v);
+
+    return (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static void estimate_costs_sse2(const int32_t *left, const int32_t *right, unsigned n, uint64_t costs[4]) {
+    unsigned i = 2;
+
+    while (i + 4 <= n) {
+        __m128i acc[4];
+        /* The differences are below 2^18, so 1024 iterations can't
+         * overflow the 32 bit lanes */
+        unsigned end = PA_MIN(n, i + 4 * 1024), k;
+
+        for (k = 0; k < 4; k++)
+            acc[k] = _mm_setzero_si128();
+
+        for (; i + 4 <= end; i += 4) {
+            __m128i l0 = _mm_loadu_si128((const __m128i *) (left + i));
+            __m128i l1 = _mm_loadu_si128((const __m128i *) (left + i - 1));
+            __m128i l2 = _mm_loadu_si128((const __m128i *) (left + i - 2));
+            __m128i r0 = _mm_loadu_si128((const __m128i *) (right + i));
+            __m128i r1 = _mm_loadu_si128((const __m128i *) (right + i - 1));
+            __m128i r2 = _mm_loadu_si128((const __m128i *) (right + i - 2));
+            __m128i l, r;
+
+            l = _mm_add_epi32(_mm_sub_epi32(l0, _mm_add_epi32(l1, l1)), l2);
+            r = _mm_add_epi32(_mm_sub_epi32(r0, _mm_add_epi32(r1, r1)), r2);
+
+            acc[0] = _mm_add_epi32(acc[0], abs_epi32(l));
+            acc[1] = _mm_add_epi32(acc[1], abs_epi32(r));
+            acc[2] = _mm_add_epi32(acc[2], abs_epi32(_mm_sub_epi32(l, r)));
+            acc[3] = _mm_add_epi32(acc[3], abs_epi32(_mm_srai_epi32(_mm_add_epi32(l, r), 1)));
+        }
+
+        for (k = 0; k < 4; k++)
+            costs[k] += sum_epi32(acc[k]);
+    }
+
+    /* The remainder */
+    if (i < n)
+        estimate_costs_c(left + i - 2, right + i - 2, n - i + 2, costs);
+}
+#endif
+
+static stereo_mode_t choose_stereo_mode(pa_raop_alac_encoder *e, unsigned n) {
+    uint64_t costs[4] = { 0, 0, 0, 0 }, best;
+    stereo_mode_t mode = STEREO_INDEPENDENT;
+
+#if defined(__SSE2__)
+    estimate_costs_sse2(e->left, e->right, n, costs);
+#else
+    estimate_costs_c(e->left, e->right, n, costs);
+#endif
+
+    best = costs[0] + costs[1];
+
+    if (costs[0] + costs[2] < best) {
+        best = costs[0] + costs[2];
+        mode = STEREO_LEFT_SIDE;
+    }
+
+    if (costs[3] + costs[2] < best)
+        mode = STEREO_MID_SIDE;
+
+    return mode;
+}
+
+static void decorrelate(pa_raop_alac_encoder *e, stereo_mode_t mode, unsigned n) {
+    int32_t *u = e->channel[0], *v = e->channel[1];
+    const int32_t *l = e->left, *r = e->right;
+    unsigned i;
+
+    switch (mode) {
+        case STEREO_INDEPENDENT:
+            memcpy(u, l, n * sizeof(int32_t));
+            memcpy(v, r, n * sizeof(int32_t));
+            break;
+
+        case STEREO_LEFT_SIDE:
+            for (i = 0; i < n; i++) {
+                u[i] = l[i];
+                v[i] = l[i] - r[i];
+            }
+            break;
+
+        case STEREO_MID_SIDE:
+            for (i = 0; i < n; i++) {
+                v[i] = l[i] - r[i];
+                u[i] = r[i] + (v[i] >> 1);
+            }
+            break;
+
+        default:
+            pa_assert_not_reached();
+    }
+}
+
+/* Computes the prediction residual of x the way the receiver reverses it,
+ * adapting the coefficients after each sample. */
+static void predict(const int32_t *x, int32_t *residual, unsigned n, int16_t coefs[PREDICTOR_ORDER]) {
+    unsigned i, j;
+
+    residual[0] = x[0];
+
+    for (i = 1; i <= PREDICTOR_ORDER && i < n; i++)
+        residual[i] = sign_extend(x[i] - x[i - 1]);
+
+    for (; i < n; i++) {
+        const int32_t *past = x + i - PREDICTOR_ORDER;
+        int32_t d = past[-1], error, prediction;
+        uint32_t sum = 0;
+
+        /* Wraps around like the receiver's 32 bit arithmetic */
+        for (j = 0; j < PREDICTOR_ORDER; j++)
+            sum += (uint32_t) (past[j] - d) * (uint32_t) (int32_t) coefs[j];
+
+        prediction = d + (int32_t) (((int64_t) (int32_t) sum + (1 << (PREDICTOR_SHIFT - 1))) >> PREDICTOR_SHIFT);
+        residual[i] = error = sign_extend(x[i] - prediction);
+
+        /* Sign-sign adaptation, oldest sample first, until the error is
+         * accounted for */
+        if (error != 0) {
+            int error_sign = sign_of(error);
+
+            for (j = 0; j < PREDICTOR_ORDER && error * error_sign > 0; j++) {
+                int32_t diff = d - past[j];
+                int sign = sign_of(diff) * error_sign;
+
+                coefs[j] = (int16_t) (coefs[j] - sign);
+                error -= ((diff * sign) >> PREDICTOR_SHIFT) * (int32_t) (j + 1);
+            }
+        }
+    }
+}
+
+static inline void put_rice(struct bit_writer *w, uint32_t x, unsigned k, unsigned escape_bits) {
+    uint32_t divisor, q, r;
+
+    k = PA_MIN(k, RICE_LIMIT);
+    divisor = (1U << k) - 1;
+    q = x / divisor;
+    r = x % divisor;
+
+    if (q > 8) {
+        put_bits(w, 9, RICE_ESCAPE_CODE);
+        put_bits(w, escape_bits, x);
+        return;
+    }
+
+    /* q ones and a zero */
+    put_bits(w, q + 1, ((1U << q) - 1) << 1);
+
+    if (k != 1) {
+        if (r > 0)
+            put_bits(w, k, r + 1);
+        else
+            put_bits(w, k - 1, 0);
+    }
+}
+
+static void write_residual(struct bit_writer *w, const int32_t *residual, unsigned n) {
+    uint32_t history = RICE_INITIAL_HISTORY;
+    const uint32_t mult = RICE_HISTORY_MULT * RICE_HISTORY_MULT_FACTOR / 4;
+    uint32_t sign_modifier = 0;
+    unsigned i = 0;
+
+    while (i < n) {
+        /* Zigzag: 0, -1, 1, -2, ... to 0, 1, 2, 3, ... */
+        uint32_t x = ((uint32_t) residual[i] << 1) ^ (uint32_t) (residual[i] >> 31);
+
+        i++;
+
+        put_rice(w, x - sign_modifier, log2_of((history >> 9) + 3), CHANNEL_BITS);
+
+        sign_modifier = 0;
+
+        if (x > 0xffff)
+            history = 0xffff;
+        else
+            history += x * mult - ((history * mult) >> 9);
+
+        /* In quiet passages runs of zeros are coded as a length */
+        if (history < 128 && i < n) {
+            uint32_t run = 0;
+            unsigned k = 7 - (history > 0 ? log2_of(history) : 0) + ((history + 16) >> 6);
+
+            while (i < n && residual[i] == 0) {
+                run++;
+                i++;
+            }
+
+            put_rice(w, run, k, 16);
+
+            sign_modifier = run <= 0xffff;
+            history = 0;
+        }
+    }
+}
+
+static size_t write_compressed(pa_raop_alac_encoder *e, struct bit_writer *w, unsigned n_frames) {
+    stereo_mode_t mode;
+    unsigned c;
+    int j;
+
+    mode = choose_stereo_mode(e, n_frames);
+    decorrelate(e, mode, n_frames);
+
+    write_frame_header(w, n_frames, false);
+    put_bits(w, 8, stereo_modes[mode].mix_bits);
+    put_bits(w, 8, stereo_modes[mode].mix_res);
+
+    for (c = 0; c < 2; c++) {
+        put_bits(w, 4, 0); /* Adaptive predictor */
+        put_bits(w, 4, PREDICTOR_SHIFT);
+        put_bits(w, 3, RICE_HISTORY_MULT_FACTOR);
+        put_bits(w, 5, PREDICTOR_ORDER);
+
+        /* The coefficients at the start of the frame, latest sample
+         * first */
+        for (j = PREDICTOR_ORDER - 1; j >= 0; j--)
+            put_bits(w, 16, (uint16_t) e->coefs[c][j]);
+    }
+
+    for (c = 0; c < 2; c++) {
+        predict(e->channel[c], e->residual[c], n_frames, e->coefs[c]);
+        write_residual(w, e->residual[c], n_frames);
+    }
+
+    put_bits(w, 3, ELEMENT_END);
+
+    /* Keep the coefficients within 16 bits, even after they adapted
+     * during the next frame */
+    for (c = 0; c < 2; c++)
+        for (j = 0; j < PREDICTOR_ORDER; j++)
+            e->coefs[c][j] = PA_CLAMP(e->coefs[c][j], -PREDICTOR_COEF_MAX, PREDICTOR_COEF_MAX);
+
+    return bit_writer_flush(w);
+}
+
+static void reset_coefs(pa_raop_alac_encoder *e) {
+    unsigned c;
+
+    /* Start as a second order predictor, 2 * x[n-1] - x[n-2] */
+    for (c = 0; c < 2; c++) {
+        memset(e->coefs[c], 0, sizeof(e->coefs[c]));
+        e->coefs[c][PREDICTOR_ORDER - 1] = 2 << PREDICTOR_SHIFT;
+        e->coefs[c][PREDICTOR_ORDER - 2] = -(1 << PREDICTOR_SHIFT);
+    }
+}
+
+pa_raop_alac_encoder* pa_raop_alac_encoder_new(bool compress) {
+    pa_raop_alac_encoder *e;
+
+    e = pa_xnew0(pa_raop_alac_encoder, 1);
+    e->compress = compress;
+    reset_coefs(e);
+
+    return e;
+}
+
+void pa_raop_alac_encoder_free(pa_raop_alac_encoder *e) {
+    pa_assert(e);
+
+    pa_xfree(e->left);
+    pa_xfree(e);
+}
+
+static void ensure_buffers(pa_raop_alac_encoder *e, unsigned n_frames) {
+    int32_t *b;
+
+    if (n_frames <= e->n_alloc)
+        return;
+
+    pa_xfree(e->left);
+
+    e->n_alloc = n_frames;
+    b = pa_xnew(int32_t, 6 * n_frames);
+    e->left = b;
+    e->right = b + n_frames;
+    e->channel[0] = b + 2 * n_frames;
+    e->channel[1] = b + 3 * n_frames;
+    e->residual[0] = b + 4 * n_frames;
+    e->residual[1] = b + 5 * n_frames;
+}
+
+size_t pa_raop_alac_encode(pa_raop_alac_encoder *e, uint8_t *packet, size_t max, const uint8_t *raw, size_t *length) {
+    unsigned n_frames = (unsigned) (*length / 4), i;
+    size_t verbatim_size = (FRAME_HEADER_BITS + 32 * (size_t) n_frames + 7) / 8;
+    struct bit_writer w;
+    size_t size;
+
+    pa_assert(e);
+    pa_assert(packet);
+    pa_assert(raw);
+    pa_assert(max >= verbatim_size);
+
+    *length = n_frames * 4;
+
+    if (e->compress && n_frames > 0) {
+        const uint8_t *s = raw;
+
+        ensure_buffers(e, n_frames);
+
+        for (i = 0; i < n_frames; i++, s += 4) {
+            e->left[i] = (int16_t) (s[1] << 8 | s[0]);
+            e->right[i] = (int16_t) (s[3] << 8 | s[2]);
+        }
+
+        bit_writer_init(&w, packet, verbatim_size - 1);
+
+        if ((size = write_compressed(e, &w, n_frames)) > 0)
+            return size;
+    }
+
+    /* Compression didn't pay off */
+    bit_writer_init(&w, packet, max);
+    return write_verbatim(&w, raw, n_frames);
+}
@@ -0,0 +1,45 @@
+#ifndef fooraopalachfoo
+#define fooraopalachfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* ALAC parameters announced to the receiver in the fmtp attribute, after
+ * the frame length: compatible version, bit depth, rice history mult,
+ * initial history, rice limit, channels, max run, max frame bytes,
+ * average bitrate and sample rate. */
+#define PA_RAOP_ALAC_FMTP_PARAMETERS "0 16 40 10 14 2 255 0 0 44100"
+
+typedef struct pa_raop_alac_encoder pa_raop_alac_encoder;
+
+/* If compress is false, frames are sent uncompressed, which costs less
+ * CPU but twice the bandwidth. */
+pa_raop_alac_encoder* pa_raop_alac_encoder_new(bool compress);
+void pa_raop_alac_encoder_free(pa_raop_alac_encoder *e);
+
+/* Encodes the *length bytes of s16le stereo audio at raw into an ALAC
+ * frame of at most max bytes at packet. max must leave room for an
+ * uncompressed frame, which is used when compression does not pay off.
+ * *length is set to the number of bytes consumed. Returns the size of
+ * the frame. */
+size_t pa_raop_alac_encode(pa_raop_alac_encoder *e, uint8_t *packet, size_t max, const uint8_t *raw, size_t *length);
+
+#endif
@@ -57,6 +57,7 @@
 #include <modules/rtp/rtsp_client.h>
 
 #include "raop-client.h"
+#include "raop-alac.h"
 #include "raop-packet-buffer.h"
 #include "raop-crypto.h"
 #include "raop-util.h"
@@ -66,6 +67,14 @@
 #define FRAMES_PER_TCP_PACKET 4096
 #define FRAMES_PER_UDP_PACKET 352
 
+/* Over UDP, the packets of one block are encoded, encrypted and sent
+ * together, every 32 ms */
+#define UDP_PACKETS_PER_BLOCK 4
+
+/* Largest packets, including the space for their headers */
+#define TCP_PACKET_SIZE (16 + 8 + 16384)
+#define UDP_PACKET_SIZE (4 + 12 + 8 + 1408)
+
 #define RTX_BUFFERING_SECONDS 4
 
 #define DEFAULT_TCP_AUDIO_PORT   6000
@@ -99,6 +108,7 @@ struct pa_raop_client {
     pa_raop_protocol_t protocol;
     pa_raop_encryption_t encryption;
     pa_raop_codec_t codec;
+    pa_raop_alac_encoder *alac;
 
     pa_raop_secret *secret;
 
@@ -217,96 +227,6 @@ static inline uint64_t timeval_to_ntp(struct timeval *tv) {
     return ntp;
 }
 
-/**
- * Function to write bits into a buffer.
- * @param buffer Handle to the buffer. It will be incremented if new data requires it.
- * @param bit_pos A pointer to a position buffer to keep track the current write location (0 for MSB, 7 for LSB)
- * @param size A pointer to the byte size currently written. This allows the calling function to do simple buffer overflow checks
- * @param data The data to write
- * @param data_bit_len The number of bits from data to write
- */
-static inline void bit_writer(uint8_t **buffer, uint8_t *bit_pos, size_t *size, uint8_t data, uint8_t data_bit_len) {
-    int bits_left, bit_overflow;
-    uint8_t bit_data;
-
-    if (!data_bit_len)
-        return;
-
-    /* If bit pos is zero, we will definitely use at least one bit from the current byte so size increments. */
-    if (!*bit_pos)
-        *size += 1;
-
-    /* Calc the number of bits left in the current byte of buffer. */
-    bits_left = 7 - *bit_pos  + 1;
-    /* Calc the overflow of bits in relation to how much space we have left... */
-    bit_overflow = bits_left - data_bit_len;
-    if (bit_overflow >= 0) {
-        /* We can fit the new data in our current byte.
-         * As we write from MSB->LSB we need to left shift by the overflow amount. */
-        bit_data = data << bit_overflow;
-        if (*bit_pos)
-            **buffer |= bit_data;
-        else
-            **buffer = bit_data;
-        /* If our data fits exactly into the current byte, we need to increment our pointer. */
-        if (0 == bit_overflow) {
-            /* Do not increment size as it will be incremented on next call as bit_pos is zero. */
-            *buffer += 1;
-            *bit_pos = 0;
-        } else {
-            *bit_pos += data_bit_len;
-        }
-    } else {
-        /* bit_overflow is negative, there for we will need a new byte from our buffer
-         * Firstly fill up what's left in the current byte. */
-        bit_data = data >> -bit_overflow;
-        **buffer |= bit_data;
-        /* Increment our buffer pointer and size counter. */
-        *buffer += 1;
-        *size += 1;
-        **buffer = data << (8 + bit_overflow);
-        *bit_pos = -bit_overflow;
-    }
-}
-
-static size_t write_ALAC_data(uint8_t *packet, const size_t max, uint8_t *raw, size_t *length, bool compress) {
-    uint32_t nbs = (*length / 2) / 2;
-    uint8_t *ibp, *maxibp;
-    uint8_t *bp, bpos;
-    size_t size = 0;
-
-    bp = packet;
-    pa_memzero(packet, max);
-    size = bpos = 0;
-
-    bit_writer(&bp, &bpos, &size, 1, 3); /* channel=1, stereo */
-    bit_writer(&bp, &bpos, &size, 0, 4); /* Unknown */
-    bit_writer(&bp, &bpos, &size, 0, 8); /* Unknown */
-    bit_writer(&bp, &bpos, &size, 0, 4); /* Unknown */
-    bit_writer(&bp, &bpos, &size, 1, 1); /* Hassize */
-    bit_writer(&bp, &bpos, &size, 0, 2); /* Unused */
-    bit_writer(&bp, &bpos, &size, 1, 1); /* Is-not-compressed */
-    /* Size of data, integer, big endian. */
-    bit_writer(&bp, &bpos, &size, (nbs >> 24) & 0xff, 8);
-    bit_writer(&bp, &bpos, &size, (nbs >> 16) & 0xff, 8);
-    bit_writer(&bp, &bpos, &size, (nbs >> 8)  & 0xff, 8);
-    bit_writer(&bp, &bpos, &size, (nbs)       & 0xff, 8);
-
-    ibp = raw;
-    maxibp = raw + (4 * nbs) - 4;
-    while (ibp <= maxibp) {
-        /* Byte swap stereo data. */
-        bit_writer(&bp, &bpos, &size, *(ibp + 1), 8);
-        bit_writer(&bp, &bpos, &size, *(ibp + 0), 8);
-        bit_writer(&bp, &bpos, &size, *(ibp + 3), 8);
-        bit_writer(&bp, &bpos, &size, *(ibp + 2), 8);
-        ibp += 4;
-    }
-
-    *length = (ibp - raw);
-    return size;
-}
-
 static size_t build_tcp_audio_packet(pa_raop_client *c, pa_memchunk *block, pa_memchunk *packet) {
     const size_t head = sizeof(tcp_audio_header);
     uint32_t *buffer = NULL;
@@ -332,7 +252,7 @@ static size_t build_tcp_audio_packet(pa_raop_client *c, pa_memchunk *block, pa_m
     length = block->length;
     size = sizeof(tcp_audio_header);
     if (c->codec == PA_RAOP_CODEC_ALAC)
-        size += write_ALAC_data(((uint8_t *) buffer + head), packet->length - head, raw, &length, false);
+        size += pa_raop_alac_encode(c->alac, ((uint8_t *) buffer + head), packet->length - head, raw, &length);
     else {
         pa_log_debug("Only ALAC encoding is supported, sending zeros...");
         pa_memzero(((uint8_t *) buffer + head), packet->length - head);
@@ -355,7 +275,7 @@ static size_t build_tcp_audio_packet(pa_raop_client *c, pa_memchunk *block, pa_m
 
 static ssize_t send_tcp_audio_packet(pa_raop_client *c, pa_memchunk *block, size_t offset) {
     static int write_type = 0;
-    const size_t max = sizeof(tcp_audio_header) + 8 + 16384;
+    const size_t max = TCP_PACKET_SIZE;
     pa_memchunk *packet = NULL;
     uint8_t *buffer = NULL;
     double progress = 0.0;
@@ -399,35 +319,29 @@ static ssize_t send_tcp_audio_packet(pa_raop_client *c, pa_memchunk *block, size
     return written;
 }
 
-static size_t build_udp_audio_packet(pa_raop_client *c, pa_memchunk *block, pa_memchunk *packet) {
+/* Builds the packet, leaving the encryption to the caller */
+static size_t build_udp_audio_packet(pa_raop_client *c, const uint8_t *raw, size_t *length, uint8_t *packet, size_t max, bool marker) {
     const size_t head = sizeof(udp_audio_header);
-    uint32_t *buffer = NULL;
-    uint8_t *raw = NULL;
-    size_t length, size;
-
-    raw = pa_memblock_acquire(block->memblock);
-    buffer = pa_memblock_acquire(packet->memblock);
-    buffer += packet->index / sizeof(uint32_t);
-    raw += block->index;
+    uint32_t *buffer = (uint32_t *) packet;
+    size_t size;
 
     memcpy(buffer, udp_audio_header, sizeof(udp_audio_header));
-    if (c->is_first_packet)
+    if (marker)
         buffer[0] |= htonl((uint32_t) 0x80 << 16);
     buffer[0] |= htonl((uint32_t) c->seq);
     buffer[1] = htonl(c->rtptime);
     buffer[2] = htonl(c->ssrc);
 
-    length = block->length;
     size = sizeof(udp_audio_header);
     if (c->codec == PA_RAOP_CODEC_ALAC)
-        size += write_ALAC_data(((uint8_t *) buffer + head), packet->length - head, raw, &length, false);
+        size += pa_raop_alac_encode(c->alac, packet + head, max - head, raw, length);
     else {
         pa_log_debug("Only ALAC encoding is supported, sending zeros...");
-        pa_memzero(((uint8_t *) buffer + head), packet->length - head);
-        size += length;
+        pa_memzero(packet + head, max - head);
+        size += *length;
     }
 
-    c->rtptime += length / 4;
+    c->rtptime += *length / 4;
 
     /* Wrap sequence number to 0 then UINT16_MAX is reached */
     if (c->seq == UINT16_MAX)
@@ -435,52 +349,80 @@ static size_t build_udp_audio_packet(pa_raop_client *c, pa_memchunk *block, pa_m
     else
         c->seq++;
 
-    pa_memblock_release(block->memblock);
-
-    if (c->encryption == PA_RAOP_ENCRYPTION_RSA)
-        pa_raop_aes_encrypt(c->secret, (uint8_t *) buffer + head, size - head);
-
-    pa_memblock_release(packet->memblock);
-    packet->length = size;
-
     return size;
 }
 
 static ssize_t send_udp_audio_packet(pa_raop_client *c, pa_memchunk *block, size_t offset) {
-    const size_t max = sizeof(udp_audio_retrans_header) + sizeof(udp_audio_header) + 8 + 1408;
-    pa_memchunk *packet = NULL;
-    uint8_t *buffer = NULL;
-    ssize_t written = -1;
+    const size_t max = UDP_PACKET_SIZE;
+    const size_t head = sizeof(udp_audio_header);
+    const size_t packet_bytes = FRAMES_PER_UDP_PACKET * 4;
+    pa_memchunk *packets[UDP_PACKETS_PER_BLOCK];
+    uint8_t *payloads[UDP_PACKETS_PER_BLOCK];
+    size_t payload_sizes[UDP_PACKETS_PER_BLOCK];
+    bool marker = c->is_first_packet;
+    const uint8_t *raw;
+    ssize_t total = 0;
+    unsigned n, i;
 
     /* UDP packet has to be sent at once ! */
     pa_assert(block->index == offset);
 
-    if (!(packet = pa_raop_packet_buffer_prepare(c->pbuf, c->seq, max)))
-        return -1;
+    raw = (const uint8_t *) pa_memblock_acquire(block->memblock) + block->index;
 
-    packet->index = sizeof(udp_audio_retrans_header);
-    packet->length = max - sizeof(udp_audio_retrans_header);
-    if (!build_udp_audio_packet(c, block, packet))
-        return -1;
+    while (block->length >= 4) {
+        /* Build the packets of the block, straight into the ring of sent
+         * packets... */
+        for (n = 0; n < UDP_PACKETS_PER_BLOCK && block->length >= 4; n++) {
+            size_t length = PA_MIN(block->length, packet_bytes), size;
+            uint8_t *buffer;
 
-    buffer = pa_memblock_acquire(packet->memblock);
+            if (!(packets[n] = pa_raop_packet_buffer_prepare(c->pbuf, c->seq, max))) {
+                pa_memblock_release(block->memblock);
+                return -1;
+            }
 
-    pa_assert(buffer);
+            packets[n]->index = sizeof(udp_audio_retrans_header);
+            buffer = (uint8_t *) pa_memblock_acquire(packets[n]->memblock) + packets[n]->index;
 
-    buffer += packet->index;
-    if (buffer && packet->length > 0)
-        written = pa_write(c->udp_sfd, buffer, packet->length, NULL);
-    if (written < 0 && errno == EAGAIN) {
-        pa_log_debug("Discarding UDP (audio, seq=%d) packet due to EAGAIN (%s)", c->seq, pa_cstrerror(errno));
-        written = packet->length;
+            size = build_udp_audio_packet(c, raw, &length, buffer, max - packets[n]->index, marker);
+            packets[n]->length = size;
+            marker = false;
+
+            payloads[n] = buffer + head;
+            payload_sizes[n] = size - head;
+
+            raw += length;
+            block->index += length;
+            block->length -= length;
+        }
+
+        /* ...encrypt them in one go... */
+        if (c->encryption == PA_RAOP_ENCRYPTION_RSA)
+            pa_raop_aes_encrypt_packets(c->secret, payloads, payload_sizes, n);
+
+        /* ...and send them */
+        for (i = 0; i < n; i++) {
+            ssize_t written;
+
+            written = pa_write(c->udp_sfd, payloads[i] - head, packets[i]->length, NULL);
+            if (written < 0 && errno == EAGAIN) {
+                pa_log_debug("Discarding UDP (audio, seq=%d) packet due to EAGAIN (%s)", c->seq, pa_cstrerror(errno));
+                written = packets[i]->length;
+            }
+
+            pa_memblock_release(packets[i]->memblock);
+
+            if (written > 0)
+                total += written;
+        }
     }
 
-    pa_memblock_release(packet->memblock);
+    pa_memblock_release(block->memblock);
     /* It is meaningless to preseve the partial data */
     block->index += block->length;
     block->length = 0;
 
-    return written;
+    return total;
 }
 
 static size_t rebuild_udp_audio_packet(pa_raop_client *c, uint16_t seq, pa_memchunk *packet) {
@@ -895,7 +837,7 @@ static void rtsp_stream_cb(pa_rtsp_client *rtsp, pa_rtsp_state_t state, pa_rtsp_
                         "t=0 0\r\n"
                         "m=audio 0 RTP/AVP 96\r\n"
                         "a=rtpmap:96 AppleLossless\r\n"
-                        "a=fmtp:96 %d 0 16 40 10 14 2 255 0 0 44100\r\n",
+                        "a=fmtp:96 %d " PA_RAOP_ALAC_FMTP_PARAMETERS "\r\n",
                         c->sid, ipv, ip, ipv, c->host, frames);
 
                     break;
@@ -925,7 +867,7 @@ static void rtsp_stream_cb(pa_rtsp_client *rtsp, pa_rtsp_state_t state, pa_rtsp_
                         "t=0 0\r\n"
                         "m=audio 0 RTP/AVP 96\r\n"
                         "a=rtpmap:96 AppleLossless\r\n"
-                        "a=fmtp:96 %d 0 16 40 10 14 2 255 0 0 44100\r\n"
+                        "a=fmtp:96 %d " PA_RAOP_ALAC_FMTP_PARAMETERS "\r\n"
                         "a=rsaaeskey:%s\r\n"
                         "a=aesiv:%s\r\n",
                         c->sid, ipv, ip, ipv, c->host, frames, key, iv);
@@ -1380,7 +1322,7 @@ static void rtsp_auth_cb(pa_rtsp_client *rtsp, pa_rtsp_state_t state, pa_rtsp_st
 }
 
 pa_raop_client* pa_raop_client_new(pa_core *core, const char *host, pa_raop_protocol_t protocol,
-                                   pa_raop_encryption_t encryption, pa_raop_codec_t codec) {
+                                   pa_raop_encryption_t encryption, pa_raop_codec_t codec, bool compress) {
     pa_raop_client *c;
 
     pa_parsed_address a;
@@ -1412,6 +1354,8 @@ pa_raop_client* pa_raop_client_new(pa_core *core, const char *host, pa_raop_prot
     c->protocol = protocol;
     c->encryption = encryption;
     c->codec = codec;
+    if (c->codec == PA_RAOP_CODEC_ALAC)
+        c->alac = pa_raop_alac_encoder_new(compress);
 
     c->tcp_sfd = -1;
 
@@ -1433,7 +1377,8 @@ pa_raop_client* pa_raop_client_new(pa_core *core, const char *host, pa_raop_prot
     c->sync_interval = ss.rate / FRAMES_PER_UDP_PACKET;
     c->sync_count = 0;
 
-    c->pbuf = pa_raop_packet_buffer_new(c->core->mempool, size);
+    c->pbuf = pa_raop_packet_buffer_new(c->core->mempool, size,
+                                        c->protocol == PA_RAOP_PROTOCOL_UDP ? UDP_PACKET_SIZE : TCP_PACKET_SIZE);
 
     return c;
 }
@@ -1456,6 +1401,9 @@ void pa_raop_client_free(pa_raop_client *c) {
         pa_rtsp_client_free(c->rtsp);
     c->rtsp = NULL;
 
+    if (c->alac)
+        pa_raop_alac_encoder_free(c->alac);
+
     pa_xfree(c->host);
     pa_xfree(c);
 }
@@ -1677,7 +1625,7 @@ void pa_raop_client_get_frames_per_block(pa_raop_client *c, size_t *frames) {
             *frames = FRAMES_PER_TCP_PACKET;
             break;
         case PA_RAOP_PROTOCOL_UDP:
-            *frames = FRAMES_PER_UDP_PACKET;
+            *frames = FRAMES_PER_UDP_PACKET * UDP_PACKETS_PER_BLOCK;
             break;
         default:
             *frames = 0;
@@ -1764,7 +1712,7 @@ ssize_t pa_raop_client_send_audio_packet(pa_raop_client *c, pa_memchunk *block,
 
     /* Sync RTP & NTP timestamp if required (UDP). */
     if (c->protocol == PA_RAOP_PROTOCOL_UDP) {
-        c->sync_count++;
+        c->sync_count += (block->length + FRAMES_PER_UDP_PACKET * 4 - 1) / (FRAMES_PER_UDP_PACKET * 4);
         if (c->is_first_packet || c->sync_count >= c->sync_interval) {
             send_udp_sync_packet(c, c->rtptime);
             c->sync_count = 0;
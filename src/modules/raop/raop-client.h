@@ -57,7 +57,7 @@ typedef enum pa_raop_state {
 } pa_raop_state_t;
 
 pa_raop_client* pa_raop_client_new(pa_core *core, const char *host, pa_raop_protocol_t protocol,
-                                   pa_raop_encryption_t encryption, pa_raop_codec_t codec);
+                                   pa_raop_encryption_t encryption, pa_raop_codec_t codec, bool compress);
 void pa_raop_client_free(pa_raop_client *c);
 
 int pa_raop_client_authenticate(pa_raop_client *c, const char *password);
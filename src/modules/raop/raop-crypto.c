@@ -28,7 +28,7 @@
 #include <string.h>
 
 #include <openssl/err.h>
-#include <openssl/aes.h>
+#include <openssl/evp.h>
 #include <openssl/rsa.h>
 
 #include <pulse/xmalloc.h>
@@ -59,7 +59,7 @@ static int RSA_set0_key(RSA *r, BIGNUM *n, BIGNUM *e, BIGNUM *d) {
 struct pa_raop_secret {
     uint8_t key[AES_CHUNK_SIZE]; /* Key for aes-cbc */
     uint8_t iv[AES_CHUNK_SIZE];  /* Initialization vector for cbc */
-    AES_KEY aes;                 /* AES encryption */
+    EVP_CIPHER_CTX *aes;         /* AES encryption, with the key schedule */
 };
 
 static const char rsa_modulus[] =
@@ -147,15 +147,22 @@ pa_raop_secret* pa_raop_secret_new(void) {
     pa_assert(s);
 
     pa_random(s->key, sizeof(s->key));
-    AES_set_encrypt_key(s->key, 128, &s->aes);
     pa_random(s->iv, sizeof(s->iv));
 
+    /* Through EVP, OpenSSL uses AES-NI or the ARMv8 crypto extensions
+     * where the CPU has them */
+    pa_assert_se(s->aes = EVP_CIPHER_CTX_new());
+    pa_assert_se(EVP_EncryptInit_ex(s->aes, EVP_aes_128_cbc(), NULL, s->key, s->iv) == 1);
+    /* The trailing partial block of a packet is sent in the clear */
+    EVP_CIPHER_CTX_set_padding(s->aes, 0);
+
     return s;
 }
 
 void pa_raop_secret_free(pa_raop_secret *s) {
     pa_assert(s);
 
+    EVP_CIPHER_CTX_free(s->aes);
     pa_xfree(s);
 }
 
@@ -189,25 +196,36 @@ char* pa_raop_secret_get_key(pa_raop_secret *s) {
 }
 
 int pa_raop_aes_encrypt(pa_raop_secret *s, uint8_t *data, int len) {
-    static uint8_t nv[AES_CHUNK_SIZE];
-    uint8_t *buffer;
-    int i = 0, j;
+    int size = len - len % AES_CHUNK_SIZE, written = 0;
 
     pa_assert(s);
     pa_assert(data);
 
-    memcpy(nv, s->iv, AES_CHUNK_SIZE);
+    if (size <= 0)
+        return 0;
 
-    while (i + AES_CHUNK_SIZE <= len) {
-        buffer = data + i;
-        for (j = 0; j < AES_CHUNK_SIZE; ++j)
-            buffer[j] ^= nv[j];
+    /* Every packet is encrypted on its own, starting from the same IV.
+     * Resetting the IV keeps the key schedule. */
+    if (EVP_EncryptInit_ex(s->aes, NULL, NULL, NULL, s->iv) != 1 ||
+        EVP_EncryptUpdate(s->aes, data, &written, data, size) != 1) {
+        pa_log("AES encryption failed.");
+        return -1;
+    }
 
-        AES_encrypt(buffer, buffer, &s->aes);
+    pa_assert(written == size);
 
-        memcpy(nv, buffer, AES_CHUNK_SIZE);
-        i += AES_CHUNK_SIZE;
-    }
+    return written;
+}
+
+void pa_raop_aes_encrypt_packets(pa_raop_secret *s, uint8_t * const *data, const size_t *len, unsigned n) {
+    unsigned i;
+
+    pa_assert(s);
+    pa_assert(data);
+    pa_assert(len);
 
-    return i;
+    /* The context keeps the key schedule and OpenSSL's choice of
+     * implementation, so only the IV is reset between packets */
+    for (i = 0; i < n; i++)
+        pa_raop_aes_encrypt(s, data[i], (int) len[i]);
 }
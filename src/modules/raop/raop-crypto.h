@@ -30,6 +30,10 @@ void pa_raop_secret_free(pa_raop_secret *s);
 char* pa_raop_secret_get_iv(pa_raop_secret *s);
 char* pa_raop_secret_get_key(pa_raop_secret *s);
 
+/* Encrypts the whole 16 byte blocks of a packet in place with AES-128 in
+ * CBC mode. Returns the number of bytes encrypted, or -1 on error. */
 int pa_raop_aes_encrypt(pa_raop_secret *s, uint8_t *data, int len);
+/* Encrypts n packets the same way, keeping the cipher set up in between */
+void pa_raop_aes_encrypt_packets(pa_raop_secret *s, uint8_t * const *data, const size_t *len, unsigned n);
 
 #endif
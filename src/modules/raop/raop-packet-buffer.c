@@ -36,6 +36,11 @@
 #include "raop-packet-buffer.h"
 
 struct pa_raop_packet_buffer {
+    /* All packets live in one contiguous ring of fixed size slots, which
+     * the memblocks of the packets point into */
+    uint8_t *ring;
+    size_t packet_size;
+
     pa_memchunk *packets;
     pa_mempool *mempool;
 
@@ -46,18 +51,26 @@ struct pa_raop_packet_buffer {
     size_t pos;
 };
 
-pa_raop_packet_buffer *pa_raop_packet_buffer_new(pa_mempool *mempool, const size_t size) {
+pa_raop_packet_buffer *pa_raop_packet_buffer_new(pa_mempool *mempool, const size_t size, const size_t packet_size) {
     pa_raop_packet_buffer *pb = pa_xnew0(pa_raop_packet_buffer, 1);
+    size_t i;
 
     pa_assert(mempool);
     pa_assert(size > 0);
+    pa_assert(packet_size > 0);
 
     pb->count = 0;
     pb->size = size;
     pb->mempool = mempool;
+    /* Keep the slots aligned for the packet builders' 32 bit accesses */
+    pb->packet_size = PA_ALIGN(packet_size);
+    pb->ring = pa_xmalloc(pb->size * pb->packet_size);
     pb->packets = pa_xnew0(pa_memchunk, size);
     pb->seq = pb->pos = 0;
 
+    for (i = 0; i < size; i++)
+        pb->packets[i].memblock = pa_memblock_new_fixed(mempool, pb->ring + i * pb->packet_size, pb->packet_size, false);
+
     return pb;
 }
 
@@ -66,14 +79,12 @@ void pa_raop_packet_buffer_free(pa_raop_packet_buffer *pb) {
 
     pa_assert(pb);
 
-    for (i = 0; pb->packets && i < pb->size; i++) {
-        if (pb->packets[i].memblock)
-            pa_memblock_unref(pb->packets[i].memblock);
-        pa_memchunk_reset(&pb->packets[i]);
-    }
+    for (i = 0; pb->packets && i < pb->size; i++)
+        pa_memblock_unref_fixed(pb->packets[i].memblock);
 
     pa_xfree(pb->packets);
     pb->packets = NULL;
+    pa_xfree(pb->ring);
     pa_xfree(pb);
 }
 
@@ -87,9 +98,8 @@ void pa_raop_packet_buffer_reset(pa_raop_packet_buffer *pb, uint16_t seq) {
     pb->count = 0;
     pb->seq = (!seq) ? UINT16_MAX : seq - 1;
     for (i = 0; i < pb->size; i++) {
-        if (pb->packets[i].memblock)
-            pa_memblock_unref(pb->packets[i].memblock);
-        pa_memchunk_reset(&pb->packets[i]);
+        pb->packets[i].index = 0;
+        pb->packets[i].length = 0;
     }
 }
 
@@ -99,6 +109,7 @@ pa_memchunk *pa_raop_packet_buffer_prepare(pa_raop_packet_buffer *pb, uint16_t s
 
     pa_assert(pb);
     pa_assert(pb->packets);
+    pa_assert(size <= pb->packet_size);
 
     if (seq == 0) {
         /* 0 means seq reached UINT16_MAX and has been wrapped... */
@@ -112,11 +123,7 @@ pa_memchunk *pa_raop_packet_buffer_prepare(pa_raop_packet_buffer *pb, uint16_t s
 
     i = (pb->pos + 1) % pb->size;
 
-    if (pb->packets[i].memblock)
-        pa_memblock_unref(pb->packets[i].memblock);
-    pa_memchunk_reset(&pb->packets[i]);
-
-    pb->packets[i].memblock = pa_memblock_new(pb->mempool, size);
+    /* The slot is simply reused, there is nothing to allocate */
     pb->packets[i].length = size;
     pb->packets[i].index = 0;
 
@@ -153,7 +160,7 @@ pa_memchunk *pa_raop_packet_buffer_retrieve(pa_raop_packet_buffer *pb, uint16_t
 
         i = (pb->size + pb->pos - delta) % pb->size;
 
-        if (delta < pb->size && pb->packets[i].memblock)
+        if (delta < pb->size)
             packet = &pb->packets[i];
     }
 
@@ -556,6 +556,7 @@ pa_sink* pa_raop_sink_new(pa_module *m, pa_modargs *ma, const char *driver) {
     char *thread_name = NULL;
     const char *server, *protocol, *encryption, *codec;
     const char /* *username, */ *password;
+    bool compress = false;
     pa_sink_new_data data;
     const char *name = NULL;
     const char *description = NULL;
@@ -649,6 +650,16 @@ pa_sink* pa_raop_sink_new(pa_module *m, pa_modargs *ma, const char *driver) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "compress", &compress) < 0) {
+        pa_log("Failed to parse compress argument.");
+        goto fail;
+    }
+
+    if (compress && u->codec != PA_RAOP_CODEC_ALAC) {
+        pa_log("Compression requires the ALAC codec.");
+        goto fail;
+    }
+
     pa_sink_new_data_init(&data);
     data.driver = driver;
     data.module = m;
@@ -718,7 +729,7 @@ pa_sink* pa_raop_sink_new(pa_module *m, pa_modargs *ma, const char *driver) {
     pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
     pa_sink_set_rtpoll(u->sink, u->rtpoll);
 
-    u->raop = pa_raop_client_new(u->core, server, u->protocol, u->encryption, u->codec);
+    u->raop = pa_raop_client_new(u->core, server, u->protocol, u->encryption, u->codec, compress);
 
     if (!(u->raop)) {
         pa_log("Failed to create RAOP client object");
@@ -0,0 +1,408 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/timeval.h>
+#include <pulse/volume.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/macro.h>
+#include <pulsecore/mix.h>
+#include <pulsecore/sample-util.h>
+
+#include "jitter-buffer.h"
+
+/* The buffer needs to be this many times as deep as the estimated mean
+ * jitter to absorb nearly all of it */
+#define JITTER_FACTOR 4
+
+/* When a packet arrives late, the target depth is raised to cover it. The
+ * raise decays at this rate, in relation to real time, which is the speed
+ * at which the drift controller of module-rtp-recv can follow. */
+#define LATE_BOOST_DECAY 0.01
+
+/* Concealment repeats up to the last PLC_PERIOD_MSEC of audio played. It
+ * is held at full level for PLC_HOLD_MSEC, then faded out so that silence
+ * is reached after PLC_FADE_END_MSEC. When audio is available again, it is
+ * faded in over FADE_IN_MSEC. The gain changes in steps of a millisecond. */
+#define PLC_PERIOD_MSEC 20
+#define PLC_HOLD_MSEC 10
+#define PLC_FADE_END_MSEC 60
+#define FADE_IN_MSEC 5
+
+struct pa_rtp_jitter_buffer {
+    pa_sample_spec sample_spec;
+    size_t frame_size;
+    pa_mempool *pool;
+
+    /* Position */
+    bool started;
+    uint32_t offset;            /* The timestamp at the write index */
+
+    /* Sequence numbers of the current stream, extended as in RFC 3550 */
+    uint32_t base_sequence;
+    uint32_t max_sequence;
+    uint64_t received;
+    uint64_t lost;              /* In earlier streams */
+
+    /* Jitter estimation */
+    bool have_transit;
+    pa_usec_t last_arrival;
+    uint32_t last_timestamp;
+    double jitter;              /* usec */
+    double late_boost;          /* usec */
+    pa_usec_t packet_duration;
+
+    /* Concealment */
+    pa_memchunk history;
+    size_t concealed_bytes;     /* Of the current gap */
+    bool concealing;
+
+    pa_rtp_jitter_buffer_stats stats;
+};
+
+pa_rtp_jitter_buffer* pa_rtp_jitter_buffer_new(const pa_sample_spec *ss, pa_mempool *pool) {
+    pa_rtp_jitter_buffer *jb;
+
+    pa_assert(ss);
+    pa_assert(pa_sample_spec_valid(ss));
+    pa_assert(pool);
+
+    jb = pa_xnew0(pa_rtp_jitter_buffer, 1);
+    jb->sample_spec = *ss;
+    jb->frame_size = pa_frame_size(ss);
+    jb->pool = pool;
+
+    pa_memchunk_reset(&jb->history);
+
+    return jb;
+}
+
+void pa_rtp_jitter_buffer_free(pa_rtp_jitter_buffer *jb) {
+    pa_assert(jb);
+
+    if (jb->history.memblock)
+        pa_memblock_unref(jb->history.memblock);
+
+    pa_xfree(jb);
+}
+
+static uint64_t get_lost(pa_rtp_jitter_buffer *jb) {
+    uint64_t expected;
+
+    /* Late packets count as received, and so they don't count as lost,
+     * as in RFC 3550 */
+    expected = jb->received > 0 ? (uint64_t) (jb->max_sequence - jb->base_sequence) + 1 : 0;
+
+    return expected > jb->received ? expected - jb->received : 0;
+}
+
+void pa_rtp_jitter_buffer_reset(pa_rtp_jitter_buffer *jb) {
+    pa_assert(jb);
+
+    jb->lost += get_lost(jb);
+    jb->received = 0;
+
+    jb->started = false;
+    jb->have_transit = false;
+}
+
+/* Updates the jitter estimate with a packet, see RFC 3550 A.8 */
+static void update_jitter(pa_rtp_jitter_buffer *jb, uint32_t timestamp, pa_usec_t arrival) {
+    double d;
+
+    if (jb->have_transit) {
+        d = (double) arrival - (double) jb->last_arrival;
+        d -= (double) (int32_t) (timestamp - jb->last_timestamp) * PA_USEC_PER_SEC / jb->sample_spec.rate;
+
+        jb->jitter += (fabs(d) - jb->jitter) / 16;
+
+        if (arrival > jb->last_arrival)
+            jb->late_boost -= PA_MIN(jb->late_boost, (double) (arrival - jb->last_arrival) * LATE_BOOST_DECAY);
+    }
+
+    jb->have_transit = true;
+    jb->last_arrival = arrival;
+    jb->last_timestamp = timestamp;
+}
+
+/* Returns true if the packet arrived after a later one */
+static bool update_sequence(pa_rtp_jitter_buffer *jb, uint16_t sequence) {
+    int16_t d;
+
+    if (jb->received++ == 0) {
+        jb->base_sequence = jb->max_sequence = sequence;
+        return false;
+    }
+
+    d = (int16_t) (sequence - (uint16_t) jb->max_sequence);
+
+    if (d > 0)
+        jb->max_sequence += (uint32_t) d;
+
+    return d < 0;
+}
+
+/* Puts chunk into q, delta bytes after the write index, where timestamp
+ * belongs */
+static int put_chunk(pa_rtp_jitter_buffer *jb, pa_memblockq *q, int64_t delta, uint32_t timestamp, const pa_memchunk *chunk) {
+    pa_memblockq_seek(q, delta, PA_SEEK_RELATIVE, true);
+
+    /* The next timestamp we expect */
+    jb->offset = timestamp + (uint32_t) (chunk->length / jb->frame_size);
+
+    if (pa_memblockq_push(q, chunk) < 0) {
+        pa_memblockq_seek(q, (int64_t) chunk->length, PA_SEEK_RELATIVE, true);
+        return -1;
+    }
+
+    return 0;
+}
+
+int pa_rtp_jitter_buffer_push(pa_rtp_jitter_buffer *jb, pa_memblockq *q, uint16_t sequence, uint32_t timestamp,
+                              const pa_memchunk *chunk, pa_usec_t arrival) {
+    int64_t delta, position;
+    bool reordered;
+
+    pa_assert(jb);
+    pa_assert(q);
+    pa_assert(chunk);
+    pa_assert(chunk->length % jb->frame_size == 0);
+
+    if (!jb->started) {
+        jb->started = true;
+        jb->offset = timestamp;
+    }
+
+    reordered = update_sequence(jb, sequence);
+    jb->stats.received++;
+
+    jb->packet_duration = pa_bytes_to_usec(chunk->length, &jb->sample_spec);
+
+    /* Where the packet belongs in relation to the write index. This also
+     * takes care of timestamp overflows. */
+    delta = (int64_t) (int32_t) (timestamp - jb->offset) * (int64_t) jb->frame_size;
+    position = pa_memblockq_get_write_index(q) + delta;
+
+    if (position + (int64_t) chunk->length <= pa_memblockq_get_read_index(q)) {
+        pa_usec_t lateness;
+
+        /* The gap is already concealed, drop the packet. Make sure that
+         * one this late would be in time. */
+        lateness = pa_bytes_to_usec((uint64_t) (pa_memblockq_get_read_index(q) - position), &jb->sample_spec);
+        jb->late_boost = PA_MAX(jb->late_boost, (double) lateness);
+        jb->stats.late++;
+
+        return -1;
+    }
+
+    /* Reordered packets don't tell much about the jitter, but would
+     * disturb the estimate */
+    if (reordered)
+        jb->stats.reordered++;
+    else
+        update_jitter(jb, timestamp, arrival);
+
+    return put_chunk(jb, q, delta, timestamp, chunk);
+}
+
+int pa_rtp_jitter_buffer_push_lost(pa_rtp_jitter_buffer *jb, pa_memblockq *q, uint32_t timestamp, const pa_memchunk *chunk) {
+    int64_t delta;
+
+    pa_assert(jb);
+    pa_assert(q);
+    pa_assert(chunk);
+    pa_assert(chunk->length % jb->frame_size == 0);
+
+    if (!jb->started) {
+        jb->started = true;
+        jb->offset = timestamp;
+    }
+
+    delta = (int64_t) (int32_t) (timestamp - jb->offset) * (int64_t) jb->frame_size;
+
+    if (pa_memblockq_get_write_index(q) + delta + (int64_t) chunk->length <= pa_memblockq_get_read_index(q))
+        return -1;
+
+    jb->stats.concealed += chunk->length / jb->frame_size;
+
+    return put_chunk(jb, q, delta, timestamp, chunk);
+}
+
+/* Applies a gain ramp to a chunk, in steps of a millisecond. start is the
+ * position of the chunk on the ramp in frames, fade_start and fade_end
+ * delimit the ramp, with gain 1 before fade_start and 0 after fade_end,
+ * or the other way round if fade_in is set. */
+static void apply_ramp(pa_rtp_jitter_buffer *jb, pa_memchunk *chunk, size_t start, size_t fade_start, size_t fade_end, bool fade_in) {
+    size_t step = PA_MAX(jb->sample_spec.rate / 1000, 1U) * jb->frame_size;
+    size_t done = 0;
+
+    start *= jb->frame_size;
+    fade_start *= jb->frame_size;
+    fade_end *= jb->frame_size;
+
+    while (done < chunk->length) {
+        pa_memchunk part;
+        size_t position = start + done;
+        double gain;
+        pa_cvolume v;
+
+        part = *chunk;
+        part.index += done;
+        part.length = PA_MIN(step, chunk->length - done);
+
+        if (position < fade_start)
+            gain = 1;
+        else if (position >= fade_end)
+            gain = 0;
+        else
+            gain = 1.0 - (double) (position - fade_start) / (double) (fade_end - fade_start);
+
+        if (fade_in)
+            gain = 1.0 - gain;
+
+        if (gain <= 0)
+            pa_silence_memchunk(&part, &jb->sample_spec);
+        else if (gain < 1)
+            pa_volume_memchunk(&part, &jb->sample_spec, pa_cvolume_set(&v, jb->sample_spec.channels, pa_sw_volume_from_linear(gain)));
+
+        done += part.length;
+    }
+}
+
+/* Fills chunk with up to length bytes of concealment for a gap */
+static void conceal(pa_rtp_jitter_buffer *jb, size_t length, pa_memchunk *chunk) {
+    size_t hold, fade_end, period = 0;
+    uint8_t *dst;
+
+    hold = pa_usec_to_bytes(PLC_HOLD_MSEC * PA_USEC_PER_MSEC, &jb->sample_spec);
+    fade_end = pa_usec_to_bytes(PLC_FADE_END_MSEC * PA_USEC_PER_MSEC, &jb->sample_spec);
+
+    if (jb->history.memblock)
+        period = PA_MIN(jb->history.length, pa_usec_to_bytes(PLC_PERIOD_MSEC * PA_USEC_PER_MSEC, &jb->sample_spec));
+
+    length = PA_MIN(length, pa_mempool_block_size_max(jb->pool));
+
+    /* After the fade out, there is only silence up to the end of the gap */
+    if (period == 0 || jb->concealed_bytes >= fade_end)
+        length = PA_MIN(length, fade_end);
+    else
+        length = PA_MIN(length, fade_end - jb->concealed_bytes);
+
+    chunk->memblock = pa_memblock_new(jb->pool, length);
+    chunk->index = 0;
+    chunk->length = length;
+
+    if (period == 0 || jb->concealed_bytes >= fade_end)
+        pa_silence_memchunk(chunk, &jb->sample_spec);
+    else {
+        const uint8_t *src;
+        size_t done = 0;
+
+        /* Repeat the end of what was played last */
+        src = (const uint8_t*) pa_memblock_acquire_chunk(&jb->history) + jb->history.length - period;
+        dst = pa_memblock_acquire(chunk->memblock);
+
+        while (done < length) {
+            size_t phase = (jb->concealed_bytes + done) % period;
+            size_t n = PA_MIN(period - phase, length - done);
+
+            memcpy(dst + done, src + phase, n);
+            done += n;
+        }
+
+        pa_memblock_release(chunk->memblock);
+        pa_memblock_release(jb->history.memblock);
+
+        apply_ramp(jb, chunk, jb->concealed_bytes / jb->frame_size, hold / jb->frame_size, fade_end / jb->frame_size, false);
+    }
+
+    jb->concealed_bytes += length;
+    jb->stats.concealed += length / jb->frame_size;
+}
+
+int pa_rtp_jitter_buffer_pop(pa_rtp_jitter_buffer *jb, pa_memblockq *q, size_t length, pa_memchunk *chunk) {
+    pa_assert(jb);
+    pa_assert(q);
+    pa_assert(chunk);
+
+    if (pa_memblockq_peek(q, chunk) < 0)
+        return -1;
+
+    if (length > 0)
+        length = PA_MAX(pa_frame_align(length, &jb->sample_spec), jb->frame_size);
+    else
+        length = chunk->length;
+
+    if (!chunk->memblock) {
+        /* A gap, the packet for it was lost or is late */
+        if (!jb->concealing) {
+            jb->concealing = true;
+            jb->concealed_bytes = 0;
+        }
+
+        conceal(jb, PA_MIN(chunk->length, length), chunk);
+
+    } else {
+        /* Keep a reference to what we play, for concealing gaps */
+        if (jb->history.memblock)
+            pa_memblock_unref(jb->history.memblock);
+
+        jb->history = *chunk;
+        pa_memblock_ref(jb->history.memblock);
+
+        if (jb->concealing) {
+            size_t fade_in = pa_usec_to_bytes(FADE_IN_MSEC * PA_USEC_PER_MSEC, &jb->sample_spec);
+
+            /* Fade in where we continue with audio after a gap, on a copy */
+            chunk->length = PA_MIN(chunk->length, fade_in);
+            pa_memchunk_make_writable(chunk, 0);
+            apply_ramp(jb, chunk, 0, 0, fade_in / jb->frame_size, true);
+
+            jb->concealing = false;
+        }
+    }
+
+    pa_memblockq_drop(q, chunk->length);
+
+    return 0;
+}
+
+pa_usec_t pa_rtp_jitter_buffer_get_target(pa_rtp_jitter_buffer *jb) {
+    pa_assert(jb);
+
+    return (pa_usec_t) (JITTER_FACTOR * jb->jitter + jb->late_boost) + jb->packet_duration;
+}
+
+void pa_rtp_jitter_buffer_get_stats(pa_rtp_jitter_buffer *jb, pa_memblockq *q, pa_rtp_jitter_buffer_stats *stats) {
+    pa_assert(jb);
+    pa_assert(q);
+    pa_assert(stats);
+
+    *stats = jb->stats;
+    stats->lost = jb->lost + get_lost(jb);
+
+    stats->jitter = (pa_usec_t) jb->jitter;
+    stats->target = pa_rtp_jitter_buffer_get_target(jb);
+    stats->depth = pa_bytes_to_usec(pa_memblockq_get_length(q), &jb->sample_spec);
+}
@@ -0,0 +1,81 @@
+#ifndef foortpjitterbufferhfoo
+#define foortpjitterbufferhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/sample.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/memchunk.h>
+
+/* Puts received RTP packets into a memblockq at the position given by
+ * their timestamp, so that packets arriving out of order are put in place
+ * as long as they are not due yet, and takes the audio out again for
+ * playback. When a packet is missing at playout time, the gap is concealed
+ * by repeating the audio played last, fading it out if the gap is long.
+ *
+ * The jitter of the arrival times is estimated as in RFC 3550, from which
+ * the buffer depth needed to absorb it is derived. The memblockq is owned
+ * by the caller, which may rewind it, and must be created without a
+ * silence memchunk, so that gaps can be told from audio. */
+
+typedef struct pa_rtp_jitter_buffer pa_rtp_jitter_buffer;
+
+typedef struct pa_rtp_jitter_buffer_stats {
+    uint64_t received;
+    uint64_t reordered;   /* Arrived after a later packet, but in time */
+    uint64_t late;        /* Arrived after they were due, and dropped */
+    uint64_t lost;        /* Never arrived */
+    uint64_t concealed;   /* Frames played in place of missing audio */
+
+    pa_usec_t jitter;     /* Estimated interarrival jitter */
+    pa_usec_t target;     /* Buffer depth needed to absorb the jitter */
+    pa_usec_t depth;      /* Audio currently buffered */
+} pa_rtp_jitter_buffer_stats;
+
+pa_rtp_jitter_buffer* pa_rtp_jitter_buffer_new(const pa_sample_spec *ss, pa_mempool *pool);
+void pa_rtp_jitter_buffer_free(pa_rtp_jitter_buffer *jb);
+
+/* Forgets the stream position, so that the next packet pushed starts a
+ * new stream at the current write index. The statistics are kept. */
+void pa_rtp_jitter_buffer_reset(pa_rtp_jitter_buffer *jb);
+
+/* Puts the audio of a packet into q. arrival is the time the packet was
+ * received. Returns a negative value if the packet was dropped because
+ * it arrived too late or the queue is full. */
+int pa_rtp_jitter_buffer_push(pa_rtp_jitter_buffer *jb, pa_memblockq *q, uint16_t sequence, uint32_t timestamp,
+                              const pa_memchunk *chunk, pa_usec_t arrival);
+
+/* Puts audio that was recovered or concealed in place of lost packets,
+ * for example by a decoder, into q at the position of timestamp. It does
+ * not count as a received packet. Returns a negative value if it is too
+ * late. */
+int pa_rtp_jitter_buffer_push_lost(pa_rtp_jitter_buffer *jb, pa_memblockq *q, uint32_t timestamp, const pa_memchunk *chunk);
+
+/* Takes up to length bytes of audio out of q, concealing gaps. Returns a
+ * negative value if q has nothing to play, either because it is
+ * prebuffering or because it ran empty. */
+int pa_rtp_jitter_buffer_pop(pa_rtp_jitter_buffer *jb, pa_memblockq *q, size_t length, pa_memchunk *chunk);
+
+/* Returns the buffer depth that absorbs the jitter observed so far */
+pa_usec_t pa_rtp_jitter_buffer_get_target(pa_rtp_jitter_buffer *jb);
+
+void pa_rtp_jitter_buffer_get_stats(pa_rtp_jitter_buffer *jb, pa_memblockq *q, pa_rtp_jitter_buffer_stats *stats);
+
+#endif
@@ -28,7 +28,6 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
-#include <math.h>
 
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
@@ -43,6 +42,7 @@
 #include <pulsecore/log.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/drift-controller.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sample-util.h>
@@ -56,6 +56,10 @@
 #include "rtp.h"
 #include "sdp.h"
 #include "sap.h"
+#include "jitter-buffer.h"
+#ifdef HAVE_OPUS
+#include "opus-codec.h"
+#endif
 
 PA_MODULE_AUTHOR("Lennart Poettering");
 PA_MODULE_DESCRIPTION("Receive data from a network via RTP/SAP/SDP");
@@ -65,6 +69,7 @@ PA_MODULE_USAGE(
         "sink=<name of the sink> "
         "sap_address=<multicast address to listen on> "
         "latency_msec=<latency in ms> "
+        "adaptive_latency=<follow the network jitter, with latency_msec as the maximum?> "
 );
 
 #define SAP_PORT 9875
@@ -73,29 +78,57 @@ PA_MODULE_USAGE(
 #define MEMBLOCKQ_MAXLENGTH (1024*1024*40)
 #define MAX_SESSIONS 16
 #define DEATH_TIMEOUT 20
-#define RATE_UPDATE_INTERVAL (5*PA_USEC_PER_SEC)
+#define RATE_UPDATE_INTERVAL (500*PA_USEC_PER_MSEC)
+#define MAX_RATE_DEVIATION 0.01
+#define MAX_PACKETS_PER_WAKEUP 64
+#define STATS_INTERVAL (5*PA_USEC_PER_SEC)
+#define MAX_OPUS_PENDING 16
 
 static const char* const valid_modargs[] = {
     "sink",
     "sap_address",
     "latency_msec",
+    "adaptive_latency",
     NULL
 };
 
+enum {
+    SINK_INPUT_MESSAGE_UPDATE_STATS = PA_SINK_INPUT_MESSAGE_MAX
+};
+
+#ifdef HAVE_OPUS
+/* An Opus packet waiting to be decoded */
+struct opus_packet {
+    pa_memchunk chunk;
+    uint16_t sequence;
+    uint32_t timestamp;
+    pa_usec_t arrival;
+};
+#endif
+
 struct session {
     struct userdata *userdata;
     PA_LLIST_FIELDS(struct session);
 
     pa_sink_input *sink_input;
     pa_memblockq *memblockq;
+    pa_rtp_jitter_buffer *jitter_buffer;
 
     bool first_packet;
     uint32_t ssrc;
-    uint32_t offset;
 
     struct pa_sdp_info sdp_info;
 
     pa_rtp_context rtp_context;
+#ifdef HAVE_OPUS
+    /* Opus packets can only be decoded in order. Those that arrive ahead
+     * of a missing one wait here, sorted by timestamp, until it arrives or
+     * its audio is due. */
+    pa_rtp_opus_decoder *opus_decoder;
+    uint32_t opus_timestamp; /* Of the next packet to decode */
+    struct opus_packet opus_pending[MAX_OPUS_PENDING];
+    unsigned n_opus_pending;
+#endif
 
     pa_rtpoll_item *rtpoll_item;
 
@@ -106,9 +139,9 @@ struct session {
 
     unsigned int base_rate;
     pa_usec_t last_rate_update;
-    pa_usec_t last_latency;
-    double estimated_rate;
-    double avg_estimated_rate;
+    pa_drift_controller *drift_controller;
+
+    pa_usec_t last_stats_update;
 };
 
 struct userdata {
@@ -127,13 +160,33 @@ struct userdata {
     int n_sessions;
 
     pa_usec_t latency;
+    bool adaptive_latency;
 };
 
 static void session_free(struct session *s);
 
-/* Called from I/O thread context */
+/* Called from main context */
+static void update_stats(struct session *s, const pa_rtp_jitter_buffer_stats *stats) {
+    pa_proplist *p;
+
+    p = pa_proplist_new();
+    pa_proplist_setf(p, "rtp.packets.received", "%llu", (unsigned long long) stats->received);
+    pa_proplist_setf(p, "rtp.packets.reordered", "%llu", (unsigned long long) stats->reordered);
+    pa_proplist_setf(p, "rtp.packets.late", "%llu", (unsigned long long) stats->late);
+    pa_proplist_setf(p, "rtp.packets.lost", "%llu", (unsigned long long) stats->lost);
+    pa_proplist_setf(p, "rtp.frames.concealed", "%llu", (unsigned long long) stats->concealed);
+    pa_proplist_setf(p, "rtp.jitter_usec", "%llu", (unsigned long long) stats->jitter);
+    pa_proplist_setf(p, "rtp.jitter_buffer.depth_usec", "%llu", (unsigned long long) stats->depth);
+    pa_proplist_setf(p, "rtp.jitter_buffer.target_usec", "%llu", (unsigned long long) stats->target);
+
+    pa_sink_input_update_proplist(s->sink_input, PA_UPDATE_REPLACE, p);
+    pa_proplist_free(p);
+}
+
+/* Called from I/O thread context, except where noted */
 static int sink_input_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
-    struct session *s = PA_SINK_INPUT(o)->userdata;
+    pa_sink_input *i = PA_SINK_INPUT(o);
+    struct session *s = i->userdata;
 
     switch (code) {
         case PA_SINK_INPUT_MESSAGE_GET_LATENCY:
@@ -142,21 +195,135 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *data, int64_t
             /* Fall through, the default handler will add in the extra
              * latency added by the resampler */
             break;
+
+        case SINK_INPUT_MESSAGE_UPDATE_STATS:
+            /* Called from main context. The session may be gone by now. */
+            if (PA_SINK_INPUT_IS_LINKED(i->state))
+                update_stats(s, data);
+
+            return 0;
     }
 
     return pa_sink_input_process_msg(o, code, data, offset, chunk);
 }
 
+#ifdef HAVE_OPUS
+/* Called from I/O thread context. Decodes a packet into the jitter buffer
+ * and drops it. */
+static void opus_decode_packet(struct session *s, struct opus_packet *p) {
+    pa_memchunk pcm;
+
+    if (pa_rtp_opus_decode(s->opus_decoder, &p->chunk, &pcm, s->userdata->module->core->mempool) >= 0) {
+        s->opus_timestamp = p->timestamp + (uint32_t) (pcm.length / pa_frame_size(&s->sink_input->sample_spec));
+        pa_rtp_jitter_buffer_push(s->jitter_buffer, s->memblockq, p->sequence, p->timestamp, &pcm, p->arrival);
+        pa_memblock_unref(pcm.memblock);
+    }
+
+    pa_memblock_unref(p->chunk.memblock);
+}
+
+/* Called from I/O thread context. Decodes the waiting packets that follow
+ * on what was decoded last. */
+static void opus_decode_pending(struct session *s) {
+    unsigned n = 0;
+
+    while (n < s->n_opus_pending && s->opus_pending[n].timestamp == s->opus_timestamp)
+        opus_decode_packet(s, &s->opus_pending[n++]);
+
+    s->n_opus_pending -= n;
+    memmove(s->opus_pending, s->opus_pending + n, s->n_opus_pending * sizeof(struct opus_packet));
+}
+
+/* Called from I/O thread context. Gives up on the packets missing before
+ * the first waiting one, recovering their audio with the help of that
+ * packet. Gaps too long for the decoder are left to the jitter buffer. */
+static void opus_decode_lost(struct session *s) {
+    struct opus_packet *p;
+    pa_memchunk pcm;
+
+    pa_assert(s->n_opus_pending > 0);
+
+    p = &s->opus_pending[0];
+
+    if (pa_rtp_opus_decode_lost(s->opus_decoder, &p->chunk, p->timestamp - s->opus_timestamp, &pcm,
+                                s->userdata->module->core->mempool) >= 0) {
+        pa_rtp_jitter_buffer_push_lost(s->jitter_buffer, s->memblockq, s->opus_timestamp, &pcm);
+        pa_memblock_unref(pcm.memblock);
+    }
+
+    s->opus_timestamp = p->timestamp;
+    opus_decode_pending(s);
+}
+
+/* Called from I/O thread context */
+static void opus_reset(struct session *s) {
+    unsigned n;
+
+    for (n = 0; n < s->n_opus_pending; n++)
+        pa_memblock_unref(s->opus_pending[n].chunk.memblock);
+
+    s->n_opus_pending = 0;
+    s->opus_timestamp = s->rtp_context.timestamp;
+}
+
+/* Called from I/O thread context. Takes the reference to chunk. */
+static void opus_push_packet(struct session *s, pa_memchunk *chunk, pa_usec_t arrival) {
+    struct opus_packet p;
+    unsigned n;
+
+    p.chunk = *chunk;
+    p.sequence = s->rtp_context.sequence;
+    p.timestamp = s->rtp_context.timestamp;
+    p.arrival = arrival;
+
+    if (p.timestamp == s->opus_timestamp) {
+        opus_decode_packet(s, &p);
+        opus_decode_pending(s);
+        return;
+    }
+
+    if (s->n_opus_pending >= MAX_OPUS_PENDING)
+        opus_decode_lost(s);
+
+    /* Its audio has been replaced already */
+    if ((int32_t) (p.timestamp - s->opus_timestamp) < 0) {
+        pa_memblock_unref(p.chunk.memblock);
+        return;
+    }
+
+    for (n = 0; n < s->n_opus_pending; n++)
+        if ((int32_t) (s->opus_pending[n].timestamp - p.timestamp) >= 0)
+            break;
+
+    /* A duplicate */
+    if (n < s->n_opus_pending && s->opus_pending[n].timestamp == p.timestamp) {
+        pa_memblock_unref(p.chunk.memblock);
+        return;
+    }
+
+    memmove(s->opus_pending + n + 1, s->opus_pending + n, (s->n_opus_pending - n) * sizeof(struct opus_packet));
+    s->opus_pending[n] = p;
+    s->n_opus_pending++;
+
+    opus_decode_pending(s);
+}
+#endif
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk) {
     struct session *s;
     pa_sink_input_assert_ref(i);
     pa_assert_se(s = i->userdata);
 
-    if (pa_memblockq_peek(s->memblockq, chunk) < 0)
-        return -1;
+#ifdef HAVE_OPUS
+    /* Packets that are still missing when their audio is due are lost */
+    while (s->n_opus_pending > 0 &&
+           pa_memblockq_get_read_index(s->memblockq) + (int64_t) length >= pa_memblockq_get_write_index(s->memblockq))
+        opus_decode_lost(s);
+#endif
 
-    pa_memblockq_drop(s->memblockq, chunk->length);
+    if (pa_rtp_jitter_buffer_pop(s->jitter_buffer, s->memblockq, length, chunk) < 0)
+        return -1;
 
     return 0;
 }
@@ -203,89 +370,60 @@ static void sink_input_suspend_within_thread(pa_sink_input* i, bool b) {
 }
 
 /* Called from I/O thread context */
-static int rtpoll_work_cb(pa_rtpoll_item *i) {
-    pa_memchunk chunk;
-    int64_t k, j, delta;
-    struct timeval now = { 0, 0 };
-    struct session *s;
-    struct pollfd *p;
-
-    pa_assert_se(s = pa_rtpoll_item_get_userdata(i));
-
-    p = pa_rtpoll_item_get_pollfd(i, NULL);
-
-    if (p->revents & (POLLERR|POLLNVAL|POLLHUP|POLLOUT)) {
-        pa_log("poll() signalled bad revents.");
-        return -1;
-    }
-
-    if ((p->revents & POLLIN) == 0)
-        return 0;
-
-    p->revents = 0;
-
-    if (pa_rtp_recv(&s->rtp_context, &chunk, s->userdata->module->core->mempool, &now) < 0)
-        return 0;
-
+static void session_push_packet(struct session *s, pa_memchunk *chunk, struct timeval *now) {
     if (s->sdp_info.payload != s->rtp_context.payload ||
         !PA_SINK_IS_OPENED(s->sink_input->sink->thread_info.state)) {
-        pa_memblock_unref(chunk.memblock);
-        return 0;
+        pa_memblock_unref(chunk->memblock);
+        return;
     }
 
     if (!s->first_packet) {
         s->first_packet = true;
 
         s->ssrc = s->rtp_context.ssrc;
-        s->offset = s->rtp_context.timestamp;
+        pa_rtp_jitter_buffer_reset(s->jitter_buffer);
+#ifdef HAVE_OPUS
+        opus_reset(s);
+#endif
 
         if (s->ssrc == s->userdata->module->core->cookie)
             pa_log_warn("Detected RTP packet loop!");
     } else {
         if (s->ssrc != s->rtp_context.ssrc) {
-            pa_memblock_unref(chunk.memblock);
-            return 0;
+            pa_memblock_unref(chunk->memblock);
+            return;
         }
     }
 
-    /* Check whether there was a timestamp overflow */
-    k = (int64_t) s->rtp_context.timestamp - (int64_t) s->offset;
-    j = (int64_t) 0x100000000LL - (int64_t) s->offset + (int64_t) s->rtp_context.timestamp;
-
-    if ((k < 0 ? -k : k) < (j < 0 ? -j : j))
-        delta = k;
-    else
-        delta = j;
-
-    pa_memblockq_seek(s->memblockq, delta * (int64_t) s->rtp_context.frame_size, PA_SEEK_RELATIVE, true);
-
-    if (now.tv_sec == 0) {
+    if (now->tv_sec == 0) {
         PA_ONCE_BEGIN {
             pa_log_warn("Using artificial time instead of timestamp");
         } PA_ONCE_END;
-        pa_rtclock_get(&now);
+        pa_rtclock_get(now);
     } else
-        pa_rtclock_from_wallclock(&now);
+        pa_rtclock_from_wallclock(now);
 
-    if (pa_memblockq_push(s->memblockq, &chunk) < 0) {
-        pa_log_warn("Queue overrun");
-        pa_memblockq_seek(s->memblockq, (int64_t) chunk.length, PA_SEEK_RELATIVE, true);
+#ifdef HAVE_OPUS
+    if (s->opus_decoder)
+        /* Decoded in order, and then put in place by the jitter buffer */
+        opus_push_packet(s, chunk, pa_timeval_load(now));
+    else
+#endif
+    {
+        /* The jitter buffer puts the packet in place, or drops it if it is
+         * too late */
+        pa_rtp_jitter_buffer_push(s->jitter_buffer, s->memblockq, s->rtp_context.sequence, s->rtp_context.timestamp,
+                                  chunk, pa_timeval_load(now));
+        pa_memblock_unref(chunk->memblock);
     }
 
 /*     pa_log("blocks in q: %u", pa_memblockq_get_nblocks(s->memblockq)); */
 
-    pa_memblock_unref(chunk.memblock);
-
-    /* The next timestamp we expect */
-    s->offset = s->rtp_context.timestamp + (uint32_t) (chunk.length / s->rtp_context.frame_size);
-
-    pa_atomic_store(&s->timestamp, (int) now.tv_sec);
+    pa_atomic_store(&s->timestamp, (int) now->tv_sec);
 
-    if (s->last_rate_update + RATE_UPDATE_INTERVAL < pa_timeval_load(&now)) {
+    if (s->last_rate_update + RATE_UPDATE_INTERVAL < pa_timeval_load(now)) {
         pa_usec_t wi, ri, render_delay, sink_delay = 0, latency;
-        uint32_t current_rate = s->sink_input->sample_spec.rate;
         uint32_t new_rate;
-        double estimated_rate, alpha = 0.02;
 
         pa_log_debug("Updating sample rate");
 
@@ -307,70 +445,81 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
         else
             latency = wi - ri;
 
-        pa_log_debug("Write index deviates by %0.2f ms, expected %0.2f ms", (double) latency/PA_USEC_PER_MSEC, (double) s->intended_latency/PA_USEC_PER_MSEC);
+        if (s->userdata->adaptive_latency) {
+            pa_usec_t max_latency = PA_MAX(s->userdata->latency, s->sink_latency*2);
 
-        /* The buffer is filling with some unknown rate R̂ samples/second. If the rate of reading in
-         * the last T seconds was Rⁿ, then the increase in buffer latency ΔLⁿ = Lⁿ - Lⁿ⁻ⁱ in that
-         * same period is ΔLⁿ = (TR̂ - TRⁿ) / R̂, giving the estimated target rate
-         *                                           T
-         *                                 R̂ = ─────────────── Rⁿ .                             (1)
-         *                                     T - (Lⁿ - Lⁿ⁻ⁱ)
-         *
-         * Setting the sample rate to R̂ results in the latency being constant (if the estimate of R̂
-         * is correct).  But there is also the requirement to keep the buffer at a predefined target
-         * latency L̂.  So instead of setting Rⁿ⁺ⁱ to R̂ immediately, the strategy will be to reduce R
-         * from Rⁿ⁺ⁱ to R̂ in a steps of T seconds, where Rⁿ⁺ⁱ is chosen such that in the total time
-         * aT the latency is reduced from Lⁿ to L̂.  This strategy translates to the requirements
-         *            ₐ      R̂ - Rⁿ⁺ʲ                            a-j+1         j-1
-         *            Σ  T ────────── = L̂ - Lⁿ    with    Rⁿ⁺ʲ = ───── Rⁿ⁺ⁱ + ───── R̂ .
-         *           ʲ⁼ⁱ        R̂                                  a            a
-         * Solving for Rⁿ⁺ⁱ gives
-         *                                     T - ²∕ₐ₊₁(L̂ - Lⁿ)
-         *                              Rⁿ⁺ⁱ = ───────────────── R̂ .                            (2)
-         *                                            T
-         * In the code below a = 7 is used.
-         *
-         * Equation (1) is not directly used in (2), but instead an exponentially weighted average
-         * of the estimated rate R̂ is used.  This average R̅ is defined as
-         *                                R̅ⁿ = α R̂ⁿ + (1-α) R̅ⁿ⁻ⁱ .
-         * Because it is difficult to find a fixed value for the coefficient α such that the
-         * averaging is without significant lag but oscillations are filtered out, a heuristic is
-         * used.  When the successive estimates R̂ⁿ do not change much then α→1, but when there is a
-         * sudden spike in the estimated rate α→0, such that the deviation is given little weight.
-         */
-        estimated_rate = (double) current_rate * (double) RATE_UPDATE_INTERVAL / (double) (RATE_UPDATE_INTERVAL + s->last_latency - latency);
-        if (fabs(s->estimated_rate - s->avg_estimated_rate) > 1) {
-          double ratio = (estimated_rate + s->estimated_rate - 2*s->avg_estimated_rate) / (s->estimated_rate - s->avg_estimated_rate);
-          alpha = PA_CLAMP(2 * (ratio + fabs(ratio)) / (4 + ratio*ratio), 0.02, 0.8);
-        }
-        s->avg_estimated_rate = alpha * estimated_rate + (1-alpha) * s->avg_estimated_rate;
-        s->estimated_rate = estimated_rate;
-        pa_log_debug("Estimated target rate: %.0f Hz, using average of %.0f Hz  (α=%.3f)", estimated_rate, s->avg_estimated_rate, alpha);
-        new_rate = (uint32_t) ((double) (RATE_UPDATE_INTERVAL + latency/4 - s->intended_latency/4) / (double) RATE_UPDATE_INTERVAL * s->avg_estimated_rate);
-        s->last_latency = latency;
-
-        if (new_rate < (uint32_t) (s->base_rate*0.8) || new_rate > (uint32_t) (s->base_rate*1.25)) {
-            pa_log_warn("Sample rates too different, not adjusting (%u vs. %u).", s->base_rate, new_rate);
-            new_rate = s->base_rate;
-        } else {
-            if (s->base_rate < new_rate + 20 && new_rate < s->base_rate + 20)
-                new_rate = s->base_rate;
-            /* Do the adjustment in small steps; 2‰ can be considered inaudible */
-            if (new_rate < (uint32_t) (current_rate*0.998) || new_rate > (uint32_t) (current_rate*1.002)) {
-                pa_log_info("New rate of %u Hz not within 2‰ of %u Hz, forcing smaller adjustment", new_rate, current_rate);
-                new_rate = PA_CLAMP(new_rate, (uint32_t) (current_rate*0.998), (uint32_t) (current_rate*1.002));
-            }
+            /* Buffer as much as the network jitter requires, in addition to
+             * what the sink needs */
+            s->intended_latency = PA_CLAMP(s->sink_latency + pa_rtp_jitter_buffer_get_target(s->jitter_buffer),
+                                           s->sink_latency*2, max_latency);
+            pa_memblockq_set_prebuf(s->memblockq, pa_usec_to_bytes(s->intended_latency - s->sink_latency, &s->sink_input->sample_spec));
         }
+
+        pa_log_debug("Write index deviates by %0.2f ms, expected %0.2f ms", (double) latency/PA_USEC_PER_MSEC, (double) s->intended_latency/PA_USEC_PER_MSEC);
+
+        /* The sender's clock drifts against ours. Let the drift controller
+         * find the rate at which the buffer stays at the intended latency. */
+        new_rate = pa_drift_controller_update(s->drift_controller, pa_timeval_load(now),
+                                              (int64_t) latency - (int64_t) s->intended_latency, s->base_rate);
+
         s->sink_input->sample_spec.rate = new_rate;
 
         pa_assert(pa_sample_spec_valid(&s->sink_input->sample_spec));
 
         pa_resampler_set_input_rate(s->sink_input->thread_info.resampler, s->sink_input->sample_spec.rate);
 
-        pa_log_debug("Updated sampling rate to %lu Hz.", (unsigned long) s->sink_input->sample_spec.rate);
+        pa_log_debug("Updated sampling rate to %lu Hz, estimated drift is %0.1f ppm.", (unsigned long) s->sink_input->sample_spec.rate,
+                     pa_drift_controller_get_drift(s->drift_controller) * 1e6);
+
+        s->last_rate_update = pa_timeval_load(now);
+    }
+
+    if (s->last_stats_update + STATS_INTERVAL < pa_timeval_load(now)) {
+        pa_rtp_jitter_buffer_stats stats;
+
+        pa_rtp_jitter_buffer_get_stats(s->jitter_buffer, s->memblockq, &stats);
+        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_UPDATE_STATS,
+                          pa_xmemdup(&stats, sizeof(stats)), 0, NULL, pa_xfree);
 
-        s->last_rate_update = pa_timeval_load(&now);
+        s->last_stats_update = pa_timeval_load(now);
     }
+}
+
+/* Called from I/O thread context */
+static int rtpoll_work_cb(pa_rtpoll_item *i) {
+    pa_memchunk chunk;
+    struct timeval now = { 0, 0 };
+    unsigned n = 0;
+    struct session *s;
+    struct pollfd *p;
+
+    pa_assert_se(s = pa_rtpoll_item_get_userdata(i));
+
+    p = pa_rtpoll_item_get_pollfd(i, NULL);
+
+    if (p->revents & (POLLERR|POLLNVAL|POLLHUP|POLLOUT)) {
+        pa_log("poll() signalled bad revents.");
+        return -1;
+    }
+
+    if ((p->revents & POLLIN) == 0)
+        return 0;
+
+    p->revents = 0;
+
+    /* The RTP context receives several packets at once where possible.
+     * Take what is queued, but give the sink a chance to run under a
+     * flood. Packets already received must be taken now, as poll() won't
+     * tell us about them again. */
+    while (pa_rtp_recv(&s->rtp_context, &chunk, s->userdata->module->core->mempool, &now) >= 0) {
+        session_push_packet(s, &chunk, &now);
+
+        if (++n >= MAX_PACKETS_PER_WAKEUP && !pa_rtp_recv_pending(&s->rtp_context))
+            break;
+    }
+
+    if (n == 0)
+        return 0;
 
     if (pa_memblockq_is_readable(s->memblockq) &&
         s->sink_input->thread_info.underrun_for > 0) {
@@ -492,7 +641,6 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     struct session *s = NULL;
     pa_sink *sink;
     int fd = -1;
-    pa_memchunk silence;
     pa_sink_input_new_data data;
     struct timeval now;
 
@@ -518,12 +666,23 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     s->rtpoll_item = NULL;
     s->intended_latency = u->latency;
     s->last_rate_update = pa_timeval_load(&now);
-    s->last_latency = u->latency;
+    s->last_stats_update = pa_timeval_load(&now);
     pa_atomic_store(&s->timestamp, (int) now.tv_sec);
 
     if ((fd = mcast_socket((const struct sockaddr*) &sdp_info->sa, sdp_info->salen)) < 0)
         goto fail;
 
+#ifdef HAVE_OPUS
+    if (sdp_info->encoding == PA_RTP_ENCODING_OPUS &&
+        !(s->opus_decoder = pa_rtp_opus_decoder_new(&sdp_info->sample_spec)))
+        goto fail;
+#else
+    if (sdp_info->encoding == PA_RTP_ENCODING_OPUS) {
+        pa_log("Opus support is not available, ignoring session.");
+        goto fail;
+    }
+#endif
+
     pa_sink_input_new_data_init(&data);
     pa_sink_input_new_data_set_sink(&data, sink, false, true);
     data.driver = __FILE__;
@@ -538,6 +697,7 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
         pa_proplist_sets(data.proplist, "rtp.session", sdp_info->session_name);
     pa_proplist_sets(data.proplist, "rtp.origin", sdp_info->origin);
     pa_proplist_setf(data.proplist, "rtp.payload", "%u", (unsigned) sdp_info->payload);
+    pa_proplist_sets(data.proplist, "rtp.encoding", sdp_info->encoding == PA_RTP_ENCODING_OPUS ? "opus" : "pcm");
     data.module = u->module;
     pa_sink_input_new_data_set_sample_spec(&data, &sdp_info->sample_spec);
     data.flags = PA_SINK_INPUT_VARIABLE_RATE;
@@ -550,9 +710,8 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
         goto fail;
     }
 
-    s->base_rate = (double) s->sink_input->sample_spec.rate;
-    s->estimated_rate = (double) s->sink_input->sample_spec.rate;
-    s->avg_estimated_rate = (double) s->sink_input->sample_spec.rate;
+    s->base_rate = s->sink_input->sample_spec.rate;
+    s->drift_controller = pa_drift_controller_new(RATE_UPDATE_INTERVAL, MAX_RATE_DEVIATION);
 
     s->sink_input->userdata = s;
 
@@ -565,13 +724,13 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     s->sink_input->detach = sink_input_detach;
     s->sink_input->suspend_within_thread = sink_input_suspend_within_thread;
 
-    pa_sink_input_get_silence(s->sink_input, &silence);
-
     s->sink_latency = pa_sink_input_set_requested_latency(s->sink_input, s->intended_latency/2);
 
     if (s->intended_latency < s->sink_latency*2)
         s->intended_latency = s->sink_latency*2;
 
+    /* Without a silence memchunk, so that the jitter buffer sees the gaps
+     * of lost packets */
     s->memblockq = pa_memblockq_new(
             "module-rtp-recv memblockq",
             0,
@@ -581,11 +740,13 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
             pa_usec_to_bytes(s->intended_latency - s->sink_latency, &s->sink_input->sample_spec),
             0,
             0,
-            &silence);
+            NULL);
 
-    pa_memblock_unref(silence.memblock);
+    s->jitter_buffer = pa_rtp_jitter_buffer_new(&s->sink_input->sample_spec, u->module->core->mempool);
 
-    pa_rtp_context_init_recv(&s->rtp_context, fd, pa_frame_size(&s->sdp_info.sample_spec));
+    /* Encoded packets can have any size */
+    pa_rtp_context_init_recv(&s->rtp_context, fd,
+                             s->sdp_info.encoding == PA_RTP_ENCODING_PCM ? pa_frame_size(&s->sdp_info.sample_spec) : 1);
 
     pa_hashmap_put(s->userdata->by_origin, s->sdp_info.origin, s);
     u->n_sessions++;
@@ -598,6 +759,11 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     return s;
 
 fail:
+#ifdef HAVE_OPUS
+    if (s && s->opus_decoder)
+        pa_rtp_opus_decoder_free(s->opus_decoder);
+#endif
+
     pa_xfree(s);
 
     if (fd >= 0)
@@ -619,9 +785,18 @@ static void session_free(struct session *s) {
     s->userdata->n_sessions--;
 
     pa_memblockq_free(s->memblockq);
+    pa_rtp_jitter_buffer_free(s->jitter_buffer);
+    pa_drift_controller_free(s->drift_controller);
     pa_sdp_info_destroy(&s->sdp_info);
     pa_rtp_context_destroy(&s->rtp_context);
 
+#ifdef HAVE_OPUS
+    if (s->opus_decoder) {
+        opus_reset(s);
+        pa_rtp_opus_decoder_free(s->opus_decoder);
+    }
+#endif
+
     pa_xfree(s);
 }
 
@@ -700,6 +875,7 @@ int pa__init(pa_module*m) {
     socklen_t salen;
     const char *sap_address;
     uint32_t latency_msec;
+    bool adaptive_latency = false;
     int fd = -1;
 
     pa_assert(m);
@@ -734,6 +910,11 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "adaptive_latency", &adaptive_latency) < 0) {
+        pa_log("Failed to parse adaptive_latency argument");
+        goto fail;
+    }
+
     if ((fd = mcast_socket(sa, salen)) < 0)
         goto fail;
 
@@ -742,6 +923,7 @@ int pa__init(pa_module*m) {
     u->core = m->core;
     u->sink_name = pa_xstrdup(pa_modargs_get_value(ma, "sink", NULL));
     u->latency = (pa_usec_t) latency_msec * PA_USEC_PER_MSEC;
+    u->adaptive_latency = adaptive_latency;
 
     u->sap_event = m->core->mainloop->io_new(m->core->mainloop, fd, PA_IO_EVENT_INPUT, sap_event_cb, u);
     pa_sap_context_init_recv(&u->sap_context, fd);
@@ -49,6 +49,9 @@
 #include "rtp.h"
 #include "sdp.h"
 #include "sap.h"
+#ifdef HAVE_OPUS
+#include "opus-codec.h"
+#endif
 
 PA_MODULE_AUTHOR("Lennart Poettering");
 PA_MODULE_DESCRIPTION("Read data from source and send it to the network via RTP/SAP/SDP");
@@ -66,7 +69,9 @@ PA_MODULE_USAGE(
         "loop=<loopback to local host?> "
         "ttl=<ttl value> "
         "inhibit_auto_suspend=<always|never|only_with_non_monitor_sources>"
-        "stream_name=<name of the stream>"
+        "stream_name=<name of the stream> "
+        "encoding=<pcm or opus> "
+        "bitrate=<bit rate of Opus streams in bit/s>"
 );
 
 #define DEFAULT_PORT 46000
@@ -77,6 +82,7 @@ PA_MODULE_USAGE(
 #define MEMBLOCKQ_MAXLENGTH (1024*170)
 #define DEFAULT_MTU 1280
 #define SAP_INTERVAL (5*PA_USEC_PER_SEC)
+#define OPUS_FRAME_DURATION (10*PA_USEC_PER_MSEC)
 
 static const char* const valid_modargs[] = {
     "source",
@@ -92,6 +98,8 @@ static const char* const valid_modargs[] = {
     "ttl",
     "inhibit_auto_suspend",
     "stream_name",
+    "encoding",
+    "bitrate",
     NULL
 };
 
@@ -114,6 +122,10 @@ struct userdata {
     pa_time_event *sap_event;
 
     enum inhibit_auto_suspend inhibit_auto_suspend;
+
+#ifdef HAVE_OPUS
+    pa_rtp_opus_encoder *opus_encoder;
+#endif
 };
 
 /* Called from I/O thread context */
@@ -133,6 +145,43 @@ static int source_output_process_msg(pa_msgobject *o, int code, void *data, int6
     return pa_source_output_process_msg(o, code, data, offset, chunk);
 }
 
+#ifdef HAVE_OPUS
+/* Called from I/O thread context */
+static void send_opus(struct userdata *u) {
+    size_t frame_bytes = pa_rtp_opus_encoder_get_frame_bytes(u->opus_encoder);
+    uint32_t n_frames = (uint32_t) (frame_bytes / pa_frame_size(&u->source_output->sample_spec));
+
+    /* Each packet carries one Opus frame */
+    while (pa_memblockq_get_length(u->memblockq) >= frame_bytes) {
+        pa_memchunk pcm, packet;
+        void *src;
+        int r;
+
+        pa_assert_se(pa_memblockq_peek_fixed_size(u->memblockq, frame_bytes, &pcm) >= 0);
+
+        packet.memblock = pa_memblock_new(u->module->core->mempool, u->mtu);
+        packet.index = 0;
+
+        src = pa_memblock_acquire_chunk(&pcm);
+        r = pa_rtp_opus_encode(u->opus_encoder, src, pa_memblock_acquire(packet.memblock), u->mtu);
+        pa_memblock_release(packet.memblock);
+        pa_memblock_release(pcm.memblock);
+
+        pa_memblock_unref(pcm.memblock);
+        pa_memblockq_drop(u->memblockq, frame_bytes);
+
+        if (r > 0) {
+            packet.length = (size_t) r;
+            pa_rtp_send_packet(&u->rtp_context, &packet, n_frames);
+        } else
+            /* Leave a gap, so that the receiver conceals it */
+            u->rtp_context.timestamp += n_frames;
+
+        pa_memblock_unref(packet.memblock);
+    }
+}
+#endif
+
 /* Called from I/O thread context */
 static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
     struct userdata *u;
@@ -144,6 +193,13 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
         return;
     }
 
+#ifdef HAVE_OPUS
+    if (u->opus_encoder) {
+        send_opus(u);
+        return;
+    }
+#endif
+
     pa_rtp_send(&u->rtp_context, u->mtu, u->memblockq);
 }
 
@@ -212,6 +268,12 @@ int pa__init(pa_module*m) {
     const char *src_addr;
     uint32_t port = DEFAULT_PORT, mtu;
     uint32_t ttl = DEFAULT_TTL;
+    uint32_t bitrate = 0;
+    pa_rtp_encoding_t encoding = PA_RTP_ENCODING_PCM;
+    const char *encoding_str;
+#ifdef HAVE_OPUS
+    pa_rtp_opus_encoder *opus_encoder = NULL;
+#endif
     sa_family_t af;
     int fd = -1, sap_fd = -1;
     pa_source *s;
@@ -263,15 +325,50 @@ int pa__init(pa_module*m) {
         }
     }
 
+    if ((encoding_str = pa_modargs_get_value(ma, "encoding", NULL))) {
+        if (pa_streq(encoding_str, "pcm"))
+            encoding = PA_RTP_ENCODING_PCM;
+        else if (pa_streq(encoding_str, "opus"))
+            encoding = PA_RTP_ENCODING_OPUS;
+        else {
+            pa_log("Failed to parse the \"encoding\" parameter.");
+            goto fail;
+        }
+    }
+
+#ifndef HAVE_OPUS
+    if (encoding == PA_RTP_ENCODING_OPUS) {
+        pa_log("Opus support is not available.");
+        goto fail;
+    }
+#endif
+
+    if (pa_modargs_get_value_u32(ma, "bitrate", &bitrate) < 0) {
+        pa_log("Failed to parse the \"bitrate\" parameter.");
+        goto fail;
+    }
+
     ss = s->sample_spec;
-    pa_rtp_sample_spec_fixup(&ss);
     cm = s->channel_map;
+
+    if (encoding == PA_RTP_ENCODING_OPUS) {
+        ss.format = PA_SAMPLE_S16NE;
+        ss.rate = PA_RTP_OPUS_RATE;
+        ss.channels = PA_MIN(ss.channels, 2);
+    } else
+        pa_rtp_sample_spec_fixup(&ss);
+
     if (pa_modargs_get_sample_spec(ma, &ss) < 0) {
         pa_log("Failed to parse sample specification");
         goto fail;
     }
 
-    if (!pa_rtp_sample_spec_valid(&ss)) {
+    if (encoding == PA_RTP_ENCODING_OPUS) {
+        if (ss.format != PA_SAMPLE_S16NE || ss.rate != PA_RTP_OPUS_RATE || ss.channels > 2) {
+            pa_log("Opus streams must be s16ne at %u Hz with one or two channels", PA_RTP_OPUS_RATE);
+            goto fail;
+        }
+    } else if (!pa_rtp_sample_spec_valid(&ss)) {
         pa_log("Specified sample type not compatible with RTP");
         goto fail;
     }
@@ -279,7 +376,15 @@ int pa__init(pa_module*m) {
     if (ss.channels != cm.channels)
         pa_channel_map_init_auto(&cm, ss.channels, PA_CHANNEL_MAP_AIFF);
 
-    payload = pa_rtp_payload_from_sample_spec(&ss);
+    if (encoding == PA_RTP_ENCODING_OPUS) {
+        payload = PA_RTP_OPUS_PAYLOAD;
+
+#ifdef HAVE_OPUS
+        if (!(opus_encoder = pa_rtp_opus_encoder_new(&ss, bitrate, OPUS_FRAME_DURATION)))
+            goto fail;
+#endif
+    } else
+        payload = pa_rtp_payload_from_sample_spec(&ss);
 
     mtu = (uint32_t) pa_frame_align(DEFAULT_MTU, &ss);
 
@@ -428,6 +533,7 @@ int pa__init(pa_module*m) {
     pa_proplist_setf(data.proplist, "rtp.mtu", "%lu", (unsigned long) mtu);
     pa_proplist_setf(data.proplist, "rtp.port", "%lu", (unsigned long) port);
     pa_proplist_setf(data.proplist, "rtp.ttl", "%lu", (unsigned long) ttl);
+    pa_proplist_sets(data.proplist, "rtp.encoding", encoding == PA_RTP_ENCODING_OPUS ? "opus" : "pcm");
     data.driver = __FILE__;
     data.module = m;
     pa_source_output_new_data_set_source(&data, s, false, true);
@@ -449,11 +555,15 @@ int pa__init(pa_module*m) {
     o->kill = source_output_kill_cb;
 
     pa_log_info("Configured source latency of %llu ms.",
-                (unsigned long long) pa_source_output_set_requested_latency(o, pa_bytes_to_usec(mtu, &o->sample_spec)) / PA_USEC_PER_MSEC);
+                (unsigned long long) pa_source_output_set_requested_latency(o,
+                    encoding == PA_RTP_ENCODING_OPUS ? OPUS_FRAME_DURATION : pa_bytes_to_usec(mtu, &o->sample_spec)) / PA_USEC_PER_MSEC);
 
-    m->userdata = o->userdata = u = pa_xnew(struct userdata, 1);
+    m->userdata = o->userdata = u = pa_xnew0(struct userdata, 1);
     u->module = m;
     u->source_output = o;
+#ifdef HAVE_OPUS
+    u->opus_encoder = opus_encoder;
+#endif
 
     u->memblockq = pa_memblockq_new(
             "module-rtp-send memblockq",
@@ -479,13 +589,13 @@ int pa__init(pa_module*m) {
         p = pa_sdp_build(af,
                      (void*) &((struct sockaddr_in*) &sa_dst)->sin_addr,
                      (void*) &dst_sa4.sin_addr,
-                     n, (uint16_t) port, payload, &ss);
+                     n, (uint16_t) port, payload, encoding, &ss);
 #ifdef HAVE_IPV6
     } else {
         p = pa_sdp_build(af,
                      (void*) &((struct sockaddr_in6*) &sa_dst)->sin6_addr,
                      (void*) &dst_sa6.sin6_addr,
-                     n, (uint16_t) port, payload, &ss);
+                     n, (uint16_t) port, payload, encoding, &ss);
 #endif
     }
 
@@ -518,6 +628,11 @@ fail:
     if (sap_fd >= 0)
         pa_close(sap_fd);
 
+#ifdef HAVE_OPUS
+    if (opus_encoder)
+        pa_rtp_opus_encoder_free(opus_encoder);
+#endif
+
     return -1;
 }
 
@@ -544,5 +659,10 @@ void pa__done(pa_module*m) {
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
+#ifdef HAVE_OPUS
+    if (u->opus_encoder)
+        pa_rtp_opus_encoder_free(u->opus_encoder);
+#endif
+
     pa_xfree(u);
 }
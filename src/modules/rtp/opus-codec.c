@@ -0,0 +1,229 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <opus.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "rtp.h"
+#include "opus-codec.h"
+
+struct pa_rtp_opus_encoder {
+    OpusEncoder *encoder;
+    size_t frame_size;
+    int n_frames;
+};
+
+struct pa_rtp_opus_decoder {
+    OpusDecoder *decoder;
+    size_t frame_size;
+};
+
+static bool sample_spec_valid(const pa_sample_spec *ss) {
+    return ss->format == PA_SAMPLE_S16NE && ss->rate == PA_RTP_OPUS_RATE && (ss->channels == 1 || ss->channels == 2);
+}
+
+pa_rtp_opus_encoder* pa_rtp_opus_encoder_new(const pa_sample_spec *ss, uint32_t bitrate, pa_usec_t frame_duration) {
+    pa_rtp_opus_encoder *e;
+    int err;
+
+    pa_assert(ss);
+    pa_assert(sample_spec_valid(ss));
+
+    switch (frame_duration) {
+        case 2500:
+        case 5 * PA_USEC_PER_MSEC:
+        case 10 * PA_USEC_PER_MSEC:
+        case 20 * PA_USEC_PER_MSEC:
+        case 40 * PA_USEC_PER_MSEC:
+        case 60 * PA_USEC_PER_MSEC:
+            break;
+
+        default:
+            pa_log("Invalid Opus frame duration %llu us.", (unsigned long long) frame_duration);
+            return NULL;
+    }
+
+    e = pa_xnew0(pa_rtp_opus_encoder, 1);
+    e->frame_size = pa_frame_size(ss);
+    e->n_frames = (int) (frame_duration * PA_RTP_OPUS_RATE / PA_USEC_PER_SEC);
+
+    /* The restricted low delay mode uses CELT only, which has the lowest
+     * algorithmic delay */
+    if (!(e->encoder = opus_encoder_create(PA_RTP_OPUS_RATE, ss->channels, OPUS_APPLICATION_RESTRICTED_LOWDELAY, &err))) {
+        pa_log("Failed to create Opus encoder: %s", opus_strerror(err));
+        pa_xfree(e);
+        return NULL;
+    }
+
+    if (bitrate > 0 && (err = opus_encoder_ctl(e->encoder, OPUS_SET_BITRATE((opus_int32) bitrate))) != OPUS_OK) {
+        pa_log("Failed to set Opus bitrate to %lu bit/s: %s", (unsigned long) bitrate, opus_strerror(err));
+        pa_rtp_opus_encoder_free(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+void pa_rtp_opus_encoder_free(pa_rtp_opus_encoder *e) {
+    pa_assert(e);
+
+    opus_encoder_destroy(e->encoder);
+    pa_xfree(e);
+}
+
+size_t pa_rtp_opus_encoder_get_frame_bytes(pa_rtp_opus_encoder *e) {
+    pa_assert(e);
+
+    return (size_t) e->n_frames * e->frame_size;
+}
+
+int pa_rtp_opus_encode(pa_rtp_opus_encoder *e, const void *pcm, uint8_t *packet, size_t max_size) {
+    opus_int32 r;
+
+    pa_assert(e);
+    pa_assert(pcm);
+    pa_assert(packet);
+
+    if ((r = opus_encode(e->encoder, pcm, e->n_frames, packet, (opus_int32) max_size)) < 0) {
+        pa_log_warn("Opus encoding failed: %s", opus_strerror(r));
+        return -1;
+    }
+
+    return (int) r;
+}
+
+pa_rtp_opus_decoder* pa_rtp_opus_decoder_new(const pa_sample_spec *ss) {
+    pa_rtp_opus_decoder *d;
+    int err;
+
+    pa_assert(ss);
+    pa_assert(sample_spec_valid(ss));
+
+    d = pa_xnew0(pa_rtp_opus_decoder, 1);
+    d->frame_size = pa_frame_size(ss);
+
+    if (!(d->decoder = opus_decoder_create(PA_RTP_OPUS_RATE, ss->channels, &err))) {
+        pa_log("Failed to create Opus decoder: %s", opus_strerror(err));
+        pa_xfree(d);
+        return NULL;
+    }
+
+    return d;
+}
+
+void pa_rtp_opus_decoder_free(pa_rtp_opus_decoder *d) {
+    pa_assert(d);
+
+    opus_decoder_destroy(d->decoder);
+    pa_xfree(d);
+}
+
+int pa_rtp_opus_decode(pa_rtp_opus_decoder *d, const pa_memchunk *packet, pa_memchunk *pcm, pa_mempool *pool) {
+    const uint8_t *data;
+    int n_frames, r;
+    void *dst;
+
+    pa_assert(d);
+    pa_assert(packet);
+    pa_assert(packet->memblock);
+    pa_assert(pcm);
+    pa_assert(pool);
+
+    data = pa_memblock_acquire_chunk(packet);
+
+    if ((n_frames = opus_packet_get_nb_samples(data, (opus_int32) packet->length, PA_RTP_OPUS_RATE)) <= 0) {
+        pa_memblock_release(packet->memblock);
+        pa_log_warn("Invalid Opus packet.");
+        return -1;
+    }
+
+    pcm->memblock = pa_memblock_new(pool, (size_t) n_frames * d->frame_size);
+    pcm->index = 0;
+
+    dst = pa_memblock_acquire(pcm->memblock);
+    r = opus_decode(d->decoder, data, (opus_int32) packet->length, dst, n_frames, 0);
+    pa_memblock_release(pcm->memblock);
+    pa_memblock_release(packet->memblock);
+
+    if (r < 0) {
+        pa_log_warn("Opus decoding failed: %s", opus_strerror(r));
+        pa_memblock_unref(pcm->memblock);
+        pa_memchunk_reset(pcm);
+        return -1;
+    }
+
+    pcm->length = (size_t) r * d->frame_size;
+
+    return 0;
+}
+
+int pa_rtp_opus_decode_lost(pa_rtp_opus_decoder *d, const pa_memchunk *next, unsigned n_frames, pa_memchunk *pcm, pa_mempool *pool) {
+    const uint8_t *data;
+    int n_fec, r = 0;
+    uint8_t *dst;
+
+    pa_assert(d);
+    pa_assert(next);
+    pa_assert(next->memblock);
+    pa_assert(pcm);
+    pa_assert(pool);
+
+    if (n_frames == 0 || n_frames % (PA_RTP_OPUS_RATE / 400) != 0 || n_frames > PA_RTP_OPUS_RATE * 120 / 1000)
+        return -1;
+
+    data = pa_memblock_acquire_chunk(next);
+
+    /* The forward error correction data covers as much as the packet
+     * it comes with */
+    if ((n_fec = opus_packet_get_nb_samples(data, (opus_int32) next->length, PA_RTP_OPUS_RATE)) <= 0 ||
+        (unsigned) n_fec > n_frames)
+        n_fec = 0;
+
+    pcm->memblock = pa_memblock_new(pool, n_frames * d->frame_size);
+    pcm->index = 0;
+    pcm->length = n_frames * d->frame_size;
+
+    dst = pa_memblock_acquire(pcm->memblock);
+
+    if (n_frames > (unsigned) n_fec)
+        r = opus_decode(d->decoder, NULL, 0, (opus_int16*) dst, (int) n_frames - n_fec, 0);
+
+    if (r >= 0 && n_fec > 0)
+        r = opus_decode(d->decoder, data, (opus_int32) next->length,
+                        (opus_int16*) (dst + (n_frames - (unsigned) n_fec) * d->frame_size), n_fec, 1);
+
+    pa_memblock_release(pcm->memblock);
+    pa_memblock_release(next->memblock);
+
+    if (r < 0) {
+        pa_log_warn("Opus loss concealment failed: %s", opus_strerror(r));
+        pa_memblock_unref(pcm->memblock);
+        pa_memchunk_reset(pcm);
+        return -1;
+    }
+
+    return 0;
+}
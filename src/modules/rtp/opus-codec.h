@@ -0,0 +1,61 @@
+#ifndef foortpopuscodechfoo
+#define foortpopuscodechfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+#include <pulse/sample.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/memchunk.h>
+
+/* Opus payloads as described in RFC 7587. The audio is encoded from and
+ * decoded to native endian 16 bit samples at PA_RTP_OPUS_RATE with one or
+ * two channels, which is also the clock rate of the RTP timestamps. */
+
+typedef struct pa_rtp_opus_encoder pa_rtp_opus_encoder;
+typedef struct pa_rtp_opus_decoder pa_rtp_opus_decoder;
+
+/* frame_duration must be one of the Opus frame sizes: 2.5, 5, 10, 20, 40
+ * or 60 ms. A bitrate of 0 lets the encoder choose. */
+pa_rtp_opus_encoder* pa_rtp_opus_encoder_new(const pa_sample_spec *ss, uint32_t bitrate, pa_usec_t frame_duration);
+void pa_rtp_opus_encoder_free(pa_rtp_opus_encoder *e);
+
+/* The number of PCM bytes that go into one packet */
+size_t pa_rtp_opus_encoder_get_frame_bytes(pa_rtp_opus_encoder *e);
+
+/* Encodes frame_bytes of PCM data into at most max_size bytes. Returns the
+ * size of the packet, or -1 on error. */
+int pa_rtp_opus_encode(pa_rtp_opus_encoder *e, const void *pcm, uint8_t *packet, size_t max_size);
+
+pa_rtp_opus_decoder* pa_rtp_opus_decoder_new(const pa_sample_spec *ss);
+void pa_rtp_opus_decoder_free(pa_rtp_opus_decoder *d);
+
+/* Decodes a packet into a new memblock from pool. Returns -1 if the
+ * packet is invalid. */
+int pa_rtp_opus_decode(pa_rtp_opus_decoder *d, const pa_memchunk *packet, pa_memchunk *pcm, pa_mempool *pool);
+
+/* Decodes n_frames of audio in place of lost packets into a new memblock
+ * from pool. The end of the gap is recovered from the forward error
+ * correction data of next, the packet after the gap, if it has any, and
+ * the rest is concealed by the decoder. Returns -1 if the gap is not a
+ * multiple of 2.5 ms or longer than 120 ms, which the decoder can't
+ * handle. */
+int pa_rtp_opus_decode_lost(pa_rtp_opus_decoder *d, const pa_memchunk *next, unsigned n_frames, pa_memchunk *pcm, pa_mempool *pool);
+
+#endif
@@ -43,6 +43,41 @@
 
 #include "rtp.h"
 
+#define MAX_IOVECS 16
+
+#ifdef HAVE_SENDMMSG
+#define SEND_BATCH_SIZE 16
+#else
+#define SEND_BATCH_SIZE 1
+#endif
+
+#ifdef HAVE_RECVMMSG
+#define RECV_BATCH_SIZE 16
+#define RECV_SLOT_SIZE_MAX (64*1024)
+#define RECV_AUX_SIZE 128
+
+/* Packets are received directly into a mempool block, each packet into a
+ * slot of slot_size bytes. The audio data is handed out as chunks of that
+ * block, so it is never copied. */
+struct pa_rtp_recv_batch {
+    size_t slot_size;
+
+    unsigned n_received, next;
+
+    struct mmsghdr msgs[RECV_BATCH_SIZE];
+    struct iovec iovs[RECV_BATCH_SIZE];
+    uint8_t aux[RECV_BATCH_SIZE][RECV_AUX_SIZE];
+    pa_memchunk chunks[RECV_BATCH_SIZE];
+};
+#endif
+
+struct send_packet {
+    uint32_t header[3];
+    struct iovec iov[MAX_IOVECS];
+    pa_memblock *mb[MAX_IOVECS];
+    int n_iov;
+};
+
 pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssrc, uint8_t payload, size_t frame_size) {
     pa_assert(c);
     pa_assert(fd >= 0);
@@ -56,17 +91,62 @@ pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssr
 
     c->recv_buf = NULL;
     c->recv_buf_size = 0;
+    c->recv_batch = NULL;
     pa_memchunk_reset(&c->memchunk);
 
     return c;
 }
 
-#define MAX_IOVECS 16
+/* Sends n packets, with a single system call if possible, and drops the
+ * references to their data. Returns the number of packets sent, or -1 if
+ * sending the first one failed. */
+static int send_packets(pa_rtp_context *c, struct send_packet *packets, unsigned n) {
+    int sent = 0;
+    unsigned i;
+    int j;
+
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[SEND_BATCH_SIZE];
+
+    pa_zero(msgs);
+
+    for (i = 0; i < n; i++) {
+        msgs[i].msg_hdr.msg_iov = packets[i].iov;
+        msgs[i].msg_hdr.msg_iovlen = (size_t) packets[i].n_iov;
+    }
+
+    sent = sendmmsg(c->fd, msgs, n, MSG_DONTWAIT);
+#else
+    for (i = 0; i < n; i++) {
+        struct msghdr m;
+
+        pa_zero(m);
+        m.msg_iov = packets[i].iov;
+        m.msg_iovlen = (size_t) packets[i].n_iov;
+
+        if (sendmsg(c->fd, &m, MSG_DONTWAIT) < 0) {
+            if (i == 0)
+                sent = -1;
+            break;
+        }
+
+        sent++;
+    }
+#endif
+
+    for (i = 0; i < n; i++)
+        for (j = 1; j < packets[i].n_iov; j++) {
+            pa_memblock_release(packets[i].mb[j]);
+            pa_memblock_unref(packets[i].mb[j]);
+        }
+
+    return sent;
+}
 
 int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
-    struct iovec iov[MAX_IOVECS];
-    pa_memblock* mb[MAX_IOVECS];
-    int iov_idx = 1;
+    struct send_packet packets[SEND_BATCH_SIZE];
+    unsigned n_packets = 0;
+    struct send_packet *p = &packets[0];
     size_t n = 0;
 
     pa_assert(c);
@@ -76,9 +156,12 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
     if (pa_memblockq_get_length(q) < size)
         return 0;
 
+    p->n_iov = 1;
+
     for (;;) {
         int r;
         pa_memchunk chunk;
+        bool done;
 
         pa_memchunk_reset(&chunk);
 
@@ -88,10 +171,10 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
 
             pa_assert(chunk.memblock);
 
-            iov[iov_idx].iov_base = pa_memblock_acquire_chunk(&chunk);
-            iov[iov_idx].iov_len = k;
-            mb[iov_idx] = chunk.memblock;
-            iov_idx ++;
+            p->iov[p->n_iov].iov_base = pa_memblock_acquire_chunk(&chunk);
+            p->iov[p->n_iov].iov_len = k;
+            p->mb[p->n_iov] = chunk.memblock;
+            p->n_iov++;
 
             n += k;
             pa_memblockq_drop(q, k);
@@ -99,53 +182,78 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
 
         pa_assert(n % c->frame_size == 0);
 
-        if (r < 0 || n >= size || iov_idx >= MAX_IOVECS) {
-            uint32_t header[3];
-            struct msghdr m;
-            ssize_t k;
-            int i;
-
-            if (n > 0) {
-                header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
-                header[1] = htonl(c->timestamp);
-                header[2] = htonl(c->ssrc);
+        if (r >= 0 && n < size && p->n_iov < MAX_IOVECS)
+            continue;
 
-                iov[0].iov_base = (void*)header;
-                iov[0].iov_len = sizeof(header);
+        /* The packet is complete */
+        if (n > 0) {
+            p->header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
+            p->header[1] = htonl(c->timestamp);
+            p->header[2] = htonl(c->ssrc);
 
-                m.msg_name = NULL;
-                m.msg_namelen = 0;
-                m.msg_iov = iov;
-                m.msg_iovlen = (size_t) iov_idx;
-                m.msg_control = NULL;
-                m.msg_controllen = 0;
-                m.msg_flags = 0;
+            p->iov[0].iov_base = (void*) p->header;
+            p->iov[0].iov_len = sizeof(p->header);
 
-                k = sendmsg(c->fd, &m, MSG_DONTWAIT);
+            n_packets++;
+            c->sequence++;
+        }
 
-                for (i = 1; i < iov_idx; i++) {
-                    pa_memblock_release(mb[i]);
-                    pa_memblock_unref(mb[i]);
-                }
+        c->timestamp += (unsigned) (n/c->frame_size);
 
-                c->sequence++;
-            } else
-                k = 0;
+        done = r < 0 || pa_memblockq_get_length(q) < size;
 
-            c->timestamp += (unsigned) (n/c->frame_size);
+        /* Send what we have when the batch is full or there is no
+         * further packet */
+        if (n_packets > 0 && (done || n_packets >= SEND_BATCH_SIZE)) {
+            int sent = send_packets(c, packets, n_packets);
 
-            if (k < 0) {
-                if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
+            if (sent < (int) n_packets) {
+                /* If the queue is full, just ignore it */
+                if (sent < 0 && errno != EAGAIN && errno != EINTR)
                     pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
                 return -1;
             }
 
-            if (r < 0 || pa_memblockq_get_length(q) < size)
-                break;
-
-            n = 0;
-            iov_idx = 1;
+            n_packets = 0;
         }
+
+        if (done)
+            break;
+
+        p = &packets[n_packets];
+        p->n_iov = 1;
+        n = 0;
+    }
+
+    return 0;
+}
+
+int pa_rtp_send_packet(pa_rtp_context *c, const pa_memchunk *chunk, uint32_t n_frames) {
+    struct send_packet p;
+
+    pa_assert(c);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+
+    p.header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
+    p.header[1] = htonl(c->timestamp);
+    p.header[2] = htonl(c->ssrc);
+
+    p.iov[0].iov_base = (void*) p.header;
+    p.iov[0].iov_len = sizeof(p.header);
+    p.iov[1].iov_base = pa_memblock_acquire_chunk(chunk);
+    p.iov[1].iov_len = chunk->length;
+    p.mb[1] = pa_memblock_ref(chunk->memblock);
+    p.n_iov = 2;
+
+    c->sequence++;
+    c->timestamp += n_frames;
+
+    if (send_packets(c, &p, 1) < 1) {
+        /* If the queue is full, just ignore it */
+        if (errno != EAGAIN && errno != EINTR)
+            pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
+        return -1;
     }
 
     return 0;
@@ -160,21 +268,228 @@ pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame
     c->recv_buf_size = 2000;
     c->recv_buf = pa_xmalloc(c->recv_buf_size);
     pa_memchunk_reset(&c->memchunk);
+
+#ifdef HAVE_RECVMMSG
+    c->recv_batch = pa_xnew0(struct pa_rtp_recv_batch, 1);
+    c->recv_batch->slot_size = c->recv_buf_size;
+#else
+    c->recv_batch = NULL;
+#endif
+
     return c;
 }
 
+/* Parses the RTP header of a packet of the given size, stores its fields in
+ * the context and returns the length of the header, or -1 if the packet is
+ * invalid. */
+static int parse_header(pa_rtp_context *c, const uint8_t *data, size_t size) {
+    uint32_t header;
+    unsigned cc;
+    size_t metadata_length;
+
+    if (size < 12) {
+        pa_log_warn("RTP packet too short.");
+        return -1;
+    }
+
+    memcpy(&header, data, sizeof(uint32_t));
+    memcpy(&c->timestamp, data + 4, sizeof(uint32_t));
+    memcpy(&c->ssrc, data + 8, sizeof(uint32_t));
+
+    header = ntohl(header);
+    c->timestamp = ntohl(c->timestamp);
+    c->ssrc = ntohl(c->ssrc);
+
+    if ((header >> 30) != 2) {
+        pa_log_warn("Unsupported RTP version.");
+        return -1;
+    }
+
+    if ((header >> 29) & 1) {
+        pa_log_warn("RTP padding not supported.");
+        return -1;
+    }
+
+    if ((header >> 28) & 1) {
+        pa_log_warn("RTP header extensions not supported.");
+        return -1;
+    }
+
+    cc = (header >> 24) & 0xF;
+    c->payload = (uint8_t) ((header >> 16) & 127U);
+    c->sequence = (uint16_t) (header & 0xFFFFU);
+
+    metadata_length = 12 + cc * 4;
+
+    if (metadata_length > size) {
+        pa_log_warn("RTP packet too short. (CSRC)");
+        return -1;
+    }
+
+    if ((size - metadata_length) % c->frame_size != 0) {
+        pa_log_warn("Bad RTP packet size.");
+        return -1;
+    }
+
+    return (int) metadata_length;
+}
+
+static void get_tstamp(struct msghdr *m, struct timeval *tstamp) {
+    struct cmsghdr *cm;
+
+    for (cm = CMSG_FIRSTHDR(m); cm; cm = CMSG_NXTHDR(m, cm))
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
+            memcpy(tstamp, CMSG_DATA(cm), sizeof(struct timeval));
+            return;
+        }
+
+    pa_log_warn("Couldn't find SCM_TIMESTAMP data in auxiliary recvmsg() data!");
+    pa_zero(*tstamp);
+}
+
+#ifdef HAVE_RECVMMSG
+
+/* Receives as many packets as are queued on the socket, up to
+ * RECV_BATCH_SIZE, with a single system call. Returns the number of
+ * packets received, or -1 if there are none. */
+static int recv_batch(pa_rtp_context *c, pa_mempool *pool) {
+    struct pa_rtp_recv_batch *b = c->recv_batch;
+    unsigned i;
+    int r;
+
+    for (i = 0; i < RECV_BATCH_SIZE; i++) {
+        pa_memchunk *slot = &b->chunks[i];
+
+        pa_assert(!slot->memblock);
+
+        /* Take the slots from the rest of the current block, or from a
+         * new one */
+        if (c->memchunk.length < b->slot_size) {
+            if (c->memchunk.memblock)
+                pa_memblock_unref(c->memchunk.memblock);
+
+            c->memchunk.memblock = pa_memblock_new(pool, PA_MAX(b->slot_size, pa_mempool_block_size_max(pool)));
+            c->memchunk.index = 0;
+            c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock);
+        }
+
+        slot->memblock = pa_memblock_ref(c->memchunk.memblock);
+        slot->index = c->memchunk.index;
+        slot->length = b->slot_size;
+
+        c->memchunk.index += b->slot_size;
+        c->memchunk.length -= b->slot_size;
+
+        b->iovs[i].iov_base = pa_memblock_acquire_chunk(slot);
+        b->iovs[i].iov_len = b->slot_size;
+
+        pa_zero(b->msgs[i]);
+        b->msgs[i].msg_hdr.msg_iov = &b->iovs[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+        b->msgs[i].msg_hdr.msg_control = b->aux[i];
+        b->msgs[i].msg_hdr.msg_controllen = sizeof(b->aux[i]);
+    }
+
+    r = recvmmsg(c->fd, b->msgs, RECV_BATCH_SIZE, MSG_DONTWAIT|MSG_TRUNC, NULL);
+
+    for (i = 0; i < RECV_BATCH_SIZE; i++)
+        pa_memblock_release(b->chunks[i].memblock);
+
+    /* Give back the slots that were not used. Those in the current block
+     * are at its end. */
+    for (i = r > 0 ? (unsigned) r : 0; i < RECV_BATCH_SIZE; i++) {
+        if (b->chunks[i].memblock == c->memchunk.memblock && b->chunks[i].index < c->memchunk.index) {
+            c->memchunk.length += c->memchunk.index - b->chunks[i].index;
+            c->memchunk.index = b->chunks[i].index;
+        }
+
+        pa_memblock_unref(b->chunks[i].memblock);
+        pa_memchunk_reset(&b->chunks[i]);
+    }
+
+    if (r <= 0) {
+        if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            pa_log_warn("recvmmsg() failed: %s", pa_cstrerror(errno));
+
+        b->n_received = b->next = 0;
+        return -1;
+    }
+
+    b->n_received = (unsigned) r;
+    b->next = 0;
+
+    return r;
+}
+
+int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
+    struct pa_rtp_recv_batch *b;
+
+    pa_assert(c);
+    pa_assert(chunk);
+    pa_assert_se(b = c->recv_batch);
+
+    pa_memchunk_reset(chunk);
+
+    for (;;) {
+        struct mmsghdr *msg;
+        pa_memchunk *slot;
+        int metadata_length = -1;
+
+        if (b->next >= b->n_received && recv_batch(c, pool) < 0)
+            return -1;
+
+        msg = &b->msgs[b->next];
+        slot = &b->chunks[b->next];
+        b->next++;
+
+        if (msg->msg_hdr.msg_flags & MSG_TRUNC) {
+            /* The packet didn't fit into a slot. It is lost, but make
+             * sure that the next one of this size fits. */
+            pa_log_warn("RTP packet of %u bytes too large for receive buffer, dropped.", msg->msg_len);
+
+            while (b->slot_size < msg->msg_len && b->slot_size < RECV_SLOT_SIZE_MAX)
+                b->slot_size *= 2;
+        } else {
+            metadata_length = parse_header(c, pa_memblock_acquire_chunk(slot), msg->msg_len);
+            pa_memblock_release(slot->memblock);
+        }
+
+        /* Zero-length packets only need to be read out */
+        if (metadata_length < 0 || msg->msg_len <= (unsigned) metadata_length) {
+            pa_memblock_unref(slot->memblock);
+            pa_memchunk_reset(slot);
+            continue;
+        }
+
+        /* Hand out the audio data of the slot */
+        *chunk = *slot;
+        chunk->index += (size_t) metadata_length;
+        chunk->length = msg->msg_len - (size_t) metadata_length;
+        pa_memchunk_reset(slot);
+
+        get_tstamp(&msg->msg_hdr, tstamp);
+
+        return 0;
+    }
+}
+
+bool pa_rtp_recv_pending(pa_rtp_context *c) {
+    pa_assert(c);
+    pa_assert(c->recv_batch);
+
+    return c->recv_batch->next < c->recv_batch->n_received;
+}
+
+#else
+
 int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
     int size;
     size_t audio_length;
-    size_t metadata_length;
+    int metadata_length;
     struct msghdr m;
-    struct cmsghdr *cm;
     struct iovec iov;
-    uint32_t header;
-    unsigned cc;
     ssize_t r;
     uint8_t aux[1024];
-    bool found_tstamp = false;
 
     pa_assert(c);
     pa_assert(chunk);
@@ -191,6 +506,7 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
          *
          * 1. Somebody sent us a perfectly valid zero-length UDP packet.
          * 2. Somebody sent us a UDP packet with a bad CRC.
+         * 3. There is no packet, as we are called until we fail.
          *
          * It is unknown whether size can actually be less than zero.
          *
@@ -200,7 +516,7 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
          * now and discard it later, when comparing the number of bytes
          * received (0) with the number of bytes wanted (1, see below).
          *
-         * In the second case, recvmsg() will fail, thus allowing us to
+         * In the other cases, recvmsg() will fail, thus allowing us to
          * return the error.
          *
          * Just to avoid passing zero-sized memchunks and NULL pointers to
@@ -231,7 +547,7 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
     m.msg_controllen = sizeof(aux);
     m.msg_flags = 0;
 
-    r = recvmsg(c->fd, &m, 0);
+    r = recvmsg(c->fd, &m, MSG_DONTWAIT);
 
     if (r != size) {
         if (r < 0 && errno != EAGAIN && errno != EINTR)
@@ -240,51 +556,10 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
         goto fail;
     }
 
-    if (size < 12) {
-        pa_log_warn("RTP packet too short.");
+    if ((metadata_length = parse_header(c, c->recv_buf, (size_t) size)) < 0)
         goto fail;
-    }
 
-    memcpy(&header, iov.iov_base, sizeof(uint32_t));
-    memcpy(&c->timestamp, (uint8_t*) iov.iov_base + 4, sizeof(uint32_t));
-    memcpy(&c->ssrc, (uint8_t*) iov.iov_base + 8, sizeof(uint32_t));
-
-    header = ntohl(header);
-    c->timestamp = ntohl(c->timestamp);
-    c->ssrc = ntohl(c->ssrc);
-
-    if ((header >> 30) != 2) {
-        pa_log_warn("Unsupported RTP version.");
-        goto fail;
-    }
-
-    if ((header >> 29) & 1) {
-        pa_log_warn("RTP padding not supported.");
-        goto fail;
-    }
-
-    if ((header >> 28) & 1) {
-        pa_log_warn("RTP header extensions not supported.");
-        goto fail;
-    }
-
-    cc = (header >> 24) & 0xF;
-    c->payload = (uint8_t) ((header >> 16) & 127U);
-    c->sequence = (uint16_t) (header & 0xFFFFU);
-
-    metadata_length = 12 + cc * 4;
-
-    if (metadata_length > (unsigned) size) {
-        pa_log_warn("RTP packet too short. (CSRC)");
-        goto fail;
-    }
-
-    audio_length = size - metadata_length;
-
-    if (audio_length % c->frame_size != 0) {
-        pa_log_warn("Bad RTP packet size.");
-        goto fail;
-    }
+    audio_length = (size_t) size - (size_t) metadata_length;
 
     if (c->memchunk.length < (unsigned) audio_length) {
         size_t l;
@@ -314,17 +589,7 @@ int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct
         pa_memchunk_reset(&c->memchunk);
     }
 
-    for (cm = CMSG_FIRSTHDR(&m); cm; cm = CMSG_NXTHDR(&m, cm))
-        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
-            memcpy(tstamp, CMSG_DATA(cm), sizeof(struct timeval));
-            found_tstamp = true;
-            break;
-        }
-
-    if (!found_tstamp) {
-        pa_log_warn("Couldn't find SCM_TIMESTAMP data in auxiliary recvmsg() data!");
-        pa_zero(*tstamp);
-    }
+    get_tstamp(&m, tstamp);
 
     return 0;
 
@@ -335,6 +600,14 @@ fail:
     return -1;
 }
 
+bool pa_rtp_recv_pending(pa_rtp_context *c) {
+    pa_assert(c);
+
+    return false;
+}
+
+#endif
+
 uint8_t pa_rtp_payload_from_sample_spec(const pa_sample_spec *ss) {
     pa_assert(ss);
 
@@ -419,6 +692,19 @@ void pa_rtp_context_destroy(pa_rtp_context *c) {
     pa_xfree(c->recv_buf);
     c->recv_buf = NULL;
     c->recv_buf_size = 0;
+
+#ifdef HAVE_RECVMMSG
+    if (c->recv_batch) {
+        unsigned i;
+
+        for (i = 0; i < RECV_BATCH_SIZE; i++)
+            if (c->recv_batch->chunks[i].memblock)
+                pa_memblock_unref(c->recv_batch->chunks[i].memblock);
+
+        pa_xfree(c->recv_batch);
+        c->recv_batch = NULL;
+    }
+#endif
 }
 
 const char* pa_rtp_format_to_string(pa_sample_format_t f) {
@@ -26,6 +26,16 @@
 #include <pulsecore/memblockq.h>
 #include <pulsecore/memchunk.h>
 
+typedef enum pa_rtp_encoding {
+    PA_RTP_ENCODING_PCM,
+    PA_RTP_ENCODING_OPUS
+} pa_rtp_encoding_t;
+
+/* Opus has no static payload type, so one from the dynamic range is used.
+ * Its RTP clock always runs at 48 kHz. */
+#define PA_RTP_OPUS_PAYLOAD 96
+#define PA_RTP_OPUS_RATE 48000
+
 typedef struct pa_rtp_context {
     int fd;
     uint16_t sequence;
@@ -37,6 +47,7 @@ typedef struct pa_rtp_context {
     uint8_t *recv_buf;
     size_t recv_buf_size;
     pa_memchunk memchunk;
+    struct pa_rtp_recv_batch *recv_batch;
 } pa_rtp_context;
 
 pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssrc, uint8_t payload, size_t frame_size);
@@ -45,9 +56,23 @@ pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssr
  * guarantee that the current read index doesn't point to a hole. */
 int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q);
 
+/* Sends chunk as the payload of a single packet, and advances the
+ * timestamp by n_frames. For encoded payloads, whose size doesn't tell the
+ * duration. */
+int pa_rtp_send_packet(pa_rtp_context *c, const pa_memchunk *chunk, uint32_t n_frames);
+
 pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame_size);
+
+/* Returns the audio data of the next packet. Packets are read from the
+ * socket in batches where supported, so the caller should keep calling
+ * this until it fails, which it does without blocking when no packet is
+ * left. */
 int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp);
 
+/* Returns true if packets of the last batch have not been returned yet,
+ * which the socket won't signal any more. */
+bool pa_rtp_recv_pending(pa_rtp_context *c);
+
 void pa_rtp_context_destroy(pa_rtp_context *c);
 
 pa_sample_spec* pa_rtp_sample_spec_fixup(pa_sample_spec *ss);
@@ -39,9 +39,10 @@
 #include "sdp.h"
 #include "rtp.h"
 
-char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload, const pa_sample_spec *ss) {
+char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload,
+                   pa_rtp_encoding_t encoding, const pa_sample_spec *ss) {
     uint32_t ntp;
-    char buf_src[64], buf_dst[64], un[64];
+    char buf_src[64], buf_dst[64], un[64], rtpmap[128];
     const char *u, *f;
 
     pa_assert(src);
@@ -53,7 +54,21 @@ char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, u
     pa_assert(af == AF_INET);
 #endif
 
-    pa_assert_se(f = pa_rtp_format_to_string(ss->format));
+    if (encoding == PA_RTP_ENCODING_OPUS) {
+        /* RFC 7587: the channel count in the rtpmap is always 2, whether
+         * the stream is stereo is signalled in the format parameters */
+        pa_assert(ss->rate == PA_RTP_OPUS_RATE);
+
+        pa_snprintf(rtpmap, sizeof(rtpmap),
+                    "a=rtpmap:%i opus/%u/2\n"
+                    "a=fmtp:%i stereo=%i; sprop-stereo=%i\n",
+                    payload, PA_RTP_OPUS_RATE,
+                    payload, ss->channels > 1, ss->channels > 1);
+    } else {
+        pa_assert_se(f = pa_rtp_format_to_string(ss->format));
+
+        pa_snprintf(rtpmap, sizeof(rtpmap), "a=rtpmap:%i %s/%u/%u\n", payload, f, ss->rate, ss->channels);
+    }
 
     if (!(u = pa_get_user_name(un, sizeof(un))))
         u = "-";
@@ -71,22 +86,36 @@ char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, u
             "t=%lu 0\n"
             "a=recvonly\n"
             "m=audio %u RTP/AVP %i\n"
-            "a=rtpmap:%i %s/%u/%u\n"
+            "%s"
             "a=type:broadcast\n",
             u, (unsigned long) ntp, af == AF_INET ? "IP4" : "IP6", buf_src,
             name,
             af == AF_INET ? "IP4" : "IP6", buf_dst,
             (unsigned long) ntp,
             port, payload,
-            payload, f, ss->rate, ss->channels);
+            rtpmap);
 }
 
-static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, char *c) {
+static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, pa_rtp_encoding_t *encoding, char *c) {
     unsigned rate, channels;
     pa_assert(ss);
+    pa_assert(encoding);
     pa_assert(c);
 
-    if (pa_startswith(c, "L16/")) {
+    *encoding = PA_RTP_ENCODING_PCM;
+
+    if (pa_startswith(c, "opus/")) {
+        if (sscanf(c + 5, "%u", &rate) != 1 || rate != PA_RTP_OPUS_RATE)
+            return NULL;
+
+        /* Mono unless the format parameters say otherwise */
+        ss->format = PA_SAMPLE_S16NE;
+        ss->rate = PA_RTP_OPUS_RATE;
+        ss->channels = 1;
+        *encoding = PA_RTP_ENCODING_OPUS;
+
+        return ss;
+    } else if (pa_startswith(c, "L16/")) {
         ss->format = PA_SAMPLE_S16BE;
         c += 4;
     } else if (pa_startswith(c, "L8/")) {
@@ -118,7 +147,7 @@ static pa_sample_spec *parse_sdp_sample_spec(pa_sample_spec *ss, char *c) {
 
 pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
     uint16_t port = 0;
-    bool ss_valid = false;
+    bool ss_valid = false, stereo = false;
 
     pa_assert(t);
     pa_assert(i);
@@ -126,6 +155,7 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
     i->origin = i->session_name = NULL;
     i->salen = 0;
     i->payload = 255;
+    i->encoding = PA_RTP_ENCODING_PCM;
 
     if (!pa_startswith(t, PA_SDP_HEADER)) {
         pa_log("Failed to parse SDP data: invalid header.");
@@ -225,11 +255,27 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
                         c[63] = 0;
                         c[strcspn(c, "\n")] = 0;
 
-                        if (parse_sdp_sample_spec(&i->sample_spec, c))
+                        if (parse_sdp_sample_spec(&i->sample_spec, &i->encoding, c))
                             ss_valid = true;
                     }
                 }
             }
+        } else if (pa_startswith(t, "a=fmtp:")) {
+
+            if (i->payload <= 127) {
+                char c[128];
+                int _payload;
+                int len;
+
+                if (sscanf(t + 7, "%i %n", &_payload, &len) == 1 && _payload == i->payload && 7 + (size_t) len < l) {
+                    pa_strlcpy(c, t + 7 + len, PA_MIN(sizeof(c), l - 7 - (size_t) len + 1));
+
+                    /* The Opus parameter telling whether the sender
+                     * sends stereo */
+                    if (strstr(c, "sprop-stereo=1"))
+                        stereo = true;
+                }
+            }
         }
 
         t += l;
@@ -238,6 +284,9 @@ pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *i, int is_goodbye) {
             t++;
     }
 
+    if (ss_valid && i->encoding == PA_RTP_ENCODING_OPUS && stereo)
+        i->sample_spec.channels = 2;
+
     if (!i->origin || (!is_goodbye && (!i->salen || i->payload > 127 || !ss_valid || port == 0))) {
         pa_log("Failed to parse SDP data: missing data.");
         goto fail;
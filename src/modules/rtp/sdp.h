@@ -26,6 +26,8 @@
 
 #include <pulse/sample.h>
 
+#include "rtp.h"
+
 #define PA_SDP_HEADER "v=0\n"
 
 typedef struct pa_sdp_info {
@@ -37,9 +39,11 @@ typedef struct pa_sdp_info {
 
     pa_sample_spec sample_spec;
     uint8_t payload;
+    pa_rtp_encoding_t encoding;
 } pa_sdp_info;
 
-char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload, const pa_sample_spec *ss);
+char *pa_sdp_build(int af, const void *src, const void *dst, const char *name, uint16_t port, uint8_t payload,
+                   pa_rtp_encoding_t encoding, const pa_sample_spec *ss);
 
 pa_sdp_info *pa_sdp_parse(const char *t, pa_sdp_info *info, int is_goodbye);
 
@@ -682,6 +682,7 @@ pa_operation* pa_context_set_source_port_by_name(pa_context *c, const char *name
 static void context_get_client_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
     int eol = 1;
+    pa_proplist *proplist = NULL;
 
     pa_assert(pd);
     pa_assert(o);
@@ -697,11 +698,16 @@ static void context_get_client_info_callback(pa_pdispatch *pd, uint32_t command,
         eol = -1;
     } else {
 
+        /* Reuse the same proplist for all entries of the list, instead
+         * of allocating a new one per entry. */
+        proplist = pa_proplist_new();
+
         while (!pa_tagstruct_eof(t)) {
             pa_client_info i;
 
             pa_zero(i);
-            i.proplist = pa_proplist_new();
+            pa_proplist_clear(proplist);
+            i.proplist = proplist;
 
             if (pa_tagstruct_getu32(t, &i.index) < 0 ||
                 pa_tagstruct_gets(t, &i.name) < 0 ||
@@ -710,7 +716,6 @@ static void context_get_client_info_callback(pa_pdispatch *pd, uint32_t command,
                 (o->context->version >= 13 && pa_tagstruct_get_proplist(t, i.proplist) < 0)) {
 
                 pa_context_fail(o->context, PA_ERR_PROTOCOL);
-                pa_proplist_free(i.proplist);
                 goto finish;
             }
 
@@ -718,8 +723,6 @@ static void context_get_client_info_callback(pa_pdispatch *pd, uint32_t command,
                 pa_client_info_cb_t cb = (pa_client_info_cb_t) o->callback;
                 cb(o->context, &i, 0, o->userdata);
             }
-
-            pa_proplist_free(i.proplist);
         }
     }
 
@@ -729,6 +732,9 @@ static void context_get_client_info_callback(pa_pdispatch *pd, uint32_t command,
     }
 
 finish:
+    if (proplist)
+        pa_proplist_free(proplist);
+
     pa_operation_done(o);
     pa_operation_unref(o);
 }
@@ -1185,6 +1191,8 @@ pa_operation* pa_context_get_module_info_list(pa_context *c, pa_module_info_cb_t
 static void context_get_sink_input_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
     int eol = 1;
+    pa_proplist *proplist = NULL;
+    pa_format_info *format = NULL;
 
     pa_assert(pd);
     pa_assert(o);
@@ -1200,13 +1208,21 @@ static void context_get_sink_input_info_callback(pa_pdispatch *pd, uint32_t comm
         eol = -1;
     } else {
 
+        /* Reuse the same proplist and format for all entries of the
+         * list, instead of allocating new ones per entry. */
+        proplist = pa_proplist_new();
+        format = pa_format_info_new();
+
         while (!pa_tagstruct_eof(t)) {
             pa_sink_input_info i;
             bool mute = false, corked = false, has_volume = false, volume_writable = true;
 
             pa_zero(i);
-            i.proplist = pa_proplist_new();
-            i.format = pa_format_info_new();
+            pa_proplist_clear(proplist);
+            pa_proplist_clear(format->plist);
+            format->encoding = PA_ENCODING_INVALID;
+            i.proplist = proplist;
+            i.format = format;
 
             if (pa_tagstruct_getu32(t, &i.index) < 0 ||
                 pa_tagstruct_gets(t, &i.name) < 0 ||
@@ -1228,8 +1244,6 @@ static void context_get_sink_input_info_callback(pa_pdispatch *pd, uint32_t comm
                 (o->context->version >= 21 && pa_tagstruct_get_format_info(t, i.format) < 0)) {
 
                 pa_context_fail(o->context, PA_ERR_PROTOCOL);
-                pa_proplist_free(i.proplist);
-                pa_format_info_free(i.format);
                 goto finish;
             }
 
@@ -1242,9 +1256,6 @@ static void context_get_sink_input_info_callback(pa_pdispatch *pd, uint32_t comm
                 pa_sink_input_info_cb_t cb = (pa_sink_input_info_cb_t) o->callback;
                 cb(o->context, &i, 0, o->userdata);
             }
-
-            pa_proplist_free(i.proplist);
-            pa_format_info_free(i.format);
         }
     }
 
@@ -1254,6 +1265,11 @@ static void context_get_sink_input_info_callback(pa_pdispatch *pd, uint32_t comm
     }
 
 finish:
+    if (proplist)
+        pa_proplist_free(proplist);
+    if (format)
+        pa_format_info_free(format);
+
     pa_operation_done(o);
     pa_operation_unref(o);
 }
@@ -1290,6 +1306,8 @@ pa_operation* pa_context_get_sink_input_info_list(pa_context *c, void (*cb)(pa_c
 static void context_get_source_output_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
     int eol = 1;
+    pa_proplist *proplist = NULL;
+    pa_format_info *format = NULL;
 
     pa_assert(pd);
     pa_assert(o);
@@ -1305,13 +1323,21 @@ static void context_get_source_output_info_callback(pa_pdispatch *pd, uint32_t c
         eol = -1;
     } else {
 
+        /* Reuse the same proplist and format for all entries of the
+         * list, instead of allocating new ones per entry. */
+        proplist = pa_proplist_new();
+        format = pa_format_info_new();
+
         while (!pa_tagstruct_eof(t)) {
             pa_source_output_info i;
             bool mute = false, corked = false, has_volume = false, volume_writable = true;
 
             pa_zero(i);
-            i.proplist = pa_proplist_new();
-            i.format = pa_format_info_new();
+            pa_proplist_clear(proplist);
+            pa_proplist_clear(format->plist);
+            format->encoding = PA_ENCODING_INVALID;
+            i.proplist = proplist;
+            i.format = format;
 
             if (pa_tagstruct_getu32(t, &i.index) < 0 ||
                 pa_tagstruct_gets(t, &i.name) < 0 ||
@@ -1333,8 +1359,6 @@ static void context_get_source_output_info_callback(pa_pdispatch *pd, uint32_t c
                                                pa_tagstruct_get_format_info(t, i.format) < 0))) {
 
                 pa_context_fail(o->context, PA_ERR_PROTOCOL);
-                pa_proplist_free(i.proplist);
-                pa_format_info_free(i.format);
                 goto finish;
             }
 
@@ -1347,9 +1371,6 @@ static void context_get_source_output_info_callback(pa_pdispatch *pd, uint32_t c
                 pa_source_output_info_cb_t cb = (pa_source_output_info_cb_t) o->callback;
                 cb(o->context, &i, 0, o->userdata);
             }
-
-            pa_proplist_free(i.proplist);
-            pa_format_info_free(i.format);
         }
     }
 
@@ -1359,6 +1380,11 @@ static void context_get_source_output_info_callback(pa_pdispatch *pd, uint32_t c
     }
 
 finish:
+    if (proplist)
+        pa_proplist_free(proplist);
+    if (format)
+        pa_format_info_free(format);
+
     pa_operation_done(o);
     pa_operation_unref(o);
 }
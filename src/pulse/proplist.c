@@ -27,21 +27,136 @@
 #include <pulse/xmalloc.h>
 #include <pulse/utf8.h>
 
-#include <pulsecore/hashmap.h>
 #include <pulsecore/strbuf.h>
 #include <pulsecore/core-util.h>
 
 #include "proplist.h"
 
+/* The keys of the well-known PA_PROP_xxx properties, sorted by their
+ * value so that they can be looked up with bsearch(). Properties with
+ * one of these keys refer to it by its index and don't store a copy of
+ * the key string. Keep this sorted when adding new properties! */
+static const char* const well_known_keys[] = {
+    PA_PROP_APPLICATION_ICON,
+    PA_PROP_APPLICATION_ICON_NAME,
+    PA_PROP_APPLICATION_ID,
+    PA_PROP_APPLICATION_LANGUAGE,
+    PA_PROP_APPLICATION_NAME,
+    PA_PROP_APPLICATION_PROCESS_BINARY,
+    PA_PROP_APPLICATION_PROCESS_HOST,
+    PA_PROP_APPLICATION_PROCESS_ID,
+    PA_PROP_APPLICATION_PROCESS_MACHINE_ID,
+    PA_PROP_APPLICATION_PROCESS_SESSION_ID,
+    PA_PROP_APPLICATION_PROCESS_USER,
+    PA_PROP_APPLICATION_VERSION,
+    PA_PROP_DEVICE_ACCESS_MODE,
+    PA_PROP_DEVICE_API,
+    PA_PROP_DEVICE_BUFFERING_BUFFER_SIZE,
+    PA_PROP_DEVICE_BUFFERING_FRAGMENT_SIZE,
+    PA_PROP_DEVICE_BUS,
+    PA_PROP_DEVICE_BUS_PATH,
+    PA_PROP_DEVICE_CLASS,
+    PA_PROP_DEVICE_DESCRIPTION,
+    PA_PROP_DEVICE_FORM_FACTOR,
+    PA_PROP_DEVICE_ICON,
+    PA_PROP_DEVICE_ICON_NAME,
+    PA_PROP_DEVICE_INTENDED_ROLES,
+    PA_PROP_DEVICE_MASTER_DEVICE,
+    PA_PROP_DEVICE_PRODUCT_ID,
+    PA_PROP_DEVICE_PRODUCT_NAME,
+    PA_PROP_DEVICE_PROFILE_DESCRIPTION,
+    PA_PROP_DEVICE_PROFILE_NAME,
+    PA_PROP_DEVICE_SERIAL,
+    PA_PROP_DEVICE_STRING,
+    PA_PROP_DEVICE_VENDOR_ID,
+    PA_PROP_DEVICE_VENDOR_NAME,
+    PA_PROP_EVENT_DESCRIPTION,
+    PA_PROP_EVENT_ID,
+    PA_PROP_EVENT_MOUSE_BUTTON,
+    PA_PROP_EVENT_MOUSE_HPOS,
+    PA_PROP_EVENT_MOUSE_VPOS,
+    PA_PROP_EVENT_MOUSE_X,
+    PA_PROP_EVENT_MOUSE_Y,
+    PA_PROP_FILTER_APPLY,
+    PA_PROP_FILTER_SUPPRESS,
+    PA_PROP_FILTER_WANT,
+    PA_PROP_FORMAT_CHANNEL_MAP,
+    PA_PROP_FORMAT_CHANNELS,
+    PA_PROP_FORMAT_RATE,
+    PA_PROP_FORMAT_SAMPLE_FORMAT,
+    PA_PROP_MEDIA_ARTIST,
+    PA_PROP_MEDIA_COPYRIGHT,
+    PA_PROP_MEDIA_FILENAME,
+    PA_PROP_MEDIA_ICON,
+    PA_PROP_MEDIA_ICON_NAME,
+    PA_PROP_MEDIA_LANGUAGE,
+    PA_PROP_MEDIA_NAME,
+    PA_PROP_MEDIA_ROLE,
+    PA_PROP_MEDIA_SOFTWARE,
+    PA_PROP_MEDIA_TITLE,
+    PA_PROP_MODULE_AUTHOR,
+    PA_PROP_MODULE_DESCRIPTION,
+    PA_PROP_MODULE_USAGE,
+    PA_PROP_MODULE_VERSION,
+    PA_PROP_WINDOW_DESKTOP,
+    PA_PROP_WINDOW_HEIGHT,
+    PA_PROP_WINDOW_HPOS,
+    PA_PROP_WINDOW_ICON,
+    PA_PROP_WINDOW_ICON_NAME,
+    PA_PROP_WINDOW_ID,
+    PA_PROP_WINDOW_NAME,
+    PA_PROP_WINDOW_VPOS,
+    PA_PROP_WINDOW_WIDTH,
+    PA_PROP_WINDOW_X,
+    PA_PROP_WINDOW_X11_DISPLAY,
+    PA_PROP_WINDOW_X11_MONITOR,
+    PA_PROP_WINDOW_X11_SCREEN,
+    PA_PROP_WINDOW_X11_XID,
+    PA_PROP_WINDOW_Y,
+};
+
+#define CUSTOM_KEY ((uint32_t) -1)
+
 struct property {
-    char *key;
-    void *value;
+    uint32_t key_id; /* Index into well_known_keys[], or CUSTOM_KEY */
+    const char *key;
+    uint8_t *value; /* nbytes of data followed by a NUL byte */
     size_t nbytes;
+    size_t space; /* Size of the value slot */
+    bool own_key, own_value; /* Allocated on their own, not in the arena */
+};
+
+/* Custom keys and values are stored in a list of arena blocks owned by
+ * the list. Values never move while the list exists, so a pointer
+ * returned by pa_proplist_gets() stays valid until that property is
+ * modified or removed.
+ *
+ * Space in the arena is not reused. Once a slot in it has been given up,
+ * because a property was removed or its value outgrew the slot, new keys
+ * and values get their own allocations, which are freed again when they
+ * are dropped. So a list that keeps changing never holds more dead space
+ * than its arena had. Copies put everything into one new arena. */
+struct arena_block {
+    struct arena_block *next;
+    size_t length, allocated;
 };
 
-#define MAKE_HASHMAP(p) ((pa_hashmap*) (p))
-#define MAKE_HASHMAP_CONST(p) ((const pa_hashmap*) (p))
-#define MAKE_PROPLIST(p) ((pa_proplist*) (p))
+#define ARENA_BLOCK_DATA(b) ((uint8_t*) (b) + PA_ALIGN(sizeof(struct arena_block)))
+#define ARENA_MIN_BLOCK 256
+#define ARENA_MAX_BLOCK 4096
+
+/* The contents of a property list */
+struct proplist_data {
+    struct property *properties;
+    unsigned n_properties, n_allocated;
+
+    struct arena_block *blocks;
+    size_t used, dead;
+};
+
+struct pa_proplist {
+    struct proplist_data *data; /* NULL while the list is empty */
+};
 
 int pa_proplist_key_valid(const char *key) {
 
@@ -54,57 +169,262 @@ int pa_proplist_key_valid(const char *key) {
     return 1;
 }
 
-static void property_free(struct property *prop) {
-    pa_assert(prop);
+static int key_compare(const void *key, const void *member) {
+    return strcmp(key, *(const char* const*) member);
+}
+
+/* Looks up the id of key, returns -1 if the key is not valid */
+static int key_lookup(const char *key, uint32_t *id) {
+    const char * const *k;
+
+    if ((k = bsearch(key, well_known_keys, PA_ELEMENTSOF(well_known_keys), sizeof(well_known_keys[0]), key_compare))) {
+        *id = (uint32_t) (k - well_known_keys);
+        return 0;
+    }
+
+    *id = CUSTOM_KEY;
+
+    return pa_proplist_key_valid(key) ? 0 : -1;
+}
+
+static void arena_add_block(struct proplist_data *d, size_t size) {
+    struct arena_block *b;
+
+    b = pa_xmalloc(PA_ALIGN(sizeof(struct arena_block)) + size);
+    b->next = d->blocks;
+    b->length = 0;
+    b->allocated = size;
+    d->blocks = b;
+}
+
+static void *arena_alloc(struct proplist_data *d, size_t size) {
+    void *r;
+
+    size = PA_ALIGN(size);
+
+    if (!d->blocks || d->blocks->length + size > d->blocks->allocated)
+        arena_add_block(d, PA_MAX(size, PA_CLAMP(d->used, ARENA_MIN_BLOCK, ARENA_MAX_BLOCK)));
+
+    r = ARENA_BLOCK_DATA(d->blocks) + d->blocks->length;
+    d->blocks->length += size;
+    d->used += size;
+
+    return r;
+}
+
+static const char *arena_strdup(struct proplist_data *d, const char *s) {
+    size_t l = strlen(s) + 1;
+
+    return memcpy(arena_alloc(d, l), s, l);
+}
+
+/* Returns space for a new key or value, see above */
+static void *data_alloc(struct proplist_data *d, size_t size, bool *own) {
+    if ((*own = d->dead > 0))
+        return pa_xmalloc(size);
+
+    return arena_alloc(d, size);
+}
+
+static void drop_value(struct proplist_data *d, struct property *prop) {
+    if (prop->own_value)
+        pa_xfree(prop->value);
+    else
+        d->dead += prop->space;
+}
+
+static void drop_key(struct proplist_data *d, struct property *prop) {
+    if (prop->key_id != CUSTOM_KEY)
+        return;
+
+    if (prop->own_key)
+        pa_xfree((char*) prop->key);
+    else
+        d->dead += PA_ALIGN(strlen(prop->key) + 1);
+}
+
+static struct proplist_data *data_new(unsigned n_properties, size_t arena_size) {
+    struct proplist_data *d;
+
+    d = pa_xnew(struct proplist_data, 1);
+
+    d->n_properties = 0;
+    d->n_allocated = PA_MAX(n_properties, 8U);
+    d->properties = pa_xnew(struct property, d->n_allocated);
+
+    d->blocks = NULL;
+    d->used = d->dead = 0;
+
+    if (arena_size > 0)
+        arena_add_block(d, PA_MAX(arena_size, (size_t) ARENA_MIN_BLOCK));
+
+    return d;
+}
+
+static void data_free(struct proplist_data *d) {
+    struct arena_block *b;
+    unsigned i;
+
+    pa_assert(d);
+
+    for (i = 0; i < d->n_properties; i++) {
+        if (d->properties[i].own_key)
+            pa_xfree((char*) d->properties[i].key);
+        if (d->properties[i].own_value)
+            pa_xfree(d->properties[i].value);
+    }
+
+    while ((b = d->blocks)) {
+        d->blocks = b->next;
+        pa_xfree(b);
+    }
+
+    pa_xfree(d->properties);
+    pa_xfree(d);
+}
+
+static struct property *append_property(struct proplist_data *d) {
+    if (d->n_properties >= d->n_allocated) {
+        d->n_allocated *= 2;
+        d->properties = pa_xrenew(struct property, d->properties, d->n_allocated);
+    }
+
+    return d->properties + d->n_properties++;
+}
+
+static struct property *find_property(const struct proplist_data *d, uint32_t id, const char *key) {
+    unsigned i;
+
+    if (!d)
+        return NULL;
+
+    for (i = 0; i < d->n_properties; i++) {
+        struct property *prop = d->properties + i;
+
+        if (prop->key_id != id)
+            continue;
+
+        if (id != CUSTOM_KEY || pa_streq(prop->key, key))
+            return prop;
+    }
+
+    return NULL;
+}
+
+/* Returns a compacted copy of d */
+static struct proplist_data *data_copy(const struct proplist_data *d) {
+    struct proplist_data *copy;
+    unsigned i;
+
+    copy = data_new(d->n_properties, d->used - d->dead);
+
+    for (i = 0; i < d->n_properties; i++) {
+        const struct property *prop = d->properties + i;
+        struct property *n = append_property(copy);
+
+        n->key_id = prop->key_id;
+        n->key = prop->key_id == CUSTOM_KEY ? arena_strdup(copy, prop->key) : prop->key;
+        n->value = memcpy(arena_alloc(copy, prop->nbytes + 1), prop->value, prop->nbytes + 1);
+        n->nbytes = prop->nbytes;
+        n->space = PA_ALIGN(prop->nbytes + 1);
+        n->own_key = n->own_value = false;
+    }
+
+    return copy;
+}
+
+static void set_property(pa_proplist *p, uint32_t id, const char *key, const void *data, size_t nbytes) {
+    struct proplist_data *d;
+    struct property *prop;
+    uint8_t *value;
+    bool own_value;
+
+    if (!p->data)
+        p->data = data_new(0, 0);
+
+    d = p->data;
+
+    /* Reuse the slot of the old value if the new one fits. The data
+     * might point into the old value, hence memmove(). */
+    if ((prop = find_property(d, id, key)) && nbytes + 1 <= prop->space) {
+        if (nbytes > 0)
+            memmove(prop->value, data, nbytes);
+        prop->value[nbytes] = 0;
+        prop->nbytes = nbytes;
+        return;
+    }
+
+    /* Copy the value before touching anything else, it might point
+     * into this list. A value that outgrew its slot always gets its own
+     * allocation. */
+    if (prop) {
+        value = pa_xmalloc(nbytes + 1);
+        own_value = true;
+    } else
+        value = data_alloc(d, nbytes + 1, &own_value);
 
-    pa_xfree(prop->key);
-    pa_xfree(prop->value);
-    pa_xfree(prop);
+    if (nbytes > 0)
+        memcpy(value, data, nbytes);
+    value[nbytes] = 0;
+
+    if (prop)
+        drop_value(d, prop);
+    else {
+        prop = append_property(d);
+        prop->key_id = id;
+        prop->own_key = false;
+
+        if (id == CUSTOM_KEY) {
+            size_t l = strlen(key) + 1;
+
+            prop->key = memcpy(data_alloc(d, l, &prop->own_key), key, l);
+        } else
+            prop->key = well_known_keys[id];
+    }
+
+    prop->value = value;
+    prop->nbytes = nbytes;
+    prop->space = own_value ? nbytes + 1 : PA_ALIGN(nbytes + 1);
+    prop->own_value = own_value;
 }
 
 pa_proplist* pa_proplist_new(void) {
-    return MAKE_PROPLIST(pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func, NULL, (pa_free_cb_t) property_free));
+    pa_proplist *p;
+
+    p = pa_xnew(pa_proplist, 1);
+    p->data = NULL;
+
+    return p;
 }
 
 void pa_proplist_free(pa_proplist* p) {
     pa_assert(p);
 
-    pa_hashmap_free(MAKE_HASHMAP(p));
+    pa_proplist_clear(p);
+    pa_xfree(p);
 }
 
 /** Will accept only valid UTF-8 */
 int pa_proplist_sets(pa_proplist *p, const char *key, const char *value) {
-    struct property *prop;
-    bool add = false;
+    uint32_t id;
 
     pa_assert(p);
     pa_assert(key);
     pa_assert(value);
 
-    if (!pa_proplist_key_valid(key) || !pa_utf8_valid(value))
+    if (key_lookup(key, &id) < 0 || !pa_utf8_valid(value))
         return -1;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP_CONST(p), key))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = pa_xstrdup(key);
-        add = true;
-    } else
-        pa_xfree(prop->value);
-
-    prop->value = pa_xstrdup(value);
-    prop->nbytes = strlen(value)+1;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    set_property(p, id, key, value, strlen(value)+1);
 
     return 0;
 }
 
 /** Will accept only valid UTF-8 */
 static int proplist_setn(pa_proplist *p, const char *key, size_t key_length, const char *value, size_t value_length) {
-    struct property *prop;
-    bool add = false;
+    uint32_t id;
     char *k, *v;
+    int r = -1;
 
     pa_assert(p);
     pa_assert(key);
@@ -113,28 +433,15 @@ static int proplist_setn(pa_proplist *p, const char *key, size_t key_length, con
     k = pa_xstrndup(key, key_length);
     v = pa_xstrndup(value, value_length);
 
-    if (!pa_proplist_key_valid(k) || !pa_utf8_valid(v)) {
-        pa_xfree(k);
-        pa_xfree(v);
-        return -1;
-    }
-
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP_CONST(p), k))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = k;
-        add = true;
-    } else {
-        pa_xfree(prop->value);
-        pa_xfree(k);
+    if (key_lookup(k, &id) >= 0 && pa_utf8_valid(v)) {
+        set_property(p, id, k, v, strlen(v)+1);
+        r = 0;
     }
 
-    prop->value = v;
-    prop->nbytes = strlen(v)+1;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    pa_xfree(k);
+    pa_xfree(v);
 
-    return 0;
+    return r;
 }
 
 /** Will accept only valid UTF-8 */
@@ -153,11 +460,11 @@ int pa_proplist_setp(pa_proplist *p, const char *pair) {
 }
 
 static int proplist_sethex(pa_proplist *p, const char *key, size_t key_length, const char *value, size_t value_length) {
-    struct property *prop;
-    bool add = false;
+    uint32_t id;
     char *k, *v;
     uint8_t *d;
     size_t dn;
+    int r = -1;
 
     pa_assert(p);
     pa_assert(key);
@@ -165,7 +472,7 @@ static int proplist_sethex(pa_proplist *p, const char *key, size_t key_length, c
 
     k = pa_xstrndup(key, key_length);
 
-    if (!pa_proplist_key_valid(k)) {
+    if (key_lookup(k, &id) < 0) {
         pa_xfree(k);
         return -1;
     }
@@ -173,38 +480,21 @@ static int proplist_sethex(pa_proplist *p, const char *key, size_t key_length, c
     v = pa_xstrndup(value, value_length);
     d = pa_xmalloc(value_length*2+1);
 
-    if ((dn = pa_parsehex(v, d, value_length*2)) == (size_t) -1) {
-        pa_xfree(k);
-        pa_xfree(v);
-        pa_xfree(d);
-        return -1;
+    if ((dn = pa_parsehex(v, d, value_length*2)) != (size_t) -1) {
+        set_property(p, id, k, d, dn);
+        r = 0;
     }
 
+    pa_xfree(k);
     pa_xfree(v);
+    pa_xfree(d);
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP_CONST(p), k))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = k;
-        add = true;
-    } else {
-        pa_xfree(prop->value);
-        pa_xfree(k);
-    }
-
-    d[dn] = 0;
-    prop->value = d;
-    prop->nbytes = dn;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
-
-    return 0;
+    return r;
 }
 
 /** Will accept only valid UTF-8 */
 int pa_proplist_setf(pa_proplist *p, const char *key, const char *format, ...) {
-    struct property *prop;
-    bool add = false;
+    uint32_t id;
     va_list ap;
     char *v;
 
@@ -212,7 +502,7 @@ int pa_proplist_setf(pa_proplist *p, const char *key, const char *format, ...) {
     pa_assert(key);
     pa_assert(format);
 
-    if (!pa_proplist_key_valid(key) || !pa_utf8_valid(format))
+    if (key_lookup(key, &id) < 0 || !pa_utf8_valid(format))
         return -1;
 
     va_start(ap, format);
@@ -222,18 +512,8 @@ int pa_proplist_setf(pa_proplist *p, const char *key, const char *format, ...) {
     if (!pa_utf8_valid(v))
         goto fail;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP_CONST(p), key))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = pa_xstrdup(key);
-        add = true;
-    } else
-        pa_xfree(prop->value);
-
-    prop->value = v;
-    prop->nbytes = strlen(v)+1;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    set_property(p, id, key, v, strlen(v)+1);
+    pa_xfree(v);
 
     return 0;
 
@@ -243,51 +523,37 @@ fail:
 }
 
 int pa_proplist_set(pa_proplist *p, const char *key, const void *data, size_t nbytes) {
-    struct property *prop;
-    bool add = false;
+    uint32_t id;
 
     pa_assert(p);
     pa_assert(key);
     pa_assert(data || nbytes == 0);
 
-    if (!pa_proplist_key_valid(key))
+    if (key_lookup(key, &id) < 0)
         return -1;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP_CONST(p), key))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = pa_xstrdup(key);
-        add = true;
-    } else
-        pa_xfree(prop->value);
-
-    prop->value = pa_xmalloc(nbytes+1);
-    if (nbytes > 0)
-        memcpy(prop->value, data, nbytes);
-    ((char*) prop->value)[nbytes] = 0;
-    prop->nbytes = nbytes;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    set_property(p, id, key, data, nbytes);
 
     return 0;
 }
 
 const char *pa_proplist_gets(const pa_proplist *p, const char *key) {
     struct property *prop;
+    uint32_t id;
 
     pa_assert(p);
     pa_assert(key);
 
-    if (!pa_proplist_key_valid(key))
+    if (key_lookup(key, &id) < 0)
         return NULL;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP_CONST(p), key)))
+    if (!(prop = find_property(p->data, id, key)))
         return NULL;
 
     if (prop->nbytes <= 0)
         return NULL;
 
-    if (((char*) prop->value)[prop->nbytes-1] != 0)
+    if (prop->value[prop->nbytes-1] != 0)
         return NULL;
 
     if (strlen((char*) prop->value) != prop->nbytes-1)
@@ -301,16 +567,17 @@ const char *pa_proplist_gets(const pa_proplist *p, const char *key) {
 
 int pa_proplist_get(const pa_proplist *p, const char *key, const void **data, size_t *nbytes) {
     struct property *prop;
+    uint32_t id;
 
     pa_assert(p);
     pa_assert(key);
     pa_assert(data);
     pa_assert(nbytes);
 
-    if (!pa_proplist_key_valid(key))
+    if (key_lookup(key, &id) < 0)
         return -1;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP_CONST(p), key)))
+    if (!(prop = find_property(p->data, id, key)))
         return -1;
 
     *data = prop->value;
@@ -320,35 +587,61 @@ int pa_proplist_get(const pa_proplist *p, const char *key, const void **data, si
 }
 
 void pa_proplist_update(pa_proplist *p, pa_update_mode_t mode, const pa_proplist *other) {
-    struct property *prop;
-    void *state = NULL;
+    unsigned i;
 
     pa_assert(p);
     pa_assert(mode == PA_UPDATE_SET || mode == PA_UPDATE_MERGE || mode == PA_UPDATE_REPLACE);
     pa_assert(other);
 
+    if (p == other)
+        return;
+
     if (mode == PA_UPDATE_SET)
         pa_proplist_clear(p);
 
-    while ((prop = pa_hashmap_iterate(MAKE_HASHMAP_CONST(other), &state, NULL))) {
+    if (!other->data)
+        return;
+
+    /* Nothing to merge with, just take a compacted copy */
+    if (!p->data) {
+        p->data = data_copy(other->data);
+        return;
+    }
 
-        if (mode == PA_UPDATE_MERGE && pa_proplist_contains(p, prop->key))
+    for (i = 0; i < other->data->n_properties; i++) {
+        const struct property *prop = other->data->properties + i;
+
+        if (mode == PA_UPDATE_MERGE && find_property(p->data, prop->key_id, prop->key))
             continue;
 
-        pa_assert_se(pa_proplist_set(p, prop->key, prop->value, prop->nbytes) == 0);
+        set_property(p, prop->key_id, prop->key, prop->value, prop->nbytes);
     }
 }
 
 int pa_proplist_unset(pa_proplist *p, const char *key) {
+    struct proplist_data *d;
+    struct property *prop;
+    uint32_t id;
+
     pa_assert(p);
     pa_assert(key);
 
-    if (!pa_proplist_key_valid(key))
+    if (key_lookup(key, &id) < 0)
         return -1;
 
-    if (pa_hashmap_remove_and_free(MAKE_HASHMAP(p), key) < 0)
+    if (!(prop = find_property(p->data, id, key)))
         return -2;
 
+    d = p->data;
+
+    drop_value(d, prop);
+    drop_key(d, prop);
+    memmove(prop, prop + 1, (d->n_properties - (prop - d->properties) - 1) * sizeof(struct property));
+    d->n_properties--;
+
+    if (d->n_properties <= 0)
+        pa_proplist_clear(p);
+
     return 0;
 }
 
@@ -371,12 +664,19 @@ int pa_proplist_unset_many(pa_proplist *p, const char * const keys[]) {
 }
 
 const char *pa_proplist_iterate(const pa_proplist *p, void **state) {
-    struct property *prop;
+    unsigned i;
+
+    pa_assert(p);
+    pa_assert(state);
+
+    i = PA_PTR_TO_UINT(*state);
 
-    if (!(prop = pa_hashmap_iterate(MAKE_HASHMAP_CONST(p), state, NULL)))
+    if (!p->data || i >= p->data->n_properties)
         return NULL;
 
-    return prop->key;
+    *state = PA_UINT_TO_PTR(i + 1);
+
+    return p->data->properties[i].key;
 }
 
 char *pa_proplist_to_string_sep(const pa_proplist *p, const char *sep) {
@@ -625,7 +925,7 @@ pa_proplist *pa_proplist_from_string(const char *s) {
     }
 
 success:
-    return MAKE_PROPLIST(pl);
+    return pl;
 
 fail:
     pa_proplist_free(pl);
@@ -633,13 +933,15 @@ fail:
 }
 
 int pa_proplist_contains(const pa_proplist *p, const char *key) {
+    uint32_t id;
+
     pa_assert(p);
     pa_assert(key);
 
-    if (!pa_proplist_key_valid(key))
+    if (key_lookup(key, &id) < 0)
         return -1;
 
-    if (!(pa_hashmap_get(MAKE_HASHMAP_CONST(p), key)))
+    if (!find_property(p->data, id, key))
         return 0;
 
     return 1;
@@ -648,7 +950,10 @@ int pa_proplist_contains(const pa_proplist *p, const char *key) {
 void pa_proplist_clear(pa_proplist *p) {
     pa_assert(p);
 
-    pa_hashmap_remove_all(MAKE_HASHMAP(p));
+    if (p->data) {
+        data_free(p->data);
+        p->data = NULL;
+    }
 }
 
 pa_proplist* pa_proplist_copy(const pa_proplist *p) {
@@ -656,8 +961,8 @@ pa_proplist* pa_proplist_copy(const pa_proplist *p) {
 
     pa_assert_se(copy = pa_proplist_new());
 
-    if (p)
-        pa_proplist_update(copy, PA_UPDATE_REPLACE, p);
+    if (p && p->data)
+        copy->data = data_copy(p->data);
 
     return copy;
 }
@@ -665,20 +970,17 @@ pa_proplist* pa_proplist_copy(const pa_proplist *p) {
 unsigned pa_proplist_size(const pa_proplist *p) {
     pa_assert(p);
 
-    return pa_hashmap_size(MAKE_HASHMAP_CONST(p));
+    return p->data ? p->data->n_properties : 0;
 }
 
 int pa_proplist_isempty(const pa_proplist *p) {
     pa_assert(p);
 
-    return pa_hashmap_isempty(MAKE_HASHMAP_CONST(p));
+    return pa_proplist_size(p) <= 0;
 }
 
 int pa_proplist_equal(const pa_proplist *a, const pa_proplist *b) {
-    const void *key = NULL;
-    struct property *a_prop = NULL;
-    struct property *b_prop = NULL;
-    void *state = NULL;
+    unsigned i;
 
     pa_assert(a);
     pa_assert(b);
@@ -689,8 +991,14 @@ int pa_proplist_equal(const pa_proplist *a, const pa_proplist *b) {
     if (pa_proplist_size(a) != pa_proplist_size(b))
         return 0;
 
-    while ((a_prop = pa_hashmap_iterate(MAKE_HASHMAP_CONST(a), &state, &key))) {
-        if (!(b_prop = pa_hashmap_get(MAKE_HASHMAP_CONST(b), key)))
+    if (!a->data)
+        return 1;
+
+    for (i = 0; i < a->data->n_properties; i++) {
+        const struct property *a_prop = a->data->properties + i;
+        const struct property *b_prop;
+
+        if (!(b_prop = find_property(b->data, a_prop->key_id, a_prop->key)))
             return 0;
 
         if (a_prop->nbytes != b_prop->nbytes)
@@ -377,6 +377,12 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, bool
                      (unsigned) pa_atomic_load(&mstat->n_exported),
                      pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_atomic_load(&mstat->exported_size)));
 
+    pa_strbuf_printf(buf, "Subscription events: %llu posted, %llu dropped as redundant, %llu coalesced, %llu delivered.\n",
+                     (unsigned long long) c->subscription_events_posted,
+                     (unsigned long long) c->subscription_events_dropped,
+                     (unsigned long long) c->subscription_events_coalesced,
+                     (unsigned long long) c->subscription_events_delivered);
+
     pa_strbuf_printf(buf, "Total sample cache size: %s.\n",
                      pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_scache_total_size(c)));
 
@@ -48,10 +48,13 @@
 #include <pulse/rtclock.h>
 
 #include <pulsecore/sink-input.h>
+#include <pulsecore/mix.h>
+#include <pulsecore/resampler.h>
 #include <pulsecore/play-memchunk.h>
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sound-file.h>
+#include <pulsecore/sound-file-cache.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/log.h>
@@ -74,6 +77,113 @@ static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct
     pa_core_rttime_restart(c, e, pa_rtclock_now() + UNLOAD_POLL_TIME);
 }
 
+/* Returns the directory for persisted decoded samples, or NULL if the
+ * persistent sample cache is disabled or unavailable. */
+static char *get_cache_dir(pa_core *c) {
+    char *dir;
+
+    if (!c->scache_persistent)
+        return NULL;
+
+    if (!(dir = pa_state_path("sample-cache", false)))
+        return NULL;
+
+    if (pa_make_secure_dir(dir, 0700, (uid_t) -1, (gid_t) -1, false) < 0) {
+        pa_log_warn("Failed to create sample cache directory %s: %s", dir, pa_cstrerror(errno));
+        pa_xfree(dir);
+        return NULL;
+    }
+
+    return dir;
+}
+
+/* Decoded samples are stored at the rate of the sink they are most
+ * likely to be played on, so that playback doesn't need to resample. */
+static uint32_t get_target_rate(pa_core *c, pa_sink *sink) {
+    if (!sink)
+        sink = c->default_sink;
+
+    return sink ? sink->sample_spec.rate : c->default_sample_spec.rate;
+}
+
+static int load_file(pa_core *c, const char *filename, pa_sink *sink, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk, pa_proplist *p) {
+    char *dir;
+    int r;
+
+    if (!(dir = get_cache_dir(c)))
+        return pa_sound_file_load(c->mempool, filename, ss, map, chunk, p);
+
+    r = pa_sound_file_cache_load(c->mempool, dir, filename, get_target_rate(c, sink), c->resample_method, ss, map, chunk, p);
+    pa_xfree(dir);
+
+    return r;
+}
+
+static void drop_sink_memchunk(pa_scache_entry *e) {
+    if (e->sink_memchunk.memblock)
+        pa_memblock_unref(e->sink_memchunk.memblock);
+
+    pa_memchunk_reset(&e->sink_memchunk);
+}
+
+/* Make sure e->sink_memchunk holds the sample in the sink's format with
+ * volume applied. This is done once, all following plays on a sink
+ * with the same format just take a reference to it. */
+static int render_for_sink(pa_scache_entry *e, pa_sink *sink, const pa_cvolume *volume) {
+    pa_core *c = e->core;
+    pa_resampler *r;
+    pa_memchunk out;
+
+    if (e->sink_memchunk.memblock &&
+        pa_sample_spec_equal(&e->sink_sample_spec, &sink->sample_spec) &&
+        pa_channel_map_equal(&e->sink_channel_map, &sink->channel_map) &&
+        pa_cvolume_equal(&e->sink_volume, volume))
+        return 0;
+
+    drop_sink_memchunk(e);
+
+    if (pa_sample_spec_equal(&e->sample_spec, &sink->sample_spec) &&
+        pa_channel_map_equal(&e->channel_map, &sink->channel_map)) {
+        out = e->memchunk;
+        pa_memblock_ref(out.memblock);
+    } else {
+        if ((uint64_t) e->memchunk.length / pa_frame_size(&e->sample_spec) * sink->sample_spec.rate / e->sample_spec.rate
+            * pa_frame_size(&sink->sample_spec) > PA_SCACHE_ENTRY_SIZE_MAX)
+            return -1;
+
+        if (!(r = pa_resampler_new(c->mempool,
+                                   &e->sample_spec, &e->channel_map,
+                                   &sink->sample_spec, &sink->channel_map,
+                                   c->lfe_crossover_freq,
+                                   c->resample_method,
+                                   (c->disable_remixing ? PA_RESAMPLER_NO_REMIX : 0) |
+                                   (c->remixing_use_all_sink_channels ? 0 : PA_RESAMPLER_NO_FILL_SINK) |
+                                   (c->disable_lfe_remixing ? PA_RESAMPLER_NO_LFE : 0))))
+            return -1;
+
+        if (pa_resampler_run_all(r, &e->memchunk, &out) < 0) {
+            pa_resampler_free(r);
+            return -1;
+        }
+
+        pa_resampler_free(r);
+    }
+
+    if (!pa_cvolume_is_norm(volume)) {
+        pa_memchunk_make_writable(&out, 0);
+        pa_volume_memchunk(&out, &sink->sample_spec, volume);
+    }
+
+    e->sink_memchunk = out;
+    e->sink_sample_spec = sink->sample_spec;
+    e->sink_channel_map = sink->channel_map;
+    e->sink_volume = *volume;
+
+    pa_log_debug("Rendered sample \"%s\" for sink \"%s\", %lu bytes", e->name, sink->name, (unsigned long) out.length);
+
+    return 0;
+}
+
 static void free_entry(pa_scache_entry *e) {
     pa_assert(e);
 
@@ -84,6 +194,7 @@ static void free_entry(pa_scache_entry *e) {
     pa_xfree(e->filename);
     if (e->memchunk.memblock)
         pa_memblock_unref(e->memchunk.memblock);
+    drop_sink_memchunk(e);
     if (e->proplist)
         pa_proplist_free(e->proplist);
     pa_xfree(e);
@@ -99,6 +210,7 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name, bool *new_
     if ((e = pa_namereg_get(c, name, PA_NAMEREG_SAMPLE))) {
         if (e->memchunk.memblock)
             pa_memblock_unref(e->memchunk.memblock);
+        drop_sink_memchunk(e);
 
         pa_xfree(e->filename);
         pa_proplist_clear(e->proplist);
@@ -127,6 +239,7 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name, bool *new_
 
     e->last_used_time = 0;
     pa_memchunk_reset(&e->memchunk);
+    pa_memchunk_reset(&e->sink_memchunk);
     e->filename = NULL;
     e->lazy = false;
     e->last_used_time = 0;
@@ -225,7 +338,7 @@ int pa_scache_add_file(pa_core *c, const char *name, const char *filename, uint3
     p = pa_proplist_new();
     pa_proplist_sets(p, PA_PROP_MEDIA_FILENAME, filename);
 
-    if (pa_sound_file_load(c->mempool, filename, &ss, &map, &chunk, p) < 0) {
+    if (load_file(c, filename, NULL, &ss, &map, &chunk, p) < 0) {
         pa_proplist_free(p);
         return -1;
     }
@@ -302,7 +415,7 @@ void pa_scache_free_all(pa_core *c) {
 
 int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, uint32_t *sink_input_idx) {
     pa_scache_entry *e;
-    pa_cvolume r;
+    pa_cvolume r, sample_volume;
     pa_proplist *merged;
     bool pass_volume;
 
@@ -320,7 +433,7 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     if (e->lazy && !e->memchunk.memblock) {
         pa_channel_map old_channel_map = e->channel_map;
 
-        if (pa_sound_file_load(c->mempool, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
+        if (load_file(c, e->filename, sink, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
             goto fail;
 
         pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
@@ -338,17 +451,22 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
 
     pa_log_debug("Playing sample \"%s\" on \"%s\"", name, sink->name);
 
-    pass_volume = true;
+    /* The sample's own volume is applied when rendering it for the
+     * sink, only the volume requested for this play is left for the
+     * sink input. */
+    if (e->volume_is_set && pa_cvolume_compatible_with_channel_map(&e->volume, &e->channel_map)) {
+        sample_volume = e->volume;
+        pa_cvolume_remap(&sample_volume, &e->channel_map, &sink->channel_map);
+    } else
+        pa_cvolume_reset(&sample_volume, sink->sample_spec.channels);
+
+    if (render_for_sink(e, sink, &sample_volume) < 0)
+        goto fail;
+
+    pass_volume = PA_VOLUME_IS_VALID(volume);
 
-    if (e->volume_is_set && PA_VOLUME_IS_VALID(volume)) {
-        pa_cvolume_set(&r, e->sample_spec.channels, volume);
-        pa_sw_cvolume_multiply(&r, &r, &e->volume);
-    } else if (e->volume_is_set)
-        r = e->volume;
-    else if (PA_VOLUME_IS_VALID(volume))
-        pa_cvolume_set(&r, e->sample_spec.channels, volume);
-    else
-        pass_volume = false;
+    if (pass_volume)
+        pa_cvolume_set(&r, sink->sample_spec.channels, volume);
 
     pa_proplist_update(merged, PA_UPDATE_REPLACE, e->proplist);
 
@@ -356,8 +474,8 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
         pa_proplist_update(merged, PA_UPDATE_REPLACE, p);
 
     if (pa_play_memchunk(sink,
-                         &e->sample_spec, &e->channel_map,
-                         &e->memchunk,
+                         &e->sink_sample_spec, &e->sink_channel_map,
+                         &e->sink_memchunk,
                          pass_volume ? &r : NULL,
                          merged,
                          PA_SINK_INPUT_NO_CREATE_ON_SUSPEND|PA_SINK_INPUT_KILL_ON_SUSPEND, sink_input_idx) < 0)
@@ -450,6 +568,7 @@ void pa_scache_unload_unused(pa_core *c) {
 
         pa_memblock_unref(e->memchunk.memblock);
         pa_memchunk_reset(&e->memchunk);
+        drop_sink_memchunk(e);
 
         pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
     }
@@ -41,6 +41,14 @@ typedef struct pa_scache_entry {
 
     char *filename;
 
+    /* The sample converted to the format of the sink it was last
+     * played on, with volume applied. Shared by all plays on sinks
+     * with that format, so they don't need resamplers of their own. */
+    pa_memchunk sink_memchunk;
+    pa_sample_spec sink_sample_spec;
+    pa_channel_map sink_channel_map;
+    pa_cvolume sink_volume;
+
     bool lazy;
     time_t last_used_time;
 
@@ -23,8 +23,11 @@
 
 #include <stdio.h>
 
+#include <pulse/rtclock.h>
 #include <pulse/xmalloc.h>
 
+#include <pulsecore/flist.h>
+#include <pulsecore/hashmap.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 
@@ -45,6 +48,18 @@ struct pa_subscription {
     void *userdata;
     pa_subscription_mask_t mask;
 
+    /* If non-zero, change events are delivered at most once per this
+     * interval for each object. Delivering a change event opens a window
+     * for its object, during which further changes of it are held back.
+     * The open windows are indexed by object in the windows hashmap and
+     * listed in the order they end in. The time event fires when the
+     * first one ends. */
+    pa_usec_t coalesce_usec;
+    pa_time_event *coalesce_event;
+    pa_hashmap *windows;
+    PA_LLIST_HEAD(pa_subscription_event, windows_head);
+    pa_subscription_event *windows_tail;
+
     PA_LLIST_FIELDS(pa_subscription);
 };
 
@@ -54,10 +69,56 @@ struct pa_subscription_event {
     pa_subscription_event_type_t type;
     uint32_t index;
 
+    /* Other queued events regarding the same object */
+    pa_subscription_event *older, *newer;
+
+    /* For coalescing windows: when the window ends and whether a change
+     * is held back until then */
+    pa_usec_t window_end;
+    bool held;
+
     PA_LLIST_FIELDS(pa_subscription_event);
 };
 
+PA_STATIC_FLIST_DECLARE(subscription_events, 0, pa_xfree);
+
 static void sched_event(pa_core *c);
+static void coalesce_cb(pa_mainloop_api *m, pa_time_event *te, const struct timeval *tv, void *userdata);
+
+/* Events are identified by facility and index, regardless of their type */
+static unsigned event_hash_func(const void *p) {
+    const pa_subscription_event *e = p;
+
+    return e->index * 31U + (e->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK);
+}
+
+static int event_compare_func(const void *a, const void *b) {
+    const pa_subscription_event *x = a, *y = b;
+
+    if (x->index != y->index)
+        return x->index < y->index ? -1 : 1;
+
+    return (int) (x->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) - (int) (y->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK);
+}
+
+static pa_subscription_event *event_new(pa_core *c, pa_subscription_event_type_t t, uint32_t idx) {
+    pa_subscription_event *e;
+
+    if (!(e = pa_flist_pop(PA_STATIC_FLIST_GET(subscription_events))))
+        e = pa_xnew(pa_subscription_event, 1);
+
+    e->core = c;
+    e->type = t;
+    e->index = idx;
+    e->older = e->newer = NULL;
+
+    return e;
+}
+
+static void event_free(pa_subscription_event *e) {
+    if (pa_flist_push(PA_STATIC_FLIST_GET(subscription_events), e) < 0)
+        pa_xfree(e);
+}
 
 /* Allocate a new subscription object for the given subscription mask. Use the specified callback function and user data */
 pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m, pa_subscription_cb_t callback, void *userdata) {
@@ -73,37 +134,142 @@ pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m, pa_su
     s->callback = callback;
     s->userdata = userdata;
     s->mask = m;
+    s->coalesce_usec = 0;
+    s->coalesce_event = NULL;
+    s->windows = NULL;
+    PA_LLIST_HEAD_INIT(pa_subscription_event, s->windows_head);
+    s->windows_tail = NULL;
 
     PA_LLIST_PREPEND(pa_subscription, c->subscriptions, s);
     return s;
 }
 
+static void unlink_window(pa_subscription *s, pa_subscription_event *w) {
+    if (!w->next)
+        s->windows_tail = w->prev;
+
+    PA_LLIST_REMOVE(pa_subscription_event, s->windows_head, w);
+}
+
+static void append_window(pa_subscription *s, pa_subscription_event *w) {
+    PA_LLIST_INSERT_AFTER(pa_subscription_event, s->windows_head, s->windows_tail, w);
+    s->windows_tail = w;
+}
+
+/* Opens a coalescing window for the object of e */
+static void open_window(pa_subscription *s, pa_subscription_event *e) {
+    pa_subscription_event *w;
+
+    w = event_new(s->core, e->type, e->index);
+    w->window_end = pa_rtclock_now() + s->coalesce_usec;
+    w->held = false;
+
+    if (!s->windows)
+        s->windows = pa_hashmap_new_full(event_hash_func, event_compare_func, NULL, (pa_free_cb_t) event_free);
+
+    pa_assert_se(pa_hashmap_put(s->windows, w, w) == 0);
+
+    /* All windows have the same length, so the new one ends last */
+    append_window(s, w);
+
+    if (!s->coalesce_event)
+        s->coalesce_event = pa_core_rttime_new(s->core, w->window_end, coalesce_cb, s);
+}
+
+static void close_window(pa_subscription *s, pa_subscription_event *w) {
+    unlink_window(s, w);
+    pa_assert_se(pa_hashmap_remove(s->windows, w) == w);
+    event_free(w);
+}
+
+static void close_all_windows(pa_subscription *s) {
+    pa_assert(s);
+
+    if (s->coalesce_event) {
+        s->core->mainloop->time_free(s->coalesce_event);
+        s->coalesce_event = NULL;
+    }
+
+    if (s->windows) {
+        pa_hashmap_free(s->windows);
+        s->windows = NULL;
+    }
+
+    PA_LLIST_HEAD_INIT(pa_subscription_event, s->windows_head);
+    s->windows_tail = NULL;
+}
+
 /* Free a subscription object, effectively marking it for deletion */
 void pa_subscription_free(pa_subscription*s) {
     pa_assert(s);
     pa_assert(!s->dead);
 
     s->dead = true;
+    close_all_windows(s);
     sched_event(s->core);
 }
 
+/* Deliver change events to this subscription at most once per usec
+ * for each object. Events arriving within that time after a delivery
+ * are merged and delivered when it has passed. Zero disables this. */
+void pa_subscription_set_coalesce_time(pa_subscription *s, pa_usec_t usec) {
+    pa_subscription_event *w;
+    pa_usec_t now;
+
+    pa_assert(s);
+    pa_assert(!s->dead);
+
+    if (usec == s->coalesce_usec)
+        return;
+
+    s->coalesce_usec = usec;
+
+    if (!s->coalesce_event)
+        return;
+
+    /* End all open windows now, so that nothing held back is lost */
+    now = pa_rtclock_now();
+
+    PA_LLIST_FOREACH(w, s->windows_head)
+        w->window_end = now;
+
+    pa_core_rttime_restart(s->core, s->coalesce_event, now);
+}
+
 static void free_subscription(pa_subscription *s) {
     pa_assert(s);
     pa_assert(s->core);
 
+    close_all_windows(s);
+
     PA_LLIST_REMOVE(pa_subscription, s->core->subscriptions, s);
     pa_xfree(s);
 }
 
 static void free_event(pa_subscription_event *s) {
+    pa_core *c;
+
     pa_assert(s);
-    pa_assert(s->core);
+    pa_assert_se(c = s->core);
+
+    if (s->newer)
+        s->newer->older = s->older;
+    else {
+        /* This was the newest queued event regarding its object */
+        pa_assert_se(pa_hashmap_remove(c->subscription_events_pending, s) == s);
+
+        if (s->older)
+            pa_assert_se(pa_hashmap_put(c->subscription_events_pending, s->older, s->older) == 0);
+    }
+
+    if (s->older)
+        s->older->newer = s->newer;
 
     if (!s->next)
-        s->core->subscription_event_last = s->prev;
+        c->subscription_event_last = s->prev;
 
-    PA_LLIST_REMOVE(pa_subscription_event, s->core->subscription_event_queue, s);
-    pa_xfree(s);
+    PA_LLIST_REMOVE(pa_subscription_event, c->subscription_event_queue, s);
+    event_free(s);
 }
 
 /* Free all subscription objects */
@@ -116,6 +282,11 @@ void pa_subscription_free_all(pa_core *c) {
     while (c->subscription_event_queue)
         free_event(c->subscription_event_queue);
 
+    if (c->subscription_events_pending) {
+        pa_hashmap_free(c->subscription_events_pending);
+        c->subscription_events_pending = NULL;
+    }
+
     if (c->subscription_defer_event) {
         c->mainloop->defer_free(c->subscription_defer_event);
         c->subscription_defer_event = NULL;
@@ -150,6 +321,99 @@ static void dump_event(const char * prefix, pa_subscription_event*e) {
 }
 #endif
 
+/* Called when the first coalescing window of a subscription ends */
+static void coalesce_cb(pa_mainloop_api *m, pa_time_event *te, const struct timeval *tv, void *userdata) {
+    pa_subscription *s = userdata;
+    pa_subscription_event *w;
+    pa_usec_t now;
+
+    pa_assert(s);
+    pa_assert(!s->dead);
+    pa_assert(s->coalesce_event == te);
+
+    now = pa_rtclock_now();
+
+    while ((w = s->windows_head) && w->window_end <= now) {
+        pa_subscription_event_type_t type = w->type;
+        uint32_t idx = w->index;
+
+        if (!w->held) {
+            close_window(s, w);
+            continue;
+        }
+
+        /* Deliver the held change and keep the window open for another
+         * period, so that the next change is held back again */
+        if (s->coalesce_usec > 0) {
+            unlink_window(s, w);
+            w->window_end = now + s->coalesce_usec;
+            w->held = false;
+            append_window(s, w);
+        } else
+            close_window(s, w);
+
+        s->callback(s->core, type, idx, s->userdata);
+        s->core->subscription_events_delivered++;
+
+        /* The callback might have freed the subscription, which also
+         * frees the windows and the time event */
+        if (s->dead)
+            return;
+    }
+
+    if (s->windows_head)
+        pa_core_rttime_restart(s->core, te, s->windows_head->window_end);
+    else {
+        m->time_free(te);
+        s->coalesce_event = NULL;
+    }
+}
+
+static void deliver_event(pa_subscription *s, pa_subscription_event *e) {
+    pa_subscription_event *w = NULL;
+    pa_core *c;
+
+    pa_assert(s);
+    pa_assert(e);
+    pa_assert_se(c = s->core);
+
+    if (s->windows)
+        w = pa_hashmap_get(s->windows, e);
+
+    switch (e->type & PA_SUBSCRIPTION_EVENT_TYPE_MASK) {
+
+        case PA_SUBSCRIPTION_EVENT_CHANGE:
+
+            /* A window is open for this object, hold the change back */
+            if (w) {
+                w->held = true;
+                c->subscription_events_coalesced++;
+                return;
+            }
+
+            if (s->coalesce_usec > 0)
+                open_window(s, e);
+            break;
+
+        case PA_SUBSCRIPTION_EVENT_REMOVE:
+
+            /* No point in telling about changes of a removed object */
+            if (w) {
+                if (w->held)
+                    c->subscription_events_coalesced++;
+
+                close_window(s, w);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    s->callback(c, e->type, e->index, s->userdata);
+    c->subscription_events_delivered++;
+}
+
 /* Deferred callback for dispatching subscription events */
 static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
     pa_core *c = userdata;
@@ -169,7 +433,7 @@ static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
         for (s = c->subscriptions; s; s = s->next) {
 
             if (!s->dead && pa_subscription_match_flags(s->mask, e->type))
-                s->callback(c, e->type, e->index, s->userdata);
+                deliver_event(s, e);
         }
 
 #ifdef DEBUG
@@ -203,52 +467,55 @@ static void sched_event(pa_core *c) {
 
 /* Append a new subscription event to the subscription event queue and schedule a main loop event */
 void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t idx) {
-    pa_subscription_event *e;
+    pa_subscription_event *e, *last;
     pa_assert(c);
 
     /* No need for queuing subscriptions of no one is listening */
     if (!c->subscriptions)
         return;
 
-    if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) != PA_SUBSCRIPTION_EVENT_NEW) {
-        pa_subscription_event *i, *n;
+    c->subscription_events_posted++;
 
-        /* Check for duplicates */
-        for (i = c->subscription_event_last; i; i = n) {
-            n = i->prev;
+    if (!c->subscription_events_pending)
+        c->subscription_events_pending = pa_hashmap_new(event_hash_func, event_compare_func);
 
-            /* not the same object type */
-            if (((t ^ i->type) & PA_SUBSCRIPTION_EVENT_FACILITY_MASK))
-                continue;
+    e = event_new(c, t, idx);
 
-            /* not the same object */
-            if (i->index != idx)
-                continue;
+    /* Look up the newest queued event regarding the same object */
+    last = pa_hashmap_get(c->subscription_events_pending, e);
 
-            if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE) {
-                /* This object is being removed, hence there is no
-                 * point in keeping the old events regarding this
-                 * entry in the queue. */
+    if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE) {
+        /* This object is being removed, hence there is no
+         * point in keeping the old events regarding this
+         * entry in the queue. */
 
-                free_event(i);
-                pa_log_debug("Dropped redundant event due to remove event.");
-                continue;
-            }
+        while (last) {
+            pa_subscription_event *older = last->older;
 
-            if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_CHANGE) {
-                /* This object has changed. If a "new" or "change" event for
-                 * this object is still in the queue we can exit. */
+            free_event(last);
+            c->subscription_events_dropped++;
+            pa_log_debug("Dropped redundant event due to remove event.");
 
-                pa_log_debug("Dropped redundant event due to change event.");
-                return;
-            }
+            last = older;
         }
+
+    } else if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_CHANGE && last) {
+        /* This object has changed. If a "new" or "change" event for
+         * this object is still in the queue we can exit. */
+
+        event_free(e);
+        c->subscription_events_dropped++;
+        pa_log_debug("Dropped redundant event due to change event.");
+        return;
     }
 
-    e = pa_xnew(pa_subscription_event, 1);
-    e->core = c;
-    e->type = t;
-    e->index = idx;
+    if (last) {
+        pa_assert_se(pa_hashmap_remove(c->subscription_events_pending, last) == last);
+        last->newer = e;
+        e->older = last;
+    }
+
+    pa_assert_se(pa_hashmap_put(c->subscription_events_pending, e, e) == 0);
 
     PA_LLIST_INSERT_AFTER(pa_subscription_event, c->subscription_event_queue, c->subscription_event_last, e);
     c->subscription_event_last = e;
@@ -32,6 +32,8 @@ pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m,  pa_s
 void pa_subscription_free(pa_subscription*s);
 void pa_subscription_free_all(pa_core *c);
 
+void pa_subscription_set_coalesce_time(pa_subscription *s, pa_usec_t usec);
+
 void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t idx);
 
 #endif
@@ -125,6 +125,10 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, bool enable_memfd, size_t
     PA_LLIST_HEAD_INIT(pa_subscription, c->subscriptions);
     PA_LLIST_HEAD_INIT(pa_subscription_event, c->subscription_event_queue);
     c->subscription_event_last = NULL;
+    c->subscription_events_pending = NULL;
+    c->subscription_coalesce_msec = 0;
+    c->subscription_events_posted = c->subscription_events_dropped = 0;
+    c->subscription_events_coalesced = c->subscription_events_delivered = 0;
 
     c->mempool = pool;
     c->shm_size = shm_size;
@@ -147,6 +151,7 @@ pa_core* pa_core_new(pa_mainloop_api *m, bool shared, bool enable_memfd, size_t
     c->disable_lfe_remixing = true;
     c->lfe_crossover_freq = 0;
     c->deferred_volume = true;
+    c->scache_persistent = false;
     c->resample_method = PA_RESAMPLER_SPEEX_FLOAT_BASE + 1;
 
     for (j = 0; j < PA_CORE_HOOK_MAX; j++)
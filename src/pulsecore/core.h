@@ -197,6 +197,12 @@ struct pa_core {
     PA_LLIST_HEAD(pa_subscription, subscriptions);
     PA_LLIST_HEAD(pa_subscription_event, subscription_event_queue);
     pa_subscription_event *subscription_event_last;
+    pa_hashmap *subscription_events_pending; /* (facility, index) -> newest queued pa_subscription_event */
+    unsigned subscription_coalesce_msec;
+
+    /* Subscription event statistics */
+    uint64_t subscription_events_posted, subscription_events_dropped;
+    uint64_t subscription_events_coalesced, subscription_events_delivered;
 
     /* The mempool is used for data we write to, it's readonly for the client. */
     pa_mempool *mempool;
@@ -222,6 +228,7 @@ struct pa_core {
     bool remixing_use_all_sink_channels:1;
     bool disable_lfe_remixing:1;
     bool deferred_volume:1;
+    bool scache_persistent:1;
 
     pa_resample_method_t resample_method;
     int realtime_priority;
@@ -0,0 +1,130 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/macro.h>
+
+#include "drift-controller.h"
+
+/* The controller time constant, in units of the adjust time. The latency
+ * filter uses one adjust time as its time constant, so the controller is
+ * slow enough not to be disturbed by the lag of the filter. */
+#define CONTROL_TIME_FACTOR 3
+
+/* If updates are further apart than this many adjust times, we assume that
+ * the system was suspended and start over with the filter */
+#define MAX_GAP_FACTOR 5
+
+struct pa_drift_controller {
+    double adjust_time;     /* s */
+    double max_deviation;
+
+    double kp;              /* 1/s */
+    double ki;              /* 1/s² */
+
+    bool have_error;
+    pa_usec_t last_time;
+    double filtered_error;  /* s */
+    double drift;           /* integral part, relative rate */
+};
+
+pa_drift_controller* pa_drift_controller_new(pa_usec_t adjust_time, double max_deviation) {
+    pa_drift_controller *c;
+    double control_time;
+
+    pa_assert(adjust_time > 0);
+    pa_assert(max_deviation > 0 && max_deviation < 1);
+
+    c = pa_xnew0(pa_drift_controller, 1);
+    c->adjust_time = (double) adjust_time / PA_USEC_PER_SEC;
+    c->max_deviation = max_deviation;
+
+    /* The latency changes with the difference between the drift and our
+     * correction. Closing the loop with a PI controller gives a second
+     * order system, which is critically damped for ki = kp²/4. */
+    control_time = CONTROL_TIME_FACTOR * c->adjust_time;
+    c->kp = 1.0 / control_time;
+    c->ki = c->kp * c->kp / 4;
+
+    return c;
+}
+
+void pa_drift_controller_free(pa_drift_controller *c) {
+    pa_assert(c);
+
+    pa_xfree(c);
+}
+
+void pa_drift_controller_reset(pa_drift_controller *c, bool forget_drift) {
+    pa_assert(c);
+
+    c->have_error = false;
+    c->filtered_error = 0;
+
+    if (forget_drift)
+        c->drift = 0;
+}
+
+uint32_t pa_drift_controller_update(pa_drift_controller *c, pa_usec_t now, int64_t latency_error, uint32_t base_rate) {
+    double error, dt = 0, correction;
+
+    pa_assert(c);
+    pa_assert(base_rate > 0);
+
+    error = (double) latency_error / PA_USEC_PER_SEC;
+
+    if (c->have_error && now > c->last_time)
+        dt = (double) (now - c->last_time) / PA_USEC_PER_SEC;
+
+    if (!c->have_error || dt > MAX_GAP_FACTOR * c->adjust_time) {
+        /* Start the filter at the current value */
+        c->filtered_error = error;
+        c->have_error = true;
+        dt = 0;
+    } else
+        c->filtered_error += dt / (c->adjust_time + dt) * (error - c->filtered_error);
+
+    c->last_time = now;
+
+    correction = c->drift + c->kp * c->filtered_error;
+
+    /* Only integrate while the output is not limited, or when the error
+     * pulls it back, so that large errors don't wind up the integral */
+    if (fabs(correction) < c->max_deviation || (correction > 0) != (c->filtered_error > 0)) {
+        c->drift += c->ki * c->filtered_error * dt;
+        c->drift = PA_CLAMP(c->drift, -c->max_deviation, c->max_deviation);
+        correction = c->drift + c->kp * c->filtered_error;
+    }
+
+    correction = PA_CLAMP(correction, -c->max_deviation, c->max_deviation);
+
+    return (uint32_t) lrint(base_rate * (1.0 + correction));
+}
+
+double pa_drift_controller_get_drift(pa_drift_controller *c) {
+    pa_assert(c);
+
+    return c->drift;
+}
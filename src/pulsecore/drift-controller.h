@@ -0,0 +1,60 @@
+#ifndef foopulsedriftcontrollerhfoo
+#define foopulsedriftcontrollerhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulsecore/macro.h>
+#include <pulse/sample.h>
+
+/* Compensates the clock drift between a producer and a consumer of audio
+ * by adjusting the rate of a resampler in between, so that the latency
+ * between the two stays at a target value.
+ *
+ * The user periodically measures the latency and feeds the difference to
+ * the target latency into pa_drift_controller_update(), which returns the
+ * rate to set on the resampler. A higher rate means that data is consumed
+ * faster, so a positive error increases the rate. The measurements are
+ * low-pass filtered, and the rate is computed by a PI controller whose
+ * integral part converges to the drift between the two clocks, so that no
+ * steady state error remains. The controller does not depend on a fixed
+ * update interval, the time between updates is taken from the timestamps
+ * passed in. The controller is not thread safe, but it may be used from
+ * any single thread. */
+
+typedef struct pa_drift_controller pa_drift_controller;
+
+/* adjust_time is the nominal time between updates, from which the filter
+ * and controller time constants are derived. max_deviation is the largest
+ * relative deviation of the rate from the base rate, e.g. 0.01 for 1%. */
+pa_drift_controller* pa_drift_controller_new(pa_usec_t adjust_time, double max_deviation);
+void pa_drift_controller_free(pa_drift_controller *c);
+
+/* Forgets the filtered latency, for example after the source or sink was
+ * changed, or after the latency was corrected by dropping or inserting
+ * samples. The estimated drift is kept unless forget_drift is set. */
+void pa_drift_controller_reset(pa_drift_controller *c, bool forget_drift);
+
+/* Feeds a new latency measurement into the controller and returns the new
+ * rate. now is the time of the measurement, latency_error the measured
+ * latency minus the target latency, and base_rate the nominal rate. */
+uint32_t pa_drift_controller_update(pa_drift_controller *c, pa_usec_t now, int64_t latency_error, uint32_t base_rate);
+
+/* Returns the currently estimated clock drift, as a relative rate deviation */
+double pa_drift_controller_get_drift(pa_drift_controller *c);
+
+#endif
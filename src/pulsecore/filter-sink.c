@@ -0,0 +1,696 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/sample-util.h>
+
+#include "filter-sink.h"
+
+#define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
+
+/* Converts a length in the sample spec of the sink input to one in the sample
+ * spec of the sink */
+static size_t to_sink_bytes(pa_filter_sink *f, size_t nbytes) {
+    return nbytes / f->fs * f->sink_fs;
+}
+
+/* Called from I/O thread context */
+static pa_usec_t get_fixed_latency(pa_filter_sink *f, pa_usec_t latency) {
+
+    /* A fixed block is only complete one block minus one frame after its
+     * first frame was rendered. Sinks with dynamic latency have no fixed
+     * latency to add that to. */
+    if (latency > 0 && f->block_size > 0)
+        latency += pa_bytes_to_usec(f->block_size - f->sink_fs, &f->sink->sample_spec);
+
+    return latency;
+}
+
+/* Called from I/O thread context */
+int pa_filter_sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    pa_filter_sink *f = PA_SINK(o)->userdata;
+
+    switch (code) {
+
+        case PA_SINK_MESSAGE_GET_LATENCY:
+
+            /* The sink is _put() before the sink input is, so let's
+             * make sure we don't access it in that time. Also, the
+             * sink input is first shut down, the sink second. */
+            if (!PA_SINK_IS_LINKED(f->sink->thread_info.state) ||
+                !PA_SINK_INPUT_IS_LINKED(f->sink_input->thread_info.state)) {
+                *((int64_t*) data) = 0;
+                return 0;
+            }
+
+            *((int64_t*) data) =
+
+                /* Get the latency of the master sink */
+                pa_sink_get_latency_within_thread(f->sink_input->sink, true) +
+
+                /* Add the latency internal to our sink input on top */
+                pa_bytes_to_usec(pa_memblockq_get_length(f->sink_input->thread_info.render_memblockq), &f->sink_input->sink->sample_spec);
+
+            /* And what is waiting to be processed */
+            if (f->memblockq)
+                *((int64_t*) data) += pa_bytes_to_usec(pa_memblockq_get_length(f->memblockq), &f->sink->sample_spec);
+
+            /* And the delay of the filter itself */
+            if (f->get_latency)
+                *((int64_t*) data) += f->get_latency(f);
+
+            return 0;
+    }
+
+    return pa_sink_process_msg(o, code, data, offset, chunk);
+}
+
+/* Called from main context */
+static int sink_set_state_in_main_thread_cb(pa_sink *s, pa_sink_state_t state, pa_suspend_cause_t suspend_cause) {
+    pa_filter_sink *f;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(f = s->userdata);
+
+    if (!PA_SINK_IS_LINKED(state) ||
+        !PA_SINK_INPUT_IS_LINKED(f->sink_input->state))
+        return 0;
+
+    pa_sink_input_cork(f->sink_input, state == PA_SINK_SUSPENDED);
+    return 0;
+}
+
+/* Called from the IO thread. */
+static int sink_set_state_in_io_thread_cb(pa_sink *s, pa_sink_state_t new_state, pa_suspend_cause_t new_suspend_cause) {
+    pa_filter_sink *f;
+
+    pa_assert(s);
+    pa_assert_se(f = s->userdata);
+
+    /* When set to running or idle for the first time, request a rewind
+     * of the master sink to make sure we are heard immediately */
+    if (PA_SINK_IS_OPENED(new_state) && s->thread_info.state == PA_SINK_INIT) {
+        pa_log_debug("Requesting rewind due to state change.");
+        pa_sink_input_request_rewind(f->sink_input, 0, false, true, true);
+    }
+
+    return 0;
+}
+
+/* Called from I/O thread context */
+static void sink_request_rewind_cb(pa_sink *s) {
+    pa_filter_sink *f;
+    size_t nbytes;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(f = s->userdata);
+
+    if (!PA_SINK_IS_LINKED(f->sink->thread_info.state) ||
+        !PA_SINK_INPUT_IS_LINKED(f->sink_input->thread_info.state))
+        return;
+
+    nbytes = s->thread_info.rewind_nbytes;
+    if (f->memblockq)
+        nbytes += pa_memblockq_get_length(f->memblockq);
+
+    /* Just hand this one over to the master sink */
+    pa_sink_input_request_rewind(f->sink_input, nbytes / f->sink_fs * f->fs, true, false, false);
+}
+
+/* Called from I/O thread context */
+static void sink_update_requested_latency_cb(pa_sink *s) {
+    pa_filter_sink *f;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(f = s->userdata);
+
+    if (!PA_SINK_IS_LINKED(f->sink->thread_info.state) ||
+        !PA_SINK_INPUT_IS_LINKED(f->sink_input->thread_info.state))
+        return;
+
+    /* Just hand this one over to the master sink */
+    pa_sink_input_set_requested_latency_within_thread(
+            f->sink_input,
+            pa_sink_get_requested_latency_within_thread(s));
+}
+
+/* Called from main context */
+static void sink_set_volume_cb(pa_sink *s) {
+    pa_filter_sink *f;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(f = s->userdata);
+
+    if (!PA_SINK_IS_LINKED(s->state) ||
+        !PA_SINK_INPUT_IS_LINKED(f->sink_input->state))
+        return;
+
+    pa_sink_input_set_volume(f->sink_input, &s->real_volume, s->save_volume, true);
+}
+
+/* Called from main context */
+static void sink_set_mute_cb(pa_sink *s) {
+    pa_filter_sink *f;
+
+    pa_sink_assert_ref(s);
+    pa_assert_se(f = s->userdata);
+
+    if (!PA_SINK_IS_LINKED(s->state) ||
+        !PA_SINK_INPUT_IS_LINKED(f->sink_input->state))
+        return;
+
+    pa_sink_input_set_mute(f->sink_input, s->muted, s->save_muted);
+}
+
+/* Called from I/O thread context */
+static void pop_in_place(pa_filter_sink *f, size_t nbytes, pa_memchunk *chunk) {
+    void *p;
+
+    chunk->index = 0;
+    chunk->length = PA_MIN(nbytes, f->max_length);
+    chunk->memblock = pa_memblock_new(f->sink->core->mempool, chunk->length);
+
+    pa_sink_render_into_full(f->sink, chunk);
+
+    p = pa_memblock_acquire(chunk->memblock);
+    f->process(f, p, p, (unsigned) (chunk->length / f->fs));
+    pa_memblock_release(chunk->memblock);
+}
+
+/* Called from I/O thread context */
+static void render_into_queue(pa_filter_sink *f, size_t nbytes) {
+    pa_memchunk nchunk;
+
+    pa_sink_render(f->sink, nbytes, &nchunk);
+    pa_memblockq_push(f->memblockq, &nchunk);
+    pa_memblock_unref(nchunk.memblock);
+}
+
+/* Called from I/O thread context */
+static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
+    pa_filter_sink *f;
+    void *src, *dst;
+    unsigned n;
+    pa_memchunk tchunk;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert(chunk);
+    pa_assert_se(f = i->userdata);
+
+    if (!PA_SINK_IS_LINKED(f->sink->thread_info.state))
+        return -1;
+
+    /* Hmm, process any rewind request that might be queued up */
+    pa_sink_process_rewind(f->sink, 0);
+
+    if (f->in_place) {
+        pop_in_place(f, nbytes, chunk);
+        return 0;
+    }
+
+    nbytes = PA_MIN(to_sink_bytes(f, nbytes), f->max_length);
+    pa_assert(nbytes > 0);
+
+    if (f->block_size > 0) {
+        size_t length;
+
+        /* Only whole blocks are processed, so render until we have at
+         * least one, and take as many as were asked for */
+        nbytes = PA_ROUND_UP(nbytes, f->block_size);
+        while ((length = pa_memblockq_get_length(f->memblockq)) < f->block_size)
+            render_into_queue(f, nbytes - length);
+
+        length = PA_MIN(nbytes, PA_ROUND_DOWN(length, f->block_size));
+        pa_assert_se(pa_memblockq_peek_fixed_size(f->memblockq, length, &tchunk) >= 0);
+    } else {
+        while (pa_memblockq_peek(f->memblockq, &tchunk) < 0)
+            render_into_queue(f, nbytes);
+
+        tchunk.length = PA_MIN(nbytes, tchunk.length);
+    }
+
+    n = (unsigned) (tchunk.length / f->sink_fs);
+    pa_assert(n > 0);
+
+    chunk->index = 0;
+    chunk->length = n * f->fs;
+    chunk->memblock = pa_memblock_new(i->sink->core->mempool, chunk->length);
+
+    pa_memblockq_drop(f->memblockq, n * f->sink_fs);
+
+    src = pa_memblock_acquire_chunk(&tchunk);
+    dst = pa_memblock_acquire(chunk->memblock);
+
+    f->process(f, src, dst, n);
+
+    pa_memblock_release(tchunk.memblock);
+    pa_memblock_release(chunk->memblock);
+
+    pa_memblock_unref(tchunk.memblock);
+
+    return 0;
+}
+
+/* Called from I/O thread context */
+static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
+    pa_filter_sink *f;
+    size_t amount = 0;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    /* If the sink is not yet linked, there is nothing to rewind */
+    if (!PA_SINK_IS_LINKED(f->sink->thread_info.state))
+        return;
+
+    nbytes = to_sink_bytes(f, nbytes);
+
+    if (f->sink->thread_info.rewind_nbytes > 0) {
+        size_t max_rewrite;
+
+        max_rewrite = nbytes;
+        if (f->memblockq)
+            max_rewrite += pa_memblockq_get_length(f->memblockq);
+
+        amount = PA_MIN(f->sink->thread_info.rewind_nbytes, max_rewrite);
+        f->sink->thread_info.rewind_nbytes = 0;
+
+        if (amount > 0) {
+            if (f->memblockq)
+                pa_memblockq_seek(f->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, true);
+
+            if (f->reset && !f->rewind)
+                f->reset(f);
+        }
+    }
+
+    pa_sink_process_rewind(f->sink, amount);
+
+    if (f->memblockq)
+        pa_memblockq_rewind(f->memblockq, nbytes);
+
+    /* The queue hands out what was rewound again, without a queue the sink
+     * renders what it rewound again */
+    if (f->rewind) {
+        size_t n = f->memblockq ? nbytes : amount;
+
+        if (n >= f->sink_fs)
+            f->rewind(f, (unsigned) (n / f->sink_fs));
+    }
+}
+
+/* Called from I/O thread context */
+static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
+    pa_filter_sink *f;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    nbytes = to_sink_bytes(f, nbytes);
+
+    /* FIXME: Too small max_rewind:
+     * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
+    if (f->memblockq)
+        pa_memblockq_set_maxrewind(f->memblockq, nbytes);
+    pa_sink_set_max_rewind_within_thread(f->sink, nbytes);
+
+    if (f->update_max_rewind)
+        f->update_max_rewind(f, (unsigned) (nbytes / f->sink_fs));
+}
+
+/* Called from I/O thread context */
+static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes) {
+    pa_filter_sink *f;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    nbytes = to_sink_bytes(f, nbytes);
+    if (f->block_size > 0)
+        nbytes = PA_ROUND_UP(nbytes, f->block_size);
+
+    pa_sink_set_max_request_within_thread(f->sink, nbytes);
+}
+
+/* Called from I/O thread context */
+static void sink_input_update_sink_latency_range_cb(pa_sink_input *i) {
+    pa_filter_sink *f;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    pa_sink_set_latency_range_within_thread(f->sink, i->sink->thread_info.min_latency, i->sink->thread_info.max_latency);
+}
+
+/* Called from I/O thread context */
+static void sink_input_update_sink_fixed_latency_cb(pa_sink_input *i) {
+    pa_filter_sink *f;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    pa_sink_set_fixed_latency_within_thread(f->sink, get_fixed_latency(f, i->sink->thread_info.fixed_latency));
+}
+
+/* Called from I/O thread context */
+static void sink_input_detach_cb(pa_sink_input *i) {
+    pa_filter_sink *f;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    if (PA_SINK_IS_LINKED(f->sink->thread_info.state))
+        pa_sink_detach_within_thread(f->sink);
+
+    pa_sink_set_rtpoll(f->sink, NULL);
+}
+
+/* Called from I/O thread context */
+static void sink_input_attach_cb(pa_sink_input *i) {
+    pa_filter_sink *f;
+    size_t max_request, max_rewind;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    pa_sink_set_rtpoll(f->sink, i->sink->thread_info.rtpoll);
+    pa_sink_set_latency_range_within_thread(f->sink, i->sink->thread_info.min_latency, i->sink->thread_info.max_latency);
+    pa_sink_set_fixed_latency_within_thread(f->sink, get_fixed_latency(f, i->sink->thread_info.fixed_latency));
+
+    max_request = to_sink_bytes(f, pa_sink_input_get_max_request(i));
+    if (f->block_size > 0)
+        max_request = PA_ROUND_UP(max_request, f->block_size);
+    pa_sink_set_max_request_within_thread(f->sink, max_request);
+
+    /* FIXME: Too small max_rewind:
+     * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
+    max_rewind = to_sink_bytes(f, pa_sink_input_get_max_rewind(i));
+    pa_sink_set_max_rewind_within_thread(f->sink, max_rewind);
+
+    if (f->update_max_rewind)
+        f->update_max_rewind(f, (unsigned) (max_rewind / f->sink_fs));
+
+    if (PA_SINK_IS_LINKED(f->sink->thread_info.state))
+        pa_sink_attach_within_thread(f->sink);
+}
+
+/* Called from main context */
+static void sink_input_kill_cb(pa_sink_input *i) {
+    pa_filter_sink *f;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    /* The order here matters! We first kill the sink so that streams
+     * can properly be moved away while the sink input is still connected
+     * to the master. */
+    pa_sink_input_cork(f->sink_input, true);
+    pa_sink_unlink(f->sink);
+    pa_sink_input_unlink(f->sink_input);
+
+    pa_sink_input_unref(f->sink_input);
+    f->sink_input = NULL;
+
+    pa_sink_unref(f->sink);
+    f->sink = NULL;
+
+    pa_module_unload_request(f->module, true);
+}
+
+/* Called from main context */
+static bool sink_input_may_move_to_cb(pa_sink_input *i, pa_sink *dest) {
+    pa_filter_sink *f;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    if (f->autoloaded)
+        return false;
+
+    return f->sink != dest;
+}
+
+/* Called from main context */
+static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest) {
+    pa_filter_sink *f;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    if (dest) {
+        pa_sink_set_asyncmsgq(f->sink, dest->asyncmsgq);
+        pa_sink_update_flags(f->sink, PA_SINK_LATENCY|PA_SINK_DYNAMIC_LATENCY, dest->flags);
+    } else
+        pa_sink_set_asyncmsgq(f->sink, NULL);
+
+    if (f->auto_desc && dest) {
+        const char *z;
+        pa_proplist *pl;
+
+        pl = pa_proplist_new();
+        z = pa_proplist_gets(dest->proplist, PA_PROP_DEVICE_DESCRIPTION);
+        pa_proplist_setf(pl, PA_PROP_DEVICE_DESCRIPTION, "%s %s on %s", f->description,
+                         pa_proplist_gets(f->sink->proplist, f->name_property), z ? z : dest->name);
+
+        pa_sink_update_proplist(f->sink, PA_UPDATE_REPLACE, pl);
+        pa_proplist_free(pl);
+    }
+}
+
+/* Called from main context */
+static void sink_input_volume_changed_cb(pa_sink_input *i) {
+    pa_filter_sink *f;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    pa_sink_volume_changed(f->sink, &i->volume);
+}
+
+/* Called from main context */
+static void sink_input_mute_changed_cb(pa_sink_input *i) {
+    pa_filter_sink *f;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    pa_sink_mute_changed(f->sink, i->muted);
+}
+
+/* Called from main context */
+static void sink_input_suspend_cb(pa_sink_input *i, pa_sink_state_t old_state, pa_suspend_cause_t old_suspend_cause) {
+    pa_filter_sink *f;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(f = i->userdata);
+
+    if (i->sink->state != PA_SINK_SUSPENDED || i->sink->suspend_cause == PA_SUSPEND_IDLE)
+        pa_sink_suspend(f->sink, false, PA_SUSPEND_UNAVAILABLE);
+    else
+        pa_sink_suspend(f->sink, true, PA_SUSPEND_UNAVAILABLE);
+}
+
+void pa_filter_sink_new_data_init(pa_filter_sink_new_data *data, pa_module *m, const char *driver, pa_sink *master) {
+    pa_assert(data);
+    pa_assert(m);
+    pa_assert(master);
+
+    pa_zero(*data);
+    data->master = master;
+    data->use_volume_sharing = true;
+
+    pa_sink_new_data_init(&data->sink_data);
+    data->sink_data.driver = driver;
+    data->sink_data.module = m;
+    pa_proplist_sets(data->sink_data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, master->name);
+    pa_proplist_sets(data->sink_data.proplist, PA_PROP_DEVICE_CLASS, "filter");
+
+    pa_sink_input_new_data_init(&data->sink_input_data);
+    data->sink_input_data.driver = driver;
+    data->sink_input_data.module = m;
+    pa_sink_input_new_data_set_sink(&data->sink_input_data, master, false, true);
+    pa_proplist_sets(data->sink_input_data.proplist, PA_PROP_MEDIA_ROLE, "filter");
+    data->sink_input_data.flags |= PA_SINK_INPUT_START_CORKED;
+}
+
+void pa_filter_sink_new_data_done(pa_filter_sink_new_data *data) {
+    pa_assert(data);
+
+    pa_sink_new_data_done(&data->sink_data);
+    pa_sink_input_new_data_done(&data->sink_input_data);
+}
+
+pa_filter_sink *pa_filter_sink_new(pa_filter_sink_new_data *data) {
+    pa_filter_sink *f;
+    pa_module *m;
+    pa_sink *master;
+    pa_memchunk silence;
+    size_t max_frames;
+
+    pa_assert(data);
+    pa_assert_se(m = data->sink_data.module);
+    pa_assert_se(master = data->master);
+    pa_assert(data->description);
+    pa_assert(data->name_property);
+    pa_assert(!data->use_volume_sharing || !data->force_flat_volume);
+
+    f = pa_xnew0(pa_filter_sink, 1);
+    f->module = m;
+    f->autoloaded = data->autoloaded;
+    f->description = pa_xstrdup(data->description);
+    f->name_property = pa_xstrdup(data->name_property);
+
+    if ((f->auto_desc = !pa_proplist_contains(data->sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION))) {
+        const char *z, *name;
+
+        z = pa_proplist_gets(master->proplist, PA_PROP_DEVICE_DESCRIPTION);
+        if (!(name = pa_proplist_gets(data->sink_data.proplist, f->name_property)))
+            name = data->sink_data.name;
+        pa_proplist_setf(data->sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "%s %s on %s", f->description, name, z ? z : master->name);
+    }
+
+    f->sink = pa_sink_new(m->core, &data->sink_data, (master->flags & (PA_SINK_LATENCY|PA_SINK_DYNAMIC_LATENCY))
+                                                     | (data->use_volume_sharing ? PA_SINK_SHARE_VOLUME_WITH_MASTER : 0));
+    if (!f->sink) {
+        pa_log("Failed to create sink.");
+        goto fail;
+    }
+
+    f->sink->parent.process_msg = pa_filter_sink_process_msg;
+    f->sink->set_state_in_main_thread = sink_set_state_in_main_thread_cb;
+    f->sink->set_state_in_io_thread = sink_set_state_in_io_thread_cb;
+    f->sink->update_requested_latency = sink_update_requested_latency_cb;
+    f->sink->request_rewind = sink_request_rewind_cb;
+    pa_sink_set_set_mute_callback(f->sink, sink_set_mute_cb);
+    if (!data->use_volume_sharing) {
+        pa_sink_set_set_volume_callback(f->sink, sink_set_volume_cb);
+        pa_sink_enable_decibel_volume(f->sink, true);
+    }
+    /* Normally this flag would be enabled automatically be we can force it. */
+    if (data->force_flat_volume)
+        f->sink->flags |= PA_SINK_FLAT_VOLUME;
+    f->sink->userdata = f;
+
+    pa_sink_set_asyncmsgq(f->sink, master->asyncmsgq);
+
+    if (!data->sink_input_data.sample_spec_is_set)
+        pa_sink_input_new_data_set_sample_spec(&data->sink_input_data, &f->sink->sample_spec);
+    if (!data->sink_input_data.channel_map_is_set)
+        pa_sink_input_new_data_set_channel_map(&data->sink_input_data, &f->sink->channel_map);
+    data->sink_input_data.origin_sink = f->sink;
+    if (!pa_proplist_contains(data->sink_input_data.proplist, PA_PROP_MEDIA_NAME))
+        pa_proplist_setf(data->sink_input_data.proplist, PA_PROP_MEDIA_NAME, "%s Stream from %s", f->description,
+                         pa_proplist_gets(f->sink->proplist, PA_PROP_DEVICE_DESCRIPTION));
+
+    pa_sink_input_new(&f->sink_input, m->core, &data->sink_input_data);
+    if (!f->sink_input) {
+        pa_log("Failed to create sink input.");
+        goto fail;
+    }
+
+    f->sink_input->pop = sink_input_pop_cb;
+    f->sink_input->process_rewind = sink_input_process_rewind_cb;
+    f->sink_input->update_max_rewind = sink_input_update_max_rewind_cb;
+    f->sink_input->update_max_request = sink_input_update_max_request_cb;
+    f->sink_input->update_sink_latency_range = sink_input_update_sink_latency_range_cb;
+    f->sink_input->update_sink_fixed_latency = sink_input_update_sink_fixed_latency_cb;
+    f->sink_input->kill = sink_input_kill_cb;
+    f->sink_input->attach = sink_input_attach_cb;
+    f->sink_input->detach = sink_input_detach_cb;
+    f->sink_input->may_move_to = sink_input_may_move_to_cb;
+    f->sink_input->moving = sink_input_moving_cb;
+    f->sink_input->volume_changed = data->use_volume_sharing ? NULL : sink_input_volume_changed_cb;
+    f->sink_input->mute_changed = sink_input_mute_changed_cb;
+    f->sink_input->suspend = sink_input_suspend_cb;
+    f->sink_input->userdata = f;
+
+    f->sink->input_to_master = f->sink_input;
+
+    f->sink_fs = pa_frame_size(&f->sink->sample_spec);
+    f->fs = pa_frame_size(&f->sink_input->sample_spec);
+    f->block_size = data->block_frames * f->sink_fs;
+
+    /* Process at most what fits in one memblock, on either side */
+    max_frames = pa_mempool_block_size_max(m->core->mempool) / PA_MAX(f->sink_fs, f->fs);
+    if (data->block_frames > 0)
+        max_frames = PA_MAX(PA_ROUND_DOWN(max_frames, data->block_frames), data->block_frames);
+    f->max_length = max_frames * f->sink_fs;
+
+    /* Filters that run in place get the block the sink rendered into, and
+     * need no queue */
+    f->in_place = data->in_place && data->block_frames == 0 && f->sink_fs == f->fs;
+
+    if (!f->in_place) {
+        pa_silence_memchunk_get(&m->core->silence_cache, m->core->mempool, &silence, &f->sink->sample_spec, 0);
+        f->memblockq = pa_memblockq_new("filter-sink memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0, &f->sink->sample_spec, 1, 1, 0, &silence);
+        pa_memblock_unref(silence.memblock);
+    }
+
+    return f;
+
+fail:
+    pa_filter_sink_free(f);
+    return NULL;
+}
+
+void pa_filter_sink_put(pa_filter_sink *f) {
+    pa_assert(f);
+    pa_assert(f->process);
+
+    /* The order here is important. The input must be put first,
+     * otherwise streams might attach to the sink before the sink
+     * input is attached to the master. */
+    pa_sink_input_put(f->sink_input);
+    pa_sink_put(f->sink);
+    pa_sink_input_cork(f->sink_input, false);
+}
+
+void pa_filter_sink_free(pa_filter_sink *f) {
+    pa_assert(f);
+
+    /* See comments in sink_input_kill_cb() above regarding
+     * destruction order! */
+
+    if (f->sink_input && PA_SINK_INPUT_IS_LINKED(f->sink_input->state))
+        pa_sink_input_cork(f->sink_input, true);
+
+    if (f->sink)
+        pa_sink_unlink(f->sink);
+
+    if (f->sink_input) {
+        pa_sink_input_unlink(f->sink_input);
+        pa_sink_input_unref(f->sink_input);
+    }
+
+    if (f->sink)
+        pa_sink_unref(f->sink);
+
+    if (f->memblockq)
+        pa_memblockq_free(f->memblockq);
+
+    pa_xfree(f->description);
+    pa_xfree(f->name_property);
+    pa_xfree(f);
+}
@@ -0,0 +1,131 @@
+#ifndef foofiltersinkhfoo
+#define foofiltersinkhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* A filter sink is a virtual sink whose audio is processed and played
+ * through a sink input on a master sink. This implements the glue between
+ * the two that all filter sinks share: passing rewinds, latencies and
+ * requests on to the master, following the sink input when it is moved,
+ * and buffering the rendered audio for the filter. The module only
+ * provides process(), and optionally reset() or rewind(), and
+ * get_latency().
+ *
+ * Filters that take any number of frames and whose input and output frames
+ * have the same size can run in place. The sink then renders straight into
+ * the block that is passed to the master, without a queue in between.
+ * Filters that need a fixed block size get whole blocks, and the block is
+ * added to the latency of the sink. */
+
+#include <pulsecore/module.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/memblockq.h>
+
+typedef struct pa_filter_sink pa_filter_sink;
+
+struct pa_filter_sink {
+    pa_module *module;
+
+    pa_sink *sink;
+    pa_sink_input *sink_input;
+
+    /* Audio rendered by the sink that was not processed yet, in the sample
+     * spec of the sink. NULL for filters that run in place. */
+    pa_memblockq *memblockq;
+
+    size_t sink_fs, fs;
+    size_t block_size;
+    size_t max_length;
+    bool in_place;
+
+    bool auto_desc;
+    bool autoloaded;
+    char *description;
+    char *name_property;
+
+    /* Called from the IO thread to process n frames of the sink's sample
+     * spec from src into n frames of the sink input's sample spec in dst.
+     * src and dst are the same for filters that run in place. n is a
+     * multiple of the block size, if there is one. */
+    void (*process)(pa_filter_sink *f, const void *src, void *dst, unsigned n);
+
+    /* Called from the IO thread when audio that was already processed is
+     * rewritten, so that the filter can forget its history. May be NULL. */
+    void (*reset)(pa_filter_sink *f);
+
+    /* Called from the IO thread instead of reset() when set, with the number
+     * of frames of the sink's sample spec that process() will get again.
+     * For filters that can restore their state from before those frames.
+     * May be NULL. */
+    void (*rewind)(pa_filter_sink *f, unsigned n);
+
+    /* Called from the IO thread with the number of frames of the sink's
+     * sample spec that rewind() may be asked to go back, whenever that
+     * changes. May be NULL. */
+    void (*update_max_rewind)(pa_filter_sink *f, unsigned n);
+
+    /* Called from the IO thread for the delay the filter adds on top of the
+     * buffering done here. May be NULL. */
+    pa_usec_t (*get_latency)(pa_filter_sink *f);
+
+    void *userdata;
+};
+
+typedef struct pa_filter_sink_new_data {
+    pa_sink_new_data sink_data;
+    pa_sink_input_new_data sink_input_data;
+
+    pa_sink *master;
+
+    /* The automatic descriptions start with this, like "Virtual Sink", and
+     * name the sink by the sink property name_property */
+    const char *description;
+    const char *name_property;
+
+    bool use_volume_sharing;
+    bool force_flat_volume;
+    bool autoloaded;
+
+    /* The number of frames process() needs at a time, or 0 for any */
+    unsigned block_frames;
+
+    /* Whether process() can work in place. Only honoured for filters
+     * without a block size whose input and output frames have the same
+     * size. */
+    bool in_place;
+} pa_filter_sink_new_data;
+
+/* Sets up the sink and sink input data for a filter sink on master. The
+ * module then sets the name and sample specs, and adds its properties. If
+ * the sink input's sample spec or channel map are not set, those of the sink
+ * are used. */
+void pa_filter_sink_new_data_init(pa_filter_sink_new_data *data, pa_module *m, const char *driver, pa_sink *master);
+void pa_filter_sink_new_data_done(pa_filter_sink_new_data *data);
+
+/* Creates the sink and the sink input. The callbacks must be set before
+ * pa_filter_sink_put() links them. */
+pa_filter_sink *pa_filter_sink_new(pa_filter_sink_new_data *data);
+void pa_filter_sink_put(pa_filter_sink *f);
+void pa_filter_sink_free(pa_filter_sink *f);
+
+/* The process_msg() of the sink. Modules that handle their own messages
+ * pass the others on to this. */
+int pa_filter_sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk);
+
+#endif
@@ -0,0 +1,410 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/macro.h>
+
+#include "biquad-cascade.h"
+
+/* Frames converted at once when the stream cannot be filtered in place */
+#define BLOCK_FRAMES 256
+
+#define N_COEFS PA_BIQUAD_CASCADE_COEFS
+#define N_STATES PA_BIQUAD_CASCADE_STATES
+
+struct pa_biquad_cascade {
+    unsigned channels;
+    unsigned n_lanes;
+    unsigned n_stages;
+
+    /* The function at the time the cascade was created, which the layout
+     * was chosen for */
+    pa_biquad_cascade_func_t func;
+
+    /* Per stage, N_COEFS arrays of n_lanes floats */
+    float *coefs;
+    float *targets;
+    float *steps;
+    unsigned ramp_remaining;
+
+    /* Per stage, N_STATES arrays of n_lanes floats */
+    float *state;
+
+    /* BLOCK_FRAMES frames of n_lanes floats */
+    float *buffer;
+};
+
+/* One stage of one lane, kept in registers while a lane is filtered */
+struct stage {
+    float b0, b1, b2, a1, a2;
+    float z1, z2;
+};
+
+static inline void stage_load(struct stage *v, const float *coefs, const float *state, unsigned n_lanes) {
+    v->b0 = coefs[0];
+    v->b1 = coefs[n_lanes];
+    v->b2 = coefs[2 * n_lanes];
+    v->a1 = coefs[3 * n_lanes];
+    v->a2 = coefs[4 * n_lanes];
+
+    if (state) {
+        v->z1 = state[0];
+        v->z2 = state[n_lanes];
+    }
+}
+
+static inline void stage_store(const struct stage *v, float *coefs, float *state, unsigned n_lanes) {
+    coefs[0] = v->b0;
+    coefs[n_lanes] = v->b1;
+    coefs[2 * n_lanes] = v->b2;
+    coefs[3 * n_lanes] = v->a1;
+    coefs[4 * n_lanes] = v->a2;
+
+    state[0] = v->z1;
+    state[n_lanes] = v->z2;
+}
+
+static inline float stage_run(struct stage *v, float x) {
+    float y;
+
+    x += PA_BIQUAD_CASCADE_DENORMAL_OFFSET;
+    y = v->b0 * x + v->z1;
+
+    v->z1 = v->b1 * x - v->a1 * y + v->z2;
+    v->z2 = v->b2 * x - v->a2 * y;
+
+    return y;
+}
+
+static inline void stage_ramp(struct stage *v, const struct stage *d) {
+    v->b0 += d->b0;
+    v->b1 += d->b1;
+    v->b2 += d->b2;
+    v->a1 += d->a1;
+    v->a2 += d->a2;
+}
+
+/* Two stages of one lane. Filtering one lane at a time, like lr4 does for
+ * each channel, keeps everything in registers. */
+static void process_lane_2(float *data, unsigned n_frames, unsigned n_lanes, float *coefs, const float *steps, float *state, unsigned n_ramp) {
+    struct stage v, w, d, e;
+    unsigned i = 0;
+
+    stage_load(&v, coefs, state, n_lanes);
+    stage_load(&w, coefs + N_COEFS * n_lanes, state + N_STATES * n_lanes, n_lanes);
+
+    if (n_ramp > 0) {
+        stage_load(&d, steps, NULL, n_lanes);
+        stage_load(&e, steps + N_COEFS * n_lanes, NULL, n_lanes);
+
+        for (; i < n_ramp; i++, data += n_lanes) {
+            *data = stage_run(&w, stage_run(&v, *data));
+            stage_ramp(&v, &d);
+            stage_ramp(&w, &e);
+        }
+    }
+
+    for (; i < n_frames; i++, data += n_lanes)
+        *data = stage_run(&w, stage_run(&v, *data));
+
+    stage_store(&v, coefs, state, n_lanes);
+    stage_store(&w, coefs + N_COEFS * n_lanes, state + N_STATES * n_lanes, n_lanes);
+}
+
+static void process_lane_1(float *data, unsigned n_frames, unsigned n_lanes, float *coefs, const float *steps, float *state, unsigned n_ramp) {
+    struct stage v, d;
+    unsigned i = 0;
+
+    stage_load(&v, coefs, state, n_lanes);
+
+    if (n_ramp > 0) {
+        stage_load(&d, steps, NULL, n_lanes);
+
+        for (; i < n_ramp; i++, data += n_lanes) {
+            *data = stage_run(&v, *data);
+            stage_ramp(&v, &d);
+        }
+    }
+
+    for (; i < n_frames; i++, data += n_lanes)
+        *data = stage_run(&v, *data);
+
+    stage_store(&v, coefs, state, n_lanes);
+}
+
+/* Cascades using this function are not padded, so n_lanes is the number of
+ * channels */
+static void process_c(float *data, unsigned n_frames, unsigned n_lanes, unsigned n_stages, float *coefs, const float *steps, float *state, unsigned n_ramp) {
+    unsigned l, s;
+
+    for (l = 0; l < n_lanes; l++) {
+        for (s = 0; s + 1 < n_stages; s += 2)
+            process_lane_2(data + l, n_frames, n_lanes,
+                           coefs + s * N_COEFS * n_lanes + l,
+                           steps + s * N_COEFS * n_lanes + l,
+                           state + s * N_STATES * n_lanes + l,
+                           n_ramp);
+
+        if (s < n_stages)
+            process_lane_1(data + l, n_frames, n_lanes,
+                           coefs + s * N_COEFS * n_lanes + l,
+                           steps + s * N_COEFS * n_lanes + l,
+                           state + s * N_STATES * n_lanes + l,
+                           n_ramp);
+    }
+}
+
+static pa_biquad_cascade_func_t process_func = process_c;
+
+pa_biquad_cascade_func_t pa_get_biquad_cascade_func(void) {
+    return process_func;
+}
+
+void pa_set_biquad_cascade_func(pa_biquad_cascade_func_t func) {
+    pa_assert(func);
+
+    process_func = func;
+}
+
+bool pa_biquad_cascade_is_optimized(void) {
+    return process_func != process_c;
+}
+
+pa_biquad_cascade *pa_biquad_cascade_new(unsigned channels, unsigned n_stages) {
+    pa_biquad_cascade *c;
+    unsigned s, l;
+
+    pa_assert(channels > 0);
+    pa_assert(n_stages > 0);
+
+    c = pa_xnew0(pa_biquad_cascade, 1);
+    c->channels = channels;
+    c->n_stages = n_stages;
+    c->func = process_func;
+
+    /* Padding only helps vector code */
+    c->n_lanes = c->func == process_c ? channels : PA_ROUND_UP(channels, PA_BIQUAD_CASCADE_LANES);
+
+    c->coefs = pa_xnew0(float, n_stages * N_COEFS * c->n_lanes);
+    c->targets = pa_xnew0(float, n_stages * N_COEFS * c->n_lanes);
+    c->steps = pa_xnew0(float, n_stages * N_COEFS * c->n_lanes);
+    c->state = pa_xnew0(float, n_stages * N_STATES * c->n_lanes);
+    c->buffer = pa_xnew0(float, BLOCK_FRAMES * c->n_lanes);
+
+    /* Pass-through is b0 = 1, for the padding lanes as well */
+    for (s = 0; s < n_stages; s++)
+        for (l = 0; l < c->n_lanes; l++)
+            c->targets[s * N_COEFS * c->n_lanes + l] = 1.0f;
+
+    pa_biquad_cascade_commit(c, 0);
+
+    return c;
+}
+
+void pa_biquad_cascade_free(pa_biquad_cascade *c) {
+    pa_assert(c);
+
+    pa_xfree(c->coefs);
+    pa_xfree(c->targets);
+    pa_xfree(c->steps);
+    pa_xfree(c->state);
+    pa_xfree(c->buffer);
+    pa_xfree(c);
+}
+
+void pa_biquad_cascade_set(pa_biquad_cascade *c, unsigned stage, unsigned channel, const struct biquad *bq) {
+    float *t;
+
+    pa_assert(c);
+    pa_assert(stage < c->n_stages);
+    pa_assert(channel < c->channels);
+    pa_assert(bq);
+
+    t = c->targets + stage * N_COEFS * c->n_lanes + channel;
+    t[0] = bq->b0;
+    t[c->n_lanes] = bq->b1;
+    t[2 * c->n_lanes] = bq->b2;
+    t[3 * c->n_lanes] = bq->a1;
+    t[4 * c->n_lanes] = bq->a2;
+}
+
+/* A biquad is stable if its a1 and a2 lie in a triangle, so the filters on
+ * the way between two stable filters are stable too. */
+void pa_biquad_cascade_commit(pa_biquad_cascade *c, unsigned ramp_frames) {
+    unsigned k, n;
+
+    pa_assert(c);
+
+    n = c->n_stages * N_COEFS * c->n_lanes;
+
+    if (ramp_frames == 0) {
+        memcpy(c->coefs, c->targets, n * sizeof(float));
+        c->ramp_remaining = 0;
+        return;
+    }
+
+    for (k = 0; k < n; k++)
+        c->steps[k] = (c->targets[k] - c->coefs[k]) / ramp_frames;
+
+    c->ramp_remaining = ramp_frames;
+}
+
+void pa_biquad_cascade_reset(pa_biquad_cascade *c) {
+    pa_assert(c);
+
+    memset(c->state, 0, c->n_stages * N_STATES * c->n_lanes * sizeof(float));
+}
+
+unsigned pa_biquad_cascade_get_state_size(const pa_biquad_cascade *c) {
+    pa_assert(c);
+
+    return c->n_stages * N_STATES * c->n_lanes;
+}
+
+void pa_biquad_cascade_save_state(const pa_biquad_cascade *c, float *state) {
+    pa_assert(c);
+    pa_assert(state);
+
+    memcpy(state, c->state, pa_biquad_cascade_get_state_size(c) * sizeof(float));
+}
+
+void pa_biquad_cascade_restore_state(pa_biquad_cascade *c, const float *state) {
+    pa_assert(c);
+    pa_assert(state);
+
+    memcpy(c->state, state, pa_biquad_cascade_get_state_size(c) * sizeof(float));
+}
+
+/* Filters n_frames frames of n_lanes floats in place */
+static void process(pa_biquad_cascade *c, float *data, unsigned n_frames) {
+    unsigned n_ramp = PA_MIN(c->ramp_remaining, n_frames);
+
+    if (n_ramp > 0) {
+        c->func(data, n_ramp, c->n_lanes, c->n_stages, c->coefs, c->steps, c->state, n_ramp);
+        c->ramp_remaining -= n_ramp;
+
+        /* Do not let rounding errors of the steps stay around */
+        if (c->ramp_remaining == 0)
+            memcpy(c->coefs, c->targets, c->n_stages * N_COEFS * c->n_lanes * sizeof(float));
+
+        data += n_ramp * c->n_lanes;
+        n_frames -= n_ramp;
+    }
+
+    if (n_frames > 0)
+        c->func(data, n_frames, c->n_lanes, c->n_stages, c->coefs, c->steps, c->state, 0);
+}
+
+/* The copies between the stream and the buffer, with the channel counts up to
+ * 7.1 as constants, so that each frame is copied without a loop */
+static inline void pack_n(float *buffer, const float *src, unsigned n_frames, unsigned channels, unsigned n_lanes) {
+    unsigned i;
+
+    for (i = 0; i < n_frames; i++, buffer += n_lanes, src += channels)
+        memcpy(buffer, src, channels * sizeof(float));
+}
+
+static inline void unpack_n(float *dst, const float *buffer, unsigned n_frames, unsigned channels, unsigned n_lanes) {
+    unsigned i;
+
+    for (i = 0; i < n_frames; i++, buffer += n_lanes, dst += channels)
+        memcpy(dst, buffer, channels * sizeof(float));
+}
+
+static void pack(pa_biquad_cascade *c, const float *src, unsigned n_frames) {
+    switch (c->channels) {
+        case 1: pack_n(c->buffer, src, n_frames, 1, 4); break;
+        case 2: pack_n(c->buffer, src, n_frames, 2, 4); break;
+        case 3: pack_n(c->buffer, src, n_frames, 3, 4); break;
+        case 5: pack_n(c->buffer, src, n_frames, 5, 8); break;
+        case 6: pack_n(c->buffer, src, n_frames, 6, 8); break;
+        case 7: pack_n(c->buffer, src, n_frames, 7, 8); break;
+        default: pack_n(c->buffer, src, n_frames, c->channels, c->n_lanes); break;
+    }
+}
+
+static void unpack(pa_biquad_cascade *c, float *dst, unsigned n_frames) {
+    switch (c->channels) {
+        case 1: unpack_n(dst, c->buffer, n_frames, 1, 4); break;
+        case 2: unpack_n(dst, c->buffer, n_frames, 2, 4); break;
+        case 3: unpack_n(dst, c->buffer, n_frames, 3, 4); break;
+        case 5: unpack_n(dst, c->buffer, n_frames, 5, 8); break;
+        case 6: unpack_n(dst, c->buffer, n_frames, 6, 8); break;
+        case 7: unpack_n(dst, c->buffer, n_frames, 7, 8); break;
+        default: unpack_n(dst, c->buffer, n_frames, c->channels, c->n_lanes); break;
+    }
+}
+
+void pa_biquad_cascade_process_float32(pa_biquad_cascade *c, float *dst, const float *src, unsigned n_frames) {
+    pa_assert(c);
+    pa_assert(dst);
+    pa_assert(src);
+
+    if (c->channels == c->n_lanes) {
+        if (dst != src)
+            memcpy(dst, src, n_frames * c->channels * sizeof(float));
+
+        process(c, dst, n_frames);
+        return;
+    }
+
+    while (n_frames > 0) {
+        unsigned n = PA_MIN(n_frames, BLOCK_FRAMES);
+
+        pack(c, src, n);
+        process(c, c->buffer, n);
+        unpack(c, dst, n);
+
+        src += n * c->channels;
+        dst += n * c->channels;
+        n_frames -= n;
+    }
+}
+
+void pa_biquad_cascade_process_s16(pa_biquad_cascade *c, int16_t *dst, const int16_t *src, unsigned n_frames) {
+    unsigned i, ch;
+
+    pa_assert(c);
+    pa_assert(dst);
+    pa_assert(src);
+
+    while (n_frames > 0) {
+        unsigned n = PA_MIN(n_frames, BLOCK_FRAMES);
+
+        for (i = 0; i < n; i++)
+            for (ch = 0; ch < c->channels; ch++)
+                c->buffer[i * c->n_lanes + ch] = src[i * c->channels + ch];
+
+        process(c, c->buffer, n);
+
+        for (i = 0; i < n; i++)
+            for (ch = 0; ch < c->channels; ch++)
+                dst[i * c->channels + ch] = (int16_t) PA_CLAMP_UNLIKELY(lrintf(c->buffer[i * c->n_lanes + ch]), -0x8000, 0x7fff);
+
+        src += n * c->channels;
+        dst += n * c->channels;
+        n_frames -= n;
+    }
+}
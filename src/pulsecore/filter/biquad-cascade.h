@@ -0,0 +1,93 @@
+#ifndef foobiquadcascadehfoo
+#define foobiquadcascadehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <pulsecore/filter/biquad.h>
+
+/* A cascade of biquad filters for all channels of an interleaved stream.
+ *
+ * Each channel has its own coefficients for each stage. The coefficients and
+ * the filter states are stored channel-interleaved. When an optimized
+ * function is set, the channels are padded to a multiple of
+ * PA_BIQUAD_CASCADE_LANES, so that one vector operation processes
+ * PA_BIQUAD_CASCADE_LANES channels at once. The stages are computed in
+ * transposed direct form II.
+ *
+ * New coefficients are applied with pa_biquad_cascade_commit(), which can
+ * move to them over a number of frames to avoid clicks. */
+
+#define PA_BIQUAD_CASCADE_LANES 4
+
+/* Arrays of coefficients and of state per stage */
+#define PA_BIQUAD_CASCADE_COEFS 5
+#define PA_BIQUAD_CASCADE_STATES 2
+
+typedef struct pa_biquad_cascade pa_biquad_cascade;
+
+/* All stages start out as pass-through filters. The cascade keeps using the
+ * function that was set when it was created. */
+pa_biquad_cascade *pa_biquad_cascade_new(unsigned channels, unsigned n_stages);
+void pa_biquad_cascade_free(pa_biquad_cascade *c);
+
+/* Sets the coefficients of one stage for one channel. They take effect at
+ * the next pa_biquad_cascade_commit(). */
+void pa_biquad_cascade_set(pa_biquad_cascade *c, unsigned stage, unsigned channel, const struct biquad *bq);
+
+/* Applies the coefficients set since the last commit, moving to them
+ * linearly over ramp_frames frames, or at once if ramp_frames is 0 */
+void pa_biquad_cascade_commit(pa_biquad_cascade *c, unsigned ramp_frames);
+
+/* Clears the filter history */
+void pa_biquad_cascade_reset(pa_biquad_cascade *c);
+
+/* The filter history can be saved to and restored from an array of
+ * pa_biquad_cascade_get_state_size() floats, for instance to go back to an
+ * earlier point of the stream. The coefficients are not saved. */
+unsigned pa_biquad_cascade_get_state_size(const pa_biquad_cascade *c);
+void pa_biquad_cascade_save_state(const pa_biquad_cascade *c, float *state);
+void pa_biquad_cascade_restore_state(pa_biquad_cascade *c, const float *state);
+
+/* Filters n_frames interleaved frames. dst may be equal to src. */
+void pa_biquad_cascade_process_float32(pa_biquad_cascade *c, float *dst, const float *src, unsigned n_frames);
+void pa_biquad_cascade_process_s16(pa_biquad_cascade *c, int16_t *dst, const int16_t *src, unsigned n_frames);
+
+/* Runs all stages over n_frames frames of n_lanes floats each, in place.
+ * For each stage, coefs holds the b0, b1, b2, a1 and a2 arrays of n_lanes
+ * floats each, and state the z1 and z2 arrays, one stage after the other.
+ * For the first n_ramp frames, steps is added to the coefficients after
+ * each frame. Optimized functions always get a multiple of
+ * PA_BIQUAD_CASCADE_LANES as n_lanes. */
+typedef void (*pa_biquad_cascade_func_t) (float *data, unsigned n_frames, unsigned n_lanes, unsigned n_stages, float *coefs, const float *steps, float *state, unsigned n_ramp);
+
+pa_biquad_cascade_func_t pa_get_biquad_cascade_func(void);
+void pa_set_biquad_cascade_func(pa_biquad_cascade_func_t func);
+
+/* Whether an optimized function is set. Without one, a filter that has
+ * simpler per-channel code may be better off using that. */
+bool pa_biquad_cascade_is_optimized(void);
+
+/* Added to the input of every stage, so that the filter states never decay
+ * to denormals, which are very slow on many CPUs. At about -400 dB, it is
+ * far below anything audible. */
+#define PA_BIQUAD_CASCADE_DENORMAL_OFFSET 1e-20f
+
+#endif
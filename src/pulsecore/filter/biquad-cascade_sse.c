@@ -0,0 +1,247 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+#include <pulsecore/cpu-x86.h>
+
+#include "biquad-cascade.h"
+
+#if defined (__SSE__)
+
+#include <xmmintrin.h>
+
+/* One stage for four channels */
+struct stage {
+    __m128 b0, b1, b2, a1, a2;
+    __m128 z1, z2;
+};
+
+static inline void stage_load(struct stage *v, const float *coefs, const float *state, unsigned n_lanes) {
+    v->b0 = _mm_loadu_ps(coefs);
+    v->b1 = _mm_loadu_ps(coefs + n_lanes);
+    v->b2 = _mm_loadu_ps(coefs + 2 * n_lanes);
+    v->a1 = _mm_loadu_ps(coefs + 3 * n_lanes);
+    v->a2 = _mm_loadu_ps(coefs + 4 * n_lanes);
+
+    if (state) {
+        v->z1 = _mm_loadu_ps(state);
+        v->z2 = _mm_loadu_ps(state + n_lanes);
+    }
+}
+
+static inline void stage_store(const struct stage *v, float *coefs, float *state, unsigned n_lanes) {
+    _mm_storeu_ps(coefs, v->b0);
+    _mm_storeu_ps(coefs + n_lanes, v->b1);
+    _mm_storeu_ps(coefs + 2 * n_lanes, v->b2);
+    _mm_storeu_ps(coefs + 3 * n_lanes, v->a1);
+    _mm_storeu_ps(coefs + 4 * n_lanes, v->a2);
+
+    _mm_storeu_ps(state, v->z1);
+    _mm_storeu_ps(state + n_lanes, v->z2);
+}
+
+static inline __m128 stage_run(struct stage *v, __m128 x) {
+    __m128 y;
+
+    x = _mm_add_ps(x, _mm_set1_ps(PA_BIQUAD_CASCADE_DENORMAL_OFFSET));
+    y = _mm_add_ps(_mm_mul_ps(v->b0, x), v->z1);
+
+    v->z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(v->b1, x), _mm_mul_ps(v->a1, y)), v->z2);
+    v->z2 = _mm_sub_ps(_mm_mul_ps(v->b2, x), _mm_mul_ps(v->a2, y));
+
+    return y;
+}
+
+static inline void stage_ramp(struct stage *v, const struct stage *d) {
+    v->b0 = _mm_add_ps(v->b0, d->b0);
+    v->b1 = _mm_add_ps(v->b1, d->b1);
+    v->b2 = _mm_add_ps(v->b2, d->b2);
+    v->a1 = _mm_add_ps(v->a1, d->a1);
+    v->a2 = _mm_add_ps(v->a2, d->a2);
+}
+
+#define COEF_STRIDE(n_lanes) (PA_BIQUAD_CASCADE_COEFS * (n_lanes))
+#define STATE_STRIDE(n_lanes) (PA_BIQUAD_CASCADE_STATES * (n_lanes))
+
+/* One stage, eight channels at a time: the two independent recursions hide
+ * each other's latency */
+static void process_8(float *data, unsigned n_frames, unsigned n_lanes, float *coefs, const float *steps, float *state, unsigned n_ramp) {
+    struct stage v0, v1, d0, d1;
+    unsigned i = 0;
+
+    stage_load(&v0, coefs, state, n_lanes);
+    stage_load(&v1, coefs + 4, state + 4, n_lanes);
+
+    if (n_ramp > 0) {
+        stage_load(&d0, steps, NULL, n_lanes);
+        stage_load(&d1, steps + 4, NULL, n_lanes);
+
+        for (; i < n_ramp; i++, data += n_lanes) {
+            _mm_storeu_ps(data, stage_run(&v0, _mm_loadu_ps(data)));
+            _mm_storeu_ps(data + 4, stage_run(&v1, _mm_loadu_ps(data + 4)));
+            stage_ramp(&v0, &d0);
+            stage_ramp(&v1, &d1);
+        }
+    }
+
+    for (; i < n_frames; i++, data += n_lanes) {
+        _mm_storeu_ps(data, stage_run(&v0, _mm_loadu_ps(data)));
+        _mm_storeu_ps(data + 4, stage_run(&v1, _mm_loadu_ps(data + 4)));
+    }
+
+    stage_store(&v0, coefs, state, n_lanes);
+    stage_store(&v1, coefs + 4, state + 4, n_lanes);
+}
+
+/* Two stages, eight channels at a time: four recursions run alongside each
+ * other */
+static void process_8x2(float *data, unsigned n_frames, unsigned n_lanes, float *coefs, const float *steps, float *state, unsigned n_ramp) {
+    struct stage v0, v1, w0, w1, d0, d1, e0, e1;
+    unsigned i = 0;
+
+    stage_load(&v0, coefs, state, n_lanes);
+    stage_load(&v1, coefs + 4, state + 4, n_lanes);
+    stage_load(&w0, coefs + COEF_STRIDE(n_lanes), state + STATE_STRIDE(n_lanes), n_lanes);
+    stage_load(&w1, coefs + COEF_STRIDE(n_lanes) + 4, state + STATE_STRIDE(n_lanes) + 4, n_lanes);
+
+    if (n_ramp > 0) {
+        stage_load(&d0, steps, NULL, n_lanes);
+        stage_load(&d1, steps + 4, NULL, n_lanes);
+        stage_load(&e0, steps + COEF_STRIDE(n_lanes), NULL, n_lanes);
+        stage_load(&e1, steps + COEF_STRIDE(n_lanes) + 4, NULL, n_lanes);
+
+        for (; i < n_ramp; i++, data += n_lanes) {
+            _mm_storeu_ps(data, stage_run(&w0, stage_run(&v0, _mm_loadu_ps(data))));
+            _mm_storeu_ps(data + 4, stage_run(&w1, stage_run(&v1, _mm_loadu_ps(data + 4))));
+            stage_ramp(&v0, &d0);
+            stage_ramp(&v1, &d1);
+            stage_ramp(&w0, &e0);
+            stage_ramp(&w1, &e1);
+        }
+    }
+
+    for (; i < n_frames; i++, data += n_lanes) {
+        _mm_storeu_ps(data, stage_run(&w0, stage_run(&v0, _mm_loadu_ps(data))));
+        _mm_storeu_ps(data + 4, stage_run(&w1, stage_run(&v1, _mm_loadu_ps(data + 4))));
+    }
+
+    stage_store(&v0, coefs, state, n_lanes);
+    stage_store(&v1, coefs + 4, state + 4, n_lanes);
+    stage_store(&w0, coefs + COEF_STRIDE(n_lanes), state + STATE_STRIDE(n_lanes), n_lanes);
+    stage_store(&w1, coefs + COEF_STRIDE(n_lanes) + 4, state + STATE_STRIDE(n_lanes) + 4, n_lanes);
+}
+
+/* Two stages, four channels at a time: the second stage of a frame runs
+ * alongside the first stage of the next one */
+static void process_4x2(float *data, unsigned n_frames, unsigned n_lanes, float *coefs, const float *steps, float *state, unsigned n_ramp) {
+    struct stage v0, v1, d0, d1;
+    unsigned i = 0;
+
+    stage_load(&v0, coefs, state, n_lanes);
+    stage_load(&v1, coefs + COEF_STRIDE(n_lanes), state + STATE_STRIDE(n_lanes), n_lanes);
+
+    if (n_ramp > 0) {
+        stage_load(&d0, steps, NULL, n_lanes);
+        stage_load(&d1, steps + COEF_STRIDE(n_lanes), NULL, n_lanes);
+
+        for (; i < n_ramp; i++, data += n_lanes) {
+            _mm_storeu_ps(data, stage_run(&v1, stage_run(&v0, _mm_loadu_ps(data))));
+            stage_ramp(&v0, &d0);
+            stage_ramp(&v1, &d1);
+        }
+    }
+
+    for (; i < n_frames; i++, data += n_lanes)
+        _mm_storeu_ps(data, stage_run(&v1, stage_run(&v0, _mm_loadu_ps(data))));
+
+    stage_store(&v0, coefs, state, n_lanes);
+    stage_store(&v1, coefs + COEF_STRIDE(n_lanes), state + STATE_STRIDE(n_lanes), n_lanes);
+}
+
+static void process_4(float *data, unsigned n_frames, unsigned n_lanes, float *coefs, const float *steps, float *state, unsigned n_ramp) {
+    struct stage v, d;
+    unsigned i = 0;
+
+    stage_load(&v, coefs, state, n_lanes);
+
+    if (n_ramp > 0) {
+        stage_load(&d, steps, NULL, n_lanes);
+
+        for (; i < n_ramp; i++, data += n_lanes) {
+            _mm_storeu_ps(data, stage_run(&v, _mm_loadu_ps(data)));
+            stage_ramp(&v, &d);
+        }
+    }
+
+    for (; i < n_frames; i++, data += n_lanes)
+        _mm_storeu_ps(data, stage_run(&v, _mm_loadu_ps(data)));
+
+    stage_store(&v, coefs, state, n_lanes);
+}
+
+static void process_sse(float *data, unsigned n_frames, unsigned n_lanes, unsigned n_stages, float *coefs, const float *steps, float *state, unsigned n_ramp) {
+    unsigned l = 0, s;
+
+    for (; l + 8 <= n_lanes; l += 8) {
+        for (s = 0; s + 2 <= n_stages; s += 2)
+            process_8x2(data + l, n_frames, n_lanes,
+                        coefs + s * COEF_STRIDE(n_lanes) + l,
+                        steps + s * COEF_STRIDE(n_lanes) + l,
+                        state + s * STATE_STRIDE(n_lanes) + l,
+                        n_ramp);
+
+        if (s < n_stages)
+            process_8(data + l, n_frames, n_lanes,
+                      coefs + s * COEF_STRIDE(n_lanes) + l,
+                      steps + s * COEF_STRIDE(n_lanes) + l,
+                      state + s * STATE_STRIDE(n_lanes) + l,
+                      n_ramp);
+    }
+
+    for (; l < n_lanes; l += 4) {
+        for (s = 0; s + 2 <= n_stages; s += 2)
+            process_4x2(data + l, n_frames, n_lanes,
+                        coefs + s * COEF_STRIDE(n_lanes) + l,
+                        steps + s * COEF_STRIDE(n_lanes) + l,
+                        state + s * STATE_STRIDE(n_lanes) + l,
+                        n_ramp);
+
+        if (s < n_stages)
+            process_4(data + l, n_frames, n_lanes,
+                      coefs + s * COEF_STRIDE(n_lanes) + l,
+                      steps + s * COEF_STRIDE(n_lanes) + l,
+                      state + s * STATE_STRIDE(n_lanes) + l,
+                      n_ramp);
+    }
+}
+
+#endif /* defined (__SSE__) */
+
+void pa_biquad_cascade_func_init_sse(pa_cpu_x86_flag_t flags) {
+#if defined (__SSE__)
+    if (flags & PA_CPU_X86_SSE) {
+        pa_log_info("Initialising SSE optimized biquad cascade functions.");
+
+        pa_set_biquad_cascade_func(process_sse);
+    }
+#endif /* defined (__SSE__) */
+}
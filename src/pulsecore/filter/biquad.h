@@ -27,6 +27,9 @@ struct biquad {
 enum biquad_type {
 	BQ_LOWPASS,
 	BQ_HIGHPASS,
+	BQ_LOWSHELF,
+	BQ_HIGHSHELF,
+	BQ_PEAKING,
 };
 
 /* Initialize a biquad filter parameters from its type and parameters.
@@ -38,6 +41,20 @@ enum biquad_type {
  */
 void biquad_set(struct biquad *bq, enum biquad_type type, double freq);
 
+/* Initialize an equalizer biquad (shelving or peaking filter).
+ * Args:
+ *    bq - The biquad filter we want to set.
+ *    type - BQ_LOWSHELF, BQ_HIGHSHELF or BQ_PEAKING.
+ *    freq - The value should be in the range [0, 1]. It is relative to
+ *        half of the sampling rate.
+ *    Q - The quality factor of a peaking filter. Ignored for shelves.
+ *    gain - The gain in dB in the band, or beyond the corner frequency.
+ *
+ * All of these are minimum phase for any gain.
+ */
+void biquad_set_eq(struct biquad *bq, enum biquad_type type, double freq,
+		   double Q, double gain);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,520 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#include "convolver.h"
+
+/* The real signals of fft_size = 2 * block_size points are transformed with a
+ * complex FFT of block_size points, on the even samples as real part and the
+ * odd samples as imaginary part, and a final pass that separates the two.
+ * Spectra are kept as block_size + 1 real parts followed by as many imaginary
+ * parts, which keeps the multiply-add loop simple enough for the compiler to
+ * vectorize. */
+
+struct pa_convolver {
+    unsigned block_size;
+    unsigned n_bins;
+    unsigned n_partitions;
+    unsigned n_inputs, n_outputs;
+
+    /* Complex FFT of block_size points */
+    unsigned *bit_reverse;
+    float *twiddle_re, *twiddle_im;
+
+    /* Separation of the real FFT of fft_size points */
+    float *split_re, *split_im;
+
+    float *fft_re, *fft_im;
+
+    /* Partition spectra of each filter, indexed by input * n_outputs +
+     * output, or NULL */
+    float **filters;
+
+    /* The last n_partitions input spectra of each input, the newest at
+     * current */
+    float **input_spectra;
+    unsigned current;
+
+    /* The previous and the current block of each input */
+    float **input_blocks;
+
+    /* The output block being played out while the next input block is
+     * collected */
+    float **output_blocks;
+    unsigned position;
+
+    /* The last history_length frames of input, interleaved, so that the
+     * state before a rewind can be computed again. Input before
+     * history_start is lost, unless history_start is 0: then it is the
+     * silence before the first frame. */
+    float *history;
+    unsigned history_length;
+    uint64_t history_start;
+    uint64_t n_written;
+
+    float *accumulator;
+    float *work;
+};
+
+static void fft_init(pa_convolver *c) {
+    unsigned m = c->block_size, bits = pa_ulog2(m), i, j;
+
+    c->bit_reverse = pa_xnew(unsigned, m);
+    for (i = 0; i < m; i++) {
+        unsigned r = 0;
+
+        for (j = 0; j < bits; j++)
+            if (i & (1U << j))
+                r |= 1U << (bits - 1 - j);
+
+        c->bit_reverse[i] = r;
+    }
+
+    c->twiddle_re = pa_xnew(float, m / 2 + 1);
+    c->twiddle_im = pa_xnew(float, m / 2 + 1);
+    for (i = 0; i <= m / 2; i++) {
+        c->twiddle_re[i] = (float) cos(2 * M_PI * i / m);
+        c->twiddle_im[i] = (float) -sin(2 * M_PI * i / m);
+    }
+
+    c->split_re = pa_xnew(float, m + 1);
+    c->split_im = pa_xnew(float, m + 1);
+    for (i = 0; i <= m; i++) {
+        c->split_re[i] = (float) cos(M_PI * i / m);
+        c->split_im[i] = (float) -sin(M_PI * i / m);
+    }
+
+    c->fft_re = pa_xnew(float, m);
+    c->fft_im = pa_xnew(float, m);
+}
+
+/* In place radix-2 FFT of data stored in bit reversed order */
+static void fft_complex(pa_convolver *c, float *re, float *im) {
+    unsigned m = c->block_size, size, half, step, i, j;
+
+    for (size = 2; size <= m; size *= 2) {
+        half = size / 2;
+        step = m / size;
+
+        for (j = 0; j < half; j++) {
+            float wr = c->twiddle_re[j * step];
+            float wi = c->twiddle_im[j * step];
+
+            for (i = j; i < m; i += size) {
+                unsigned k = i + half;
+                float tr = re[k] * wr - im[k] * wi;
+                float ti = re[k] * wi + im[k] * wr;
+
+                re[k] = re[i] - tr;
+                im[k] = im[i] - ti;
+                re[i] += tr;
+                im[i] += ti;
+            }
+        }
+    }
+}
+
+/* Transforms fft_size real samples into n_bins complex bins */
+static void fft_forward(pa_convolver *c, const float *x, float *spectrum) {
+    unsigned m = c->block_size, k;
+    float *zr = c->fft_re, *zi = c->fft_im;
+    float *xr = spectrum, *xi = spectrum + c->n_bins;
+
+    for (k = 0; k < m; k++) {
+        zr[c->bit_reverse[k]] = x[2 * k];
+        zi[c->bit_reverse[k]] = x[2 * k + 1];
+    }
+
+    fft_complex(c, zr, zi);
+
+    for (k = 0; k <= m; k++) {
+        unsigned a = k & (m - 1), b = (m - k) & (m - 1);
+        float even_re = (zr[a] + zr[b]) * 0.5f;
+        float even_im = (zi[a] - zi[b]) * 0.5f;
+        float odd_re = (zi[a] + zi[b]) * 0.5f;
+        float odd_im = (zr[b] - zr[a]) * 0.5f;
+
+        xr[k] = even_re + c->split_re[k] * odd_re - c->split_im[k] * odd_im;
+        xi[k] = even_im + c->split_re[k] * odd_im + c->split_im[k] * odd_re;
+    }
+}
+
+/* Transforms n_bins complex bins back into fft_size real samples. The result
+ * is scaled by block_size. */
+static void fft_inverse(pa_convolver *c, const float *spectrum, float *x) {
+    unsigned m = c->block_size, k;
+    float *zr = c->fft_re, *zi = c->fft_im;
+    const float *xr = spectrum, *xi = spectrum + c->n_bins;
+
+    /* Undo the separation, and conjugate so that the forward FFT computes
+     * the inverse one */
+    for (k = 0; k < m; k++) {
+        unsigned b = m - k;
+        float even_re = (xr[k] + xr[b]) * 0.5f;
+        float even_im = (xi[k] - xi[b]) * 0.5f;
+        float dr = (xr[k] - xr[b]) * 0.5f;
+        float di = (xi[k] + xi[b]) * 0.5f;
+        float odd_re = dr * c->split_re[k] + di * c->split_im[k];
+        float odd_im = di * c->split_re[k] - dr * c->split_im[k];
+
+        zr[c->bit_reverse[k]] = even_re - odd_im;
+        zi[c->bit_reverse[k]] = -(even_im + odd_re);
+    }
+
+    fft_complex(c, zr, zi);
+
+    for (k = 0; k < m; k++) {
+        x[2 * k] = zr[k];
+        x[2 * k + 1] = -zi[k];
+    }
+}
+
+static void multiply_accumulate(float *accumulator, const float *x, const float *h, unsigned n_bins) {
+    float *ar = accumulator, *ai = accumulator + n_bins;
+    const float *xr = x, *xi = x + n_bins;
+    const float *hr = h, *hi = h + n_bins;
+    unsigned k;
+
+    for (k = 0; k < n_bins; k++) {
+        ar[k] += xr[k] * hr[k] - xi[k] * hi[k];
+        ai[k] += xr[k] * hi[k] + xi[k] * hr[k];
+    }
+}
+
+pa_convolver *pa_convolver_new(unsigned block_size, unsigned n_inputs, unsigned n_outputs, unsigned max_taps) {
+    pa_convolver *c;
+    unsigned i;
+
+    pa_assert(block_size >= 2);
+    pa_assert(pa_is_power_of_two(block_size));
+    pa_assert(n_inputs > 0);
+    pa_assert(n_outputs > 0);
+    pa_assert(max_taps > 0);
+
+    c = pa_xnew0(pa_convolver, 1);
+    c->block_size = block_size;
+    c->n_bins = block_size + 1;
+    c->n_partitions = (max_taps + block_size - 1) / block_size;
+    c->n_inputs = n_inputs;
+    c->n_outputs = n_outputs;
+
+    fft_init(c);
+
+    c->filters = pa_xnew0(float *, n_inputs * n_outputs);
+
+    c->input_spectra = pa_xnew(float *, n_inputs);
+    c->input_blocks = pa_xnew(float *, n_inputs);
+    for (i = 0; i < n_inputs; i++) {
+        c->input_spectra[i] = pa_xnew(float, c->n_partitions * 2 * c->n_bins);
+        c->input_blocks[i] = pa_xnew(float, 2 * block_size);
+    }
+
+    c->output_blocks = pa_xnew(float *, n_outputs);
+    for (i = 0; i < n_outputs; i++)
+        c->output_blocks[i] = pa_xnew(float, block_size);
+
+    c->accumulator = pa_xnew(float, 2 * c->n_bins);
+    c->work = pa_xnew(float, 2 * block_size);
+
+    c->history_length = (c->n_partitions + 2) * block_size;
+    c->history = pa_xnew(float, c->history_length * n_inputs);
+
+    pa_convolver_reset(c);
+
+    return c;
+}
+
+void pa_convolver_free(pa_convolver *c) {
+    unsigned i;
+
+    pa_assert(c);
+
+    for (i = 0; i < c->n_inputs * c->n_outputs; i++)
+        pa_xfree(c->filters[i]);
+    pa_xfree(c->filters);
+
+    for (i = 0; i < c->n_inputs; i++) {
+        pa_xfree(c->input_spectra[i]);
+        pa_xfree(c->input_blocks[i]);
+    }
+    pa_xfree(c->input_spectra);
+    pa_xfree(c->input_blocks);
+
+    for (i = 0; i < c->n_outputs; i++)
+        pa_xfree(c->output_blocks[i]);
+    pa_xfree(c->output_blocks);
+
+    pa_xfree(c->accumulator);
+    pa_xfree(c->work);
+    pa_xfree(c->history);
+
+    pa_xfree(c->bit_reverse);
+    pa_xfree(c->twiddle_re);
+    pa_xfree(c->twiddle_im);
+    pa_xfree(c->split_re);
+    pa_xfree(c->split_im);
+    pa_xfree(c->fft_re);
+    pa_xfree(c->fft_im);
+
+    pa_xfree(c);
+}
+
+void pa_convolver_set_filter(pa_convolver *c, unsigned input, unsigned output, const float *taps, unsigned n_taps, unsigned stride) {
+    float **filter;
+    unsigned p, i;
+    float scale;
+
+    pa_assert(c);
+    pa_assert(input < c->n_inputs);
+    pa_assert(output < c->n_outputs);
+    pa_assert(taps);
+    pa_assert(n_taps <= c->n_partitions * c->block_size);
+    pa_assert(stride > 0);
+
+    filter = &c->filters[input * c->n_outputs + output];
+    if (!*filter)
+        *filter = pa_xnew(float, c->n_partitions * 2 * c->n_bins);
+
+    /* Fold the scaling of the inverse FFT into the filter */
+    scale = 1.0f / c->block_size;
+
+    /* Each partition is zero padded to fft_size, so that the last block_size
+     * samples of the circular convolution with the previous and the current
+     * input block are free of aliasing */
+    for (p = 0; p < c->n_partitions; p++) {
+        float *spectrum = *filter + p * 2 * c->n_bins;
+
+        memset(c->work, 0, 2 * c->block_size * sizeof(float));
+        for (i = 0; i < c->block_size && p * c->block_size + i < n_taps; i++)
+            c->work[i] = taps[(p * c->block_size + i) * stride] * scale;
+
+        fft_forward(c, c->work, spectrum);
+    }
+}
+
+static void reset_blocks(pa_convolver *c) {
+    unsigned i;
+
+    for (i = 0; i < c->n_inputs; i++) {
+        memset(c->input_spectra[i], 0, c->n_partitions * 2 * c->n_bins * sizeof(float));
+        memset(c->input_blocks[i], 0, 2 * c->block_size * sizeof(float));
+    }
+
+    for (i = 0; i < c->n_outputs; i++)
+        memset(c->output_blocks[i], 0, c->block_size * sizeof(float));
+
+    c->current = 0;
+    c->position = 0;
+}
+
+void pa_convolver_reset(pa_convolver *c) {
+    pa_assert(c);
+
+    reset_blocks(c);
+
+    c->history_start = 0;
+    c->n_written = 0;
+}
+
+void pa_convolver_set_max_rewind(pa_convolver *c, unsigned n_frames) {
+    unsigned length;
+    uint64_t kept, i;
+    float *history;
+
+    pa_assert(c);
+
+    /* Rewinding to any frame needs the blocks that went into the output
+     * block playing there, and the partial block after them */
+    length = n_frames + (c->n_partitions + 2) * c->block_size;
+    if (length == c->history_length)
+        return;
+
+    kept = PA_MIN(c->n_written - c->history_start, (uint64_t) length);
+
+    history = pa_xnew(float, length * c->n_inputs);
+    for (i = c->n_written - kept; i < c->n_written; i++)
+        memcpy(history + (i % length) * c->n_inputs,
+               c->history + (i % c->history_length) * c->n_inputs,
+               c->n_inputs * sizeof(float));
+
+    pa_xfree(c->history);
+    c->history = history;
+    c->history_length = length;
+    c->history_start = c->n_written - kept;
+}
+
+/* Called when the current input block is complete: computes the next output
+ * block from it, unless only the input spectra are being rebuilt */
+static void process_block(pa_convolver *c, bool output) {
+    unsigned i, o, p;
+
+    c->current = (c->current + 1) % c->n_partitions;
+
+    for (i = 0; i < c->n_inputs; i++) {
+        fft_forward(c, c->input_blocks[i], c->input_spectra[i] + c->current * 2 * c->n_bins);
+        memcpy(c->input_blocks[i], c->input_blocks[i] + c->block_size, c->block_size * sizeof(float));
+    }
+
+    if (!output)
+        return;
+
+    for (o = 0; o < c->n_outputs; o++) {
+        memset(c->accumulator, 0, 2 * c->n_bins * sizeof(float));
+
+        for (i = 0; i < c->n_inputs; i++) {
+            const float *filter = c->filters[i * c->n_outputs + o];
+
+            if (!filter)
+                continue;
+
+            /* Partition p applies to the input from p blocks ago */
+            for (p = 0; p < c->n_partitions; p++) {
+                unsigned slot = (c->current + c->n_partitions - p) % c->n_partitions;
+
+                multiply_accumulate(c->accumulator,
+                                    c->input_spectra[i] + slot * 2 * c->n_bins,
+                                    filter + p * 2 * c->n_bins,
+                                    c->n_bins);
+            }
+        }
+
+        fft_inverse(c, c->accumulator, c->work);
+        memcpy(c->output_blocks[o], c->work + c->block_size, c->block_size * sizeof(float));
+    }
+}
+
+/* Adds n frames to the current input block. They must fit into it. */
+static void collect_input(pa_convolver *c, const float *src, unsigned n) {
+    unsigned i, l;
+
+    for (i = 0; i < c->n_inputs; i++) {
+        float *block = c->input_blocks[i] + c->block_size + c->position;
+
+        for (l = 0; l < n; l++)
+            block[l] = src[l * c->n_inputs + i];
+    }
+
+    c->position += n;
+}
+
+static void write_history(pa_convolver *c, const float *src, unsigned n_frames) {
+    while (n_frames > 0) {
+        unsigned offset = (unsigned) (c->n_written % c->history_length);
+        unsigned n = PA_MIN(n_frames, c->history_length - offset);
+
+        memcpy(c->history + offset * c->n_inputs, src, n * c->n_inputs * sizeof(float));
+
+        src += n * c->n_inputs;
+        n_frames -= n;
+        c->n_written += n;
+    }
+
+    if (c->n_written - c->history_start > c->history_length)
+        c->history_start = c->n_written - c->history_length;
+}
+
+void pa_convolver_process(pa_convolver *c, const float *src, float *dst, unsigned n_frames) {
+    pa_assert(c);
+    pa_assert(src);
+    pa_assert(dst);
+
+    write_history(c, src, n_frames);
+
+    while (n_frames > 0) {
+        unsigned n = PA_MIN(n_frames, c->block_size - c->position);
+        unsigned o, l;
+
+        for (o = 0; o < c->n_outputs; o++) {
+            const float *block = c->output_blocks[o] + c->position;
+
+            for (l = 0; l < n; l++)
+                dst[l * c->n_outputs + o] = block[l];
+        }
+
+        collect_input(c, src, n);
+
+        src += n * c->n_inputs;
+        dst += n * c->n_outputs;
+        n_frames -= n;
+
+        if (c->position == c->block_size) {
+            process_block(c, true);
+            c->position = 0;
+        }
+    }
+}
+
+void pa_convolver_rewind(pa_convolver *c, unsigned n_frames) {
+    uint64_t end, output_start, start, pos;
+    unsigned margin;
+
+    pa_assert(c);
+
+    /* Don't go back further than the history allows */
+    margin = (c->n_partitions + 2) * c->block_size;
+    if (c->history_start > 0)
+        n_frames = (unsigned) PA_MIN((uint64_t) n_frames,
+                                     c->n_written - c->history_start > margin ? c->n_written - c->history_start - margin : 0);
+    n_frames = (unsigned) PA_MIN((uint64_t) n_frames, c->n_written);
+
+    if (n_frames == 0)
+        return;
+
+    end = c->n_written - n_frames;
+
+    /* The output block playing at end was computed when the block before
+     * it was complete, from the spectra of the last n_partitions blocks.
+     * Each of these spectra covers the block before it too. */
+    output_start = end - end % c->block_size;
+    start = output_start > (uint64_t) (c->n_partitions + 1) * c->block_size ?
+        output_start - (uint64_t) (c->n_partitions + 1) * c->block_size : 0;
+
+    reset_blocks(c);
+
+    for (pos = start; pos < end; ) {
+        unsigned offset = (unsigned) (pos % c->history_length);
+        unsigned n = (unsigned) PA_MIN(end - pos, (uint64_t) (c->block_size - c->position));
+
+        n = PA_MIN(n, c->history_length - offset);
+        collect_input(c, c->history + offset * c->n_inputs, n);
+        pos += n;
+
+        if (c->position == c->block_size) {
+            process_block(c, pos == output_start);
+            c->position = 0;
+        }
+    }
+
+    c->n_written = end;
+}
+
+unsigned pa_convolver_get_latency(pa_convolver *c) {
+    pa_assert(c);
+
+    return c->block_size;
+}
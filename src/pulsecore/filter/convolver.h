@@ -0,0 +1,66 @@
+#ifndef fooconvolverhfoo
+#define fooconvolverhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* A uniformly partitioned overlap-save convolver, for long FIR filters such
+ * as head related impulse responses.
+ *
+ * Every output channel is the sum of the input channels, each convolved with
+ * the filter set for that pair of channels. The filters are cut into
+ * partitions of block_size taps whose spectra are computed once, when the
+ * filter is set. Processing then costs two FFTs of 2 * block_size points per
+ * channel and one complex multiply-add per partition and filter for every
+ * block of block_size frames, instead of one multiply-add per tap and filter
+ * for every frame.
+ *
+ * The output is delayed by pa_convolver_get_latency() frames. */
+
+typedef struct pa_convolver pa_convolver;
+
+/* block_size must be a power of two. max_taps is the length of the longest
+ * filter that will be set. */
+pa_convolver *pa_convolver_new(unsigned block_size, unsigned n_inputs, unsigned n_outputs, unsigned max_taps);
+void pa_convolver_free(pa_convolver *c);
+
+/* Sets the filter from an input channel to an output channel. The taps are
+ * read stride floats apart, so that one channel of interleaved impulse
+ * responses can be used directly. Pairs of channels without a filter do not
+ * contribute to the output. */
+void pa_convolver_set_filter(pa_convolver *c, unsigned input, unsigned output, const float *taps, unsigned n_taps, unsigned stride);
+
+/* Forgets all past input */
+void pa_convolver_reset(pa_convolver *c);
+
+/* Sets how many frames pa_convolver_rewind() may go back. The input is kept
+ * for that long, plus the length of the filter. */
+void pa_convolver_set_max_rewind(pa_convolver *c, unsigned n_frames);
+
+/* Goes back n_frames frames of input, to the state the convolver had before
+ * it processed them. The input that follows is processed as if those frames
+ * had never been seen. */
+void pa_convolver_rewind(pa_convolver *c, unsigned n_frames);
+
+/* Processes n_frames frames of interleaved float samples. src has n_inputs
+ * channels, dst has n_outputs channels. */
+void pa_convolver_process(pa_convolver *c, const float *src, float *dst, unsigned n_frames);
+
+/* Returns the delay of the output, in frames */
+unsigned pa_convolver_get_latency(pa_convolver *c);
+
+#endif
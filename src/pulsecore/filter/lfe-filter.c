@@ -23,19 +23,19 @@
 
 #include "lfe-filter.h"
 #include <pulse/xmalloc.h>
-#include <pulsecore/flist.h>
-#include <pulsecore/llist.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
 #include <pulsecore/filter/biquad.h>
+#include <pulsecore/filter/biquad-cascade.h>
 #include <pulsecore/filter/crossover.h>
 
-struct saved_state {
-    PA_LLIST_FIELDS(struct saved_state);
-    pa_memchunk chunk;
-    int64_t index;
-    struct lr4 lr4[PA_CHANNELS_MAX];
-};
+/* The filter state is saved every SAVE_INTERVAL frames. A rewind restores the
+   last state saved before the new position, and filters the input from there
+   on again, which is at most SAVE_INTERVAL - 1 frames. */
+#define SAVE_INTERVAL 1024
 
-PA_STATIC_FLIST_DECLARE(lfe_state, 0, pa_xfree);
+/* Frames filtered at once when catching up after a rewind */
+#define SCRATCH_FRAMES 256
 
 /* An LR4 filter, implemented as a chain of two Butterworth filters.
 
@@ -43,24 +43,41 @@ PA_STATIC_FLIST_DECLARE(lfe_state, 0, pa_xfree);
    channels except for the LFE channel, where a lowpass filter is applied.
    This works well for e g stereo to 2.1/5.1/7.1 scenarios, where the remap engine
    has calculated the LFE channel to be the average of all source channels.
+
+   With an optimized biquad cascade function, all channels are filtered
+   together, by a cascade of two stages. Otherwise each channel is filtered
+   on its own by lr4, which is faster than the generic cascade code.
 */
 
 struct pa_lfe_filter {
     int64_t index;
-    PA_LLIST_HEAD(struct saved_state, saved);
     float crossover;
     pa_channel_map cm;
     pa_sample_spec ss;
-    size_t maxrewind;
+    size_t fs;
     bool active;
-    struct lr4 lr4[PA_CHANNELS_MAX];
-};
 
-static void remove_state(pa_lfe_filter_t *f, struct saved_state *s) {
-    PA_LLIST_REMOVE(struct saved_state, f->saved, s);
-    pa_memblock_unref(s->chunk.memblock);
-    pa_xfree(s);
-}
+    /* One of the two is used */
+    pa_biquad_cascade *cascade;
+    struct lr4 *lr4;
+
+    /* The unfiltered input of the last history_frames frames before
+       history_end, the furthest frame filtered so far. Frame i is at position
+       i % history_frames. */
+    uint8_t *history;
+    size_t history_frames;
+    int64_t history_end;
+
+    /* The filter states at multiples of SAVE_INTERVAL, of state_size bytes
+       each. The state at frame i is in slot (i / SAVE_INTERVAL) % n_saved, if
+       saved_index of that slot is i. */
+    uint8_t *saved;
+    int64_t *saved_index;
+    unsigned n_saved;
+    size_t state_size;
+
+    void *scratch;
+};
 
 pa_lfe_filter_t * pa_lfe_filter_new(const pa_sample_spec* ss, const pa_channel_map* cm, float crossover_freq, size_t maxrewind) {
 
@@ -68,15 +85,38 @@ pa_lfe_filter_t * pa_lfe_filter_new(const pa_sample_spec* ss, const pa_channel_m
     f->crossover = crossover_freq;
     f->cm = *cm;
     f->ss = *ss;
-    f->maxrewind = maxrewind;
+    f->fs = pa_frame_size(ss);
+
+    if (pa_biquad_cascade_is_optimized()) {
+        f->cascade = pa_biquad_cascade_new(cm->channels, 2);
+        f->state_size = pa_biquad_cascade_get_state_size(f->cascade) * sizeof(float);
+    } else {
+        f->lr4 = pa_xnew0(struct lr4, cm->channels);
+        f->state_size = cm->channels * sizeof(struct lr4);
+    }
+
+    /* Everything a rewind may need is allocated here, so that the IO thread
+       never has to. Rewinding maxrewind frames may go back to a state saved
+       up to SAVE_INTERVAL - 1 frames before that. */
+    f->history_frames = maxrewind + SAVE_INTERVAL;
+    f->history = pa_xmalloc(f->history_frames * f->fs);
+    f->n_saved = f->history_frames / SAVE_INTERVAL + 2;
+    f->saved = pa_xmalloc(f->n_saved * f->state_size);
+    f->saved_index = pa_xnew(int64_t, f->n_saved);
+    f->scratch = pa_xmalloc(SCRATCH_FRAMES * f->fs);
+
     pa_lfe_filter_update_rate(f, ss->rate);
     return f;
 }
 
 void pa_lfe_filter_free(pa_lfe_filter_t *f) {
-    while (f->saved)
-        remove_state(f, f->saved);
-
+    if (f->cascade)
+        pa_biquad_cascade_free(f->cascade);
+    pa_xfree(f->lr4);
+    pa_xfree(f->history);
+    pa_xfree(f->saved);
+    pa_xfree(f->saved_index);
+    pa_xfree(f->scratch);
     pa_xfree(f);
 }
 
@@ -84,75 +124,90 @@ void pa_lfe_filter_reset(pa_lfe_filter_t *f) {
     pa_lfe_filter_update_rate(f, f->ss.rate);
 }
 
-static void process_block(pa_lfe_filter_t *f, pa_memchunk *buf, bool store_result) {
-    int samples = buf->length / pa_frame_size(&f->ss);
-
-    void *garbage = store_result ? NULL : pa_xmalloc(buf->length);
+static void filter(pa_lfe_filter_t *f, void *dst, const void *src, unsigned samples) {
+    unsigned i;
 
-    if (f->ss.format == PA_SAMPLE_FLOAT32NE) {
-        int i;
-        float *data = pa_memblock_acquire_chunk(buf);
-        for (i = 0; i < f->cm.channels; i++)
-            lr4_process_float32(&f->lr4[i], samples, f->cm.channels, &data[i], garbage ? garbage : &data[i]);
-        pa_memblock_release(buf->memblock);
-    }
-    else if (f->ss.format == PA_SAMPLE_S16NE) {
-        int i;
-        short *data = pa_memblock_acquire_chunk(buf);
-        for (i = 0; i < f->cm.channels; i++)
-            lr4_process_s16(&f->lr4[i], samples, f->cm.channels, &data[i], garbage ? garbage : &data[i]);
-        pa_memblock_release(buf->memblock);
+    if (f->lr4) {
+        for (i = 0; i < f->cm.channels; i++) {
+            if (f->ss.format == PA_SAMPLE_FLOAT32NE)
+                lr4_process_float32(&f->lr4[i], samples, f->cm.channels, (float *) src + i, (float *) dst + i);
+            else if (f->ss.format == PA_SAMPLE_S16NE)
+                lr4_process_s16(&f->lr4[i], samples, f->cm.channels, (short *) src + i, (short *) dst + i);
+            else pa_assert_not_reached();
+        }
+        return;
     }
+
+    if (f->ss.format == PA_SAMPLE_FLOAT32NE)
+        pa_biquad_cascade_process_float32(f->cascade, dst, src, samples);
+    else if (f->ss.format == PA_SAMPLE_S16NE)
+        pa_biquad_cascade_process_s16(f->cascade, dst, src, samples);
     else pa_assert_not_reached();
+}
 
-    pa_xfree(garbage);
-    f->index += samples;
+static void save_state(pa_lfe_filter_t *f) {
+    unsigned slot = (unsigned) ((f->index / SAVE_INTERVAL) % f->n_saved);
+
+    if (f->cascade)
+        pa_biquad_cascade_save_state(f->cascade, (float *) (f->saved + slot * f->state_size));
+    else
+        memcpy(f->saved + slot * f->state_size, f->lr4, f->state_size);
+    f->saved_index[slot] = f->index;
+}
+
+static void save_input(pa_lfe_filter_t *f, const uint8_t *src, size_t samples) {
+    size_t pos = (size_t) (f->index % (int64_t) f->history_frames);
+
+    while (samples > 0) {
+        size_t n = PA_MIN(samples, f->history_frames - pos);
+
+        memcpy(f->history + pos * f->fs, src, n * f->fs);
+        src += n * f->fs;
+        samples -= n;
+        pos = 0;
+    }
 }
 
 pa_memchunk * pa_lfe_filter_process(pa_lfe_filter_t *f, pa_memchunk *buf) {
-    pa_mempool *pool;
-    struct saved_state *s, *s2;
-    void *data;
+    uint8_t *data;
+    size_t samples;
 
     if (!f->active || !buf->length)
         return buf;
 
-    /* Remove old states (FIXME: we could do better than searching the entire array here?) */
-    PA_LLIST_FOREACH_SAFE(s, s2, f->saved)
-        if (s->index + (int64_t) (s->chunk.length / pa_frame_size(&f->ss) + f->maxrewind) < f->index)
-            remove_state(f, s);
+    samples = buf->length / f->fs;
+    data = pa_memblock_acquire_chunk(buf);
 
-    /* Insert our existing state into the flist */
-    if ((s = pa_flist_pop(PA_STATIC_FLIST_GET(lfe_state))) == NULL)
-        s = pa_xnew(struct saved_state, 1);
-    PA_LLIST_INIT(struct saved_state, s);
+    while (samples > 0) {
+        size_t offset = (size_t) (f->index % SAVE_INTERVAL);
+        size_t n = PA_MIN(samples, SAVE_INTERVAL - offset);
 
-    /* TODO: This actually memcpys the entire chunk into a new allocation, because we need to retain the original
-       in case of rewinding. Investigate whether this can be avoided. */
-    data = pa_memblock_acquire_chunk(buf);
-    pool = pa_memblock_get_pool(buf->memblock);
-    s->chunk.memblock = pa_memblock_new_malloced(pool, pa_xmemdup(data, buf->length), buf->length);
-    s->chunk.length = buf->length;
-    s->chunk.index = 0;
-    pa_memblock_release(buf->memblock);
-    pa_mempool_unref(pool), pool = NULL;
+        if (offset == 0)
+            save_state(f);
+
+        save_input(f, data, n);
+        filter(f, data, data, n);
 
-    s->index = f->index;
-    memcpy(s->lr4, f->lr4, sizeof(struct lr4) * f->cm.channels);
-    PA_LLIST_PREPEND(struct saved_state, f->saved, s);
+        f->index += n;
+        data += n * f->fs;
+        samples -= n;
+    }
 
-    process_block(f, buf, true);
+    f->history_end = PA_MAX(f->history_end, f->index);
+
+    pa_memblock_release(buf->memblock);
     return buf;
 }
 
 void pa_lfe_filter_update_rate(pa_lfe_filter_t *f, uint32_t new_rate) {
-    int i;
+    unsigned i;
     float biquad_freq = f->crossover / (new_rate / 2);
 
-    while (f->saved)
-        remove_state(f, f->saved);
-
     f->index = 0;
+    f->history_end = 0;
+    for (i = 0; i < f->n_saved; i++)
+        f->saved_index[i] = -1;
+
     f->ss.rate = new_rate;
     if (biquad_freq <= 0 || biquad_freq >= 1) {
         pa_log_warn("Crossover frequency (%f) outside range for sample rate %d", f->crossover, new_rate);
@@ -160,42 +215,56 @@ void pa_lfe_filter_update_rate(pa_lfe_filter_t *f, uint32_t new_rate) {
         return;
     }
 
-    for (i = 0; i < f->cm.channels; i++)
-        lr4_set(&f->lr4[i], f->cm.map[i] == PA_CHANNEL_POSITION_LFE ? BQ_LOWPASS : BQ_HIGHPASS, biquad_freq);
+    if (f->lr4) {
+        for (i = 0; i < f->cm.channels; i++)
+            lr4_set(&f->lr4[i], f->cm.map[i] == PA_CHANNEL_POSITION_LFE ? BQ_LOWPASS : BQ_HIGHPASS, biquad_freq);
+
+        f->active = true;
+        return;
+    }
+
+    for (i = 0; i < f->cm.channels; i++) {
+        struct biquad bq;
+
+        biquad_set(&bq, f->cm.map[i] == PA_CHANNEL_POSITION_LFE ? BQ_LOWPASS : BQ_HIGHPASS, biquad_freq);
+        pa_biquad_cascade_set(f->cascade, 0, i, &bq);
+        pa_biquad_cascade_set(f->cascade, 1, i, &bq);
+    }
+
+    pa_biquad_cascade_commit(f->cascade, 0);
+    pa_biquad_cascade_reset(f->cascade);
 
     f->active = true;
 }
 
 void pa_lfe_filter_rewind(pa_lfe_filter_t *f, size_t amount) {
-    struct saved_state *i, *s = NULL;
-    size_t samples = amount / pa_frame_size(&f->ss);
-    f->index -= samples;
-
-    /* Find the closest saved position */
-    PA_LLIST_FOREACH(i, f->saved) {
-        if (i->index > f->index)
-            continue;
-        if (s == NULL || i->index > s->index)
-            s = i;
-    }
-    if (s == NULL) {
-        pa_log_debug("Rewinding LFE filter %zu samples to position %lli. No saved state found", samples, (long long) f->index);
+    size_t samples = amount / f->fs;
+    int64_t index = f->index - (int64_t) samples;
+    int64_t saved = index - index % SAVE_INTERVAL;
+    unsigned slot = (unsigned) ((saved / SAVE_INTERVAL) % f->n_saved);
+    int64_t i;
+
+    /* The input since the saved state must still be in the history */
+    if (index < 0 || f->saved_index[slot] != saved || saved < f->history_end - (int64_t) f->history_frames) {
+        pa_log_debug("Rewinding LFE filter %zu samples to position %lli. No saved state found", samples, (long long) index);
         pa_lfe_filter_update_rate(f, f->ss.rate);
         return;
     }
     pa_log_debug("Rewinding LFE filter %zu samples to position %lli. Found saved state at position %lli",
-        samples, (long long) f->index, (long long) s->index);
-    memcpy(f->lr4, s->lr4, sizeof(struct lr4) * f->cm.channels);
+        samples, (long long) index, (long long) saved);
+    if (f->cascade)
+        pa_biquad_cascade_restore_state(f->cascade, (const float *) (f->saved + slot * f->state_size));
+    else
+        memcpy(f->lr4, f->saved + slot * f->state_size, f->state_size);
 
     /* now fast forward to the actual position */
-    if (f->index > s->index) {
-        pa_memchunk x = s->chunk;
-        x.length = (f->index - s->index) * pa_frame_size(&f->ss);
-        if (x.length > s->chunk.length) {
-            pa_log_error("Hole in stream, cannot fast forward LFE filter");
-            return;
-        }
-        f->index = s->index;
-        process_block(f, &x, false);
+    for (i = saved; i < index; ) {
+        size_t pos = (size_t) (i % (int64_t) f->history_frames);
+        size_t n = PA_MIN(PA_MIN((size_t) (index - i), (size_t) SCRATCH_FRAMES), f->history_frames - pos);
+
+        filter(f, f->scratch, f->history + pos * f->fs, n);
+        i += n;
     }
+
+    f->index = index;
 }
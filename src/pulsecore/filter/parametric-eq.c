@@ -0,0 +1,164 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/macro.h>
+
+#include "parametric-eq.h"
+
+/* Rounds of correcting the band gains for the overlap of neighbouring bands */
+#define N_ITERATIONS 8
+
+/* Floor of the magnitude response, so that zeros do not become -inf dB */
+#define MIN_MAGNITUDE 1e-6
+
+/* Width of one band in octaves */
+static double get_bandwidth(unsigned n_stages, unsigned rate) {
+    double max_freq = PA_MIN(PA_PARAMETRIC_EQ_MAX_FREQ, 0.4 * rate);
+
+    pa_assert(max_freq > PA_PARAMETRIC_EQ_MIN_FREQ);
+
+    return log2(max_freq / PA_PARAMETRIC_EQ_MIN_FREQ) / (n_stages - 1);
+}
+
+double pa_parametric_eq_get_frequency(unsigned n_stages, unsigned rate, unsigned band) {
+    pa_assert(n_stages >= 3);
+    pa_assert(band < n_stages);
+
+    return PA_PARAMETRIC_EQ_MIN_FREQ * exp2(band * get_bandwidth(n_stages, rate));
+}
+
+double pa_parametric_eq_response(const struct biquad *stages, unsigned n_stages, unsigned rate, double freq) {
+    double w = 2 * M_PI * freq / rate;
+    double c1 = cos(w), s1 = sin(w), c2 = cos(2 * w), s2 = sin(2 * w);
+    double db = 0;
+    unsigned s;
+
+    pa_assert(stages);
+
+    /* |B(e^jw)|^2 / |A(e^jw)|^2 for each stage */
+    for (s = 0; s < n_stages; s++) {
+        const struct biquad *bq = &stages[s];
+        double br = bq->b0 + bq->b1 * c1 + bq->b2 * c2;
+        double bi = bq->b1 * s1 + bq->b2 * s2;
+        double ar = 1 + bq->a1 * c1 + bq->a2 * c2;
+        double ai = bq->a1 * s1 + bq->a2 * s2;
+
+        db += 10 * log10((br * br + bi * bi) / (ar * ar + ai * ai));
+    }
+
+    return db;
+}
+
+static void design_stages(struct biquad *stages, unsigned n_stages, unsigned rate, const double *freqs, double bandwidth, const double *gains) {
+    double nyquist = rate / 2.0;
+    double edge = exp2(bandwidth / 2);
+    double Q = edge / (exp2(bandwidth) - 1);
+    unsigned k;
+
+    /* The shelves turn over at the inner edge of their band, so that they
+     * cover everything beyond it */
+    biquad_set_eq(&stages[0], BQ_LOWSHELF, freqs[0] * edge / nyquist, 0, gains[0]);
+
+    for (k = 1; k < n_stages - 1; k++)
+        biquad_set_eq(&stages[k], BQ_PEAKING, freqs[k] / nyquist, Q, gains[k]);
+
+    biquad_set_eq(&stages[n_stages - 1], BQ_HIGHSHELF, freqs[n_stages - 1] / edge / nyquist, 0, gains[n_stages - 1]);
+}
+
+/* The mean level of H in one band, in dB */
+static double get_band_level(const float *H, unsigned n_points, unsigned rate, double low, double high, float gain) {
+    double bin_width = rate / 2.0 / (n_points - 1);
+    unsigned first, last, i;
+    double sum = 0;
+
+    first = PA_MIN((unsigned) ceil(low / bin_width), n_points - 1);
+    last = PA_MIN((unsigned) floor(high / bin_width), n_points - 1);
+
+    /* Narrow bands may fall between two bins */
+    if (last < first)
+        first = last = PA_MIN((unsigned) lrint(sqrt(low * high) / bin_width), n_points - 1);
+
+    for (i = first; i <= last; i++)
+        sum += 20 * log10(PA_MAX(fabs(H[i] * gain), MIN_MAGNITUDE));
+
+    return sum / (last - first + 1);
+}
+
+void pa_parametric_eq_design(struct biquad *stages, unsigned n_stages, const float *H, unsigned n_points, unsigned rate, float gain) {
+    double *freqs, *targets, *gains;
+    double bandwidth, center, mean = 0, scale;
+    unsigned k, i;
+
+    pa_assert(stages);
+    pa_assert(n_stages >= 3);
+    pa_assert(H);
+    pa_assert(n_points >= 2);
+
+    freqs = pa_xnew(double, n_stages);
+    targets = pa_xnew(double, n_stages);
+    gains = pa_xnew(double, n_stages);
+
+    bandwidth = get_bandwidth(n_stages, rate);
+    center = exp2(bandwidth / 8);
+
+    /* The targets are taken from the middle quarter of each band, where the
+     * stage of the band dominates the response */
+    for (k = 0; k < n_stages; k++) {
+        freqs[k] = pa_parametric_eq_get_frequency(n_stages, rate, k);
+        targets[k] = get_band_level(H, n_points, rate, freqs[k] / center, freqs[k] * center, gain);
+        mean += targets[k] / n_stages;
+    }
+
+    /* The stages only shape the response around the mean level, which is
+     * applied as a plain gain */
+    for (k = 0; k < n_stages; k++) {
+        targets[k] = PA_CLAMP(targets[k] - mean, -PA_PARAMETRIC_EQ_MAX_DB, PA_PARAMETRIC_EQ_MAX_DB);
+        gains[k] = targets[k];
+    }
+
+    /* Neighbouring bands overlap, so the cascade misses the targets at the
+     * band centers by the contributions of the other stages. Correct the
+     * gains by the remaining error a few times. */
+    for (i = 0; i < N_ITERATIONS; i++) {
+        design_stages(stages, n_stages, rate, freqs, bandwidth, gains);
+
+        for (k = 0; k < n_stages; k++) {
+            double error = targets[k] - pa_parametric_eq_response(stages, n_stages, rate, freqs[k]);
+
+            gains[k] = PA_CLAMP(gains[k] + error, -2 * PA_PARAMETRIC_EQ_MAX_DB, 2 * PA_PARAMETRIC_EQ_MAX_DB);
+        }
+    }
+
+    design_stages(stages, n_stages, rate, freqs, bandwidth, gains);
+
+    scale = pow(10, mean / 20);
+    stages[0].b0 *= scale;
+    stages[0].b1 *= scale;
+    stages[0].b2 *= scale;
+
+    pa_xfree(gains);
+    pa_xfree(targets);
+    pa_xfree(freqs);
+}
@@ -0,0 +1,49 @@
+#ifndef fooparametriceqhfoo
+#define fooparametriceqhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulsecore/filter/biquad.h>
+
+/* Fits a cascade of shelving and peaking biquads to a magnitude response.
+ *
+ * The stages are centered on bands spread evenly over the octaves between
+ * PA_PARAMETRIC_EQ_MIN_FREQ and PA_PARAMETRIC_EQ_MAX_FREQ, or 0.4 times the
+ * sample rate if that is lower. The first stage is a low shelf, the last one
+ * a high shelf and the others are peaking filters. All of them are minimum
+ * phase, so the cascade adds no latency beyond its group delay.
+ *
+ * The band gains are clamped to +/- PA_PARAMETRIC_EQ_MAX_DB around the mean
+ * level of the response. */
+
+#define PA_PARAMETRIC_EQ_MIN_FREQ 31.25
+#define PA_PARAMETRIC_EQ_MAX_FREQ 16000.0
+#define PA_PARAMETRIC_EQ_MAX_DB 24.0
+
+/* Designs n_stages stages (at least 3) from the magnitude response H, given
+ * at n_points frequencies equally spaced from 0 to rate / 2. All of H is
+ * multiplied by gain. */
+void pa_parametric_eq_design(struct biquad *stages, unsigned n_stages, const float *H, unsigned n_points, unsigned rate, float gain);
+
+/* The center frequency of one band, in Hz */
+double pa_parametric_eq_get_frequency(unsigned n_stages, unsigned rate, unsigned band);
+
+/* The magnitude response of the cascade at freq Hz, in dB */
+double pa_parametric_eq_response(const struct biquad *stages, unsigned n_stages, unsigned rate, double freq);
+
+#endif
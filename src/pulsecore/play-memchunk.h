@@ -21,8 +21,21 @@
 ***/
 
 #include <pulsecore/sink.h>
+#include <pulsecore/sink-input.h>
 #include <pulsecore/memchunk.h>
 
+/* Create a sink input that plays chunk once, sharing its memblock
+ * instead of copying it. If the sample spec and channel map match the
+ * sink's, no resampler is set up for it. */
+pa_sink_input* pa_memchunk_sink_input_new(
+        pa_sink *sink,
+        const pa_sample_spec *ss,
+        const pa_channel_map *map,
+        const pa_memchunk *chunk,
+        pa_cvolume *volume,
+        pa_proplist *p,
+        pa_sink_input_flags_t flags);
+
 int pa_play_memchunk(
         pa_sink *sink,
         const pa_sample_spec *ss,
@@ -3736,6 +3736,10 @@ static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag,
     if (m != 0) {
         c->subscription = pa_subscription_new(c->protocol->core, m, subscription_cb, c);
         pa_assert(c->subscription);
+
+        /* Limit the rate of change events sent to clients, so that
+         * e.g. dragging a volume slider doesn't flood them */
+        pa_subscription_set_coalesce_time(c->subscription, c->protocol->core->subscription_coalesce_msec * PA_USEC_PER_MSEC);
     } else
         c->subscription = NULL;
 
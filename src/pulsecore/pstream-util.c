@@ -38,8 +38,14 @@ static void pa_pstream_send_tagstruct_with_ancil_data(pa_pstream *p, pa_tagstruc
     pa_assert(p);
     pa_assert(t);
 
-    pa_assert_se(data = pa_tagstruct_data(t, &length));
-    pa_assert_se(packet = pa_packet_new_data(data, length));
+    /* Large tagstructs hand their buffer over to the packet, so that the
+     * data is not copied once more after it has been encoded. */
+    if ((data = pa_tagstruct_steal_data(t, &length)))
+        pa_assert_se(packet = pa_packet_new_dynamic((uint8_t*) data, length));
+    else {
+        pa_assert_se(data = pa_tagstruct_data(t, &length));
+        pa_assert_se(packet = pa_packet_new_data(data, length));
+    }
     pa_tagstruct_free(t);
 
     pa_pstream_send_packet(p, packet, ancil_data);
@@ -28,6 +28,7 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/strbuf.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/sample-util.h>
 
 #include "resampler.h"
 
@@ -1496,6 +1497,96 @@ void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out)
         pa_memchunk_reset(out);
 }
 
+unsigned pa_resampler_get_delay(pa_resampler *r) {
+    pa_assert(r);
+
+    if (!r->impl.get_delay)
+        return 0;
+
+    return r->impl.get_delay(r);
+}
+
+int pa_resampler_run_all(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out) {
+    pa_memchunk pad;
+    size_t out_length, skip, in_index = 0, out_index = 0, max_in;
+    uint8_t *dst;
+
+    pa_assert(r);
+    pa_assert(in);
+    pa_assert(in->memblock);
+    pa_assert(in->length % r->i_fz == 0);
+    pa_assert(out);
+
+    out_length = (size_t) ((uint64_t) (in->length / r->i_fz) * r->o_ss.rate / r->i_ss.rate) * r->o_fz;
+
+    if (out_length == 0)
+        return -1;
+
+    /* What comes out first is the delay of the filter, from before the
+     * input */
+    skip = (size_t) ((uint64_t) pa_resampler_get_delay(r) * r->o_ss.rate / r->i_ss.rate) * r->o_fz;
+
+    pa_memchunk_reset(&pad);
+
+    out->memblock = pa_memblock_new(r->mempool, out_length);
+    out->index = 0;
+    out->length = out_length;
+
+    dst = pa_memblock_acquire(out->memblock);
+
+    /* Feed at most as much padding as there is input, plus the delay */
+    max_in = 2 * in->length + (size_t) pa_resampler_get_delay(r) * r->i_fz;
+
+    while (out_index < out_length && in_index < max_in) {
+        pa_memchunk c, res;
+        size_t l = pa_resampler_max_block_size(r);
+
+        if (in_index < in->length) {
+            c = *in;
+            c.index += in_index;
+            c.length = PA_MIN(l, in->length - in_index);
+        } else {
+            if (!pad.memblock) {
+                pad.memblock = pa_memblock_new(r->mempool, l);
+                pad.index = 0;
+                pad.length = l;
+                pa_silence_memchunk(&pad, &r->i_ss);
+            }
+
+            c = pad;
+            c.length = PA_MIN(l, pad.length);
+        }
+
+        in_index += c.length;
+
+        pa_resampler_run(r, &c, &res);
+
+        if (res.memblock) {
+            size_t n, drop;
+
+            drop = PA_MIN(res.length, skip);
+            skip -= drop;
+            n = PA_MIN(res.length - drop, out_length - out_index);
+
+            memcpy(dst + out_index, (uint8_t*) pa_memblock_acquire(res.memblock) + res.index + drop, n);
+            pa_memblock_release(res.memblock);
+            pa_memblock_unref(res.memblock);
+
+            out_index += n;
+        }
+    }
+
+    if (out_index < out_length)
+        pa_silence_memory(dst + out_index, out_length - out_index, &r->o_ss);
+
+    pa_memblock_release(out->memblock);
+
+    if (pad.memblock)
+        pa_memblock_unref(pad.memblock);
+
+    return 0;
+}
+
 /*** copy (noop) implementation ***/
 
 static int copy_init(pa_resampler *r) {
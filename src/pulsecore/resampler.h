@@ -39,6 +39,11 @@ struct pa_resampler_impl {
     unsigned (*resample)(pa_resampler *r, const pa_memchunk *in, unsigned in_n_frames, pa_memchunk *out, unsigned *out_n_frames);
 
     void (*reset)(pa_resampler *r);
+
+    /* Returns the delay of the output in input frames. May be NULL if the
+     * output is not delayed. */
+    unsigned (*get_delay)(pa_resampler *r);
+
     void *data;
 };
 
@@ -137,6 +142,17 @@ size_t pa_resampler_max_block_size(pa_resampler *r);
 /* Pass the specified memory chunk to the resampler and return the newly resampled data */
 void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out);
 
+/* Returns the number of input frames by which the output lags behind the
+ * input, such as half the filter length of the speex resampler */
+unsigned pa_resampler_get_delay(pa_resampler *r);
+
+/* Convert a complete, self-contained chunk (e.g. a sample cache entry)
+ * in one go. The input is followed by silence to flush out the filter
+ * delay, the output of that delay is dropped from the front, and the
+ * result is cut to the length corresponding to the input length. Returns
+ * a negative value if that length is zero. */
+int pa_resampler_run_all(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out);
+
 /* Change the input rate of the resampler object */
 void pa_resampler_set_input_rate(pa_resampler *r, uint32_t rate);
 
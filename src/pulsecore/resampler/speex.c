@@ -134,6 +134,15 @@ static void speex_reset(pa_resampler *r) {
     pa_assert_se(speex_resampler_reset_mem(state) == 0);
 }
 
+static unsigned speex_get_delay(pa_resampler *r) {
+    SpeexResamplerState *state;
+    pa_assert(r);
+
+    state = r->impl.data;
+
+    return (unsigned) speex_resampler_get_input_latency(state);
+}
+
 static void speex_free(pa_resampler *r) {
     SpeexResamplerState *state;
     pa_assert(r);
@@ -154,6 +163,7 @@ int pa_resampler_speex_init(pa_resampler *r) {
     r->impl.free = speex_free;
     r->impl.update_rates = speex_update_rates;
     r->impl.reset = speex_reset;
+    r->impl.get_delay = speex_get_delay;
 
     if (r->method >= PA_RESAMPLER_SPEEX_FIXED_BASE && r->method <= PA_RESAMPLER_SPEEX_FIXED_MAX) {
 
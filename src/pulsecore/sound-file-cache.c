@@ -0,0 +1,530 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-scache.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/sound-file.h>
+#include <pulsecore/tagstruct.h>
+
+#include "sound-file-cache.h"
+
+#define CACHE_MAGIC "PASCACHE"
+#define CACHE_VERSION 1
+
+/* Source paths with the same hash get different cache files, up to this
+ * many per rate */
+#define CACHE_SLOTS 8
+
+/* On-disk layout: this header, then a tagstruct describing the entry
+ * (source path, mtime, size, sample spec, channel map, proplist), then
+ * the PCM data at a page aligned offset. Everything is in host byte
+ * order, cache files are never shared between machines. */
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t info_length;
+    uint64_t data_offset;
+    uint64_t data_length;
+};
+
+#ifdef HAVE_SYS_MMAN_H
+
+struct mapping {
+    void *start;
+    size_t length;
+};
+
+static void mapping_free(void *userdata) {
+    struct mapping *m = userdata;
+
+    pa_assert(m);
+
+    if (munmap(m->start, m->length) < 0)
+        pa_log("munmap() failed: %s", pa_cstrerror(errno));
+
+    pa_xfree(m);
+}
+
+static char *cache_file_name(const char *cache_dir, const char *fname, uint32_t rate, unsigned slot) {
+    if (slot == 0)
+        return pa_sprintf_malloc("%s" PA_PATH_SEP "%08x-%u.pcm", cache_dir, pa_idxset_string_hash_func(fname), rate);
+
+    return pa_sprintf_malloc("%s" PA_PATH_SEP "%08x-%u-%u.pcm", cache_dir, pa_idxset_string_hash_func(fname), rate, slot);
+}
+
+static bool header_valid(const struct cache_header *h, size_t length) {
+    return memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) == 0 &&
+        h->version == CACHE_VERSION &&
+        h->info_length <= length - sizeof(*h) &&
+        h->data_offset >= sizeof(*h) + h->info_length &&
+        h->data_offset <= length &&
+        h->data_length > 0 &&
+        h->data_length <= length - h->data_offset &&
+        h->data_length <= PA_SCACHE_ENTRY_SIZE_MAX;
+}
+
+/* Returns the source path stored in a cache file, or NULL if there is no
+ * such file or it is not a valid cache file. */
+static char *cache_file_source(const char *cfn) {
+    struct cache_header h;
+    struct stat cst;
+    pa_tagstruct *t = NULL;
+    uint8_t *info = NULL;
+    const char *c_fname;
+    char *r = NULL;
+    int fd;
+
+    if ((fd = pa_open_cloexec(cfn, O_RDONLY, 0)) < 0)
+        return NULL;
+
+    if (fstat(fd, &cst) < 0 ||
+        cst.st_size < (off_t) sizeof(h) ||
+        pa_loop_read(fd, &h, sizeof(h), NULL) != (ssize_t) sizeof(h) ||
+        !header_valid(&h, (size_t) cst.st_size) ||
+        h.info_length == 0)
+        goto finish;
+
+    info = pa_xmalloc(h.info_length);
+
+    if (pa_loop_read(fd, info, h.info_length, NULL) != (ssize_t) h.info_length)
+        goto finish;
+
+    t = pa_tagstruct_new_fixed(info, h.info_length);
+
+    if (pa_tagstruct_gets(t, &c_fname) >= 0 && c_fname)
+        r = pa_xstrdup(c_fname);
+
+finish:
+    if (t)
+        pa_tagstruct_free(t);
+
+    pa_xfree(info);
+    pa_close(fd);
+
+    return r;
+}
+
+/* Returns the name of the cache file for fname at rate: the one that
+ * already belongs to fname, or else the first one that does not belong to
+ * another file. Returns NULL if all of them do. */
+static char *cache_file_find(const char *cache_dir, const char *fname, uint32_t rate) {
+    char *cfn, *free_cfn = NULL;
+    unsigned slot;
+
+    for (slot = 0; slot < CACHE_SLOTS; slot++) {
+        char *source;
+
+        cfn = cache_file_name(cache_dir, fname, rate, slot);
+
+        if ((source = cache_file_source(cfn))) {
+            bool ours = pa_streq(source, fname);
+
+            pa_xfree(source);
+
+            if (ours) {
+                pa_xfree(free_cfn);
+                return cfn;
+            }
+
+            pa_xfree(cfn);
+            continue;
+        }
+
+        /* Missing and invalid files can be replaced, but a later slot may
+         * still hold fname */
+        if (!free_cfn)
+            free_cfn = cfn;
+        else
+            pa_xfree(cfn);
+    }
+
+    return free_cfn;
+}
+
+/* Removes the cache files of fname other than cfn, which are left over from
+ * earlier rates */
+static void cache_remove_stale(const char *cache_dir, const char *fname, const char *cfn) {
+    DIR *d;
+    struct dirent *de;
+    char *prefix;
+
+    if (!(d = opendir(cache_dir)))
+        return;
+
+    prefix = pa_sprintf_malloc("%08x-", pa_idxset_string_hash_func(fname));
+
+    while ((de = readdir(d))) {
+        char *path, *source;
+
+        if (!pa_startswith(de->d_name, prefix) || !pa_endswith(de->d_name, ".pcm"))
+            continue;
+
+        path = pa_sprintf_malloc("%s" PA_PATH_SEP "%s", cache_dir, de->d_name);
+
+        if (!pa_streq(path, cfn) && (source = cache_file_source(path))) {
+            if (pa_streq(source, fname)) {
+                pa_log_debug("Removing stale sample cache file %s", path);
+
+                if (unlink(path) < 0)
+                    pa_log_warn("Failed to remove sample cache file %s: %s", path, pa_cstrerror(errno));
+            }
+
+            pa_xfree(source);
+        }
+
+        pa_xfree(path);
+    }
+
+    pa_xfree(prefix);
+    closedir(d);
+}
+
+static int cache_map(
+        pa_mempool *pool,
+        const char *cfn,
+        const char *fname,
+        const struct stat *st,
+        uint32_t rate,
+        pa_sample_spec *ss,
+        pa_channel_map *map,
+        pa_memchunk *chunk,
+        pa_proplist *p) {
+
+    struct cache_header h;
+    struct mapping *m;
+    struct stat cst;
+    pa_tagstruct *t = NULL;
+    pa_proplist *info_p = NULL;
+    pa_sample_spec c_ss;
+    pa_channel_map c_map;
+    const char *c_fname;
+    uint64_t c_mtime, c_size;
+    void *start = MAP_FAILED;
+    size_t length = 0;
+    int fd;
+
+    if ((fd = pa_open_cloexec(cfn, O_RDONLY, 0)) < 0) {
+        if (errno != ENOENT)
+            pa_log_warn("Failed to open sample cache file %s: %s", cfn, pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (fstat(fd, &cst) < 0) {
+        pa_log_warn("fstat() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (cst.st_size < (off_t) sizeof(h))
+        goto invalid;
+
+    length = (size_t) cst.st_size;
+
+    if ((start = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        pa_log_warn("mmap() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    pa_close(fd);
+    fd = -1;
+
+    memcpy(&h, start, sizeof(h));
+
+    if (!header_valid(&h, length))
+        goto invalid;
+
+    info_p = pa_proplist_new();
+    t = pa_tagstruct_new_fixed((const uint8_t*) start + sizeof(h), h.info_length);
+
+    if (pa_tagstruct_gets(t, &c_fname) < 0 ||
+        pa_tagstruct_getu64(t, &c_mtime) < 0 ||
+        pa_tagstruct_getu64(t, &c_size) < 0 ||
+        pa_tagstruct_get_sample_spec(t, &c_ss) < 0 ||
+        pa_tagstruct_get_channel_map(t, &c_map) < 0 ||
+        pa_tagstruct_get_proplist(t, info_p) < 0 ||
+        !pa_tagstruct_eof(t))
+        goto invalid;
+
+    /* A different file hashing to the same name or a stale entry:
+     * the caller will regenerate it. */
+    if (!pa_streq(c_fname, fname) ||
+        c_mtime != (uint64_t) st->st_mtime ||
+        c_size != (uint64_t) st->st_size ||
+        c_ss.rate != rate)
+        goto fail;
+
+    if (!pa_sample_spec_valid(&c_ss) ||
+        !pa_channel_map_compatible(&c_map, &c_ss) ||
+        h.data_length % pa_frame_size(&c_ss) != 0)
+        goto invalid;
+
+    pa_tagstruct_free(t);
+
+    *ss = c_ss;
+    if (map)
+        *map = c_map;
+    if (p)
+        pa_proplist_update(p, PA_UPDATE_REPLACE, info_p);
+    pa_proplist_free(info_p);
+
+    m = pa_xnew(struct mapping, 1);
+    m->start = start;
+    m->length = length;
+
+    chunk->memblock = pa_memblock_new_user(pool, (uint8_t*) start + h.data_offset, (size_t) h.data_length, mapping_free, m, true);
+    chunk->index = 0;
+    chunk->length = (size_t) h.data_length;
+
+    return 0;
+
+invalid:
+    pa_log_warn("Ignoring invalid sample cache file %s", cfn);
+
+fail:
+    if (t)
+        pa_tagstruct_free(t);
+
+    if (info_p)
+        pa_proplist_free(info_p);
+
+    if (start != MAP_FAILED)
+        munmap(start, length);
+
+    if (fd >= 0)
+        pa_close(fd);
+
+    return -1;
+}
+
+static int resample_chunk(
+        pa_mempool *pool,
+        pa_resample_method_t method,
+        pa_sample_spec *ss,
+        const pa_channel_map *map,
+        pa_memchunk *chunk,
+        uint32_t rate) {
+
+    pa_resampler *r;
+    pa_sample_spec o_ss;
+    pa_memchunk out;
+    int ret;
+
+    o_ss = *ss;
+    o_ss.rate = rate;
+
+    if ((uint64_t) chunk->length * rate / ss->rate > PA_SCACHE_ENTRY_SIZE_MAX)
+        return -1;
+
+    if (!(r = pa_resampler_new(pool, ss, map, &o_ss, map, 0, method, 0)))
+        return -1;
+
+    ret = pa_resampler_run_all(r, chunk, &out);
+    pa_resampler_free(r);
+
+    if (ret < 0)
+        return -1;
+
+    pa_memblock_unref(chunk->memblock);
+    *chunk = out;
+    *ss = o_ss;
+
+    return 0;
+}
+
+static int cache_write(
+        const char *cfn,
+        const char *fname,
+        const struct stat *st,
+        const pa_sample_spec *ss,
+        const pa_channel_map *map,
+        const pa_memchunk *chunk,
+        const pa_proplist *p) {
+
+    struct cache_header h;
+    pa_tagstruct *t;
+    const uint8_t *info;
+    size_t info_length;
+    char *tmp;
+    void *pad;
+    size_t pad_length;
+    const void *data;
+    ssize_t r;
+    bool written = false;
+    int fd, ret = -1;
+
+    t = pa_tagstruct_new();
+    pa_tagstruct_puts(t, fname);
+    pa_tagstruct_putu64(t, (uint64_t) st->st_mtime);
+    pa_tagstruct_putu64(t, (uint64_t) st->st_size);
+    pa_tagstruct_put_sample_spec(t, ss);
+    pa_tagstruct_put_channel_map(t, map);
+    pa_tagstruct_put_proplist(t, p);
+    info = pa_tagstruct_data(t, &info_length);
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.version = CACHE_VERSION;
+    h.info_length = (uint32_t) info_length;
+    h.data_offset = PA_PAGE_ALIGN(sizeof(h) + info_length);
+    h.data_length = chunk->length;
+
+    tmp = pa_sprintf_malloc("%s.tmp-%lu", cfn, (unsigned long) getpid());
+
+    if ((fd = pa_open_cloexec(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0) {
+        pa_log_warn("Failed to create sample cache file %s: %s", tmp, pa_cstrerror(errno));
+        goto finish;
+    }
+
+    pad_length = h.data_offset - sizeof(h) - info_length;
+    pad = pad_length > 0 ? pa_xmalloc0(pad_length) : NULL;
+
+    data = pa_memblock_acquire_chunk(chunk);
+
+    /* Each part must be written completely, or the file is dropped */
+    if ((r = pa_loop_write(fd, &h, sizeof(h), NULL)) == (ssize_t) sizeof(h) &&
+        (r = pa_loop_write(fd, info, info_length, NULL)) == (ssize_t) info_length &&
+        (r = pa_loop_write(fd, pad, pad_length, NULL)) == (ssize_t) pad_length &&
+        (r = pa_loop_write(fd, data, chunk->length, NULL)) == (ssize_t) chunk->length)
+        written = true;
+
+    pa_memblock_release(chunk->memblock);
+    pa_xfree(pad);
+
+    if (!written) {
+        pa_log_warn("Failed to write sample cache file %s: %s", tmp, r < 0 ? pa_cstrerror(errno) : "short write");
+        pa_close(fd);
+        unlink(tmp);
+        goto finish;
+    }
+
+    if (pa_close(fd) < 0 || rename(tmp, cfn) < 0) {
+        pa_log_warn("Failed to store sample cache file %s: %s", cfn, pa_cstrerror(errno));
+        unlink(tmp);
+        goto finish;
+    }
+
+    ret = 0;
+
+finish:
+    pa_xfree(tmp);
+    pa_tagstruct_free(t);
+
+    return ret;
+}
+
+#endif
+
+int pa_sound_file_cache_load(
+        pa_mempool *pool,
+        const char *cache_dir,
+        const char *fname,
+        uint32_t rate,
+        pa_resample_method_t method,
+        pa_sample_spec *ss,
+        pa_channel_map *map,
+        pa_memchunk *chunk,
+        pa_proplist *p) {
+
+#ifdef HAVE_SYS_MMAN_H
+    struct stat st;
+    char *cfn;
+    pa_channel_map tmap;
+    pa_proplist *file_p;
+#endif
+
+    pa_assert(pool);
+    pa_assert(fname);
+    pa_assert(ss);
+    pa_assert(chunk);
+
+#ifdef HAVE_SYS_MMAN_H
+    if (!cache_dir || !pa_sample_rate_valid(rate) || stat(fname, &st) < 0)
+        return pa_sound_file_load(pool, fname, ss, map, chunk, p);
+
+    pa_memchunk_reset(chunk);
+
+    if (!(cfn = cache_file_find(cache_dir, fname, rate)))
+        pa_log_debug("All sample cache files for %s are taken by other files, not caching it.", fname);
+    else if (cache_map(pool, cfn, fname, &st, rate, ss, map, chunk, p) >= 0) {
+        pa_log_debug("Mapped cached sample data for %s from %s", fname, cfn);
+        pa_xfree(cfn);
+        return 0;
+    }
+
+    /* We need the channel map and the file's own properties for the
+     * cache entry, even if the caller isn't interested in them. */
+    if (!map)
+        map = &tmap;
+
+    file_p = pa_proplist_new();
+
+    if (pa_sound_file_load(pool, fname, ss, map, chunk, file_p) < 0) {
+        pa_proplist_free(file_p);
+        pa_xfree(cfn);
+        return -1;
+    }
+
+    if (ss->rate != rate && resample_chunk(pool, method, ss, map, chunk, rate) < 0)
+        pa_log_debug("Failed to resample %s for the sample cache, storing it at its native rate.", fname);
+
+    if (p)
+        pa_proplist_update(p, PA_UPDATE_REPLACE, file_p);
+
+    /* Replace the freshly decoded data by a mapping of the cache file,
+     * so that it doesn't stay around in anonymous memory. */
+    if (cfn && ss->rate == rate && cache_write(cfn, fname, &st, ss, map, chunk, file_p) >= 0) {
+        pa_memchunk mapped;
+        pa_sample_spec m_ss;
+
+        if (cache_map(pool, cfn, fname, &st, rate, &m_ss, NULL, &mapped, NULL) >= 0) {
+            pa_memblock_unref(chunk->memblock);
+            *chunk = mapped;
+        }
+
+        pa_log_debug("Stored decoded sample data for %s in %s", fname, cfn);
+
+        cache_remove_stale(cache_dir, fname, cfn);
+    }
+
+    pa_proplist_free(file_p);
+    pa_xfree(cfn);
+
+    return 0;
+#else
+    return pa_sound_file_load(pool, fname, ss, map, chunk, p);
+#endif
+}
@@ -0,0 +1,50 @@
+#ifndef foosoundfilecachehfoo
+#define foosoundfilecachehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pulse/sample.h>
+#include <pulse/channelmap.h>
+#include <pulse/proplist.h>
+#include <pulsecore/memchunk.h>
+#include <pulsecore/resampler.h>
+
+/* Like pa_sound_file_load(), but goes through a persistent cache of
+ * decoded PCM stored below cache_dir. Cache files are keyed by the
+ * source path, its mtime and size, and the target sample rate. The
+ * PCM is resampled to rate before it is stored, and on a cache hit the
+ * returned chunk is a read-only mmap() of the cache file, so neither
+ * decoding nor resampling happens and the data is backed by the page
+ * cache instead of anonymous memory. If the cache cannot be used for
+ * any reason this silently falls back to decoding the file.
+ *
+ * Each cache file records its source path, so paths whose names hash
+ * alike get files of their own. When a file is cached at a new rate, its
+ * files for other rates are removed. */
+int pa_sound_file_cache_load(
+        pa_mempool *pool,
+        const char *cache_dir,
+        const char *fname,
+        uint32_t rate,
+        pa_resample_method_t method,
+        pa_sample_spec *ss,
+        pa_channel_map *map,
+        pa_memchunk *chunk,
+        pa_proplist *p);
+
+#endif
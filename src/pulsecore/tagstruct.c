@@ -104,11 +104,14 @@ static inline void extend(pa_tagstruct*t, size_t l) {
     if (t->length+l <= t->allocated)
         return;
 
+    /* Grow geometrically, so that building large replies (e.g. info
+     * lists of hundreds of streams) needs only a logarithmic number of
+     * reallocations instead of one every GROW_TAG_SIZE bytes. */
     if (t->type == PA_TAGSTRUCT_DYNAMIC)
-        t->data = pa_xrealloc(t->data, t->allocated = t->length + l + GROW_TAG_SIZE);
+        t->data = pa_xrealloc(t->data, t->allocated = PA_MAX(t->length + l + GROW_TAG_SIZE, t->allocated * 2));
     else if (t->type == PA_TAGSTRUCT_APPENDED) {
         t->type = PA_TAGSTRUCT_DYNAMIC;
-        t->data = pa_xmalloc(t->allocated = t->length + l + GROW_TAG_SIZE);
+        t->data = pa_xmalloc(t->allocated = PA_MAX(t->length + l + GROW_TAG_SIZE, t->allocated * 2));
         memcpy(t->data, t->per_type.appended, t->length);
     }
 }
@@ -463,6 +466,26 @@ const uint8_t* pa_tagstruct_data(pa_tagstruct*t, size_t *l) {
     return t->data;
 }
 
+uint8_t* pa_tagstruct_steal_data(pa_tagstruct *t, size_t *l) {
+    uint8_t *data;
+
+    pa_assert(t);
+    pa_assert(l);
+
+    if (t->type != PA_TAGSTRUCT_DYNAMIC)
+        return NULL;
+
+    data = t->data;
+    *l = t->length;
+
+    t->data = t->per_type.appended;
+    t->allocated = MAX_APPENDED_SIZE;
+    t->length = t->rindex = 0;
+    t->type = PA_TAGSTRUCT_APPENDED;
+
+    return data;
+}
+
 int pa_tagstruct_get_boolean(pa_tagstruct*t, bool *b) {
     pa_assert(t);
     pa_assert(b);
@@ -67,6 +67,12 @@ void pa_tagstruct_free(pa_tagstruct*t);
 int pa_tagstruct_eof(pa_tagstruct*t);
 const uint8_t* pa_tagstruct_data(pa_tagstruct*t, size_t *l);
 
+/* If the tagstruct's data lives in a heap buffer owned by it, hand
+ * that buffer over to the caller (to be freed with pa_xfree()) and
+ * reset the tagstruct to empty. Returns NULL for small tagstructs whose
+ * data is stored inline, and for fixed ones. */
+uint8_t* pa_tagstruct_steal_data(pa_tagstruct *t, size_t *l);
+
 void pa_tagstruct_put(pa_tagstruct *t, ...);
 
 void pa_tagstruct_puts(pa_tagstruct*t, const char *s);
@@ -0,0 +1,235 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Runs the A2DP bitrate controller against a socketpair standing in for the
+ * Bluetooth link. The reading end is drained at a limited rate, in simulated
+ * time, like a radio link that cannot carry more than a given bitrate. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/socket.h>
+
+#include <modules/bluetooth/a2dp-bitrate-controller.h>
+
+/* The bitrates the stand-in encoder can switch between, in kbit/s */
+static const unsigned levels[] = { 192, 240, 288, 336, 384, 432 };
+
+#define PACKET_USEC (10 * PA_USEC_PER_MSEC)
+#define MAX_PACKET_SIZE (432 * 1000 / 8 * PACKET_USEC / PA_USEC_PER_SEC)
+
+struct link {
+    int fds[2];
+    double credit;
+    unsigned level;
+    pa_usec_t now;
+    pa_a2dp_bitrate_controller *controller;
+};
+
+struct stats {
+    uint64_t bytes_sent;
+    unsigned packets_sent;
+    unsigned packets_dropped;
+    unsigned changes;
+};
+
+static void link_init(struct link *l) {
+    int size = 2 * MAX_PACKET_SIZE;
+
+    pa_zero(*l);
+
+    fail_unless(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, l->fds) == 0);
+    fail_unless(setsockopt(l->fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == 0);
+    pa_make_fd_nonblock(l->fds[0]);
+    pa_make_fd_nonblock(l->fds[1]);
+
+    l->level = PA_ELEMENTSOF(levels) - 1;
+    l->controller = pa_a2dp_bitrate_controller_new();
+    pa_a2dp_bitrate_controller_reset(l->controller, 0);
+}
+
+static void link_done(struct link *l) {
+    pa_a2dp_bitrate_controller_free(l->controller);
+    pa_close(l->fds[0]);
+    pa_close(l->fds[1]);
+}
+
+/* Lets one packet period pass on a link carrying at most capacity kbit/s,
+ * then sends a packet like the module does */
+static void link_run(struct link *l, unsigned capacity, pa_usec_t duration, struct stats *s) {
+    uint8_t packet[MAX_PACKET_SIZE];
+    pa_usec_t end = l->now + duration;
+
+    pa_zero(*s);
+    memset(packet, 0x55, sizeof(packet));
+
+    for (; l->now < end; l->now += PACKET_USEC) {
+        size_t queued, buffer_size, packet_size;
+        ssize_t r;
+
+        l->credit += (double) capacity * 1000 / 8 * PACKET_USEC / PA_USEC_PER_SEC;
+
+        while (l->credit > 0 && (r = recv(l->fds[1], packet, sizeof(packet), 0)) > 0)
+            l->credit -= r;
+
+        /* An idle link cannot save up for later */
+        l->credit = PA_MIN(l->credit, MAX_PACKET_SIZE);
+
+        fail_unless(pa_a2dp_socket_get_queued(l->fds[0], &queued, &buffer_size) == 0);
+
+        switch (pa_a2dp_bitrate_controller_update(l->controller, l->now, queued, buffer_size)) {
+            case PA_A2DP_BITRATE_DECREASE:
+                if (l->level > 0) {
+                    l->level--;
+                    s->changes++;
+                }
+                break;
+
+            case PA_A2DP_BITRATE_INCREASE:
+                if (l->level < PA_ELEMENTSOF(levels) - 1) {
+                    l->level++;
+                    s->changes++;
+                }
+                break;
+
+            case PA_A2DP_BITRATE_KEEP:
+                break;
+        }
+
+        packet_size = levels[l->level] * 1000 / 8 * PACKET_USEC / PA_USEC_PER_SEC;
+
+        if (send(l->fds[0], packet, packet_size, 0) < 0) {
+            fail_unless(errno == EAGAIN);
+            s->packets_dropped++;
+            continue;
+        }
+
+        s->bytes_sent += packet_size;
+        s->packets_sent++;
+    }
+
+    pa_log_info("Link at %u kbit/s: sent %0.0f kbit/s, %u packets dropped, %u bitrate changes, ending at %u kbit/s",
+                capacity, (double) s->bytes_sent * 8 / 1000 / ((double) duration / PA_USEC_PER_SEC),
+                s->packets_dropped, s->changes, levels[l->level]);
+}
+
+START_TEST (socket_queued_test) {
+    int fds[2];
+    uint8_t packet[MAX_PACKET_SIZE];
+    size_t queued, buffer_size;
+    unsigned i;
+
+    fail_unless(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == 0);
+
+    fail_unless(pa_a2dp_socket_get_queued(fds[0], &queued, &buffer_size) == 0);
+    fail_unless(queued == 0);
+    fail_unless(buffer_size > 0);
+
+    memset(packet, 0, sizeof(packet));
+    for (i = 0; i < 3; i++)
+        fail_unless(send(fds[0], packet, sizeof(packet), 0) == sizeof(packet));
+
+    /* The kernel accounts for its own overhead as well */
+    fail_unless(pa_a2dp_socket_get_queued(fds[0], &queued, &buffer_size) == 0);
+    fail_unless(queued >= 3 * sizeof(packet));
+
+    for (i = 0; i < 3; i++)
+        fail_unless(recv(fds[1], packet, sizeof(packet), 0) == sizeof(packet));
+
+    fail_unless(pa_a2dp_socket_get_queued(fds[0], &queued, &buffer_size) == 0);
+    fail_unless(queued == 0);
+
+    pa_close(fds[0]);
+    pa_close(fds[1]);
+}
+END_TEST
+
+START_TEST (constrained_link_test) {
+    struct link l;
+    struct stats s;
+
+    link_init(&l);
+
+    /* Let the controller find the highest bitrate below 300 kbit/s */
+    link_run(&l, 300, 30 * PA_USEC_PER_SEC, &s);
+
+    /* Once it has, it should stay there, apart from rare probes */
+    link_run(&l, 300, 60 * PA_USEC_PER_SEC, &s);
+    fail_unless(s.bytes_sent * 8 / 1000 / 60 <= 300);
+    fail_unless(s.bytes_sent * 8 / 1000 / 60 >= 240);
+    fail_unless(s.changes <= 10);
+    fail_unless(levels[l.level] <= 336);
+
+    /* When the link recovers, it should go back to the highest bitrate */
+    link_run(&l, 1000, 180 * PA_USEC_PER_SEC, &s);
+    fail_unless(s.packets_dropped == 0);
+    fail_unless(l.level == PA_ELEMENTSOF(levels) - 1);
+
+    link_done(&l);
+}
+END_TEST
+
+START_TEST (unconstrained_link_test) {
+    struct link l;
+    struct stats s;
+
+    link_init(&l);
+
+    /* A link with room to spare never loses its bitrate */
+    link_run(&l, 1000, 60 * PA_USEC_PER_SEC, &s);
+    fail_unless(s.packets_dropped == 0);
+    fail_unless(s.changes == 0);
+
+    link_done(&l);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("A2DP bitrate");
+    tc = tcase_create("a2dpbitrate");
+    tcase_add_test(tc, socket_queued_test);
+    tcase_add_test(tc, constrained_link_test);
+    tcase_add_test(tc, unconstrained_link_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,350 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Drives every A2DP codec through the encoder and decoder at each
+ * configuration it prefers for the usual sample specs, without a Bluetooth
+ * transport. Reports the encoding time per packet, the bitrate and the SNR
+ * of the round trip. A WAV file given on the command line is used in place
+ * of the synthetic signal, for configurations with its sample rate. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <check.h>
+#include <sndfile.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/sample.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <modules/bluetooth/a2dp-codec-util.h>
+
+/* The default L2CAP MTU, which many headsets use */
+#define LINK_MTU 672
+
+#define SIGNAL_SECONDS 2
+#define MAX_CODEC_DELAY 1024
+#define DELAY_SEARCH_FRAMES 8192
+
+/* Catches broken codecs, not small regressions in quality */
+#define MIN_SNR_DB 15.0
+
+#define MAX_CONFIGURATIONS 32
+
+struct configuration {
+    const pa_a2dp_codec *codec;
+    uint8_t config[MAX_A2DP_CAPS_SIZE];
+    uint8_t size;
+};
+
+static struct configuration configurations[MAX_CONFIGURATIONS];
+static unsigned n_configurations;
+
+static float *wav_data;
+static sf_count_t wav_frames;
+static SF_INFO wav_info;
+
+static void collect_configurations(void) {
+    static const uint32_t rates[] = { 16000, 32000, 44100, 48000 };
+    unsigned i, j, k, l;
+
+    for (i = 0; i < pa_bluetooth_a2dp_codec_count(); i++) {
+        const pa_a2dp_codec *codec = pa_bluetooth_a2dp_codec_iter(i);
+        uint8_t capabilities[MAX_A2DP_CAPS_SIZE];
+        uint8_t capabilities_size;
+
+        capabilities_size = codec->fill_capabilities(capabilities);
+
+        for (j = 0; j < PA_ELEMENTSOF(rates); j++) {
+            for (k = 1; k <= 2; k++) {
+                struct configuration *c = &configurations[n_configurations];
+                pa_sample_spec ss;
+
+                ss.format = PA_SAMPLE_S16LE;
+                ss.rate = rates[j];
+                ss.channels = (uint8_t) k;
+
+                if (!(c->size = codec->fill_preferred_configuration(&ss, capabilities, capabilities_size, c->config)))
+                    continue;
+
+                pa_assert_se(codec->is_configuration_valid(c->config, c->size));
+                c->codec = codec;
+
+                for (l = 0; l < n_configurations; l++)
+                    if (configurations[l].codec == codec && configurations[l].size == c->size &&
+                        memcmp(configurations[l].config, c->config, c->size) == 0)
+                        break;
+
+                if (l == n_configurations) {
+                    pa_assert(n_configurations < MAX_CONFIGURATIONS - 1);
+                    n_configurations++;
+                }
+            }
+        }
+    }
+}
+
+static int16_t clip(double v) {
+    return (int16_t) PA_CLAMP(lrint(v * 0x7fff), -0x8000, 0x7fff);
+}
+
+/* A few tones and some noise, with the channels out of phase */
+static int16_t *generate_signal(const pa_sample_spec *ss, size_t *n_frames) {
+    int16_t *data;
+    uint32_t seed = 1;
+    size_t i;
+    unsigned c;
+
+    *n_frames = SIGNAL_SECONDS * ss->rate;
+    data = pa_xnew(int16_t, *n_frames * ss->channels);
+
+    for (i = 0; i < *n_frames; i++) {
+        double t = (double) i / ss->rate;
+
+        for (c = 0; c < ss->channels; c++) {
+            double phase = c * M_PI / 3;
+
+            seed = seed * 1103515245 + 12345;
+            data[i * ss->channels + c] = clip(0.25 * sin(2 * M_PI * 220 * t + phase) +
+                                              0.15 * sin(2 * M_PI * 1000 * t + 2 * phase) +
+                                              0.08 * sin(2 * M_PI * 3500 * t + 3 * phase) +
+                                              0.01 * ((double) (seed >> 16) / 0x8000 - 1));
+        }
+    }
+
+    return data;
+}
+
+/* Returns NULL if the WAV file does not have the rate of the configuration */
+static int16_t *convert_wav(const pa_sample_spec *ss, size_t *n_frames) {
+    int16_t *data;
+    sf_count_t i;
+    unsigned c;
+
+    if ((uint32_t) wav_info.samplerate != ss->rate)
+        return NULL;
+
+    *n_frames = (size_t) wav_frames;
+    data = pa_xnew(int16_t, *n_frames * ss->channels);
+
+    for (i = 0; i < wav_frames; i++) {
+        const float *f = wav_data + i * wav_info.channels;
+
+        for (c = 0; c < ss->channels; c++) {
+            double v;
+
+            /* Down mix to mono, and play mono files on both channels */
+            if (ss->channels == 1 && wav_info.channels > 1)
+                v = (f[0] + f[1]) / 2;
+            else
+                v = f[PA_MIN(c, (unsigned) wav_info.channels - 1)];
+
+            data[i * ss->channels + c] = clip(v);
+        }
+    }
+
+    return data;
+}
+
+/* Finds the delay of the codec on the first channel, then returns the SNR
+ * over all channels of the aligned signals */
+static double round_trip_snr(const int16_t *input, size_t n_input, const int16_t *output, size_t n_output, unsigned channels) {
+    size_t delay = 0, lag, i, n;
+    double best = -1, signal = 0, noise = 0;
+
+    if (n_output <= MAX_CODEC_DELAY)
+        return 0;
+
+    n = PA_MIN(n_input, n_output - MAX_CODEC_DELAY);
+    n = PA_MIN(n, DELAY_SEARCH_FRAMES);
+
+    for (lag = 0; lag < MAX_CODEC_DELAY; lag++) {
+        double e = 0;
+
+        for (i = 0; i < n; i++) {
+            double d = (double) output[(i + lag) * channels] - input[i * channels];
+            e += d * d;
+        }
+
+        if (best < 0 || e < best) {
+            best = e;
+            delay = lag;
+        }
+    }
+
+    n = PA_MIN(n_input, n_output - delay);
+
+    for (i = 0; i < n * channels; i++) {
+        double d = (double) output[i + delay * channels] - input[i];
+
+        signal += (double) input[i] * input[i];
+        noise += d * d;
+    }
+
+    return 10 * log10(signal / PA_MAX(noise, 1e-9));
+}
+
+static void describe_configuration(const struct configuration *c, const pa_sample_spec *ss, char *buf, size_t length) {
+    char ss_buf[PA_SAMPLE_SPEC_SNPRINT_MAX];
+
+    pa_snprintf(buf, length, "%s %s", c->codec->name, pa_sample_spec_snprint(ss_buf, sizeof(ss_buf), ss));
+}
+
+START_TEST (codec_round_trip_test) {
+    const struct configuration *c = &configurations[_i];
+    const pa_a2dp_codec *codec = c->codec;
+    void *encoder, *decoder;
+    pa_sample_spec ss, decoder_ss;
+    int16_t *input, *output;
+    uint8_t packet[LINK_MTU];
+    size_t n_frames, frame_size, write_block, read_block, offset, n_output = 0;
+    uint64_t encoded_bytes = 0;
+    unsigned n_packets = 0;
+    uint32_t timestamp = 0;
+    pa_usec_t encode_time = 0;
+    char name[64 + PA_SAMPLE_SPEC_SNPRINT_MAX];
+    double snr, seconds;
+
+    fail_unless((encoder = codec->init(true, false, c->config, c->size, &ss)) != NULL);
+    fail_unless((decoder = codec->init(false, false, c->config, c->size, &decoder_ss)) != NULL);
+    fail_unless(pa_sample_spec_equal(&ss, &decoder_ss));
+
+    describe_configuration(c, &ss, name, sizeof(name));
+
+    if (wav_data)
+        input = convert_wav(&ss, &n_frames);
+    else
+        input = generate_signal(&ss, &n_frames);
+
+    if (!input) {
+        pa_log_info("%s: skipped, the WAV file has a different sample rate", name);
+        goto finish;
+    }
+
+    frame_size = pa_frame_size(&ss);
+    write_block = codec->get_write_block_size(encoder, LINK_MTU);
+    read_block = codec->get_read_block_size(decoder, LINK_MTU);
+
+    fail_unless(write_block > 0);
+    fail_unless(write_block % frame_size == 0);
+
+    output = pa_xmalloc(n_frames * frame_size + read_block);
+
+    for (offset = 0; offset + write_block <= n_frames * frame_size; ) {
+        size_t written, processed, decoded, decoder_processed;
+        pa_usec_t start;
+
+        start = pa_rtclock_now();
+        written = codec->encode_buffer(encoder, timestamp, (const uint8_t *) input + offset, write_block, packet, sizeof(packet), &processed);
+        encode_time += pa_rtclock_now() - start;
+
+        /* A write block must go out in one packet */
+        fail_unless(processed == write_block);
+        fail_unless(written > 0 && written <= sizeof(packet));
+
+        offset += processed;
+        timestamp += processed / frame_size;
+        encoded_bytes += written;
+        n_packets++;
+
+        decoded = codec->decode_buffer(decoder, packet, written, (uint8_t *) output + n_output * frame_size, read_block, &decoder_processed);
+        fail_unless(decoder_processed == written);
+        fail_unless(decoded % frame_size == 0);
+
+        n_output += decoded / frame_size;
+    }
+
+    fail_unless(n_packets > 0);
+
+    seconds = (double) timestamp / ss.rate;
+    snr = round_trip_snr(input, n_frames, output, n_output, ss.channels);
+
+    pa_log_info("%s: %0.2f us per packet of %0.2f ms, %0.1f kbit/s, SNR %0.1f dB",
+                name, (double) encode_time / n_packets, seconds * 1000 / n_packets,
+                encoded_bytes * 8 / seconds / 1000, snr);
+
+    if (!wav_data)
+        fail_unless(snr >= MIN_SNR_DB);
+
+    pa_xfree(output);
+    pa_xfree(input);
+
+finish:
+    codec->deinit(decoder);
+    codec->deinit(encoder);
+}
+END_TEST
+
+static int load_wav(const char *path) {
+    SNDFILE *f;
+
+    pa_zero(wav_info);
+
+    if (!(f = sf_open(path, SFM_READ, &wav_info))) {
+        pa_log_error("Failed to open %s: %s", path, sf_strerror(NULL));
+        return -1;
+    }
+
+    wav_data = pa_xnew(float, wav_info.frames * wav_info.channels);
+    wav_frames = sf_readf_float(f, wav_data, wav_info.frames);
+    sf_close(f);
+
+    if (wav_frames <= 0) {
+        pa_log_error("No audio in %s", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    if (argc > 1 && load_wav(argv[1]) < 0)
+        return EXIT_FAILURE;
+
+    collect_configurations();
+
+    s = suite_create("A2DP codecs");
+    tc = tcase_create("a2dpcodecs");
+    tcase_add_loop_test(tc, codec_round_trip_test, 0, n_configurations);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    pa_xfree(wav_data);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,347 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/cpu-x86.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <pulsecore/filter/biquad-cascade.h>
+#include <pulsecore/filter/crossover.h>
+
+#include "runtime-test-util.h"
+
+#define RATE 48000
+#define N_FRAMES 4801
+
+#define TIMES 10
+#define TIMES2 20
+
+static float *random_samples(unsigned n) {
+    float *data = pa_xnew(float, n);
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        data[i] = (float) rand() / RAND_MAX * 2 - 1;
+
+    return data;
+}
+
+/* The crossover of the LFE filter: a lowpass LR4 on the first channel, a
+ * highpass one on the others */
+static enum biquad_type channel_type(unsigned channel) {
+    return channel == 0 ? BQ_LOWPASS : BQ_HIGHPASS;
+}
+
+static pa_biquad_cascade *lr4_cascade_new(unsigned channels, float freq) {
+    pa_biquad_cascade *c;
+    struct biquad bq;
+    unsigned ch;
+
+    c = pa_biquad_cascade_new(channels, 2);
+
+    for (ch = 0; ch < channels; ch++) {
+        biquad_set(&bq, channel_type(ch), freq);
+        pa_biquad_cascade_set(c, 0, ch, &bq);
+        pa_biquad_cascade_set(c, 1, ch, &bq);
+    }
+
+    pa_biquad_cascade_commit(c, 0);
+
+    return c;
+}
+
+static void lr4_process(struct lr4 *lr4, float *data, unsigned channels, unsigned n_frames) {
+    unsigned ch;
+
+    for (ch = 0; ch < channels; ch++)
+        lr4_process_float32(&lr4[ch], n_frames, channels, &data[ch], &data[ch]);
+}
+
+static void check_lr4(unsigned channels) {
+    struct lr4 lr4[PA_CHANNELS_MAX];
+    pa_biquad_cascade *c;
+    float *input, *expected, *output;
+    unsigned ch, i, offset, n;
+
+    input = random_samples(N_FRAMES * channels);
+    expected = pa_xmemdup(input, N_FRAMES * channels * sizeof(float));
+    output = pa_xnew(float, N_FRAMES * channels);
+
+    for (ch = 0; ch < channels; ch++)
+        lr4_set(&lr4[ch], channel_type(ch), 0.01f);
+    lr4_process(lr4, expected, channels, N_FRAMES);
+
+    /* Feed the cascade in chunks of varying size */
+    c = lr4_cascade_new(channels, 0.01f);
+    for (offset = 0; offset < N_FRAMES; offset += n) {
+        n = PA_MIN(N_FRAMES - offset, (unsigned) rand() % 700 + 1);
+        pa_biquad_cascade_process_float32(c, output + offset * channels, input + offset * channels, n);
+    }
+
+    for (i = 0; i < N_FRAMES * channels; i++)
+        fail_unless(fabsf(output[i] - expected[i]) < 1e-4, "%u channels, sample %u: %f != %f", channels, i, output[i], expected[i]);
+
+    pa_biquad_cascade_free(c);
+    pa_xfree(output);
+    pa_xfree(expected);
+    pa_xfree(input);
+}
+
+START_TEST (biquad_cascade_lr4_test) {
+    check_lr4(1);
+    check_lr4(2);
+    check_lr4(6);
+    check_lr4(8);
+}
+END_TEST
+
+START_TEST (biquad_cascade_s16_test) {
+    pa_biquad_cascade *c;
+    int16_t input[N_FRAMES * 2], output[N_FRAMES * 2];
+    float reference[N_FRAMES * 2];
+    unsigned i;
+
+    for (i = 0; i < N_FRAMES * 2; i++) {
+        input[i] = (int16_t) (rand() - RAND_MAX / 2);
+        reference[i] = input[i];
+    }
+
+    c = lr4_cascade_new(2, 0.05f);
+    pa_biquad_cascade_process_float32(c, reference, reference, N_FRAMES);
+    pa_biquad_cascade_free(c);
+
+    c = lr4_cascade_new(2, 0.05f);
+    pa_biquad_cascade_process_s16(c, output, input, N_FRAMES);
+    pa_biquad_cascade_free(c);
+
+    for (i = 0; i < N_FRAMES * 2; i++)
+        fail_unless(abs(output[i] - (int) PA_CLAMP(lrintf(reference[i]), -0x8000, 0x7fff)) <= 1);
+}
+END_TEST
+
+/* A gain change is a step in the output of a DC input, unless it is ramped */
+START_TEST (biquad_cascade_ramp_test) {
+    struct biquad gain = { 0.25f, 0, 0, 0, 0 };
+    pa_biquad_cascade *c;
+    float data[1024];
+    float largest_step = 0;
+    unsigned i;
+
+    c = pa_biquad_cascade_new(1, 1);
+
+    for (i = 0; i < 1024; i++)
+        data[i] = 1;
+    pa_biquad_cascade_process_float32(c, data, data, 1024);
+    fail_unless(fabsf(data[1023] - 1) < 1e-6);
+
+    pa_biquad_cascade_set(c, 0, 0, &gain);
+    pa_biquad_cascade_commit(c, 512);
+
+    /* The ramp spans several calls */
+    for (i = 0; i < 1024; i++)
+        data[i] = 1;
+    pa_biquad_cascade_process_float32(c, data, data, 100);
+    pa_biquad_cascade_process_float32(c, data + 100, data + 100, 924);
+
+    for (i = 1; i < 1024; i++)
+        largest_step = PA_MAX(largest_step, fabsf(data[i] - data[i - 1]));
+
+    fail_unless(largest_step < 0.75f / 512 * 1.01f);
+    fail_unless(fabsf(data[512] - 0.25f) < 1e-4);
+    fail_unless(fabsf(data[1023] - 0.25f) < 1e-6);
+
+    pa_biquad_cascade_free(c);
+}
+END_TEST
+
+/* After an impulse, the state of a resonant filter decays towards zero. Without
+ * the offset, it would go through denormals. */
+START_TEST (biquad_cascade_denormal_test) {
+    pa_biquad_cascade *c;
+    struct biquad bq;
+    float data[4096 * 4];
+    unsigned i, j;
+
+    c = pa_biquad_cascade_new(4, 2);
+    biquad_set(&bq, BQ_HIGHPASS, 0.001);
+    for (i = 0; i < 4; i++) {
+        pa_biquad_cascade_set(c, 0, i, &bq);
+        pa_biquad_cascade_set(c, 1, i, &bq);
+    }
+    pa_biquad_cascade_commit(c, 0);
+
+    for (j = 0; j < 100; j++) {
+        memset(data, 0, sizeof(data));
+        if (j == 0)
+            data[0] = data[1] = data[2] = data[3] = 1e-30f;
+
+        pa_biquad_cascade_process_float32(c, data, data, 4096);
+
+        for (i = 0; i < 4096 * 4; i++)
+            fail_unless(fpclassify(data[i]) != FP_SUBNORMAL);
+    }
+
+    pa_biquad_cascade_free(c);
+}
+END_TEST
+
+/* Random, but stable, filters for each channel and stage */
+static void set_random_filters(pa_biquad_cascade *c, unsigned channels, unsigned n_stages) {
+    unsigned s, ch;
+
+    for (s = 0; s < n_stages; s++) {
+        for (ch = 0; ch < channels; ch++) {
+            struct biquad bq;
+
+            biquad_set(&bq, rand() % 2 ? BQ_LOWPASS : BQ_HIGHPASS, 0.01 + 0.9 * rand() / RAND_MAX);
+            pa_biquad_cascade_set(c, s, ch, &bq);
+        }
+    }
+}
+
+static void run_benchmark(pa_biquad_cascade_func_t func, pa_biquad_cascade_func_t orig_func, unsigned channels) {
+    struct lr4 lr4[PA_CHANNELS_MAX];
+    pa_biquad_cascade *c;
+    float *input, *data, *reference;
+    unsigned i, ch;
+
+    input = random_samples(RATE / 10 * channels);
+    data = pa_xnew(float, RATE / 10 * channels);
+    reference = pa_xnew(float, RATE / 10 * channels);
+
+    /* The same filters with both functions, changed half way with a ramp.
+     * A cascade uses the function set when it is created. */
+    srand(channels);
+    pa_set_biquad_cascade_func(orig_func);
+    c = pa_biquad_cascade_new(channels, 3);
+    set_random_filters(c, channels, 3);
+    pa_biquad_cascade_commit(c, 0);
+    pa_biquad_cascade_process_float32(c, reference, input, RATE / 20);
+    set_random_filters(c, channels, 3);
+    pa_biquad_cascade_commit(c, 1000);
+    pa_biquad_cascade_process_float32(c, reference + RATE / 20 * channels, input + RATE / 20 * channels, RATE / 20);
+    pa_biquad_cascade_free(c);
+
+    srand(channels);
+    pa_set_biquad_cascade_func(func);
+    c = pa_biquad_cascade_new(channels, 3);
+    set_random_filters(c, channels, 3);
+    pa_biquad_cascade_commit(c, 0);
+    pa_biquad_cascade_process_float32(c, data, input, RATE / 20);
+    set_random_filters(c, channels, 3);
+    pa_biquad_cascade_commit(c, 1000);
+    pa_biquad_cascade_process_float32(c, data + RATE / 20 * channels, input + RATE / 20 * channels, RATE / 20);
+    pa_biquad_cascade_free(c);
+
+    for (i = 0; i < RATE / 10 * channels; i++)
+        fail_unless(fabsf(data[i] - reference[i]) < 1e-5, "%u channels, sample %u: %f != %f", channels, i, data[i], reference[i]);
+
+    /* Then time the LFE filter crossover, for a tenth of a second */
+    pa_log_debug("Running LR4 on %u channels:", channels);
+
+    for (ch = 0; ch < channels; ch++)
+        lr4_set(&lr4[ch], channel_type(ch), 0.01f);
+    PA_RUNTIME_TEST_RUN_START("lr4", TIMES, TIMES2) {
+        memcpy(data, input, RATE / 10 * channels * sizeof(float));
+        lr4_process(lr4, data, channels, RATE / 10);
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_set_biquad_cascade_func(orig_func);
+    c = lr4_cascade_new(channels, 0.01f);
+    PA_RUNTIME_TEST_RUN_START("orig", TIMES, TIMES2) {
+        pa_biquad_cascade_process_float32(c, data, input, RATE / 10);
+    } PA_RUNTIME_TEST_RUN_STOP
+    pa_biquad_cascade_free(c);
+
+    pa_set_biquad_cascade_func(func);
+    c = lr4_cascade_new(channels, 0.01f);
+    PA_RUNTIME_TEST_RUN_START("func", TIMES, TIMES2) {
+        pa_biquad_cascade_process_float32(c, data, input, RATE / 10);
+    } PA_RUNTIME_TEST_RUN_STOP
+    pa_biquad_cascade_free(c);
+
+    pa_set_biquad_cascade_func(orig_func);
+
+    pa_xfree(reference);
+    pa_xfree(data);
+    pa_xfree(input);
+}
+
+#if defined (__i386__) || defined (__amd64__)
+START_TEST (biquad_cascade_sse_test) {
+    pa_cpu_x86_flag_t flags = 0;
+    pa_biquad_cascade_func_t func, orig_func;
+
+    pa_cpu_get_x86_flags(&flags);
+    if (!(flags & PA_CPU_X86_SSE)) {
+        pa_log_info("SSE not supported. Skipping");
+        return;
+    }
+
+    orig_func = pa_get_biquad_cascade_func();
+    pa_biquad_cascade_func_init_sse(flags);
+    func = pa_get_biquad_cascade_func();
+
+    pa_log_debug("Checking SSE biquad cascade");
+    run_benchmark(func, orig_func, 2);
+    run_benchmark(func, orig_func, 6);
+    run_benchmark(func, orig_func, 8);
+}
+END_TEST
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    srand(1);
+
+    s = suite_create("Biquad cascade");
+    tc = tcase_create("biquadcascade");
+    tcase_add_test(tc, biquad_cascade_lr4_test);
+    tcase_add_test(tc, biquad_cascade_s16_test);
+    tcase_add_test(tc, biquad_cascade_ramp_test);
+    tcase_add_test(tc, biquad_cascade_denormal_test);
+#if defined (__i386__) || defined (__amd64__)
+    tcase_add_test(tc, biquad_cascade_sse_test);
+#endif
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,222 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Combines NSINKS null sinks with module-combine-sink, plays a low
+ * latency stream into the combined sink and reports the number of
+ * underflows and how much CPU time each thread of the daemon spent. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/mainloop.h>
+
+#include <pulsecore/core-util.h>
+
+#include "stress-test-util.h"
+
+#define NSINKS 8
+#define SINK_NAME "combine-stress"
+#define SINE_HZ 440
+#define SAMPLE_HZ 48000
+#define LATENCY_MSEC 20
+#define DURATION_SEC 5
+
+static pa_stress_test_context ctx;
+static pa_stream *stream = NULL;
+
+static uint32_t modules[NSINKS + 1];
+static int n_modules_loaded = 0;
+static unsigned n_underflows = 0;
+static uint64_t n_frames = 0;
+
+static pa_stress_thread threads[PA_STRESS_MAX_THREADS];
+static unsigned n_threads = 0;
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_FLOAT32,
+    .rate = SAMPLE_HZ,
+    .channels = 2
+};
+
+/* Prints the CPU usage of every thread of the daemon since the values
+ * recorded in threads */
+static void print_thread_usage(void) {
+    pa_stress_thread now[PA_STRESS_MAX_THREADS];
+    unsigned i, j, n;
+
+    n = pa_stress_read_threads(ctx.daemon_pid, now, PA_ELEMENTSOF(now));
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n_threads; j++)
+            if (threads[j].tid == now[i].tid)
+                break;
+
+        fprintf(stderr, "  %-16s %6lu: %5.1f%%\n", now[i].name, now[i].tid,
+                pa_stress_cpu_percent(now[i].ticks - (j < n_threads ? threads[j].ticks : 0), DURATION_SEC));
+    }
+}
+
+static void unload_cb(pa_context *c, int success, void *userdata) {
+    if (--n_modules_loaded <= 0)
+        pa_context_disconnect(c);
+}
+
+static void finish(void) {
+    int i;
+
+    fprintf(stderr, "%llu frames played to %u sinks in %u s, %u underflows\n",
+            (unsigned long long) n_frames, NSINKS, DURATION_SEC, n_underflows);
+    fprintf(stderr, "Daemon CPU per thread:\n");
+    print_thread_usage();
+
+    pa_stream_disconnect(stream);
+
+    /* Unload the combine sink first */
+    for (i = NSINKS; i >= 0; i--)
+        pa_operation_unref(pa_context_unload_module(ctx.context, modules[i], unload_cb, NULL));
+}
+
+static void time_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    a->time_free(e);
+    finish();
+}
+
+static void underflow_cb(pa_stream *s, void *userdata) {
+    n_underflows++;
+}
+
+static void write_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    float *data;
+    size_t i, n;
+
+    fail_unless(pa_stream_begin_write(s, (void**) &data, &nbytes) == 0);
+
+    n = nbytes / pa_frame_size(&sample_spec);
+    for (i = 0; i < n; i++)
+        data[2*i] = data[2*i+1] = (float) sin(((double) (n_frames + i) / SAMPLE_HZ) * 2 * M_PI * SINE_HZ) / 2;
+
+    n_frames += n;
+
+    fail_unless(pa_stream_write(s, data, n * pa_frame_size(&sample_spec), NULL, 0, PA_SEEK_RELATIVE) == 0);
+}
+
+static void stream_state_callback(pa_stream *s, void *userdata) {
+    struct timeval tv;
+
+    if (pa_stress_stream_state(s) != PA_STREAM_READY)
+        return;
+
+    fprintf(stderr, "Stream ready, playing for %u s.\n", DURATION_SEC);
+
+    n_threads = pa_stress_read_threads(ctx.daemon_pid, threads, PA_ELEMENTSOF(threads));
+
+    pa_gettimeofday(&tv);
+    ctx.mainloop_api->time_new(ctx.mainloop_api, pa_timeval_add(&tv, DURATION_SEC * PA_USEC_PER_SEC), time_cb, NULL);
+}
+
+static void create_stream(pa_context *c) {
+    pa_buffer_attr attr;
+
+    memset(&attr, 0xff, sizeof(attr));
+    attr.tlength = (uint32_t) pa_usec_to_bytes(LATENCY_MSEC * PA_USEC_PER_MSEC, &sample_spec);
+
+    stream = pa_stream_new(c, "combine-stress", &sample_spec, NULL);
+    fail_unless(stream != NULL);
+
+    pa_stream_set_state_callback(stream, stream_state_callback, NULL);
+    pa_stream_set_write_callback(stream, write_cb, NULL);
+    pa_stream_set_underflow_callback(stream, underflow_cb, NULL);
+
+    fail_unless(pa_stream_connect_playback(stream, SINK_NAME, &attr, PA_STREAM_ADJUST_LATENCY, NULL, NULL) == 0);
+}
+
+static void load_cb(pa_context *c, uint32_t idx, void *userdata) {
+    fail_unless(idx != PA_INVALID_INDEX);
+
+    modules[n_modules_loaded++] = idx;
+
+    if (n_modules_loaded == NSINKS) {
+        char args[64 + NSINKS * 32];
+        size_t l;
+        int i;
+
+        l = pa_snprintf(args, sizeof(args), "sink_name=" SINK_NAME " slaves=");
+        for (i = 0; i < NSINKS; i++)
+            l += pa_snprintf(args + l, sizeof(args) - l, "%s" SINK_NAME "-%i", i > 0 ? "," : "", i);
+
+        pa_operation_unref(pa_context_load_module(c, "module-combine-sink", args, load_cb, NULL));
+    } else if (n_modules_loaded == NSINKS + 1)
+        create_stream(c);
+}
+
+static void context_ready(pa_context *c) {
+    int i;
+
+    for (i = 0; i < NSINKS; i++) {
+        char args[64];
+
+        pa_snprintf(args, sizeof(args), "sink_name=" SINK_NAME "-%i", i);
+        pa_operation_unref(pa_context_load_module(c, "module-null-sink", args, load_cb, NULL));
+    }
+}
+
+START_TEST (combine_stress_test) {
+    int ret;
+
+    pa_stress_test_init(&ctx);
+    ret = pa_stress_test_run(&ctx);
+
+    if (stream)
+        pa_stream_unref(stream);
+
+    pa_stress_test_deinit(&ctx);
+
+    fail_unless(ret == 0);
+    fail_unless(n_frames > 0);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    ctx.context_name = argv[0];
+    ctx.ready_cb = context_ready;
+
+    s = suite_create("Combine Stress");
+    tc = tcase_create("combinestress");
+    tcase_add_test(tc, combine_stress_test);
+    tcase_set_timeout(tc, DURATION_SEC + 30);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,331 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <pulsecore/filter/convolver.h>
+
+#include "runtime-test-util.h"
+
+/* 7.1 to binaural, as module-virtual-surround-sink does it */
+#define CHANNELS 8
+#define RATE 48000
+
+#define TIMES2 10
+
+/* Each input channel is filtered with one of the HRIR channels for each ear */
+static const unsigned mapping_left[CHANNELS] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+static const unsigned mapping_right[CHANNELS] = { 1, 0, 2, 3, 5, 4, 7, 6 };
+
+static float random_sample(void) {
+    return (float) rand() / RAND_MAX * 2 - 1;
+}
+
+static float *random_samples(unsigned n) {
+    float *data = pa_xnew(float, n);
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        data[i] = random_sample();
+
+    return data;
+}
+
+/* A decaying noise burst, like a measured impulse response */
+static float *generate_hrir(unsigned n_taps) {
+    float *hrir = random_samples(n_taps * CHANNELS);
+    unsigned i, j;
+
+    for (i = 0; i < n_taps; i++)
+        for (j = 0; j < CHANNELS; j++)
+            hrir[i * CHANNELS + j] *= expf(-5.0f * i / n_taps) / CHANNELS;
+
+    return hrir;
+}
+
+static pa_convolver *convolver_new(unsigned block_size, const float *hrir, unsigned n_taps) {
+    pa_convolver *c;
+    unsigned k;
+
+    c = pa_convolver_new(block_size, CHANNELS, 2, n_taps);
+
+    for (k = 0; k < CHANNELS; k++) {
+        pa_convolver_set_filter(c, k, 0, hrir + mapping_left[k], n_taps, CHANNELS);
+        pa_convolver_set_filter(c, k, 1, hrir + mapping_right[k], n_taps, CHANNELS);
+    }
+
+    return c;
+}
+
+/* The direct convolution module-virtual-surround-sink used to do */
+struct direct {
+    const float *hrir;
+    unsigned n_taps;
+    float *input_buffer;
+    int input_buffer_offset;
+};
+
+static void direct_process(struct direct *d, const float *src, float *dst, unsigned n) {
+    unsigned j, k, l;
+
+    for (l = 0; l < n; l++) {
+        float sum_left = 0, sum_right = 0;
+
+        memcpy(d->input_buffer + d->input_buffer_offset * CHANNELS, src + l * CHANNELS, CHANNELS * sizeof(float));
+
+        for (j = 0; j < d->n_taps; j++) {
+            for (k = 0; k < CHANNELS; k++) {
+                float current_sample = d->input_buffer[((d->input_buffer_offset + j) % d->n_taps) * CHANNELS + k];
+
+                sum_left += current_sample * d->hrir[j * CHANNELS + mapping_left[k]];
+                sum_right += current_sample * d->hrir[j * CHANNELS + mapping_right[k]];
+            }
+        }
+
+        dst[2 * l] = sum_left;
+        dst[2 * l + 1] = sum_right;
+
+        d->input_buffer_offset--;
+        if (d->input_buffer_offset < 0)
+            d->input_buffer_offset += d->n_taps;
+    }
+}
+
+/* Compares the output of the convolver to the one of the direct convolution,
+ * feeding both in chunks of varying size */
+static void check_against_direct(unsigned block_size, unsigned n_taps) {
+    unsigned n_frames = 4 * n_taps + 3 * block_size + 17;
+    float *hrir, *input, *expected, *output;
+    struct direct d;
+    pa_convolver *c;
+    unsigned latency, offset, i;
+    double error = 0, power = 0;
+
+    hrir = generate_hrir(n_taps);
+    input = random_samples(n_frames * CHANNELS);
+    expected = pa_xnew(float, n_frames * 2);
+    output = pa_xnew(float, n_frames * 2);
+
+    d.hrir = hrir;
+    d.n_taps = n_taps;
+    d.input_buffer = pa_xnew0(float, n_taps * CHANNELS);
+    d.input_buffer_offset = 0;
+    direct_process(&d, input, expected, n_frames);
+
+    c = convolver_new(block_size, hrir, n_taps);
+    latency = pa_convolver_get_latency(c);
+
+    for (offset = 0; offset < n_frames; ) {
+        unsigned n = PA_MIN(n_frames - offset, (unsigned) rand() % (2 * block_size) + 1);
+
+        pa_convolver_process(c, input + offset * CHANNELS, output + offset * 2, n);
+        offset += n;
+    }
+
+    for (i = 0; i < latency * 2; i++)
+        fail_unless(output[i] == 0);
+
+    for (i = latency * 2; i < n_frames * 2; i++) {
+        double e = output[i] - expected[i - latency * 2];
+
+        error += e * e;
+        power += (double) expected[i - latency * 2] * expected[i - latency * 2];
+    }
+
+    pa_log_debug("Block size %u, %u taps: error %0.1f dB", block_size, n_taps, 10 * log10(error / power));
+    fail_unless(error < power * 1e-9);
+
+    pa_convolver_free(c);
+    pa_xfree(d.input_buffer);
+    pa_xfree(output);
+    pa_xfree(expected);
+    pa_xfree(input);
+    pa_xfree(hrir);
+}
+
+START_TEST (convolver_direct_test) {
+    check_against_direct(2, 1);
+    check_against_direct(4, 3);
+    check_against_direct(64, 64);
+    check_against_direct(64, 100);
+    check_against_direct(128, 512);
+    check_against_direct(256, 2000);
+}
+END_TEST
+
+START_TEST (convolver_reset_test) {
+    float taps[1] = { 1 };
+    float input[64 * 2], output[64];
+    pa_convolver *c;
+    unsigned i;
+
+    c = pa_convolver_new(16, 2, 1, 1);
+    pa_convolver_set_filter(c, 1, 0, taps, 1, 1);
+
+    for (i = 0; i < 64; i++) {
+        input[2 * i] = 0.5f;
+        input[2 * i + 1] = (float) i;
+    }
+
+    /* A single tap on the second input delays it by the latency */
+    pa_convolver_process(c, input, output, 64);
+    for (i = 16; i < 64; i++)
+        fail_unless(fabsf(output[i] - (i - 16)) < 1e-3);
+
+    /* After a reset, the output starts over with silence */
+    pa_convolver_process(c, input, output, 5);
+    pa_convolver_reset(c);
+    pa_convolver_process(c, input, output, 64);
+    for (i = 0; i < 16; i++)
+        fail_unless(output[i] == 0);
+    for (i = 16; i < 64; i++)
+        fail_unless(fabsf(output[i] - (i - 16)) < 1e-3);
+
+    pa_convolver_free(c);
+}
+END_TEST
+
+/* Rewinds by varying amounts and checks that processing the same input
+ * again gives the same output as the first time */
+START_TEST (convolver_rewind_test) {
+    unsigned block_size = 64, n_taps = 300, max_rewind = 1000, n_frames = 4000;
+    float *hrir, *input, *expected, *output;
+    unsigned offset, i, k;
+    pa_convolver *c;
+
+    hrir = generate_hrir(n_taps);
+    input = random_samples(n_frames * CHANNELS);
+    expected = pa_xnew(float, n_frames * 2);
+    output = pa_xnew(float, n_frames * 2);
+
+    c = convolver_new(block_size, hrir, n_taps);
+    pa_convolver_process(c, input, expected, n_frames);
+    pa_convolver_free(c);
+
+    c = convolver_new(block_size, hrir, n_taps);
+    pa_convolver_set_max_rewind(c, max_rewind);
+
+    for (offset = 0, k = 0; offset < n_frames; k++) {
+        unsigned n = PA_MIN(n_frames - offset, (unsigned) rand() % (3 * block_size) + 1);
+
+        pa_convolver_process(c, input + offset * CHANNELS, output + offset * 2, n);
+        offset += n;
+
+        /* Rewind often by a little, sometimes by as much as possible, and
+         * once by more than was processed */
+        if (k % 4 == 0) {
+            unsigned r = k % 20 == 0 ? max_rewind : (unsigned) rand() % (2 * block_size + 1);
+
+            pa_convolver_rewind(c, r);
+            offset = r > offset ? 0 : offset - r;
+        }
+    }
+
+    for (i = 0; i < n_frames * 2; i++)
+        fail_unless(fabsf(output[i] - expected[i]) < 1e-6f);
+
+    pa_convolver_free(c);
+    pa_xfree(output);
+    pa_xfree(expected);
+    pa_xfree(input);
+    pa_xfree(hrir);
+}
+END_TEST
+
+/* Processes one second of 7.1 input with both implementations */
+static void run_benchmark(unsigned n_taps, unsigned block_size) {
+    float *hrir, *input, *output;
+    struct direct d;
+    pa_convolver *c;
+    char label[64];
+
+    hrir = generate_hrir(n_taps);
+    input = random_samples(RATE * CHANNELS);
+    output = pa_xnew(float, RATE * 2);
+
+    pa_log_debug("Processing one second of %u channels with %u taps:", CHANNELS, n_taps);
+
+    c = convolver_new(block_size, hrir, n_taps);
+    pa_snprintf(label, sizeof(label), "convolver, blocks of %u", block_size);
+    PA_RUNTIME_TEST_RUN_START(label, 1, TIMES2) {
+        pa_convolver_process(c, input, output, RATE);
+    } PA_RUNTIME_TEST_RUN_STOP
+    pa_convolver_free(c);
+
+    /* The direct convolution is too slow to run as often for long filters */
+    d.hrir = hrir;
+    d.n_taps = n_taps;
+    d.input_buffer = pa_xnew0(float, n_taps * CHANNELS);
+    d.input_buffer_offset = 0;
+    PA_RUNTIME_TEST_RUN_START("direct", 1, n_taps > 256 ? 1 : TIMES2) {
+        direct_process(&d, input, output, RATE);
+    } PA_RUNTIME_TEST_RUN_STOP
+    pa_xfree(d.input_buffer);
+
+    pa_xfree(output);
+    pa_xfree(input);
+    pa_xfree(hrir);
+}
+
+START_TEST (convolver_benchmark_test) {
+    run_benchmark(64, 64);
+    run_benchmark(512, 128);
+    run_benchmark(512, 256);
+    run_benchmark(2048, 256);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    srand(1);
+
+    s = suite_create("Convolver");
+    tc = tcase_create("convolver");
+    tcase_add_test(tc, convolver_direct_test);
+    tcase_add_test(tc, convolver_reset_test);
+    tcase_add_test(tc, convolver_rewind_test);
+    tcase_add_test(tc, convolver_benchmark_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
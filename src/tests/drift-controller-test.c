@@ -0,0 +1,173 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/drift-controller.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define BASE_RATE 48000
+#define SIM_STEP_USEC 1000
+#define SIM_DURATION_SEC 120
+#define STEADY_STATE_SEC 60
+
+struct scenario {
+    const char *name;
+    double drift;           /* relative rate deviation of the producer */
+    double initial_error;   /* s */
+    double noise;           /* peak measurement noise, s */
+    pa_usec_t adjust_time;
+    double max_convergence; /* s */
+    double max_error;       /* s */
+};
+
+/* Simulates a buffer that is filled by a producer whose clock runs at
+ * BASE_RATE * (1 + drift) and drained at the rate set by the controller.
+ * The latency is measured every adjust_time, with uniformly distributed
+ * noise added. Returns the time after which the error stayed within
+ * max_error, and the mean and maximum absolute error in steady state. */
+static double simulate(const struct scenario *s, double *mean_error, double *max_error) {
+    pa_drift_controller *c;
+    double error = s->initial_error, sum = 0, converged = -1;
+    pa_usec_t t, next_update = 0;
+    uint32_t rate = BASE_RATE, seed = 1;
+    unsigned n = 0;
+
+    c = pa_drift_controller_new(s->adjust_time, 0.01);
+    *max_error = 0;
+
+    for (t = 0; t < SIM_DURATION_SEC * PA_USEC_PER_SEC; t += SIM_STEP_USEC) {
+        error += (s->drift - ((double) rate / BASE_RATE - 1)) * SIM_STEP_USEC / PA_USEC_PER_SEC;
+
+        if (t >= next_update) {
+            double measured;
+
+            /* Deterministic pseudo random noise */
+            seed = seed * 1103515245 + 12345;
+            measured = error + s->noise * (((seed >> 16) & 0x7fff) / 16383.5 - 1);
+
+            rate = pa_drift_controller_update(c, t, (int64_t) (measured * PA_USEC_PER_SEC), BASE_RATE);
+            next_update += s->adjust_time;
+        }
+
+        if (fabs(error) > s->max_error)
+            converged = -1;
+        else if (converged < 0)
+            converged = (double) t / PA_USEC_PER_SEC;
+
+        if (t >= (SIM_DURATION_SEC - STEADY_STATE_SEC) * PA_USEC_PER_SEC) {
+            sum += fabs(error);
+            *max_error = PA_MAX(*max_error, fabs(error));
+            n++;
+        }
+    }
+
+    *mean_error = sum / n;
+
+    pa_log_debug("%s: drift estimated as %0.1f ppm, is %0.1f ppm", s->name,
+                 pa_drift_controller_get_drift(c) * 1e6, s->drift * 1e6);
+
+    pa_drift_controller_free(c);
+
+    return converged;
+}
+
+static const struct scenario scenarios[] = {
+    { "small drift",     0.0003,  0.020, 0,      500 * PA_USEC_PER_MSEC, 15, 0.0005 },
+    { "large drift",     0.008,   0,     0,      500 * PA_USEC_PER_MSEC, 25, 0.0005 },
+    { "negative drift", -0.005,   0.050, 0,      500 * PA_USEC_PER_MSEC, 25, 0.0005 },
+    { "noisy",           0.001,   0.020, 0.002,  500 * PA_USEC_PER_MSEC, 30, 0.0025 },
+    { "very noisy",     -0.002,   0.100, 0.005,  500 * PA_USEC_PER_MSEC, 40, 0.0060 },
+    { "fast updates",    0.0005,  0.010, 0.001,  100 * PA_USEC_PER_MSEC, 10, 0.0015 },
+    { "slow updates",    0.0005,  0.010, 0.001, 2000 * PA_USEC_PER_MSEC, 60, 0.0015 },
+};
+
+START_TEST (drift_controller_convergence_test) {
+    const struct scenario *s = &scenarios[_i];
+    double converged, mean_error, max_error;
+
+    converged = simulate(s, &mean_error, &max_error);
+
+    pa_log_debug("%s: converged after %0.1f s, steady state error %0.3f ms mean, %0.3f ms max", s->name,
+                 converged, mean_error * PA_MSEC_PER_SEC, max_error * PA_MSEC_PER_SEC);
+
+    fail_unless(converged >= 0);
+    fail_unless(converged <= s->max_convergence);
+    fail_unless(max_error <= s->max_error);
+    fail_unless(mean_error <= s->max_error / 2);
+}
+END_TEST
+
+START_TEST (drift_controller_limit_test) {
+    pa_drift_controller *c;
+    uint32_t rate;
+    unsigned i;
+
+    /* The rate never leaves the allowed range, and a long saturation does
+     * not wind up the integral */
+    c = pa_drift_controller_new(PA_USEC_PER_SEC, 0.01);
+
+    for (i = 0; i < 100; i++) {
+        rate = pa_drift_controller_update(c, i * PA_USEC_PER_SEC, PA_USEC_PER_SEC, BASE_RATE);
+        fail_unless(rate <= BASE_RATE * 1.01 + 1);
+    }
+
+    rate = pa_drift_controller_update(c, i * PA_USEC_PER_SEC, -(int64_t) PA_USEC_PER_SEC, BASE_RATE);
+    fail_unless(rate >= BASE_RATE * 0.99 - 1);
+
+    /* After a suspend the filter starts over at the new value */
+    pa_drift_controller_reset(c, true);
+    fail_unless(pa_drift_controller_get_drift(c) == 0);
+
+    rate = pa_drift_controller_update(c, 1000 * PA_USEC_PER_SEC, 0, BASE_RATE);
+    fail_unless(rate == BASE_RATE);
+
+    pa_drift_controller_free(c);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Drift Controller");
+    tc = tcase_create("driftcontroller");
+    tcase_add_loop_test(tc, drift_controller_convergence_test, 0, PA_ELEMENTSOF(scenarios));
+    tcase_add_test(tc, drift_controller_limit_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
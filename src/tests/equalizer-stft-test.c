@@ -0,0 +1,270 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <fftw3.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "../modules/equalizer-stft.h"
+
+#include "runtime-test-util.h"
+
+/* As in module-equalizer-sink at 48 kHz */
+#define RATE 48000
+#define FFT_SIZE 65536
+#define WINDOW_SIZE 15999
+#define HOP_SIZE ((WINDOW_SIZE + 1) / 2)
+#define FILTER_SIZE (FFT_SIZE / 2 + 1)
+
+#define MAX_CHANNELS 8
+#define TIMES2 5
+
+struct filters {
+    unsigned channels;
+    pa_aupdate *a_H[MAX_CHANNELS];
+    float *X[MAX_CHANNELS];
+    float **H[MAX_CHANNELS];
+};
+
+/* Random magnitude responses, or all pass ones */
+static void filters_init(struct filters *f, unsigned channels, bool flat) {
+    unsigned c, i, j;
+
+    f->channels = channels;
+
+    for (c = 0; c < channels; c++) {
+        f->a_H[c] = pa_aupdate_new();
+        f->X[c] = pa_xnew(float, 2);
+        f->H[c] = pa_xnew(float *, 2);
+
+        for (i = 0; i < 2; i++) {
+            f->X[c][i] = flat ? 1.0f : 0.5f;
+            f->H[c][i] = fftwf_malloc(FILTER_SIZE * sizeof(float));
+
+            for (j = 0; j < FILTER_SIZE; j++)
+                f->H[c][i][j] = (flat ? 1.0f : (float) rand() / RAND_MAX) / FFT_SIZE;
+        }
+    }
+}
+
+static void filters_done(struct filters *f) {
+    unsigned c;
+
+    for (c = 0; c < f->channels; c++) {
+        fftwf_free(f->H[c][0]);
+        fftwf_free(f->H[c][1]);
+        pa_xfree(f->H[c]);
+        pa_xfree(f->X[c]);
+        pa_aupdate_free(f->a_H[c]);
+    }
+}
+
+/* Feeds n_frames interleaved frames to the filter the way the module does,
+ * a few hops at a time, and returns the output */
+static float *run_filter(pa_eq_stft *s, unsigned channels, const float *src, unsigned n_frames) {
+    size_t R = pa_eq_stft_get_hop_size(s);
+    size_t overlap_size = pa_eq_stft_get_overlap_size(s);
+    size_t n_gathered = 0, in = 0, out = 0, max_hops = 3;
+    float *input[MAX_CHANNELS], *overlap[MAX_CHANNELS];
+    float *dst = pa_xnew0(float, n_frames * channels);
+    unsigned c;
+
+    for (c = 0; c < channels; c++) {
+        input[c] = pa_xnew0(float, overlap_size + max_hops * R);
+        overlap[c] = pa_xnew0(float, overlap_size);
+    }
+
+    while (out + R <= n_frames) {
+        size_t n_hops = PA_MIN((size_t) rand() % max_hops + 1, (n_frames - out) / R);
+        size_t n = overlap_size + n_hops * R - n_gathered;
+
+        /* Past the end of the input, there is silence */
+        for (c = 0; c < channels; c++)
+            for (size_t j = 0; j < n; j++)
+                input[c][n_gathered + j] = in + j < n_frames ? src[(in + j) * channels + c] : 0;
+
+        pa_eq_stft_process(s, input, overlap, n_gathered + n, n_hops, out == 0, dst + out * channels);
+
+        in += n;
+        out += n_hops * R;
+        n_gathered = overlap_size;
+    }
+
+    for (c = 0; c < channels; c++) {
+        pa_xfree(input[c]);
+        pa_xfree(overlap[c]);
+    }
+
+    return dst;
+}
+
+static float *random_samples(unsigned n) {
+    float *data = pa_xnew(float, n);
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        data[i] = ((float) rand() / RAND_MAX * 2 - 1) * 0.5f;
+
+    return data;
+}
+
+/* With an all pass filter, the windows add up to the input */
+START_TEST (equalizer_stft_reconstruction_test) {
+    unsigned channels = 3, n_frames = 20 * HOP_SIZE, i;
+    struct filters f;
+    pa_eq_stft *s;
+    float *src, *dst;
+    double max_error = 0;
+
+    filters_init(&f, channels, true);
+    s = pa_eq_stft_new(channels, FFT_SIZE, WINDOW_SIZE, 2, 0, f.a_H, f.X, f.H);
+
+    src = random_samples(n_frames * channels);
+    dst = run_filter(s, channels, src, n_frames);
+
+    /* Undoing the window of the first hop amplifies the rounding errors */
+    for (i = HOP_SIZE * channels; i < n_frames * channels; i++)
+        max_error = PA_MAX(max_error, fabs(dst[i] - src[i]));
+
+    pa_log_debug("Maximum reconstruction error: %g", max_error);
+    fail_unless(max_error < 1e-5);
+
+    pa_xfree(dst);
+    pa_xfree(src);
+    pa_eq_stft_free(s);
+    filters_done(&f);
+}
+END_TEST
+
+/* The channels come out the same whatever thread filters them */
+START_TEST (equalizer_stft_threads_test) {
+    unsigned channels = 6, n_frames = 12 * HOP_SIZE;
+    struct filters f;
+    pa_eq_stft *s;
+    float *src, *dst1, *dst3;
+    unsigned seed = rand();
+
+    filters_init(&f, channels, false);
+    src = random_samples(n_frames * channels);
+
+    s = pa_eq_stft_new(channels, FFT_SIZE, WINDOW_SIZE, 1, 0, f.a_H, f.X, f.H);
+    srand(seed);
+    dst1 = run_filter(s, channels, src, n_frames);
+    pa_eq_stft_free(s);
+
+    s = pa_eq_stft_new(channels, FFT_SIZE, WINDOW_SIZE, 4, 0, f.a_H, f.X, f.H);
+    srand(seed);
+    dst3 = run_filter(s, channels, src, n_frames);
+    pa_eq_stft_free(s);
+
+    fail_unless(memcmp(dst1, dst3, n_frames * channels * sizeof(float)) == 0);
+
+    pa_xfree(dst3);
+    pa_xfree(dst1);
+    pa_xfree(src);
+    filters_done(&f);
+}
+END_TEST
+
+/* Filters one second of audio at a time */
+static void run_benchmark(unsigned channels) {
+    struct filters f;
+    pa_eq_stft *s;
+    size_t R, overlap_size, n_hops;
+    float *input[MAX_CHANNELS], *overlap[MAX_CHANNELS], *dst;
+    unsigned n_threads, c;
+    char label[64];
+
+    filters_init(&f, channels, false);
+
+    pa_log_debug("Filtering one second of %u channels:", channels);
+
+    for (n_threads = 1; n_threads <= PA_MIN(channels, 4U); n_threads *= 2) {
+        s = pa_eq_stft_new(channels, FFT_SIZE, WINDOW_SIZE, n_threads, 0, f.a_H, f.X, f.H);
+        R = pa_eq_stft_get_hop_size(s);
+        overlap_size = pa_eq_stft_get_overlap_size(s);
+        n_hops = (RATE + R - 1) / R;
+
+        for (c = 0; c < channels; c++) {
+            input[c] = random_samples(overlap_size + n_hops * R);
+            overlap[c] = pa_xnew0(float, overlap_size);
+        }
+        dst = pa_xnew(float, n_hops * R * channels);
+
+        pa_snprintf(label, sizeof(label), "%u threads", n_threads);
+        PA_RUNTIME_TEST_RUN_START(label, 1, TIMES2) {
+            pa_eq_stft_process(s, input, overlap, overlap_size + n_hops * R, n_hops, false, dst);
+        } PA_RUNTIME_TEST_RUN_STOP
+
+        pa_xfree(dst);
+        for (c = 0; c < channels; c++) {
+            pa_xfree(input[c]);
+            pa_xfree(overlap[c]);
+        }
+        pa_eq_stft_free(s);
+    }
+
+    filters_done(&f);
+}
+
+START_TEST (equalizer_stft_benchmark_test) {
+    run_benchmark(2);
+    run_benchmark(6);
+    run_benchmark(8);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    srand(1);
+
+    s = suite_create("Equalizer STFT");
+    tc = tcase_create("equalizer-stft");
+    tcase_add_test(tc, equalizer_stft_reconstruction_test);
+    tcase_add_test(tc, equalizer_stft_threads_test);
+    tcase_add_test(tc, equalizer_stft_benchmark_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,294 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Drives the pop and rewind paths of the filter sink against a stubbed sink
+ * and master. The sink renders a ramp, so that every frame tells where it
+ * came from, and the filter keeps the first channels of each frame. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* The callbacks under test are static */
+#include <pulsecore/filter-sink.c>
+
+/* Longer than any pop, so that the sink renders in several pieces */
+#define RENDER_MAX_FRAMES 37
+#define REWIND_FRAMES 50
+#define MAX_REWIND_FRAMES 10000
+
+struct scenario {
+    const char *name;
+    unsigned sink_channels;
+    unsigned input_channels;
+    unsigned block_frames;
+    bool in_place;
+};
+
+static const struct scenario scenarios[] = {
+    { "in place", 2, 2, 0, true },
+    { "queued", 2, 2, 0, false },
+    { "6 to 2 channels", 6, 2, 0, false },
+    { "blocks of 64", 2, 2, 64, false },
+    { "blocks of 48, 6 to 2 channels", 6, 2, 48, false },
+};
+
+static pa_core core;
+
+/* The frame the stubbed sink renders next */
+static int64_t render_pos;
+/* The first frame process() should get next, or -1 after a reset */
+static int64_t process_pos;
+static unsigned n_resets;
+static unsigned max_rewind_frames;
+
+/* The sink stubs. These take the place of the ones in libpulsecore. */
+
+static void render_ramp(pa_sink *s, pa_memchunk *chunk) {
+    float *p;
+    size_t k, n;
+    unsigned c;
+
+    n = chunk->length / pa_frame_size(&s->sample_spec);
+    p = pa_memblock_acquire_chunk(chunk);
+
+    for (k = 0; k < n; k++, render_pos++)
+        for (c = 0; c < s->sample_spec.channels; c++)
+            *p++ = (float) render_pos + 0.25f * c;
+
+    pa_memblock_release(chunk->memblock);
+}
+
+void pa_sink_render(pa_sink *s, size_t length, pa_memchunk *result) {
+    /* Render odd sizes, like a sink with several inputs may */
+    result->index = 0;
+    result->length = PA_MIN(length, RENDER_MAX_FRAMES * pa_frame_size(&s->sample_spec));
+    result->memblock = pa_memblock_new(core.mempool, result->length);
+
+    render_ramp(s, result);
+}
+
+void pa_sink_render_into_full(pa_sink *s, pa_memchunk *target) {
+    render_ramp(s, target);
+}
+
+void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
+    render_pos -= nbytes / pa_frame_size(&s->sample_spec);
+}
+
+void pa_sink_set_max_rewind_within_thread(pa_sink *s, size_t max_rewind) {
+}
+
+/* The filter */
+
+static void filter_process(pa_filter_sink *f, const void *src, void *dst, unsigned n) {
+    const struct scenario *sc = f->userdata;
+    const float *s = src;
+    float *d = dst;
+    unsigned k;
+
+    if (sc->block_frames > 0)
+        fail_unless(n % sc->block_frames == 0);
+
+    for (k = 0; k < n; k++) {
+        /* Filters that are only reset see the queued input again after a
+         * rewind, those that rewind must be told where they are */
+        if (f->rewind && process_pos >= 0)
+            fail_unless(s[k * sc->sink_channels] == (float) process_pos,
+                        "%s: process() got frame %0.0f, expected %lli", sc->name, s[k * sc->sink_channels], (long long) process_pos);
+
+        process_pos = (int64_t) s[k * sc->sink_channels] + 1;
+        memmove(d + k * sc->input_channels, s + k * sc->sink_channels, sc->input_channels * sizeof(float));
+    }
+}
+
+static void filter_reset(pa_filter_sink *f) {
+    n_resets++;
+    process_pos = -1;
+}
+
+static void filter_rewind(pa_filter_sink *f, unsigned n) {
+    process_pos -= n;
+}
+
+static void filter_update_max_rewind(pa_filter_sink *f, unsigned n) {
+    max_rewind_frames = n;
+}
+
+/* Sets up a filter sink like pa_filter_sink_new() does, on stubbed objects */
+static pa_filter_sink *filter_sink_new(const struct scenario *sc, bool rewind) {
+    pa_filter_sink *f;
+    pa_memchunk silence;
+
+    f = pa_xnew0(pa_filter_sink, 1);
+
+    f->sink = pa_msgobject_new(pa_sink);
+    f->sink->core = &core;
+    f->sink->sample_spec.format = PA_SAMPLE_FLOAT32NE;
+    f->sink->sample_spec.rate = 48000;
+    f->sink->sample_spec.channels = sc->sink_channels;
+    f->sink->thread_info.state = PA_SINK_RUNNING;
+
+    f->sink_input = pa_msgobject_new(pa_sink_input);
+    f->sink_input->sink = f->sink;
+    f->sink_input->sample_spec = f->sink->sample_spec;
+    f->sink_input->sample_spec.channels = sc->input_channels;
+    f->sink_input->userdata = f;
+
+    f->sink_fs = pa_frame_size(&f->sink->sample_spec);
+    f->fs = pa_frame_size(&f->sink_input->sample_spec);
+    f->block_size = sc->block_frames * f->sink_fs;
+    f->max_length = (sc->block_frames > 0 ? PA_ROUND_DOWN(1000, sc->block_frames) : 1000) * f->sink_fs;
+    f->in_place = sc->in_place;
+
+    if (!f->in_place) {
+        pa_silence_memchunk_get(&core.silence_cache, core.mempool, &silence, &f->sink->sample_spec, 0);
+        f->memblockq = pa_memblockq_new("filter-sink-test memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0, &f->sink->sample_spec, 1, 1, 0, &silence);
+        pa_memblock_unref(silence.memblock);
+    }
+
+    f->process = filter_process;
+    if (rewind) {
+        f->rewind = filter_rewind;
+        f->update_max_rewind = filter_update_max_rewind;
+    } else
+        f->reset = filter_reset;
+    f->userdata = (void *) sc;
+
+    render_pos = 0;
+    process_pos = -1;
+    n_resets = 0;
+    max_rewind_frames = 0;
+
+    sink_input_update_max_rewind_cb(f->sink_input, MAX_REWIND_FRAMES * f->fs);
+
+    return f;
+}
+
+static void filter_sink_free(pa_filter_sink *f) {
+    if (f->memblockq)
+        pa_memblockq_free(f->memblockq);
+
+    pa_xfree(f->sink_input);
+    pa_xfree(f->sink);
+    pa_xfree(f);
+}
+
+/* Pops odd sizes and checks that the output follows the ramp. Rewinds
+ * REWIND_FRAMES frames in between, rewriting none, some or as much of the
+ * queue as there is, and checks that the output starts again from there. */
+static void run_scenario(const struct scenario *sc, bool rewind) {
+    static const size_t sizes[] = { 1, 7, 100, 4096, 3, 333 };
+    pa_filter_sink *f;
+    int64_t out = 0;
+    unsigned k, r;
+
+    f = filter_sink_new(sc, rewind);
+
+    if (rewind)
+        fail_unless(max_rewind_frames == MAX_REWIND_FRAMES);
+
+    for (r = 0; r < 3; r++) {
+        size_t rewrite;
+
+        for (k = 0; k < PA_ELEMENTSOF(sizes); k++) {
+            pa_memchunk chunk;
+            const float *p;
+            size_t n, j;
+
+            fail_unless(sink_input_pop_cb(f->sink_input, sizes[k] * f->fs, &chunk) == 0);
+            n = chunk.length / f->fs;
+
+            /* Blocks may come out larger than asked for */
+            if (sc->block_frames == 0)
+                fail_unless(n <= sizes[k]);
+
+            p = pa_memblock_acquire_chunk(&chunk);
+            for (j = 0; j < n; j++, out++) {
+                fail_unless(p[j * sc->input_channels] == (float) out,
+                            "%s: output frame %lli is %0.2f", sc->name, (long long) out, p[j * sc->input_channels]);
+                fail_unless(p[j * sc->input_channels + 1] == (float) out + 0.25f);
+            }
+            pa_memblock_release(chunk.memblock);
+            pa_memblock_unref(chunk.memblock);
+        }
+
+        /* Without a queue, whatever the master rewinds must be rendered
+         * again */
+        if (sc->in_place)
+            rewrite = REWIND_FRAMES;
+        else
+            rewrite = r == 0 ? 0 : r == 1 ? REWIND_FRAMES : MAX_REWIND_FRAMES;
+
+        f->sink->thread_info.rewind_nbytes = rewrite * f->sink_fs;
+        sink_input_process_rewind_cb(f->sink_input, REWIND_FRAMES * f->fs);
+        out -= REWIND_FRAMES;
+
+        /* The filter is only reset when its input is rewritten */
+        fail_unless(n_resets == (!rewind && rewrite > 0 ? 1U : 0U));
+        n_resets = 0;
+    }
+
+    filter_sink_free(f);
+}
+
+START_TEST (filter_sink_reset_test) {
+    run_scenario(&scenarios[_i], false);
+}
+END_TEST
+
+START_TEST (filter_sink_rewind_test) {
+    run_scenario(&scenarios[_i], true);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(core.mempool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true));
+    pa_silence_cache_init(&core.silence_cache);
+
+    s = suite_create("Filter Sink");
+    tc = tcase_create("filtersink");
+    tcase_add_loop_test(tc, filter_sink_reset_test, 0, PA_ELEMENTSOF(scenarios));
+    tcase_add_loop_test(tc, filter_sink_rewind_test, 0, PA_ELEMENTSOF(scenarios));
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    pa_silence_cache_done(&core.silence_cache);
+    pa_mempool_unref(core.mempool);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
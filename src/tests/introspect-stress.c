@@ -0,0 +1,249 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Creates NSTREAMS corked playback streams and lists them with
+ * pa_context_get_sink_input_info_list() LISTS_PER_SEC times per second,
+ * reporting the round trip time of a listing and the CPU time spent by
+ * the client and by the daemon's main thread. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include <check.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/mainloop.h>
+
+#include <pulsecore/core-util.h>
+
+#include "stress-test-util.h"
+
+/* Stay below PA_MAX_INPUTS_PER_SINK on each sink */
+#define NSINKS 2
+#define NSTREAMS 500
+#define LISTS_PER_SEC 100
+#define DURATION_SEC 5
+#define SAMPLE_HZ 44100
+
+static pa_stress_test_context ctx;
+static pa_stream *streams[NSTREAMS];
+static uint32_t modules[NSINKS];
+
+static int n_modules_loaded = 0, n_streams_ready = 0;
+static unsigned n_ticks = 0, n_lists = 0, n_skipped = 0, n_entries = 0;
+static bool list_pending = false;
+static pa_usec_t list_started, rtt_sum = 0, rtt_max = 0;
+static unsigned long daemon_ticks;
+static struct rusage client_usage;
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = SAMPLE_HZ,
+    .channels = 2
+};
+
+static unsigned long read_daemon_main_thread_ticks(void) {
+    pa_stress_thread threads[PA_STRESS_MAX_THREADS];
+    unsigned i, n;
+
+    n = pa_stress_read_threads(ctx.daemon_pid, threads, PA_ELEMENTSOF(threads));
+    for (i = 0; i < n; i++)
+        if ((pid_t) threads[i].tid == ctx.daemon_pid)
+            return threads[i].ticks;
+
+    return 0;
+}
+
+static double rusage_sec(const struct rusage *r) {
+    return r->ru_utime.tv_sec + r->ru_stime.tv_sec + (r->ru_utime.tv_usec + r->ru_stime.tv_usec) / 1000000.0;
+}
+
+static void unload_cb(pa_context *c, int success, void *userdata) {
+    if (--n_modules_loaded <= 0)
+        pa_context_disconnect(c);
+}
+
+static void finish(void) {
+    struct rusage usage;
+    unsigned long ticks = read_daemon_main_thread_ticks();
+    int i;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "%u listings of %u sink inputs in %u s, %u skipped because the previous one was still pending\n",
+            n_lists, n_lists ? n_entries / n_lists : 0, DURATION_SEC, n_skipped);
+    fprintf(stderr, "Round trip: %0.2f ms average, %0.2f ms max\n",
+            n_lists ? (double) rtt_sum / n_lists / PA_USEC_PER_MSEC : 0.0, (double) rtt_max / PA_USEC_PER_MSEC);
+    fprintf(stderr, "Client CPU: %0.1f%%, daemon main thread CPU: %0.1f%%\n",
+            (rusage_sec(&usage) - rusage_sec(&client_usage)) * 100.0 / DURATION_SEC,
+            pa_stress_cpu_percent(ticks - daemon_ticks, DURATION_SEC));
+
+    for (i = 0; i < NSTREAMS; i++)
+        if (streams[i])
+            pa_stream_disconnect(streams[i]);
+
+    for (i = 0; i < NSINKS; i++)
+        pa_operation_unref(pa_context_unload_module(ctx.context, modules[i], unload_cb, NULL));
+}
+
+static void sink_input_info_cb(pa_context *c, const pa_sink_input_info *i, int eol, void *userdata) {
+    pa_usec_t rtt;
+
+    fail_unless(eol >= 0);
+
+    if (!eol) {
+        n_entries++;
+        return;
+    }
+
+    rtt = pa_rtclock_now() - list_started;
+    rtt_sum += rtt;
+    rtt_max = PA_MAX(rtt_max, rtt);
+    n_lists++;
+    list_pending = false;
+}
+
+static void time_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    struct timeval next;
+
+    if (n_ticks++ >= DURATION_SEC * LISTS_PER_SEC) {
+        a->time_free(e);
+        finish();
+        return;
+    }
+
+    if (list_pending)
+        n_skipped++;
+    else {
+        list_pending = true;
+        list_started = pa_rtclock_now();
+        pa_operation_unref(pa_context_get_sink_input_info_list(ctx.context, sink_input_info_cb, NULL));
+    }
+
+    a->time_restart(e, pa_timeval_add(pa_timeval_store(&next, pa_timeval_load(tv)), PA_USEC_PER_SEC / LISTS_PER_SEC));
+}
+
+static void start_listing(void) {
+    struct timeval tv;
+
+    fprintf(stderr, "All streams ready, listing them %u times per second.\n", LISTS_PER_SEC);
+
+    daemon_ticks = read_daemon_main_thread_ticks();
+    getrusage(RUSAGE_SELF, &client_usage);
+
+    pa_gettimeofday(&tv);
+    ctx.mainloop_api->time_new(ctx.mainloop_api, &tv, time_cb, NULL);
+}
+
+static void stream_state_callback(pa_stream *s, void *userdata) {
+    if (pa_stress_stream_state(s) == PA_STREAM_READY && ++n_streams_ready == NSTREAMS)
+        start_listing();
+}
+
+static void create_streams(pa_context *c) {
+    int i;
+
+    for (i = 0; i < NSTREAMS; i++) {
+        char name[64], sink[64];
+        pa_proplist *p;
+
+        /* Give every stream a realistic set of properties */
+        p = pa_proplist_new();
+        pa_proplist_sets(p, PA_PROP_MEDIA_ROLE, "music");
+        pa_proplist_sets(p, PA_PROP_APPLICATION_ID, "org.PulseAudio.introspect-stress");
+        pa_proplist_sets(p, PA_PROP_APPLICATION_ICON_NAME, "audio-x-generic");
+        pa_proplist_setf(p, PA_PROP_MEDIA_TITLE, "Track %i", i);
+
+        pa_snprintf(name, sizeof(name), "stream #%i", i);
+        pa_snprintf(sink, sizeof(sink), "introspect-stress-%i", i % NSINKS);
+
+        streams[i] = pa_stream_new_with_proplist(c, name, &sample_spec, NULL, p);
+        fail_unless(streams[i] != NULL);
+        pa_proplist_free(p);
+
+        pa_stream_set_state_callback(streams[i], stream_state_callback, NULL);
+        fail_unless(pa_stream_connect_playback(streams[i], sink, NULL, PA_STREAM_START_CORKED, NULL, NULL) == 0);
+    }
+}
+
+static void load_cb(pa_context *c, uint32_t idx, void *userdata) {
+    fail_unless(idx != PA_INVALID_INDEX);
+
+    modules[n_modules_loaded] = idx;
+
+    if (++n_modules_loaded == NSINKS)
+        create_streams(c);
+}
+
+static void context_ready(pa_context *c) {
+    int i;
+
+    for (i = 0; i < NSINKS; i++) {
+        char args[64];
+
+        pa_snprintf(args, sizeof(args), "sink_name=introspect-stress-%i", i);
+        pa_operation_unref(pa_context_load_module(c, "module-null-sink", args, load_cb, NULL));
+    }
+}
+
+START_TEST (introspect_stress_test) {
+    int i, ret;
+
+    for (i = 0; i < NSTREAMS; i++)
+        streams[i] = NULL;
+
+    pa_stress_test_init(&ctx);
+    ret = pa_stress_test_run(&ctx);
+
+    for (i = 0; i < NSTREAMS; i++)
+        if (streams[i])
+            pa_stream_unref(streams[i]);
+
+    pa_stress_test_deinit(&ctx);
+
+    fail_unless(ret == 0);
+    fail_unless(n_lists > 0);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    ctx.context_name = argv[0];
+    ctx.ready_cb = context_ready;
+
+    s = suite_create("Introspect Stress");
+    tc = tcase_create("introspectstress");
+    tcase_add_test(tc, introspect_stress_test);
+    tcase_set_timeout(tc, DURATION_SEC + 30);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
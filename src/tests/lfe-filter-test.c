@@ -24,7 +24,9 @@
 #include <pulse/pulseaudio.h>
 #include <pulse/sample.h>
 #include <pulsecore/memblock.h>
+#include <pulsecore/cpu-x86.h>
 
+#include <pulsecore/filter/biquad-cascade.h>
 #include <pulsecore/filter/lfe-filter.h>
 
 struct lfe_filter_test {
@@ -172,6 +174,101 @@ START_TEST (lfe_filter_test) {
 }
 END_TEST
 
+/* 5.1 float audio in blocks of varying length, with rewinds after most of
+   them. Like a sink, this never rewinds more than MAX_REWIND samples before
+   the furthest sample so far, which is all the history the filter keeps, so
+   the saved states are overwritten many times over. After every rewind, the
+   output must be the same as that of a filter that never rewound. */
+#define CHANNELS_5_1 6
+#define MAX_REWIND 2000
+
+static void process_float(pa_lfe_filter_t *lf, pa_mempool *pool, float *dst, const float *src, unsigned samples) {
+    pa_memchunk mc;
+    size_t length = samples * CHANNELS_5_1 * sizeof(float);
+
+    pa_assert_se(mc.memblock = pa_memblock_new(pool, length));
+    mc.length = length;
+    mc.index = 0;
+    memcpy(pa_memblock_acquire(mc.memblock), src, length);
+    pa_memblock_release(mc.memblock);
+
+    pa_lfe_filter_process(lf, &mc);
+
+    memcpy(dst, pa_memblock_acquire(mc.memblock), length);
+    pa_memblock_release(mc.memblock);
+    pa_memblock_unref(mc.memblock);
+}
+
+static void check_multichannel_rewind(void) {
+    pa_sample_spec a = { PA_SAMPLE_FLOAT32NE, 48000, CHANNELS_5_1 };
+    pa_channel_map map;
+    pa_mempool *pool;
+    pa_lfe_filter_t *lf, *ref;
+    float *in, *out, *expected;
+    unsigned i, pos = 0, end = 0, n_rewinds = 0;
+
+    pa_assert_se(pa_channel_map_init_auto(&map, CHANNELS_5_1, PA_CHANNEL_MAP_DEFAULT));
+    pa_assert_se(pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true));
+
+    in = pa_xnew(float, TOTAL_SAMPLES * CHANNELS_5_1);
+    out = pa_xnew(float, TOTAL_SAMPLES * CHANNELS_5_1);
+    expected = pa_xnew(float, TOTAL_SAMPLES * CHANNELS_5_1);
+    for (i = 0; i < TOTAL_SAMPLES * CHANNELS_5_1; i++)
+        in[i] = (float) random() / RAND_MAX - 0.5f;
+
+    pa_assert_se(ref = pa_lfe_filter_new(&a, &map, 120, MAX_REWIND));
+    process_float(ref, pool, expected, in, TOTAL_SAMPLES);
+    pa_lfe_filter_free(ref);
+
+    pa_assert_se(lf = pa_lfe_filter_new(&a, &map, 120, MAX_REWIND));
+    while (pos < TOTAL_SAMPLES) {
+        unsigned samples = PA_MIN(1 + random() % 1500, TOTAL_SAMPLES - pos), rewind;
+
+        process_float(lf, pool, out + pos * CHANNELS_5_1, in + pos * CHANNELS_5_1, samples);
+        fail_unless(memcmp(out + pos * CHANNELS_5_1, expected + pos * CHANNELS_5_1, samples * CHANNELS_5_1 * sizeof(float)) == 0);
+        pos += samples;
+        end = PA_MAX(end, pos);
+
+        if (pos < TOTAL_SAMPLES && random() % 4) {
+            rewind = PA_MIN(random() % MAX_REWIND, PA_MIN(MAX_REWIND - (end - pos), pos));
+            pa_lfe_filter_rewind(lf, rewind * CHANNELS_5_1 * sizeof(float));
+            pos -= rewind;
+            n_rewinds++;
+        }
+    }
+    pa_lfe_filter_free(lf);
+
+    pa_log_debug("lfe-filter-test: %u rewinds of 5.1 audio passed", n_rewinds);
+
+    pa_xfree(in);
+    pa_xfree(out);
+    pa_xfree(expected);
+    pa_mempool_unref(pool);
+}
+
+/* Without an optimized biquad cascade, the filter uses lr4 for each channel.
+ * Check the cascade too where there is one. */
+START_TEST (lfe_filter_multichannel_rewind_test) {
+#if defined (__i386__) || defined (__amd64__)
+    pa_cpu_x86_flag_t flags = 0;
+    pa_biquad_cascade_func_t orig_func;
+#endif
+
+    check_multichannel_rewind();
+
+#if defined (__i386__) || defined (__amd64__)
+    pa_cpu_get_x86_flags(&flags);
+    if (!(flags & PA_CPU_X86_SSE))
+        return;
+
+    orig_func = pa_get_biquad_cascade_func();
+    pa_biquad_cascade_func_init_sse(flags);
+    check_multichannel_rewind();
+    pa_set_biquad_cascade_func(orig_func);
+#endif
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -184,6 +281,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("lfe-filter");
     tc = tcase_create("lfe-filter");
     tcase_add_test(tc, lfe_filter_test);
+    tcase_add_test(tc, lfe_filter_multichannel_rewind_test);
     tcase_set_timeout(tc, 10);
     suite_add_tcase(s, tc);
 
@@ -0,0 +1,317 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#ifdef HAVE_FFTW
+#include <fftw3.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/cpu-x86.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include <pulsecore/filter/biquad-cascade.h>
+#include <pulsecore/filter/parametric-eq.h>
+
+#include "runtime-test-util.h"
+
+#define RATE 48000
+
+/* As in module-equalizer-sink */
+#define N_STAGES 10
+#define FFT_SIZE 65536
+#define N_POINTS (FFT_SIZE / 2 + 1)
+#define WINDOW_SIZE 15999
+#define HOP_SIZE ((WINDOW_SIZE + 1) / 2)
+
+#define TIMES2 5
+
+static float *random_samples(unsigned n) {
+    float *data = pa_xnew(float, n);
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        data[i] = (float) rand() / RAND_MAX * 2 - 1;
+
+    return data;
+}
+
+/* A magnitude response through the given levels in dB at the band centers,
+ * interpolated over log frequency */
+static float *make_response(const double *levels) {
+    float *H = pa_xnew(float, N_POINTS);
+    unsigned i, k = 0;
+
+    for (i = 0; i < N_POINTS; i++) {
+        double f = (double) i * RATE / 2 / (N_POINTS - 1);
+        double f0, f1, db;
+
+        while (k < N_STAGES - 2 && f > pa_parametric_eq_get_frequency(N_STAGES, RATE, k + 1))
+            k++;
+
+        f0 = pa_parametric_eq_get_frequency(N_STAGES, RATE, k);
+        f1 = pa_parametric_eq_get_frequency(N_STAGES, RATE, k + 1);
+
+        if (f <= f0)
+            db = levels[k];
+        else if (f >= f1)
+            db = levels[k + 1];
+        else
+            db = levels[k] + (levels[k + 1] - levels[k]) * log(f / f0) / log(f1 / f0);
+
+        H[i] = pow(10, db / 20);
+    }
+
+    return H;
+}
+
+/* The roots of z^2 + p z + q lie inside the unit circle */
+static bool roots_inside(double p, double q) {
+    return fabs(q) < 1 && fabs(p) < 1 + q;
+}
+
+START_TEST (parametric_eq_flat_test) {
+    struct biquad stages[N_STAGES];
+    float *H = pa_xnew(float, N_POINTS);
+    unsigned i;
+
+    for (i = 0; i < N_POINTS; i++)
+        H[i] = 1.0f / sqrtf(2.0f);
+
+    pa_parametric_eq_design(stages, N_STAGES, H, N_POINTS, RATE, 2.0f);
+
+    for (i = 1; i < 20; i++) {
+        double f = i * 1000.0 + 20;
+
+        fail_unless(fabs(pa_parametric_eq_response(stages, N_STAGES, RATE, f) - 20 * log10(sqrt(2))) < 0.01);
+    }
+
+    pa_xfree(H);
+}
+END_TEST
+
+START_TEST (parametric_eq_design_test) {
+    struct biquad stages[N_STAGES];
+    double levels[N_STAGES];
+    unsigned n, k;
+
+    for (n = 0; n < 20; n++) {
+        double max_error = 0;
+        float *H;
+
+        /* Neighbouring bands can differ by up to 12 dB */
+        for (k = 0; k < N_STAGES; k++)
+            levels[k] = (double) rand() / RAND_MAX * 12 - 6 - (n % 2 ? 10 : 0);
+
+        H = make_response(levels);
+        pa_parametric_eq_design(stages, N_STAGES, H, N_POINTS, RATE, 1.0f);
+
+        for (k = 0; k < N_STAGES; k++) {
+            double f = pa_parametric_eq_get_frequency(N_STAGES, RATE, k);
+            double error = pa_parametric_eq_response(stages, N_STAGES, RATE, f) - levels[k];
+
+            max_error = PA_MAX(max_error, fabs(error));
+        }
+
+        pa_log_debug("Maximum error at the band centers: %0.2f dB", max_error);
+        fail_unless(max_error < 1.0);
+
+        /* Stable and minimum phase: poles and zeros inside the unit circle */
+        for (k = 0; k < N_STAGES; k++) {
+            fail_unless(roots_inside(stages[k].a1, stages[k].a2));
+            fail_unless(roots_inside(stages[k].b1 / stages[k].b0, stages[k].b2 / stages[k].b0));
+        }
+
+        pa_xfree(H);
+    }
+}
+END_TEST
+
+#ifdef HAVE_FFTW
+/* The STFT overlap-add of module-equalizer-sink */
+struct fft_eq {
+    float *W, *H, *work, *input, *overlap;
+    fftwf_complex *output_window;
+    fftwf_plan forward_plan, inverse_plan;
+};
+
+static void fft_eq_init(struct fft_eq *e, const float *H) {
+    unsigned i;
+
+    e->W = fftwf_malloc(WINDOW_SIZE * sizeof(float));
+    e->H = fftwf_malloc(N_POINTS * sizeof(float));
+    e->work = fftwf_malloc(FFT_SIZE * sizeof(float));
+    e->input = fftwf_malloc(WINDOW_SIZE * sizeof(float));
+    e->overlap = fftwf_malloc((WINDOW_SIZE - HOP_SIZE) * sizeof(float));
+    e->output_window = fftwf_malloc(N_POINTS * sizeof(fftwf_complex));
+    e->forward_plan = fftwf_plan_dft_r2c_1d(FFT_SIZE, e->work, e->output_window, FFTW_ESTIMATE);
+    e->inverse_plan = fftwf_plan_dft_c2r_1d(FFT_SIZE, e->output_window, e->work, FFTW_ESTIMATE);
+
+    for (i = 0; i < WINDOW_SIZE; i++)
+        e->W[i] = 0.5f * (1 - cos(2 * M_PI * i / (WINDOW_SIZE + 1)));
+
+    for (i = 0; i < N_POINTS; i++)
+        e->H[i] = H[i] / FFT_SIZE;
+
+    memset(e->input, 0, WINDOW_SIZE * sizeof(float));
+    memset(e->overlap, 0, (WINDOW_SIZE - HOP_SIZE) * sizeof(float));
+}
+
+static void fft_eq_done(struct fft_eq *e) {
+    fftwf_destroy_plan(e->inverse_plan);
+    fftwf_destroy_plan(e->forward_plan);
+    fftwf_free(e->output_window);
+    fftwf_free(e->overlap);
+    fftwf_free(e->input);
+    fftwf_free(e->work);
+    fftwf_free(e->H);
+    fftwf_free(e->W);
+}
+
+/* Filters one hop of one channel of interleaved data in place */
+static void fft_eq_process(struct fft_eq *e, float *data, unsigned channels) {
+    unsigned j;
+
+    for (j = 0; j < HOP_SIZE; j++)
+        e->input[WINDOW_SIZE - HOP_SIZE + j] = data[j * channels];
+
+    for (j = 0; j < WINDOW_SIZE; j++)
+        e->work[j] = e->W[j] * e->input[j];
+    memset(e->work + WINDOW_SIZE, 0, (FFT_SIZE - WINDOW_SIZE) * sizeof(float));
+
+    fftwf_execute(e->forward_plan);
+    for (j = 0; j < N_POINTS; j++) {
+        e->output_window[j][0] *= e->H[j];
+        e->output_window[j][1] *= e->H[j];
+    }
+    fftwf_execute(e->inverse_plan);
+
+    for (j = 0; j < WINDOW_SIZE - HOP_SIZE; j++) {
+        e->work[j] += e->overlap[j];
+        e->overlap[j] = e->work[HOP_SIZE + j];
+    }
+
+    for (j = 0; j < HOP_SIZE; j++)
+        data[j * channels] = e->work[j];
+
+    memmove(e->input, e->input + HOP_SIZE, (WINDOW_SIZE - HOP_SIZE) * sizeof(float));
+}
+#endif
+
+/* Processes one second of audio in each mode */
+static void run_benchmark(unsigned channels) {
+    unsigned n_frames = PA_ROUND_UP(RATE, HOP_SIZE);
+    double levels[N_STAGES];
+    struct biquad stages[N_STAGES];
+    pa_biquad_cascade *c;
+    float *H, *data;
+    unsigned ch, k;
+#ifdef HAVE_FFTW
+    struct fft_eq e;
+    unsigned i;
+#endif
+
+    for (k = 0; k < N_STAGES; k++)
+        levels[k] = (double) rand() / RAND_MAX * 12 - 6;
+    H = make_response(levels);
+    data = random_samples(n_frames * channels);
+
+    pa_log_debug("Processing one second of %u channels:", channels);
+
+    c = pa_biquad_cascade_new(channels, N_STAGES);
+    pa_parametric_eq_design(stages, N_STAGES, H, N_POINTS, RATE, 1.0f);
+    for (k = 0; k < N_STAGES; k++)
+        for (ch = 0; ch < channels; ch++)
+            pa_biquad_cascade_set(c, k, ch, &stages[k]);
+    pa_biquad_cascade_commit(c, 0);
+
+    pa_log_debug("iir: no latency");
+    PA_RUNTIME_TEST_RUN_START("iir", 1, TIMES2) {
+        pa_biquad_cascade_process_float32(c, data, data, n_frames);
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    pa_biquad_cascade_free(c);
+
+#ifdef HAVE_FFTW
+    fft_eq_init(&e, H);
+
+    pa_log_debug("fft: latency of %u frames", HOP_SIZE);
+    PA_RUNTIME_TEST_RUN_START("fft", 1, TIMES2) {
+        for (i = 0; i < n_frames; i += HOP_SIZE)
+            for (ch = 0; ch < channels; ch++)
+                fft_eq_process(&e, data + i * channels + ch, channels);
+    } PA_RUNTIME_TEST_RUN_STOP
+
+    fft_eq_done(&e);
+#endif
+
+    pa_xfree(data);
+    pa_xfree(H);
+}
+
+START_TEST (parametric_eq_benchmark_test) {
+#if defined (__i386__) || defined (__amd64__)
+    pa_cpu_x86_flag_t flags = 0;
+
+    /* Filter as fast as the daemon would */
+    pa_cpu_get_x86_flags(&flags);
+    pa_biquad_cascade_func_init_sse(flags);
+#endif
+
+    run_benchmark(2);
+    run_benchmark(6);
+    run_benchmark(8);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    srand(1);
+
+    s = suite_create("Parametric EQ");
+    tc = tcase_create("parametric-eq");
+    tcase_add_test(tc, parametric_eq_flat_test);
+    tcase_add_test(tc, parametric_eq_design_test);
+    tcase_add_test(tc, parametric_eq_benchmark_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
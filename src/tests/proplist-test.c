@@ -96,6 +96,90 @@ START_TEST (proplist_test) {
 }
 END_TEST
 
+START_TEST (proplist_copy_test) {
+    pa_proplist *a, *b;
+    void *state;
+    char buf[32];
+    int i;
+
+    a = pa_proplist_new();
+    fail_unless(pa_proplist_sets(a, PA_PROP_MEDIA_TITLE, "Kunst der Fuge") == 0);
+    fail_unless(pa_proplist_sets(a, "custom.key", "custom") == 0);
+
+    /* A copy must not see modifications of the original and vice versa */
+    b = pa_proplist_copy(a);
+    fail_unless(pa_proplist_equal(a, b));
+    fail_unless(pa_proplist_sets(b, PA_PROP_MEDIA_TITLE, "Musikalisches Opfer") == 0);
+    fail_unless(pa_streq(pa_proplist_gets(a, PA_PROP_MEDIA_TITLE), "Kunst der Fuge"));
+    fail_unless(pa_streq(pa_proplist_gets(b, PA_PROP_MEDIA_TITLE), "Musikalisches Opfer"));
+    fail_unless(pa_proplist_unset(a, "custom.key") == 0);
+    fail_unless(pa_streq(pa_proplist_gets(b, "custom.key"), "custom"));
+
+    /* Setting a property from a value of the same list */
+    fail_unless(pa_proplist_sets(b, PA_PROP_MEDIA_NAME, pa_proplist_gets(b, PA_PROP_MEDIA_TITLE)) == 0);
+    fail_unless(pa_streq(pa_proplist_gets(b, PA_PROP_MEDIA_NAME), "Musikalisches Opfer"));
+
+    /* Overwriting values repeatedly must keep the order and the contents */
+    for (i = 0; i < 10000; i++) {
+        pa_snprintf(buf, sizeof(buf), "%i", i);
+        fail_unless(pa_proplist_sets(b, "custom.key", buf) == 0);
+    }
+
+    fail_unless(pa_streq(pa_proplist_gets(b, "custom.key"), "9999"));
+    fail_unless(pa_proplist_size(b) == 3);
+
+    state = NULL;
+    fail_unless(pa_streq(pa_proplist_iterate(b, &state), PA_PROP_MEDIA_TITLE));
+    fail_unless(pa_streq(pa_proplist_iterate(b, &state), "custom.key"));
+    fail_unless(pa_streq(pa_proplist_iterate(b, &state), PA_PROP_MEDIA_NAME));
+    fail_unless(!pa_proplist_iterate(b, &state));
+
+    pa_proplist_free(a);
+    pa_proplist_free(b);
+}
+END_TEST
+
+START_TEST (proplist_stable_test) {
+    pa_proplist *a, *b;
+    const char *title, *custom;
+    char key[32], buf[32];
+    int i;
+
+    a = pa_proplist_new();
+    fail_unless(pa_proplist_sets(a, PA_PROP_MEDIA_TITLE, "Kunst der Fuge") == 0);
+    fail_unless(pa_proplist_sets(a, "custom.key", "custom") == 0);
+
+    title = pa_proplist_gets(a, PA_PROP_MEDIA_TITLE);
+    custom = pa_proplist_gets(a, "custom.key");
+
+    /* Values returned by pa_proplist_gets() must stay where they are
+     * while other properties are set, overwritten, removed and the list
+     * is copied */
+    for (i = 0; i < 10000; i++) {
+        pa_snprintf(key, sizeof(key), "custom.key%i", i % 16);
+        pa_snprintf(buf, sizeof(buf), "%0*i", i % 24 + 1, i);
+        fail_unless(pa_proplist_sets(a, key, buf) == 0);
+        fail_unless(pa_proplist_sets(a, PA_PROP_MEDIA_NAME, buf) == 0);
+
+        if (i % 7 == 0)
+            fail_unless(pa_proplist_unset(a, key) == 0);
+
+        if (i % 100 == 0) {
+            b = pa_proplist_copy(a);
+            fail_unless(pa_proplist_sets(a, PA_PROP_MEDIA_ARTIST, buf) == 0);
+            pa_proplist_free(b);
+        }
+    }
+
+    fail_unless(title == pa_proplist_gets(a, PA_PROP_MEDIA_TITLE));
+    fail_unless(custom == pa_proplist_gets(a, "custom.key"));
+    fail_unless(pa_streq(title, "Kunst der Fuge"));
+    fail_unless(pa_streq(custom, "custom"));
+
+    pa_proplist_free(a);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -108,6 +192,8 @@ int main(int argc, char *argv[]) {
     s = suite_create("Property List");
     tc = tcase_create("propertylist");
     tcase_add_test(tc, proplist_test);
+    tcase_add_test(tc, proplist_copy_test);
+    tcase_add_test(tc, proplist_stable_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
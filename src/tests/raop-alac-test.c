@@ -0,0 +1,588 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Checks the ALAC frames of the RAOP sink against a decoder that works like
+ * the receivers do, checks the batched AES encryption against the plain one,
+ * and measures what encoding and encrypting a packet costs, sending the
+ * packets to a local UDP socket in place of a receiver. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/arpa-inet.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/socket.h>
+
+#include <modules/raop/raop-alac.h>
+#include <modules/raop/raop-crypto.h>
+#include <modules/raop/raop-packet-buffer.h>
+
+/* As sent by the RAOP sink over UDP */
+#define FRAMES_PER_PACKET 352
+#define RTP_HEADER_SIZE 12
+#define MAX_FRAME_SIZE (7 + 4 * FRAMES_PER_PACKET)
+
+#define PACKETS_PER_BATCH 4
+
+#define SIGNAL_FRAMES (FRAMES_PER_PACKET * 64)
+#define BENCHMARK_PACKETS 4000
+
+static pa_mempool *pool;
+
+enum signal {
+    SIGNAL_SILENCE,
+    SIGNAL_SINE,
+    SIGNAL_MUSIC,
+    SIGNAL_NOISE,
+    SIGNAL_FULL_SCALE,
+    SIGNAL_MONO,
+    SIGNAL_MAX
+};
+
+static const char *signal_names[SIGNAL_MAX] = {
+    "silence", "sine", "music", "noise", "full scale", "mono"
+};
+
+/* A decoder for the frames we send, as in the receivers */
+
+struct bit_reader {
+    const uint8_t *data;
+    size_t n_bits, pos;
+};
+
+static uint32_t show_bits(struct bit_reader *r, unsigned n) {
+    uint32_t v = 0;
+    size_t pos = r->pos;
+    unsigned i;
+
+    for (i = 0; i < n; i++, pos++)
+        v = (v << 1) | (pos < r->n_bits ? (r->data[pos / 8] >> (7 - pos % 8)) & 1 : 0);
+
+    return v;
+}
+
+static uint32_t get_bits(struct bit_reader *r, unsigned n) {
+    uint32_t v = show_bits(r, n);
+
+    r->pos += n;
+    fail_unless(r->pos <= r->n_bits);
+
+    return v;
+}
+
+static int32_t get_sbits(struct bit_reader *r, unsigned n) {
+    return (int32_t) (get_bits(r, n) << (32 - n)) >> (32 - n);
+}
+
+static inline int sign_of(int32_t v) {
+    return (v > 0) - (v < 0);
+}
+
+static inline unsigned log2_of(uint32_t v) {
+    return v ? 31 - (unsigned) __builtin_clz(v) : 0;
+}
+
+static uint32_t decode_scalar(struct bit_reader *r, unsigned k, unsigned bps) {
+    uint32_t x = 0;
+
+    while (x < 9 && get_bits(r, 1))
+        x++;
+
+    if (x > 8)
+        return get_bits(r, bps);
+
+    if (k != 1) {
+        uint32_t extra = show_bits(r, k);
+
+        x = (x << k) - x;
+
+        if (extra > 1) {
+            x += extra - 1;
+            r->pos += k;
+        } else
+            r->pos += k - 1;
+    }
+
+    return x;
+}
+
+static void decode_residual(struct bit_reader *r, int32_t *out, unsigned n, unsigned bps, unsigned mult, unsigned initial_history, unsigned limit) {
+    uint32_t history = initial_history;
+    uint32_t sign_modifier = 0;
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        uint32_t x = decode_scalar(r, PA_MIN(log2_of((history >> 9) + 3), limit), bps) + sign_modifier;
+
+        sign_modifier = 0;
+        out[i] = (int32_t) (x >> 1) ^ -(int32_t) (x & 1);
+
+        if (x > 0xffff)
+            history = 0xffff;
+        else
+            history += x * mult - ((history * mult) >> 9);
+
+        if (history < 128 && i + 1 < n) {
+            unsigned k = PA_MIN(7 - log2_of(history) + ((history + 16) >> 6), limit);
+            uint32_t run = decode_scalar(r, k, 16);
+
+            fail_unless(i + 1 + run <= n);
+            memset(out + i + 1, 0, run * sizeof(int32_t));
+            i += run;
+
+            sign_modifier = run <= 0xffff;
+            history = 0;
+        }
+    }
+}
+
+static int32_t sign_extend(int32_t v, unsigned bits) {
+    return (int32_t) ((uint32_t) v << (32 - bits)) >> (32 - bits);
+}
+
+static void unpredict(const int32_t *error, int32_t *out, unsigned n, unsigned bps, int16_t *coefs, unsigned order, unsigned shift) {
+    unsigned i, j;
+
+    out[0] = error[0];
+
+    for (i = 1; i <= order && i < n; i++)
+        out[i] = sign_extend(out[i - 1] + error[i], bps);
+
+    for (; i < n; i++) {
+        const int32_t *past = out + i - order;
+        int32_t d = past[-1], e = error[i], val;
+        uint32_t sum = 0;
+
+        for (j = 0; j < order; j++)
+            sum += (uint32_t) (past[j] - d) * (uint32_t) (int32_t) coefs[j];
+
+        val = (int32_t) (((int64_t) (int32_t) sum + (1 << (shift - 1))) >> shift);
+        out[i] = sign_extend(val + d + e, bps);
+
+        if (e != 0) {
+            int e_sign = sign_of(e);
+
+            for (j = 0; j < order && e * e_sign > 0; j++) {
+                int32_t diff = d - past[j];
+                int sign = sign_of(diff) * e_sign;
+
+                coefs[j] = (int16_t) (coefs[j] - sign);
+                e -= ((diff * sign) >> shift) * (int32_t) (j + 1);
+            }
+        }
+    }
+}
+
+/* Decodes a frame into s16ne stereo and returns the number of frames */
+static unsigned decode_frame(const uint8_t *data, size_t size, int16_t *pcm, bool *verbatim) {
+    struct bit_reader r = { data, size * 8, 0 };
+    int32_t *channel[2];
+    unsigned n, c, i;
+
+    fail_unless(get_bits(&r, 3) == 1); /* Channel pair element */
+    get_bits(&r, 4);
+    get_bits(&r, 12);
+    fail_unless(get_bits(&r, 1) == 1); /* Has size */
+    fail_unless(get_bits(&r, 2) == 0); /* No extra bits */
+    *verbatim = get_bits(&r, 1);
+    n = get_bits(&r, 32);
+
+    channel[0] = pa_xnew(int32_t, n);
+    channel[1] = pa_xnew(int32_t, n);
+
+    if (*verbatim) {
+        for (i = 0; i < n; i++) {
+            channel[0][i] = get_sbits(&r, 16);
+            channel[1][i] = get_sbits(&r, 16);
+        }
+    } else {
+        unsigned mix_bits, mix_res, shift[2], mult[2], order[2];
+        int16_t coefs[2][32];
+        int32_t *error = pa_xnew(int32_t, n);
+        int j;
+
+        mix_bits = get_bits(&r, 8);
+        mix_res = get_bits(&r, 8);
+
+        for (c = 0; c < 2; c++) {
+            fail_unless(get_bits(&r, 4) == 0); /* Adaptive prediction */
+            shift[c] = get_bits(&r, 4);
+            mult[c] = get_bits(&r, 3) * 40 / 4;
+            order[c] = get_bits(&r, 5);
+
+            for (j = (int) order[c] - 1; j >= 0; j--)
+                coefs[c][j] = (int16_t) get_sbits(&r, 16);
+        }
+
+        for (c = 0; c < 2; c++) {
+            decode_residual(&r, error, n, 17, mult[c], 10, 14);
+            unpredict(error, channel[c], n, 17, coefs[c], order[c], shift[c]);
+        }
+
+        fail_unless(get_bits(&r, 3) == 7); /* End */
+        fail_unless((r.pos + 7) / 8 == size);
+
+        if (mix_res != 0) {
+            for (i = 0; i < n; i++) {
+                int32_t a = channel[0][i], b = channel[1][i];
+
+                a -= (b * (int32_t) mix_res) >> mix_bits;
+                b += a;
+                channel[0][i] = b;
+                channel[1][i] = a;
+            }
+        }
+
+        pa_xfree(error);
+    }
+
+    for (i = 0; i < n; i++) {
+        fail_unless(channel[0][i] >= INT16_MIN && channel[0][i] <= INT16_MAX);
+        fail_unless(channel[1][i] >= INT16_MIN && channel[1][i] <= INT16_MAX);
+        pcm[2 * i] = (int16_t) channel[0][i];
+        pcm[2 * i + 1] = (int16_t) channel[1][i];
+    }
+
+    pa_xfree(channel[0]);
+    pa_xfree(channel[1]);
+
+    return n;
+}
+
+static int16_t clip(double v) {
+    return (int16_t) PA_CLAMP(lrint(v), INT16_MIN, INT16_MAX);
+}
+
+/* s16le stereo */
+static void generate_signal(enum signal s, uint8_t *raw, unsigned n) {
+    unsigned i;
+
+    srand(4711);
+
+    for (i = 0; i < n; i++) {
+        double t = (double) i / 44100;
+        int16_t l, r;
+
+        switch (s) {
+            case SIGNAL_SILENCE:
+                l = r = 0;
+                break;
+
+            case SIGNAL_SINE:
+                l = clip(20000 * sin(2 * M_PI * 440 * t));
+                r = clip(16000 * sin(2 * M_PI * 440 * t + 0.3));
+                break;
+
+            case SIGNAL_MUSIC:
+                l = clip(8000 * sin(2 * M_PI * 220 * t) + 4000 * sin(2 * M_PI * 1375 * t) + 1500 * sin(2 * M_PI * 5150 * t) + (rand() % 200 - 100));
+                r = clip(7000 * sin(2 * M_PI * 220 * t + 0.1) + 4500 * sin(2 * M_PI * 1375 * t) + 1000 * sin(2 * M_PI * 7110 * t) + (rand() % 200 - 100));
+                break;
+
+            case SIGNAL_NOISE:
+                l = (int16_t) (rand() & 0xffff);
+                r = (int16_t) (rand() & 0xffff);
+                break;
+
+            case SIGNAL_FULL_SCALE:
+                l = (i & 1) ? INT16_MAX : INT16_MIN;
+                r = (i & 1) ? INT16_MIN : INT16_MAX;
+                break;
+
+            case SIGNAL_MONO:
+                l = r = clip(12000 * sin(2 * M_PI * 330 * t) + (rand() % 64 - 32));
+                break;
+
+            default:
+                pa_assert_not_reached();
+        }
+
+        raw[4 * i] = (uint8_t) l;
+        raw[4 * i + 1] = (uint8_t) ((uint16_t) l >> 8);
+        raw[4 * i + 2] = (uint8_t) r;
+        raw[4 * i + 3] = (uint8_t) ((uint16_t) r >> 8);
+    }
+}
+
+/* Encodes the signal in packets of frames_per_packet and checks that it
+ * decodes losslessly. Returns the number of bytes of the frames. */
+static size_t encode_and_check(pa_raop_alac_encoder *e, const uint8_t *raw, unsigned n, unsigned frames_per_packet, bool compress) {
+    uint8_t packet[7 + 4 * 4096];
+    int16_t *pcm = pa_xnew(int16_t, 2 * frames_per_packet);
+    size_t total = 0;
+    unsigned i, j;
+
+    for (i = 0; i < n; i += frames_per_packet) {
+        size_t length = PA_MIN(frames_per_packet, n - i) * 4, size;
+        unsigned n_frames;
+        bool verbatim;
+
+        size = pa_raop_alac_encode(e, packet, 7 + 4 * frames_per_packet, raw + 4 * i, &length);
+        fail_unless(length == PA_MIN(frames_per_packet, n - i) * 4);
+        fail_unless(size > 0 && size <= 7 + length);
+
+        n_frames = decode_frame(packet, size, pcm, &verbatim);
+        fail_unless(n_frames * 4 == length);
+        fail_unless(verbatim == !compress || size == 7 + length);
+
+        for (j = 0; j < 2 * n_frames; j++) {
+            const uint8_t *s = raw + 4 * i + 2 * j;
+
+            if (pcm[j] != (int16_t) (s[1] << 8 | s[0])) {
+                pa_log_error("Mismatch at sample %u: %d != %d", 2 * i + j, pcm[j], (int16_t) (s[1] << 8 | s[0]));
+                ck_abort();
+            }
+        }
+
+        total += size;
+    }
+
+    pa_xfree(pcm);
+
+    return total;
+}
+
+START_TEST (alac_verbatim_test) {
+    pa_raop_alac_encoder *e = pa_raop_alac_encoder_new(false);
+    const uint8_t raw[4 * 3] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0xfc };
+    /* The 55 bit header with the uncompressed flag and 3 frames, then the
+     * samples byte swapped */
+    const uint8_t expected[7 + 12] = {
+        0x20, 0x00, 0x12, 0x00, 0x00, 0x00, 0x06,
+        0x04, 0x02, 0x08, 0x06, 0x0c, 0x0a, 0x10, 0x0e, 0x14, 0x13, 0xf8, 0x16
+    };
+    uint8_t packet[sizeof(raw) + 8];
+    int16_t pcm[6];
+    size_t length = sizeof(raw) + 2, size;
+    bool verbatim;
+    unsigned i;
+
+    /* Partial frames are left out */
+    size = pa_raop_alac_encode(e, packet, sizeof(packet), raw, &length);
+    fail_unless(length == sizeof(raw));
+    fail_unless(size == sizeof(expected));
+    fail_unless(memcmp(packet, expected, size) == 0);
+
+    fail_unless(decode_frame(packet, size, pcm, &verbatim) == 3);
+    fail_unless(verbatim);
+
+    for (i = 0; i < 6; i++)
+        fail_unless(pcm[i] == (int16_t) (raw[2 * i + 1] << 8 | raw[2 * i]));
+
+    pa_raop_alac_encoder_free(e);
+}
+END_TEST
+
+START_TEST (alac_roundtrip_test) {
+    static const unsigned packet_sizes[] = { 1, 2, 5, 17, FRAMES_PER_PACKET, 4096 };
+    uint8_t *raw = pa_xmalloc(4 * SIGNAL_FRAMES);
+    unsigned i;
+
+    generate_signal(_i, raw, SIGNAL_FRAMES);
+
+    for (i = 0; i < PA_ELEMENTSOF(packet_sizes); i++) {
+        pa_raop_alac_encoder *e;
+        unsigned n = packet_sizes[i] < 32 ? 4096 : SIGNAL_FRAMES;
+        size_t plain, compressed;
+
+        e = pa_raop_alac_encoder_new(false);
+        plain = encode_and_check(e, raw, n, packet_sizes[i], false);
+        pa_raop_alac_encoder_free(e);
+
+        e = pa_raop_alac_encoder_new(true);
+        compressed = encode_and_check(e, raw, n, packet_sizes[i], true);
+        pa_raop_alac_encoder_free(e);
+
+        pa_log_debug("%s, %u frames per packet: %0.1f%% of the uncompressed size", signal_names[_i],
+                     packet_sizes[i], 100.0 * compressed / plain);
+
+        fail_unless(compressed <= plain);
+
+        /* Anything but noise has to compress well with real packet sizes */
+        if (packet_sizes[i] >= FRAMES_PER_PACKET && _i != SIGNAL_NOISE)
+            fail_unless(compressed < plain * 3 / 4);
+    }
+
+    pa_xfree(raw);
+}
+END_TEST
+
+START_TEST (aes_batch_test) {
+    static const size_t lengths[] = { 0, 5, 16, 33, MAX_FRAME_SIZE, 1000, 7, 1024, 48 };
+    uint8_t *batch[PA_ELEMENTSOF(lengths)], *single[PA_ELEMENTSOF(lengths)];
+    pa_raop_secret *secret;
+    unsigned i, j;
+
+    secret = pa_raop_secret_new();
+
+    for (i = 0; i < PA_ELEMENTSOF(lengths); i++) {
+        batch[i] = pa_xmalloc(lengths[i] + 1);
+        single[i] = pa_xmalloc(lengths[i] + 1);
+
+        for (j = 0; j < lengths[i]; j++)
+            batch[i][j] = single[i][j] = (uint8_t) rand();
+
+        pa_raop_aes_encrypt(secret, single[i], (int) lengths[i]);
+    }
+
+    pa_raop_aes_encrypt_packets(secret, batch, lengths, PA_ELEMENTSOF(lengths));
+
+    for (i = 0; i < PA_ELEMENTSOF(lengths); i++) {
+        fail_unless(memcmp(batch[i], single[i], lengths[i]) == 0);
+        pa_xfree(batch[i]);
+        pa_xfree(single[i]);
+    }
+
+    pa_raop_secret_free(secret);
+}
+END_TEST
+
+/* Encodes and encrypts the packets in batches, like the RAOP sink does over
+ * UDP, and sends them to a local socket */
+START_TEST (alac_benchmark) {
+    bool compress = _i;
+    pa_raop_alac_encoder *e;
+    pa_raop_secret *secret;
+    pa_raop_packet_buffer *pb;
+    struct sockaddr_in sa;
+    socklen_t sa_len = sizeof(sa);
+    int send_fd, recv_fd, size = 4 * 1024 * 1024;
+    uint8_t *raw, buffer[RTP_HEADER_SIZE + MAX_FRAME_SIZE];
+    uint64_t bytes_sent = 0, bytes_received = 0, n_received = 0;
+    pa_usec_t start, elapsed;
+    uint16_t seq = 0;
+    unsigned i, k;
+
+    pa_zero(sa);
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fail_unless((recv_fd = pa_socket_cloexec(AF_INET, SOCK_DGRAM, 0)) >= 0);
+    fail_unless(bind(recv_fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+    fail_unless(getsockname(recv_fd, (struct sockaddr*) &sa, &sa_len) == 0);
+    setsockopt(recv_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    pa_make_fd_nonblock(recv_fd);
+
+    fail_unless((send_fd = pa_socket_cloexec(AF_INET, SOCK_DGRAM, 0)) >= 0);
+    fail_unless(connect(send_fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+
+    raw = pa_xmalloc(4 * SIGNAL_FRAMES);
+    generate_signal(SIGNAL_MUSIC, raw, SIGNAL_FRAMES);
+
+    e = pa_raop_alac_encoder_new(compress);
+    secret = pa_raop_secret_new();
+    pb = pa_raop_packet_buffer_new(pool, 500, RTP_HEADER_SIZE + MAX_FRAME_SIZE);
+    pa_raop_packet_buffer_reset(pb, seq);
+
+    start = pa_rtclock_now();
+
+    for (i = 0; i < BENCHMARK_PACKETS; i += PACKETS_PER_BATCH) {
+        pa_memchunk *packets[PACKETS_PER_BATCH];
+        uint8_t *payloads[PACKETS_PER_BATCH];
+        size_t payload_sizes[PACKETS_PER_BATCH];
+        ssize_t r;
+
+        for (k = 0; k < PACKETS_PER_BATCH; k++, seq++) {
+            size_t length = FRAMES_PER_PACKET * 4;
+            uint8_t *packet;
+
+            packets[k] = pa_raop_packet_buffer_prepare(pb, seq, RTP_HEADER_SIZE + MAX_FRAME_SIZE);
+            packet = pa_memblock_acquire(packets[k]->memblock);
+            memset(packet, 0, RTP_HEADER_SIZE);
+
+            payloads[k] = packet + RTP_HEADER_SIZE;
+            payload_sizes[k] = pa_raop_alac_encode(e, payloads[k], MAX_FRAME_SIZE,
+                                                   raw + ((i + k) % (SIGNAL_FRAMES / FRAMES_PER_PACKET)) * FRAMES_PER_PACKET * 4, &length);
+            packets[k]->length = RTP_HEADER_SIZE + payload_sizes[k];
+        }
+
+        pa_raop_aes_encrypt_packets(secret, payloads, payload_sizes, PACKETS_PER_BATCH);
+
+        for (k = 0; k < PACKETS_PER_BATCH; k++) {
+            if (send(send_fd, payloads[k] - RTP_HEADER_SIZE, packets[k]->length, 0) > 0)
+                bytes_sent += packets[k]->length;
+
+            pa_memblock_release(packets[k]->memblock);
+        }
+
+        while ((r = recv(recv_fd, buffer, sizeof(buffer), 0)) > 0) {
+            bytes_received += (size_t) r;
+            n_received++;
+        }
+    }
+
+    elapsed = pa_rtclock_now() - start;
+
+    pa_log_info("%s: %0.2f us per packet, %0.0f bytes per packet, %llu of %u packets received",
+                compress ? "compressed" : "uncompressed",
+                (double) elapsed / BENCHMARK_PACKETS, (double) bytes_sent / BENCHMARK_PACKETS,
+                (unsigned long long) n_received, BENCHMARK_PACKETS);
+
+    fail_unless(n_received > 0);
+    fail_unless(bytes_received <= bytes_sent);
+
+    pa_raop_packet_buffer_free(pb);
+    pa_raop_secret_free(secret);
+    pa_raop_alac_encoder_free(e);
+    pa_xfree(raw);
+    pa_close(send_fd);
+    pa_close(recv_fd);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true));
+
+    s = suite_create("RAOP ALAC");
+    tc = tcase_create("raopalac");
+    tcase_add_test(tc, alac_verbatim_test);
+    tcase_add_loop_test(tc, alac_roundtrip_test, 0, SIGNAL_MAX);
+    tcase_add_test(tc, aes_batch_test);
+    /* Uncompressed and compressed */
+    tcase_add_loop_test(tc, alac_benchmark, 0, 2);
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    pa_mempool_unref(pool);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
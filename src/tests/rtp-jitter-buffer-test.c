@@ -0,0 +1,393 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Sends an RTP stream over a UDP socket on the loopback interface, which
+ * stands in for the network, and receives it into a jitter buffer the way
+ * module-rtp-recv does. The sender drops, reorders and delays packets by
+ * a pattern, and the time is simulated, so the test runs much faster than
+ * real time and always sees the same arrival times. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/arpa-inet.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/socket.h>
+
+#include <modules/rtp/jitter-buffer.h>
+#include <modules/rtp/rtp.h>
+
+#define RATE 48000
+#define CHANNELS 2
+#define PACKET_FRAMES 480
+#define N_PACKETS 1000
+#define PREBUF_MSEC 60
+#define TICK_FRAMES 240
+#define LATE_MSEC 200
+
+#define PACKET_USEC ((pa_usec_t) PACKET_FRAMES * PA_USEC_PER_SEC / RATE)
+#define TICK_USEC ((pa_usec_t) TICK_FRAMES * PA_USEC_PER_SEC / RATE)
+#define N_FRAMES (N_PACKETS * PACKET_FRAMES)
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16BE,
+    .rate = RATE,
+    .channels = CHANNELS
+};
+
+struct scenario {
+    const char *name;
+    unsigned loss_every;        /* Drop one of every n packets */
+    unsigned reorder_every;     /* Swap every nth packet with the next */
+    pa_usec_t max_jitter;
+    int late_packet;            /* Delayed by LATE_MSEC */
+};
+
+static const struct scenario scenarios[] = {
+    { "clean",   0,  0, 0,                        -1  },
+    { "reorder", 0,  7, 0,                        -1  },
+    { "jitter",  0,  0, 30 * PA_USEC_PER_MSEC,    -1  },
+    { "loss",    20, 0, 0,                        -1  },
+    { "late",    0,  0, 0,                        300 },
+    { "all",     50, 9, 20 * PA_USEC_PER_MSEC,    500 },
+};
+
+struct packet {
+    unsigned index;
+    pa_usec_t arrival;
+};
+
+static pa_mempool *pool;
+
+/* The value of every sample identifies the frame, and is never zero */
+static int16_t frame_value(unsigned frame) {
+    return (int16_t) (frame % 30000 + 1);
+}
+
+static void send_packet(int fd, unsigned index) {
+    uint8_t buf[12 + PACKET_FRAMES * CHANNELS * 2];
+    uint32_t header[3];
+    unsigned i;
+
+    header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) 127 << 16) | (uint16_t) (0xfff0 + index));
+    header[1] = htonl(0xffff0000U + index * PACKET_FRAMES);
+    header[2] = htonl(0x12345678);
+    memcpy(buf, header, sizeof(header));
+
+    for (i = 0; i < PACKET_FRAMES * CHANNELS; i++) {
+        int16_t v = frame_value(index * PACKET_FRAMES + i / CHANNELS);
+
+        buf[12 + 2*i] = (uint8_t) ((uint16_t) v >> 8);
+        buf[12 + 2*i + 1] = (uint8_t) v;
+    }
+
+    fail_unless(send(fd, buf, sizeof(buf), 0) == (ssize_t) sizeof(buf));
+}
+
+static int compare_arrival(const void *a, const void *b) {
+    const struct packet *pa = a, *pb = b;
+
+    if (pa->arrival != pb->arrival)
+        return pa->arrival < pb->arrival ? -1 : 1;
+
+    return pa->index < pb->index ? -1 : 1;
+}
+
+/* Builds the list of packets in the order in which they arrive */
+static unsigned make_schedule(const struct scenario *s, struct packet *packets) {
+    unsigned i, n = 0;
+    uint32_t seed = 1;
+
+    for (i = 0; i < N_PACKETS; i++) {
+        pa_usec_t arrival = i * PACKET_USEC;
+
+        if (s->loss_every && i % s->loss_every == s->loss_every / 2)
+            continue;
+
+        if (s->reorder_every && i % s->reorder_every == s->reorder_every - 1)
+            arrival += PACKET_USEC + 1;
+        else if (s->reorder_every && i > 0 && i % s->reorder_every == 0)
+            arrival -= PACKET_USEC;
+
+        /* The first packet starts the stream, jitter only delays the
+         * others */
+        if (s->max_jitter && i > 0) {
+            seed = seed * 1103515245 + 12345;
+            arrival += ((seed >> 16) & 0x7fff) * s->max_jitter / 0x7fff;
+        }
+
+        if ((int) i == s->late_packet)
+            arrival += LATE_MSEC * PA_USEC_PER_MSEC;
+
+        packets[n].index = i;
+        packets[n].arrival = arrival;
+        n++;
+    }
+
+    qsort(packets, n, sizeof(struct packet), compare_arrival);
+
+    return n;
+}
+
+START_TEST (rtp_jitter_buffer_test) {
+    const struct scenario *s = &scenarios[_i];
+    static struct packet packets[N_PACKETS];
+    static int16_t output[N_FRAMES];
+    struct sockaddr_in sa;
+    socklen_t sa_len = sizeof(sa);
+    int send_fd, recv_fd, one = 1;
+    pa_rtp_context rtp;
+    pa_rtp_jitter_buffer *jb;
+    pa_rtp_jitter_buffer_stats stats;
+    pa_memblockq *q;
+    pa_usec_t t, play_start = 0;
+    unsigned n_packets, next = 0, n_out = 0, n_wrong = 0, n_lost = 0, i;
+    bool started = false;
+
+    n_packets = make_schedule(s, packets);
+
+    pa_zero(sa);
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fail_unless((recv_fd = pa_socket_cloexec(AF_INET, SOCK_DGRAM, 0)) >= 0);
+    fail_unless(bind(recv_fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+    fail_unless(getsockname(recv_fd, (struct sockaddr*) &sa, &sa_len) == 0);
+    fail_unless(setsockopt(recv_fd, SOL_SOCKET, SO_TIMESTAMP, &one, sizeof(one)) == 0);
+
+    fail_unless((send_fd = pa_socket_cloexec(AF_INET, SOCK_DGRAM, 0)) >= 0);
+    fail_unless(connect(send_fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+
+    pa_rtp_context_init_recv(&rtp, recv_fd, pa_frame_size(&sample_spec));
+
+    q = pa_memblockq_new("rtp-jitter-buffer-test memblockq", 0, 4 * 1024 * 1024, 0, &sample_spec,
+                         pa_usec_to_bytes(PREBUF_MSEC * PA_USEC_PER_MSEC, &sample_spec), 0, 0, NULL);
+    jb = pa_rtp_jitter_buffer_new(&sample_spec, pool);
+
+    for (t = 0; n_out < N_FRAMES; t += PA_USEC_PER_MSEC) {
+        pa_memchunk chunk;
+        struct timeval tv;
+
+        /* The network */
+        while (next < n_packets && packets[next].arrival <= t)
+            send_packet(send_fd, packets[next++].index);
+
+        /* module-rtp-recv */
+        while (pa_rtp_recv(&rtp, &chunk, pool, &tv) >= 0) {
+            fail_unless(rtp.ssrc == 0x12345678);
+
+            pa_rtp_jitter_buffer_push(jb, q, rtp.sequence, rtp.timestamp, &chunk, t);
+            pa_memblock_unref(chunk.memblock);
+        }
+
+        /* The sink, playing a tick whenever one has passed */
+        if (t % TICK_USEC != 0)
+            continue;
+
+        while (n_out < (started ? ((t - play_start) / TICK_USEC + 1) * TICK_FRAMES : 1)) {
+            const uint8_t *p;
+            size_t j;
+
+            if (pa_rtp_jitter_buffer_pop(jb, q, TICK_FRAMES * pa_frame_size(&sample_spec), &chunk) < 0) {
+                /* Prebuffering, or at the end of the stream */
+                fail_unless(!started || next == n_packets);
+                break;
+            }
+
+            if (!started) {
+                started = true;
+                play_start = t;
+            }
+
+            p = pa_memblock_acquire_chunk(&chunk);
+
+            for (j = 0; j < chunk.length / pa_frame_size(&sample_spec) && n_out < N_FRAMES; j++)
+                output[n_out++] = (int16_t) (((uint16_t) p[4*j] << 8) | p[4*j+1]);
+
+            pa_memblock_release(chunk.memblock);
+            pa_memblock_unref(chunk.memblock);
+        }
+
+        if (n_out > 0 && next == n_packets && pa_memblockq_get_length(q) == 0)
+            break;
+    }
+
+    pa_rtp_jitter_buffer_get_stats(jb, q, &stats);
+
+    /* Compare what was played with what was sent */
+    for (i = 0; i < n_out; i++)
+        if (output[i] != frame_value(i))
+            n_wrong++;
+
+    for (i = 0; i < N_PACKETS; i++)
+        if (s->loss_every && i % s->loss_every == s->loss_every / 2)
+            n_lost++;
+
+    pa_log_debug("%s: %llu received, %llu reordered, %llu late, %llu lost, %llu frames concealed, %u frames differ",
+                 s->name, (unsigned long long) stats.received, (unsigned long long) stats.reordered,
+                 (unsigned long long) stats.late, (unsigned long long) stats.lost,
+                 (unsigned long long) stats.concealed, n_wrong);
+    pa_log_debug("%s: jitter %0.2f ms, target depth %0.2f ms", s->name,
+                 (double) stats.jitter / PA_USEC_PER_MSEC, (double) stats.target / PA_USEC_PER_MSEC);
+
+    /* All audio arrives at the right place, each gap is concealed once */
+    fail_unless(n_out >= N_FRAMES - PACKET_FRAMES);
+    fail_unless(stats.received == n_packets);
+    fail_unless(stats.lost == n_lost);
+    fail_unless(stats.late == (s->late_packet >= 0 ? 1U : 0U));
+    fail_unless(stats.concealed == (stats.lost + stats.late) * PACKET_FRAMES);
+
+    if (s->reorder_every || s->max_jitter > PACKET_USEC)
+        fail_unless(stats.reordered > 0);
+    else
+        fail_unless(stats.reordered == 0);
+
+    /* Only concealed audio and the fade in after it differ */
+    if (stats.concealed == 0)
+        fail_unless(n_wrong == 0);
+    else
+        fail_unless(n_wrong <= stats.concealed + (stats.lost + stats.late) * RATE * 5 / 1000);
+
+    /* Gaps are filled with what was played before, not with silence */
+    for (i = 0; i < N_PACKETS; i++)
+        if ((s->loss_every && i % s->loss_every == s->loss_every / 2) || (int) i == s->late_packet) {
+            fail_unless(output[i * PACKET_FRAMES] != 0);
+            fail_unless(output[i * PACKET_FRAMES] != frame_value(i * PACKET_FRAMES));
+        }
+
+    /* The target depth follows the jitter */
+    if (s->max_jitter == 0 && s->late_packet < 0 && !s->reorder_every)
+        fail_unless(stats.target <= PACKET_USEC + PA_USEC_PER_MSEC);
+    else
+        fail_unless(stats.target > PACKET_USEC + s->max_jitter / 4);
+
+    pa_rtp_jitter_buffer_free(jb);
+    pa_memblockq_free(q);
+    pa_rtp_context_destroy(&rtp);
+    pa_close(send_fd);
+}
+END_TEST
+
+/* Returns a chunk of n frames that all have the value v */
+static pa_memchunk make_chunk(unsigned n, int16_t v) {
+    pa_memchunk chunk;
+    uint8_t *p;
+    unsigned i;
+
+    chunk.memblock = pa_memblock_new(pool, n * pa_frame_size(&sample_spec));
+    chunk.index = 0;
+    chunk.length = n * pa_frame_size(&sample_spec);
+
+    p = pa_memblock_acquire(chunk.memblock);
+    for (i = 0; i < n * CHANNELS; i++) {
+        p[2*i] = (uint8_t) ((uint16_t) v >> 8);
+        p[2*i + 1] = (uint8_t) v;
+    }
+    pa_memblock_release(chunk.memblock);
+
+    return chunk;
+}
+
+/* Audio that a decoder recovered for a lost packet is played in its
+ * place instead of the concealment */
+START_TEST (rtp_jitter_buffer_lost_test) {
+    pa_rtp_jitter_buffer *jb;
+    pa_rtp_jitter_buffer_stats stats;
+    pa_memblockq *q;
+    pa_memchunk chunk;
+    unsigned n_out = 0;
+    int16_t expected[] = { 1, 2, 3 };
+
+    q = pa_memblockq_new("rtp-jitter-buffer-test memblockq", 0, 4 * 1024 * 1024, 0, &sample_spec, 0, 0, 0, NULL);
+    jb = pa_rtp_jitter_buffer_new(&sample_spec, pool);
+
+    /* The second packet is lost, the third waits for it */
+    chunk = make_chunk(PACKET_FRAMES, 1);
+    fail_unless(pa_rtp_jitter_buffer_push(jb, q, 10, 1000, &chunk, 0) == 0);
+    pa_memblock_unref(chunk.memblock);
+
+    chunk = make_chunk(PACKET_FRAMES, 3);
+    fail_unless(pa_rtp_jitter_buffer_push(jb, q, 12, 1000 + 2 * PACKET_FRAMES, &chunk, 2 * PACKET_USEC) == 0);
+    pa_memblock_unref(chunk.memblock);
+
+    chunk = make_chunk(PACKET_FRAMES, 2);
+    fail_unless(pa_rtp_jitter_buffer_push_lost(jb, q, 1000 + PACKET_FRAMES, &chunk) == 0);
+    pa_memblock_unref(chunk.memblock);
+
+    while (pa_rtp_jitter_buffer_pop(jb, q, TICK_FRAMES * pa_frame_size(&sample_spec), &chunk) >= 0) {
+        const uint8_t *p = pa_memblock_acquire_chunk(&chunk);
+        size_t j;
+
+        for (j = 0; j < chunk.length / pa_frame_size(&sample_spec); j++, n_out++)
+            fail_unless((int16_t) (((uint16_t) p[4*j] << 8) | p[4*j+1]) == expected[n_out / PACKET_FRAMES]);
+
+        pa_memblock_release(chunk.memblock);
+        pa_memblock_unref(chunk.memblock);
+    }
+
+    fail_unless(n_out == 3 * PACKET_FRAMES);
+
+    /* Too late once it has been played */
+    chunk = make_chunk(PACKET_FRAMES, 2);
+    fail_unless(pa_rtp_jitter_buffer_push_lost(jb, q, 1000 + PACKET_FRAMES, &chunk) < 0);
+    pa_memblock_unref(chunk.memblock);
+
+    pa_rtp_jitter_buffer_get_stats(jb, q, &stats);
+    fail_unless(stats.received == 2);
+    fail_unless(stats.lost == 1);
+    fail_unless(stats.concealed == PACKET_FRAMES);
+
+    pa_rtp_jitter_buffer_free(jb);
+    pa_memblockq_free(q);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true));
+
+    s = suite_create("RTP Jitter Buffer");
+    tc = tcase_create("rtpjitterbuffer");
+    tcase_add_loop_test(tc, rtp_jitter_buffer_test, 0, PA_ELEMENTSOF(scenarios));
+    tcase_add_test(tc, rtp_jitter_buffer_lost_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    pa_mempool_unref(pool);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
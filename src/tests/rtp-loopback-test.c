@@ -0,0 +1,212 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Sends RTP streams over the loopback interface with the same code as
+ * module-rtp-send and module-rtp-recv, and reports how many packets per
+ * second get through and how much CPU time a real-time stream costs. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/arpa-inet.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/sample-util.h>
+#include <pulsecore/socket.h>
+
+#include <modules/rtp/rtp.h>
+
+#define MAX_STREAMS 8
+#define DURATION_SEC 2
+#define PACKETS_PER_ROUND 32
+
+/* What module-rtp-send sends with its defaults: s16be stereo at 44.1 kHz,
+ * in packets that fit into an MTU of 1280 bytes */
+#define MTU 1280
+#define PAYLOAD_SIZE (((MTU - 12) / 4) * 4)
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16BE,
+    .rate = 44100,
+    .channels = 2
+};
+
+struct stream {
+    int send_fd, recv_fd;
+    pa_rtp_context send_context, recv_context;
+    pa_memblockq *q;
+
+    uint64_t n_sent, n_received, n_out_of_order;
+    uint16_t next_sequence;
+};
+
+static pa_mempool *pool;
+static pa_memchunk silence;
+
+static void stream_init(struct stream *s) {
+    struct sockaddr_in sa;
+    socklen_t sa_len = sizeof(sa);
+    int one = 1, size = 4 * 1024 * 1024;
+
+    pa_zero(*s);
+
+    pa_zero(sa);
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fail_unless((s->recv_fd = pa_socket_cloexec(AF_INET, SOCK_DGRAM, 0)) >= 0);
+    fail_unless(bind(s->recv_fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+    fail_unless(getsockname(s->recv_fd, (struct sockaddr*) &sa, &sa_len) == 0);
+    fail_unless(setsockopt(s->recv_fd, SOL_SOCKET, SO_TIMESTAMP, &one, sizeof(one)) == 0);
+    setsockopt(s->recv_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    fail_unless((s->send_fd = pa_socket_cloexec(AF_INET, SOCK_DGRAM, 0)) >= 0);
+    fail_unless(connect(s->send_fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+
+    pa_rtp_context_init_send(&s->send_context, s->send_fd, 0, pa_rtp_payload_from_sample_spec(&sample_spec), pa_frame_size(&sample_spec));
+    pa_rtp_context_init_recv(&s->recv_context, s->recv_fd, pa_frame_size(&sample_spec));
+
+    s->next_sequence = s->send_context.sequence;
+    s->q = pa_memblockq_new("rtp-loopback-test memblockq", 0, 4 * 1024 * 1024, 0, &sample_spec, 1, 0, 0, &silence);
+}
+
+static void stream_done(struct stream *s) {
+    /* This closes the sockets as well */
+    pa_rtp_context_destroy(&s->send_context);
+    pa_rtp_context_destroy(&s->recv_context);
+    pa_memblockq_free(s->q);
+}
+
+/* Sends a round of packets the way module-rtp-send does, from whatever
+ * the memblockq holds, and receives them the way module-rtp-recv does */
+static void stream_iterate(struct stream *s) {
+    pa_memchunk chunk;
+    struct timeval tv;
+    uint64_t sent;
+
+    pa_memblockq_seek(s->q, PACKETS_PER_ROUND * PAYLOAD_SIZE, PA_SEEK_RELATIVE, true);
+
+    sent = s->send_context.sequence;
+    fail_unless(pa_rtp_send(&s->send_context, PAYLOAD_SIZE, s->q) == 0);
+    s->n_sent += (uint16_t) (s->send_context.sequence - (uint16_t) sent);
+
+    while (pa_rtp_recv(&s->recv_context, &chunk, pool, &tv) >= 0) {
+        fail_unless(chunk.length == PAYLOAD_SIZE);
+        fail_unless(tv.tv_sec != 0);
+
+        if (s->recv_context.sequence != s->next_sequence)
+            s->n_out_of_order++;
+
+        s->next_sequence = (uint16_t) (s->recv_context.sequence + 1);
+        s->n_received++;
+
+        pa_memblock_unref(chunk.memblock);
+    }
+}
+
+static pa_usec_t cpu_time(void) {
+    struct rusage ru;
+
+    pa_assert_se(getrusage(RUSAGE_SELF, &ru) == 0);
+
+    return pa_timeval_load(&ru.ru_utime) + pa_timeval_load(&ru.ru_stime);
+}
+
+START_TEST (rtp_loopback_test) {
+    struct stream streams[MAX_STREAMS];
+    unsigned n_streams = 1U << _i, i;
+    uint64_t n_sent = 0, n_received = 0, n_out_of_order = 0;
+    pa_usec_t start, cpu_start, elapsed, cpu;
+    double packets_per_sec, stream_packets_per_sec, cpu_per_packet;
+
+    for (i = 0; i < n_streams; i++)
+        stream_init(&streams[i]);
+
+    start = pa_rtclock_now();
+    cpu_start = cpu_time();
+
+    do {
+        for (i = 0; i < n_streams; i++)
+            stream_iterate(&streams[i]);
+    } while ((elapsed = pa_rtclock_now() - start) < DURATION_SEC * PA_USEC_PER_SEC);
+
+    cpu = cpu_time() - cpu_start;
+
+    for (i = 0; i < n_streams; i++) {
+        n_sent += streams[i].n_sent;
+        n_received += streams[i].n_received;
+        n_out_of_order += streams[i].n_out_of_order;
+        stream_done(&streams[i]);
+    }
+
+    packets_per_sec = (double) n_received * PA_USEC_PER_SEC / elapsed;
+    cpu_per_packet = (double) cpu / n_received;
+    stream_packets_per_sec = (double) pa_bytes_per_second(&sample_spec) / PAYLOAD_SIZE;
+
+    pa_log_info("%u streams: %llu packets sent, %llu received, %llu out of order", n_streams,
+                (unsigned long long) n_sent, (unsigned long long) n_received, (unsigned long long) n_out_of_order);
+    pa_log_info("%u streams: %0.0f packets/s, %0.2f us CPU per packet, %0.3f%% CPU per real-time stream",
+                n_streams, packets_per_sec, cpu_per_packet, cpu_per_packet * stream_packets_per_sec / PA_USEC_PER_SEC * 100);
+
+    fail_unless(n_received > 0);
+    fail_unless(n_received <= n_sent);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_INFO);
+
+    pa_assert_se(pool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true));
+
+    silence.memblock = pa_memblock_new(pool, PAYLOAD_SIZE);
+    silence.index = 0;
+    silence.length = PAYLOAD_SIZE;
+    pa_silence_memchunk(&silence, &sample_spec);
+
+    s = suite_create("RTP Loopback");
+    tc = tcase_create("rtploopback");
+    /* 1, 2, 4 and 8 streams */
+    tcase_add_loop_test(tc, rtp_loopback_test, 0, 4);
+    tcase_set_timeout(tc, 4 * DURATION_SEC + 30);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    pa_memblock_unref(silence.memblock);
+    pa_mempool_unref(pool);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,185 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Plays a sample cache entry 1000 times per second and reports how much
+ * CPU time the daemon's main thread and its other (IO) threads spent on
+ * it. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/mainloop.h>
+
+#include <pulsecore/core-util.h>
+
+#include "stress-test-util.h"
+
+#define SAMPLE_NAME "scache-stress"
+#define SINE_HZ 440
+#define SAMPLE_HZ 22050
+#define SAMPLE_MSEC 50
+#define PLAYS_PER_SEC 1000
+#define TICK_MSEC 10
+#define DURATION_SEC 5
+
+static pa_stress_test_context ctx;
+static pa_stream *upload = NULL;
+
+static float data[SAMPLE_HZ * SAMPLE_MSEC / 1000];
+
+static unsigned long main_ticks, io_ticks;
+static unsigned n_ticks = 0, n_played = 0, n_failed = 0;
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_FLOAT32,
+    .rate = SAMPLE_HZ,
+    .channels = 1
+};
+
+/* Sums up the CPU time of all threads of the daemon, separately for the
+ * main thread and everything else */
+static void read_cpu_ticks(unsigned long *main_thread, unsigned long *other_threads) {
+    pa_stress_thread threads[PA_STRESS_MAX_THREADS];
+    unsigned i, n;
+
+    *main_thread = *other_threads = 0;
+
+    n = pa_stress_read_threads(ctx.daemon_pid, threads, PA_ELEMENTSOF(threads));
+    for (i = 0; i < n; i++) {
+        if ((pid_t) threads[i].tid == ctx.daemon_pid)
+            *main_thread += threads[i].ticks;
+        else
+            *other_threads += threads[i].ticks;
+    }
+}
+
+static void play_cb(pa_context *c, int success, void *userdata) {
+    if (success)
+        n_played++;
+    else
+        n_failed++;
+}
+
+static void time_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    struct timeval next;
+    unsigned i;
+
+    if (n_ticks++ >= DURATION_SEC * 1000 / TICK_MSEC) {
+        unsigned long main_now, io_now;
+
+        read_cpu_ticks(&main_now, &io_now);
+
+        fprintf(stderr, "%u plays succeeded, %u failed in %u s\n", n_played, n_failed, DURATION_SEC);
+        fprintf(stderr, "Main thread CPU: %0.1f%%, IO threads CPU: %0.1f%%\n",
+                pa_stress_cpu_percent(main_now - main_ticks, DURATION_SEC),
+                pa_stress_cpu_percent(io_now - io_ticks, DURATION_SEC));
+
+        a->time_free(e);
+        pa_operation_unref(pa_context_remove_sample(ctx.context, SAMPLE_NAME, NULL, NULL));
+        pa_context_disconnect(ctx.context);
+        return;
+    }
+
+    for (i = 0; i < PLAYS_PER_SEC * TICK_MSEC / 1000; i++)
+        pa_operation_unref(pa_context_play_sample(ctx.context, SAMPLE_NAME, NULL, PA_VOLUME_NORM, play_cb, NULL));
+
+    a->time_restart(e, pa_timeval_add(pa_timeval_store(&next, pa_timeval_load(tv)), TICK_MSEC * PA_USEC_PER_MSEC));
+}
+
+static void start_playing(void) {
+    struct timeval tv;
+
+    read_cpu_ticks(&main_ticks, &io_ticks);
+
+    pa_gettimeofday(&tv);
+    ctx.mainloop_api->time_new(ctx.mainloop_api, &tv, time_cb, NULL);
+}
+
+static void stream_state_callback(pa_stream *s, void *userdata) {
+    switch (pa_stress_stream_state(s)) {
+        case PA_STREAM_READY:
+            fail_unless(pa_stream_write(s, data, sizeof(data), NULL, 0, PA_SEEK_RELATIVE) == 0);
+            fail_unless(pa_stream_finish_upload(s) == 0);
+            break;
+
+        case PA_STREAM_TERMINATED:
+            fprintf(stderr, "Sample uploaded, playing it %u times per second.\n", PLAYS_PER_SEC);
+            start_playing();
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void context_ready(pa_context *c) {
+    upload = pa_stream_new(c, SAMPLE_NAME, &sample_spec, NULL);
+    fail_unless(upload != NULL);
+    pa_stream_set_state_callback(upload, stream_state_callback, NULL);
+    fail_unless(pa_stream_connect_upload(upload, sizeof(data)) == 0);
+}
+
+START_TEST (scache_stress_test) {
+    unsigned i;
+    int ret;
+
+    for (i = 0; i < PA_ELEMENTSOF(data); i++)
+        data[i] = (float) sin(((double) i/SAMPLE_HZ)*2*M_PI*SINE_HZ)/2;
+
+    pa_stress_test_init(&ctx);
+    ret = pa_stress_test_run(&ctx);
+
+    if (upload)
+        pa_stream_unref(upload);
+
+    pa_stress_test_deinit(&ctx);
+
+    fail_unless(ret == 0);
+    fail_unless(n_failed == 0);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    ctx.context_name = argv[0];
+    ctx.ready_cb = context_ready;
+
+    s = suite_create("Sample Cache Stress");
+    tc = tcase_create("scachestress");
+    tcase_add_test(tc, scache_stress_test);
+    tcase_set_timeout(tc, DURATION_SEC + 10);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
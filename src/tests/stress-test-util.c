@@ -0,0 +1,158 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include <check.h>
+
+#include <pulsecore/pid.h>
+#include <pulsecore/core-util.h>
+
+#include "stress-test-util.h"
+
+static void context_state_callback(pa_context *c, void *userdata) {
+    pa_stress_test_context *ctx = userdata;
+
+    fail_unless(c != NULL);
+
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_CONNECTING:
+        case PA_CONTEXT_AUTHORIZING:
+        case PA_CONTEXT_SETTING_NAME:
+            break;
+
+        case PA_CONTEXT_READY:
+            fprintf(stderr, "Connection established.\n");
+
+            fail_unless(pa_pid_file_check_running(&ctx->daemon_pid, "pulseaudio") >= 0);
+            ctx->ready_cb(c);
+            break;
+
+        case PA_CONTEXT_TERMINATED:
+            ctx->mainloop_api->quit(ctx->mainloop_api, 0);
+            break;
+
+        case PA_CONTEXT_FAILED:
+        default:
+            fprintf(stderr, "Context error: %s\n", pa_strerror(pa_context_errno(c)));
+            ck_abort();
+    }
+}
+
+void pa_stress_test_init(pa_stress_test_context *ctx) {
+    ctx->mainloop = pa_mainloop_new();
+    fail_unless(ctx->mainloop != NULL);
+
+    ctx->mainloop_api = pa_mainloop_get_api(ctx->mainloop);
+
+    ctx->context = pa_context_new(ctx->mainloop_api, ctx->context_name);
+    fail_unless(ctx->context != NULL);
+
+    pa_context_set_state_callback(ctx->context, context_state_callback, ctx);
+}
+
+int pa_stress_test_run(pa_stress_test_context *ctx) {
+    int ret = 0;
+
+    if (pa_context_connect(ctx->context, NULL, 0, NULL) < 0) {
+        fprintf(stderr, "pa_context_connect() failed.\n");
+        return 1;
+    }
+
+    if (pa_mainloop_run(ctx->mainloop, &ret) < 0)
+        fprintf(stderr, "pa_mainloop_run() failed.\n");
+
+    return ret;
+}
+
+void pa_stress_test_deinit(pa_stress_test_context *ctx) {
+    pa_context_unref(ctx->context);
+    pa_mainloop_free(ctx->mainloop);
+}
+
+pa_stream_state_t pa_stress_stream_state(pa_stream *s) {
+    pa_stream_state_t state;
+
+    fail_unless(s != NULL);
+
+    state = pa_stream_get_state(s);
+    if (!PA_STREAM_IS_GOOD(state) && state != PA_STREAM_TERMINATED) {
+        fprintf(stderr, "Stream error: %s\n", pa_strerror(pa_context_errno(pa_stream_get_context(s))));
+        ck_abort();
+    }
+
+    return state;
+}
+
+unsigned pa_stress_read_threads(pid_t pid, pa_stress_thread *threads, unsigned n_max) {
+    char path[64];
+    unsigned n = 0;
+    DIR *d;
+    struct dirent *de;
+
+    pa_snprintf(path, sizeof(path), "/proc/%lu/task", (unsigned long) pid);
+    if (!(d = opendir(path)))
+        return 0;
+
+    while (n < n_max && (de = readdir(d))) {
+        char stat_path[128], buf[1024], *p, *name;
+        unsigned long utime, stime;
+        FILE *f;
+
+        if (de->d_name[0] == '.')
+            continue;
+
+        pa_snprintf(stat_path, sizeof(stat_path), "%s/%s/stat", path, de->d_name);
+        if (!(f = fopen(stat_path, "r")))
+            continue;
+
+        p = fgets(buf, sizeof(buf), f);
+        fclose(f);
+
+        /* The thread name may contain spaces, so look for the last
+         * closing parenthesis */
+        if (!p || !(name = strchr(buf, '(')) || !(p = strrchr(buf, ')')))
+            continue;
+
+        *p = 0;
+        name++;
+
+        if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+            continue;
+
+        pa_strlcpy(threads[n].name, name, sizeof(threads[n].name));
+        threads[n].tid = strtoul(de->d_name, NULL, 10);
+        threads[n].ticks = utime + stime;
+        n++;
+    }
+
+    closedir(d);
+
+    return n;
+}
+
+double pa_stress_cpu_percent(unsigned long ticks, unsigned sec) {
+    return ticks / (double) sysconf(_SC_CLK_TCK) * 100.0 / sec;
+}
@@ -0,0 +1,66 @@
+#ifndef foostresstestutilhfoo
+#define foostresstestutilhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sys/types.h>
+
+#include <pulse/pulseaudio.h>
+
+#define PA_STRESS_MAX_THREADS 64
+
+typedef struct pa_stress_thread {
+    char name[32];
+    unsigned long tid;
+    unsigned long ticks; /* utime + stime, in clock ticks */
+} pa_stress_thread;
+
+typedef struct pa_stress_test_context {
+    /* Tests need to set these */
+    const char *context_name;
+
+    /* Called once the connection is established */
+    void (*ready_cb)(pa_context *c);
+
+    /* These are set by pa_stress_test_init() and pa_stress_test_run() */
+    pa_mainloop *mainloop;
+    pa_mainloop_api *mainloop_api;
+    pa_context *context;
+
+    pid_t daemon_pid;
+} pa_stress_test_context;
+
+/* Create the main loop and the context */
+void pa_stress_test_init(pa_stress_test_context *ctx);
+/* Connect and run the main loop until the context is disconnected.
+ * Returns the main loop's return value. */
+int pa_stress_test_run(pa_stress_test_context *ctx);
+/* Clean up, streams must have been unreferenced before */
+void pa_stress_test_deinit(pa_stress_test_context *ctx);
+
+/* Aborts the test if the stream failed, returns its state otherwise */
+pa_stream_state_t pa_stress_stream_state(pa_stream *s);
+
+/* Reads the name and CPU time of up to n_max threads of the process
+ * pid. Returns the number of threads read. */
+unsigned pa_stress_read_threads(pid_t pid, pa_stress_thread *threads, unsigned n_max);
+
+/* Returns the CPU usage in percent for ticks spent in sec seconds */
+double pa_stress_cpu_percent(unsigned long ticks, unsigned sec);
+
+#endif
@@ -0,0 +1,242 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/core-subscribe.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+
+#define MAX_EVENTS 16
+
+#define COALESCE_MSEC 100
+#define POST_MSEC 5
+#define RUN_MSEC 1000
+
+static pa_subscription_event_type_t types[MAX_EVENTS];
+static uint32_t indexes[MAX_EVENTS];
+static unsigned n_events;
+static unsigned n_posts;
+static pa_usec_t last_post, last_delivery;
+
+static void subscription_cb(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata) {
+    if (n_events < MAX_EVENTS) {
+        types[n_events] = t;
+        indexes[n_events] = idx;
+    }
+
+    n_events++;
+    last_delivery = pa_rtclock_now();
+}
+
+static void dispatch(pa_mainloop *m) {
+    /* The events are dispatched from a defer event */
+    while (pa_mainloop_iterate(m, 0, NULL) > 0)
+        ;
+}
+
+START_TEST (subscribe_dedup_test) {
+    pa_mainloop *m;
+    pa_core *c;
+    pa_subscription *s;
+    unsigned i;
+
+    pa_assert_se(m = pa_mainloop_new());
+    pa_assert_se(c = pa_core_new(pa_mainloop_get_api(m), false, false, 0));
+
+    n_events = 0;
+    s = pa_subscription_new(c, PA_SUBSCRIPTION_MASK_ALL, subscription_cb, NULL);
+
+    /* Changes of an object that is still queued as new are dropped */
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_NEW, 1);
+    for (i = 0; i < 1000; i++)
+        pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, 1);
+
+    /* Same index, but a different facility */
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE, 1);
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE, 1);
+
+    /* Everything about a removed object is dropped */
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_NEW, 2);
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, 2);
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_REMOVE, 2);
+
+    dispatch(m);
+
+    ck_assert_int_eq(n_events, 3);
+    ck_assert_int_eq(types[0], PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_NEW);
+    ck_assert_int_eq(indexes[0], 1);
+    ck_assert_int_eq(types[1], PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE);
+    ck_assert_int_eq(indexes[1], 1);
+    ck_assert_int_eq(types[2], PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_REMOVE);
+    ck_assert_int_eq(indexes[2], 2);
+
+    ck_assert_int_eq(c->subscription_events_posted, 1006);
+    ck_assert_int_eq(c->subscription_events_dropped, 1003);
+    ck_assert_int_eq(c->subscription_events_delivered, 3);
+
+    /* Once dispatched, the same change is queued again */
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, 1);
+    dispatch(m);
+    ck_assert_int_eq(n_events, 4);
+
+    pa_subscription_free(s);
+    dispatch(m);
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+static void post_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    pa_core *c = userdata;
+    struct timeval next;
+
+    if (n_posts++ >= RUN_MSEC / POST_MSEC) {
+        a->time_free(e);
+        return;
+    }
+
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, 7);
+    last_post = pa_rtclock_now();
+
+    a->time_restart(e, pa_timeval_add(pa_timeval_store(&next, pa_timeval_load(tv)), POST_MSEC * PA_USEC_PER_MSEC));
+}
+
+static void quit_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    a->time_free(e);
+    a->quit(a, 0);
+}
+
+START_TEST (subscribe_coalesce_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    pa_core *c;
+    pa_subscription *s;
+    struct timeval tv;
+
+    pa_assert_se(m = pa_mainloop_new());
+    a = pa_mainloop_get_api(m);
+    pa_assert_se(c = pa_core_new(a, false, false, 0));
+
+    n_events = n_posts = 0;
+    s = pa_subscription_new(c, PA_SUBSCRIPTION_MASK_SINK_INPUT, subscription_cb, NULL);
+    pa_subscription_set_coalesce_time(s, COALESCE_MSEC * PA_USEC_PER_MSEC);
+
+    pa_gettimeofday(&tv);
+    a->time_new(a, &tv, post_cb, c);
+    a->time_new(a, pa_timeval_add(&tv, (RUN_MSEC + 3 * COALESCE_MSEC) * PA_USEC_PER_MSEC), quit_cb, NULL);
+
+    pa_mainloop_run(m, NULL);
+
+    pa_log_debug("%u changes posted, %u delivered", n_posts - 1, n_events);
+
+    /* At most one change per window, plus the one opening the first
+     * window, and the last change must not be lost */
+    fail_unless(n_events >= 2);
+    fail_unless(n_events <= RUN_MSEC / COALESCE_MSEC + 2);
+    fail_unless(last_delivery >= last_post);
+
+    pa_subscription_free(s);
+    dispatch(m);
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+START_TEST (subscribe_coalesce_per_object_test) {
+    pa_mainloop *m;
+    pa_core *c;
+    pa_subscription *s;
+
+    pa_assert_se(m = pa_mainloop_new());
+    pa_assert_se(c = pa_core_new(pa_mainloop_get_api(m), false, false, 0));
+
+    n_events = 0;
+    s = pa_subscription_new(c, PA_SUBSCRIPTION_MASK_ALL, subscription_cb, NULL);
+    pa_subscription_set_coalesce_time(s, 10 * PA_USEC_PER_SEC);
+
+    /* Opens a window for sink input 1 */
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, 1);
+    dispatch(m);
+    ck_assert_int_eq(n_events, 1);
+
+    /* A change of sink input 1 that is held back must not delay the
+     * changes of other objects */
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, 1);
+    dispatch(m);
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, 2);
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, 1);
+    dispatch(m);
+
+    ck_assert_int_eq(n_events, 3);
+    ck_assert_int_eq(types[1], PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE);
+    ck_assert_int_eq(indexes[1], 2);
+    ck_assert_int_eq(types[2], PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE);
+    ck_assert_int_eq(indexes[2], 1);
+    ck_assert_int_eq(c->subscription_events_coalesced, 1);
+
+    /* Turning coalescing off delivers what is held back */
+    pa_subscription_set_coalesce_time(s, 0);
+    dispatch(m);
+
+    ck_assert_int_eq(n_events, 4);
+    ck_assert_int_eq(types[3], PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE);
+    ck_assert_int_eq(indexes[3], 1);
+
+    pa_subscription_free(s);
+    dispatch(m);
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Subscribe");
+    tc = tcase_create("subscribe");
+    tcase_add_test(tc, subscribe_dedup_test);
+    tcase_add_test(tc, subscribe_coalesce_test);
+    tcase_add_test(tc, subscribe_coalesce_per_object_test);
+    tcase_set_timeout(tc, 10);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,213 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Loads module-tunnel-sink-new with adaptive_latency=1, tunneling to a
+ * null sink of the same daemon over its own native socket. Plays into the
+ * tunnel sink and checks that the tunnel.* properties are published and
+ * that the target latency stays within sane bounds. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/mainloop.h>
+
+#include <pulsecore/core-util.h>
+
+#include "stress-test-util.h"
+
+#define TARGET_SINK_NAME "tunnel-latency-target"
+#define TUNNEL_SINK_NAME "tunnel-latency"
+#define SAMPLE_HZ 48000
+#define DURATION_SEC 6
+#define POLL_MSEC 500
+
+/* The adaptive mode never goes below its 25 ms base. Over a local socket
+ * the RTT is negligible, so 200 ms is only reached if the safety margin
+ * ran away. */
+#define MIN_TARGET_USEC (25 * PA_USEC_PER_MSEC)
+#define MAX_TARGET_USEC (200 * PA_USEC_PER_MSEC)
+
+static pa_stress_test_context ctx;
+static pa_stream *stream = NULL;
+static pa_time_event *poll_event = NULL;
+
+static uint32_t target_module = PA_INVALID_INDEX, tunnel_module = PA_INVALID_INDEX;
+static pa_usec_t start_time;
+static unsigned n_checks = 0;
+static uint32_t min_target = UINT32_MAX, max_target = 0;
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = SAMPLE_HZ,
+    .channels = 2
+};
+
+static void unload_cb(pa_context *c, int success, void *userdata) {
+    fail_unless(success);
+
+    /* The tunnel is unloaded first, the null sink last */
+    if (PA_PTR_TO_UINT(userdata) == target_module)
+        pa_context_disconnect(c);
+}
+
+static void finish(void) {
+    fprintf(stderr, "%u checks, target latency between %0.2f and %0.2f ms\n", n_checks,
+            (double) min_target / PA_USEC_PER_MSEC, (double) max_target / PA_USEC_PER_MSEC);
+
+    pa_stream_disconnect(stream);
+
+    pa_operation_unref(pa_context_unload_module(ctx.context, tunnel_module, unload_cb, PA_UINT_TO_PTR(tunnel_module)));
+    pa_operation_unref(pa_context_unload_module(ctx.context, target_module, unload_cb, PA_UINT_TO_PTR(target_module)));
+}
+
+static void sink_info_cb(pa_context *c, const pa_sink_info *i, int eol, void *userdata) {
+    const char *t;
+    uint32_t target;
+
+    if (eol) {
+        if (pa_rtclock_now() - start_time >= DURATION_SEC * PA_USEC_PER_SEC)
+            finish();
+        else
+            pa_context_rttime_restart(c, poll_event, pa_rtclock_now() + POLL_MSEC * PA_USEC_PER_MSEC);
+        return;
+    }
+
+    fail_unless(eol == 0 && i != NULL);
+
+    /* The properties show up with the first timing update */
+    if (!(t = pa_proplist_gets(i->proplist, "tunnel.target_latency_usec")))
+        return;
+
+    fail_unless(pa_proplist_contains(i->proplist, "tunnel.latency_usec"));
+    fail_unless(pa_proplist_contains(i->proplist, "tunnel.rtt_usec"));
+    fail_unless(pa_proplist_contains(i->proplist, "tunnel.underruns"));
+
+    fail_unless(pa_atou(t, &target) == 0);
+    fail_unless(target >= MIN_TARGET_USEC && target <= MAX_TARGET_USEC,
+                "target latency %u us out of range", target);
+
+    min_target = PA_MIN(min_target, target);
+    max_target = PA_MAX(max_target, target);
+    n_checks++;
+}
+
+static void poll_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    pa_operation_unref(pa_context_get_sink_info_by_name(ctx.context, TUNNEL_SINK_NAME, sink_info_cb, NULL));
+}
+
+static void write_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    void *data;
+
+    fail_unless(pa_stream_begin_write(s, &data, &nbytes) == 0);
+    memset(data, 0, nbytes);
+    fail_unless(pa_stream_write(s, data, nbytes, NULL, 0, PA_SEEK_RELATIVE) == 0);
+}
+
+static void stream_state_callback(pa_stream *s, void *userdata) {
+    if (pa_stress_stream_state(s) != PA_STREAM_READY)
+        return;
+
+    fprintf(stderr, "Stream ready, playing through the tunnel for %u s.\n", DURATION_SEC);
+
+    start_time = pa_rtclock_now();
+    poll_event = pa_context_rttime_new(ctx.context, start_time + POLL_MSEC * PA_USEC_PER_MSEC, poll_cb, NULL);
+}
+
+static void create_stream(pa_context *c) {
+    stream = pa_stream_new(c, "tunnel-latency-test", &sample_spec, NULL);
+    fail_unless(stream != NULL);
+
+    pa_stream_set_state_callback(stream, stream_state_callback, NULL);
+    pa_stream_set_write_callback(stream, write_cb, NULL);
+
+    fail_unless(pa_stream_connect_playback(stream, TUNNEL_SINK_NAME, NULL, 0, NULL, NULL) == 0);
+}
+
+static void load_tunnel_cb(pa_context *c, uint32_t idx, void *userdata) {
+    fail_unless(idx != PA_INVALID_INDEX);
+
+    tunnel_module = idx;
+    create_stream(c);
+}
+
+static void load_target_cb(pa_context *c, uint32_t idx, void *userdata) {
+    char *args;
+
+    fail_unless(idx != PA_INVALID_INDEX);
+
+    target_module = idx;
+
+    /* Tunnel back into the daemon through the socket we are connected to */
+    args = pa_sprintf_malloc("server=%s sink=" TARGET_SINK_NAME " sink_name=" TUNNEL_SINK_NAME
+                             " adaptive_latency=1", pa_context_get_server(c));
+    pa_operation_unref(pa_context_load_module(c, "module-tunnel-sink-new", args, load_tunnel_cb, NULL));
+    pa_xfree(args);
+}
+
+static void context_ready(pa_context *c) {
+    pa_operation_unref(pa_context_load_module(c, "module-null-sink", "sink_name=" TARGET_SINK_NAME, load_target_cb, NULL));
+}
+
+START_TEST (tunnel_latency_test) {
+    int ret;
+
+    pa_stress_test_init(&ctx);
+    ret = pa_stress_test_run(&ctx);
+
+    if (poll_event)
+        ctx.mainloop_api->time_free(poll_event);
+
+    if (stream)
+        pa_stream_unref(stream);
+
+    pa_stress_test_deinit(&ctx);
+
+    fail_unless(ret == 0);
+    fail_unless(n_checks > 0);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    ctx.context_name = argv[0];
+    ctx.ready_cb = context_ready;
+
+    s = suite_create("Tunnel Latency");
+    tc = tcase_create("tunnellatency");
+    tcase_add_test(tc, tunnel_latency_test);
+    tcase_set_timeout(tc, DURATION_SEC + 30);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}